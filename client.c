@@ -5,6 +5,13 @@
  * client input, a function to handle server output, and a function
  * to make the display sufficiently large.
  *
+ * usage: ./client [-k keys | -a policy] [-r rate] [-d seconds] [-o file.csv] hostname port [playername]
+ * With -k or -a the client plays headless: no terminal, with keys from the
+ * script (sent in turn, over and over) or chosen by the policy (random or
+ * greedy, as the server's bots choose them), rate keys a second (default 10)
+ * for the given seconds (default 10); it then quits and prints how long each
+ * key took to show in a frame, and with -o writes a line per key to the file.
+ *
  * Ashna Kumar    3/7/22
  */
 
@@ -13,9 +20,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "bots.h"
+#include "delta.h"
+#include "hist.h"
 #include "log.h"
 #include "mem.h"
 #include "message.h"
+#include "predict.h"
+#include "rtt.h"
 
 // Data structures
 typedef struct playerAttributes {
@@ -24,18 +36,85 @@ typedef struct playerAttributes {
   bool isPlayer;
   int numGoldLeft;
   int goldCollected;
-  char* display;
+  char* display;                       // the frame the screen shows, once onScreen
+  bool onScreen;                       // is display on the screen, so only changes need drawing?
+  char* incoming;                      // the latest DISPLAY, kept until drawn
+  const char* latest;                  // the newest frame not yet drawn (incoming, or a held
+                                       //   sequenced frame); NULL if none
+  uint64_t drawnAt;                    // when the screen was last drawn (see hist_now)
+  size_t frameLength;                  // of a frame of the grid, from GRID; room for one more
+  unsigned int goldSeq;                // frame number the last GOLD came with, if any
+  unsigned int frameSeq;               // number of the newest sequenced frame; 0 if none yet
+  char* frames[delta_History];         // the last sequenced frames, frame n at n % delta_History
+  unsigned int frameSeqs[delta_History];  // the number of the frame in each
+  predict_t* predict;                  // a player's moves not yet shown taken, and the
+                                       //   frame with them played on top
+  rtt_t rtt;                           // round trips of our PINGs to the server
+  char queued[predict_MaxPending];     // keys pressed while a batch was in flight, not yet
+  int numQueued;                       //   sent; the newest of the prediction's pending keys
+  int batchKeys[predict_MaxPending];   // batches sent and not yet settled, oldest first: the
+  int batchRejected[predict_MaxPending];  //   keys each held, and how many the server rejected
+  int numBatches;
+  uint64_t batchSentAt;                // when the last was sent
 } playerAttributes_t;
 
 // Global game variable (while it is not the 'game' struct seen in server;
 // it is the global game variable for client-side use)
 playerAttributes_t playerAttributes;
 
+// Headless play: keys from a script or a policy, and how long each takes to show
+typedef struct headless {
+  bool on;                             // playing headless, with no terminal?
+  const char* keys;                    // script of keys, sent in turn; NULL with a policy
+  bots_t* bots;                        // one bot, choosing keys by the policy; NULL with a script
+  double rate;                         // keys sent per second
+  int seconds;                         // how long to play
+  FILE* csv;                           // a line per key goes here, if not NULL
+  uint64_t start;                      // when the first frame came; 0 until then
+  uint64_t nextKey;                    // when the next key is due
+  bool quitting;                       // has KEY Q been sent?
+  int script;                          // the next key of the script
+  char sentKey[predict_MaxPending];    // keys not yet settled, oldest first, in a ring parallel
+  uint64_t sentAt[predict_MaxPending]; //   to the prediction's pending keys; and when sent
+  int oldest;                          // index of the oldest in the ring
+  int inFlight;                        // number in the ring
+  unsigned long sent, shown, rejected, undone, lost;
+  hist_t* latency;                     // from each key to the frame that showed it, in ns
+} headless_t;
+
+static headless_t headless = { .rate = 10, .seconds = 10 };
+
+// A frame that comes sooner than this after the screen was last drawn waits, and is drawn
+// with any that follow it, once this has passed or no more messages come
+static const uint64_t DrawNanos = 1000000000 / 60;
+// A headless client that has sent KEY Q gives up waiting for QUIT after this
+static const uint64_t QuitNanos = 2000000000;
+// how often to PING the server, once in a game
+static const uint64_t PingNanos = 1000000000;
+// how long a batch of keys is taken to be in flight, unless settled sooner, until a round
+// trip has been timed (after that, the round trip and four times its jitter, as TCP waits)
+static const uint64_t BatchNanos = 1000000000;
+static const char MoveKeys[] = "hlkjyubnHLKJYUBN";
+
 // Function prototypes
-static void parseArgs(const int argc, char* argv[]);
+static int parseArgs(const int argc, char* argv[]);
 static bool handleInput(void* arg);
+static bool handleTimeout(void* arg);
 static bool receiveMessage(void* arg, const addr_t from, const char* message);
 static void checkDisplay(int nrow, int ncol);
+static bool receiveFrame(const addr_t from, const char* message);
+static void showDisplay(const char* frame);
+static void drawFrame(const char* note);
+static void drawStatus(const char* note);
+static bool drawChanges(const char* frame);
+static bool headlessTick(const addr_t server);
+static bool sendKey(const addr_t server, const char key);
+static void flushKeys(const addr_t server, const bool now);
+static void settleBatches(int count);
+static bool sendBotMessage(void* arg, const addr_t from, const char* message);
+static void settleKeys(const int first, const int count, const char* outcome);
+static void headlessReport(void);
+static void pingServer(const addr_t server);
 
 /**************** main **********************/
 /**
@@ -55,8 +134,8 @@ static void checkDisplay(int nrow, int ncol);
  */
 int main(const int argc, char* argv[])
 {
-  // Validate argv[1] and argv[2] from command-line args first
-  parseArgs(argc, argv);
+  // Validate the options, and the hostname and port after them, from command-line args first
+  const int first = parseArgs(argc, argv);
 
   // Check if message module can be initialized
   if (message_init(NULL) == 0) {
@@ -67,16 +146,16 @@ int main(const int argc, char* argv[])
   addr_t server;
 
   // Check if address can be formed
-  if (!message_setAddr(argv[1], argv[2], &server)) {
-    fprintf(stderr, "Unable to form address from %s %s\n", argv[1], argv[2]);
+  if (!message_setAddr(argv[first], argv[first + 1], &server)) {
+    fprintf(stderr, "Unable to form address from %s %s\n", argv[first], argv[first + 1]);
     exit(4);
   }
 
   // Check if client is player or spectator
-  if (argc == 4 && argv[3] != NULL) {
+  if (argc == first + 3 && argv[first + 2] != NULL) {
     playerAttributes.isPlayer = true;
     char message[56] = "PLAY ";  // Long enough to fit play and maxNameLength
-    strcat(message, argv[3]);
+    strncat(message, argv[first + 2], sizeof(message) - strlen(message) - 1);
     message_send(server, message);
   }
 
@@ -85,40 +164,112 @@ int main(const int argc, char* argv[])
     message_send(server, "SPECTATE");
   }
 
-  // Handle messages
-  message_loop(&server, 0, NULL, handleInput, receiveMessage);
-  message_done();
-  endwin();
+  // Handle messages; headless, there is no keyboard, and nothing to draw on
+  if (headless.on) {
+    message_loop(&server, DrawNanos / 1e9, handleTimeout, NULL, receiveMessage);
+    message_done();
+    headlessReport();
+  }
+  else {
+    message_loop(&server, DrawNanos / 1e9, handleTimeout, handleInput, receiveMessage);
+    message_done();
+    endwin();
+  }
 
   mem_free(playerAttributes.display);
+  mem_free(playerAttributes.incoming);
+  predict_delete(playerAttributes.predict);
+  for (int h = 0; h < delta_History; h++) {
+    mem_free(playerAttributes.frames[h]);
+  }
 
   return 0;  // true if success, false if fail
 }
 
 /**************** parseArgs **********************/
 /**
- * Parses and verifies server hostname and port
+ * Parses the options for headless play, and verifies server hostname and port
  *
  * Caller provides:
  *   command-line arguments
  * We guarantee:
  *   Exiting upon fatal error
  * We return:
- *   Nothing
+ *   the index of the hostname in argv
  */
-static void parseArgs(const int argc, char* argv[])
+static int parseArgs(const int argc, char* argv[])
 {
+  int arg = 1;
+  const char* csvName = NULL;
+  while (arg < argc - 2 && argv[arg][0] == '-' && strlen(argv[arg]) == 2) {
+    const char option = argv[arg][1];
+    const char* value = argv[arg + 1];
+    char* end;
+    if (option == 'k') {
+      if (*value == '\0' || strspn(value, MoveKeys) != strlen(value)) {
+        fprintf(stderr, "Option -k needs a script of movement keys (%s).\n", MoveKeys);
+        exit(1);
+      }
+      headless.keys = value;
+    }
+    else if (option == 'a') {
+      bots_policy_t policy;
+      if (!bots_parsePolicy(value, &policy)) {
+        fprintf(stderr, "Option -a needs a policy, random or greedy.\n");
+        exit(1);
+      }
+      headless.bots = mem_assert(bots_new(1, policy, 1), "Out of memory for bots\n");
+    }
+    else if (option == 'r') {
+      headless.rate = strtod(value, &end);
+      if (*value == '\0' || *end != '\0' || !(headless.rate > 0)) {
+        fprintf(stderr, "Option -r needs a positive number.\n");
+        exit(1);
+      }
+    }
+    else if (option == 'd') {
+      headless.seconds = strtol(value, &end, 10);
+      if (*value == '\0' || *end != '\0' || headless.seconds < 1) {
+        fprintf(stderr, "Option -d needs a positive integer.\n");
+        exit(1);
+      }
+    }
+    else if (option == 'o') {
+      csvName = value;
+    }
+    else {
+      break;
+    }
+    arg += 2;
+  }
+
   // Check that command-line usage is correct
-  if (argc != 3 && argc != 4) {
+  headless.on = (headless.keys != NULL || headless.bots != NULL);
+  if ((argc - arg != 2 && argc - arg != 3) || (headless.on && argc - arg != 3)
+      || (headless.keys != NULL && headless.bots != NULL)) {
     fprintf(stderr, "There are an invalid number of arguments.\n");
+    fprintf(stderr, "usage: ./client [-k keys | -a policy] [-r rate] [-d seconds] [-o file.csv] "
+            "hostname port [playername]\n(a headless client, with -k or -a, needs a playername)\n");
     exit(1);
   }
 
   // Check if hostname and port are valid
-  if (argv[1] == NULL || argv[2] == NULL) {
+  if (argv[arg] == NULL || argv[arg + 1] == NULL) {
     fprintf(stderr, "Hostname or port is invalid.\n");
     exit(2);
   }
+
+  if (csvName != NULL && (headless.csv = fopen(csvName, "w")) == NULL) {
+    fprintf(stderr, "Unable to write %s\n", csvName);
+    exit(2);
+  }
+  if (headless.csv != NULL) {
+    fprintf(headless.csv, "key,sent_us,latency_us,outcome\n");
+  }
+  if (headless.on) {
+    headless.latency = mem_assert(hist_new(), "Out of memory for histogram\n");
+  }
+  return arg;
 }
 
 /**************** handleInput **********************/
@@ -155,22 +306,51 @@ static bool handleInput(void* arg)
   // Read client keystroke
   char c = getch();
   if (c == 'Q' || c == EOF) {
-    // EOF/EOT case: stop looping
+    // EOF/EOT case: stop looping, once any keys still queued are sent
+    flushKeys(*serverp, true);
     message_send(*serverp, "KEY Q");
   }
 
   else {
-    // send any other keystroke to server if client is player
-    if (playerAttributes.isPlayer) {
-      char str[2] = {c, '\0'};
-      char message[6] = "KEY ";
-      strcat(message, str);
-      message_send(*serverp, message);
+    // send any other keystroke to server if client is player, and show the move at once
+    // rather than a round trip later, until the server's frames confirm or undo it
+    if (playerAttributes.isPlayer && sendKey(*serverp, c)) {
+      playerAttributes.latest = predict_view(playerAttributes.predict);
+      drawFrame(NULL);
     }
   }
   return false;
 }
 
+/**************** handleTimeout **********************/
+/**
+ * Draws the frame that waited for more messages, now that none came,
+ * first dropping any predicted move the server has not shown taken
+ * within a second, and sending any keys queued behind a batch that has
+ * landed; headless, sends the keys that are due instead.
+ *
+ * Caller provides:
+ *   pointer to server address
+ * We return:
+ *   false, to keep looping; true when a headless client gives up on the server
+ */
+static bool handleTimeout(void* arg)
+{
+  pingServer(*(addr_t*)arg);
+  int before = predict_pending(playerAttributes.predict);
+  if (predict_expire(playerAttributes.predict, hist_now())) {
+    settleKeys(0, before - predict_pending(playerAttributes.predict), "lost");
+    settleBatches(before - predict_pending(playerAttributes.predict));
+    playerAttributes.latest = predict_view(playerAttributes.predict);
+  }
+  flushKeys(*(addr_t*)arg, false);
+  if (headless.on) {
+    return headlessTick(*(addr_t*)arg);
+  }
+  drawFrame(NULL);
+  return false;
+}
+
 /**************** receiveMessage **********************/
 /**
  * Processes each message correctly and carries out the
@@ -189,7 +369,9 @@ static bool receiveMessage(void* arg, const addr_t from, const char* message)
   // In the case of a quit message, print appropriate output to client
   if (strncmp(message, "QUIT ", strlen("QUIT ")) == 0) {
     const char* quitContent = message + strlen("QUIT ");
-    endwin();
+    if (!headless.on) {
+      endwin();
+    }
     printf("\n%s\n", quitContent);
     return true;
   }
@@ -197,8 +379,15 @@ static bool receiveMessage(void* arg, const addr_t from, const char* message)
   // In the case of gold message, assign variables depending on message
   else if (strncmp(message, "GOLD", strlen("GOLD")) == 0) {
     int n, p, r;
-    // Parse message to get specific integer values
-    sscanf(message, "GOLD %d %d %d", &n, &p, &r);
+    unsigned int seq;
+    // Parse message to get specific integer values; with sequenced frames, a GOLD also
+    // names the frame it goes with, and one older than the last is stale
+    if (sscanf(message, "GOLD %d %d %d %u", &n, &p, &r, &seq) == 4) {
+      if (seq < playerAttributes.goldSeq) {
+        return false;
+      }
+      playerAttributes.goldSeq = seq;
+    }
     playerAttributes.goldCollected = n;
     playerAttributes.purse = p;
     playerAttributes.numGoldLeft = r;
@@ -210,67 +399,306 @@ static bool receiveMessage(void* arg, const addr_t from, const char* message)
     int ncols;
     sscanf(message, "GRID %d %d", &nrows, &ncols);
     checkDisplay(nrows, ncols);
+    message_send(from, "PACK");  // ask for each GOLD and DISPLAY in one datagram
   }
 
   // In the case of ok message, set player ID variable to given ID
   else if (strncmp(message, "OK", strlen("OK")) == 0) {
     const char* id = message + strlen("OK ");
     playerAttributes.playerID = *id;
+    message_send(from, "ACK 0");  // ask for sequenced frames: only what changed
+    if (headless.bots != NULL) {
+      bots_deliver(headless.bots, bots_address(headless.bots, 0), message);  // it may now play
+    }
+  }
+
+  // In the case of a sequenced frame, rebuild it, show it and acknowledge it
+  else if (strncmp(message, "KEYFRAME ", strlen("KEYFRAME ")) == 0
+           || strncmp(message, "DELTA ", strlen("DELTA ")) == 0) {
+    if (!receiveFrame(from, message)) {
+      fprintf(stderr, "Ignored a stale or undecodable frame.\n");
+    }
   }
 
   // In the case of display message,
+  // (only until sequenced frames start, which supersede it)
   else if (strncmp(message, "DISPLAY", strlen("DISPLAY")) == 0) {
-    // Create variable to store message
     const char* displayContent = message + strlen("DISPLAY\n");
-    if (playerAttributes.display != NULL) {
-      strcpy(playerAttributes.display, displayContent);
+    if (playerAttributes.frameSeq == 0 && playerAttributes.incoming != NULL
+        && strlen(displayContent) <= playerAttributes.frameLength) {
+      strcpy(playerAttributes.incoming, displayContent);
+      showDisplay(playerAttributes.incoming);
     }
-    clear();
+  }
 
-    // Print these messages only if client is a player
-    if (playerAttributes.isPlayer) {
-      if (playerAttributes.goldCollected == 0) {
-        printw("Player %c has %d nuggets (%d nuggets unclaimed).\n",
-               playerAttributes.playerID, playerAttributes.purse, playerAttributes.numGoldLeft);
-      }
-      else {
-        printw("Player %c has %d nuggets (%d nuggets unclaimed). GOLD received: %d\n",
-               playerAttributes.playerID, playerAttributes.purse, playerAttributes.numGoldLeft,
-               playerAttributes.goldCollected);
-      }
-    }
-    // If client is spectator
-    else {
-      printw("Spectator: %d nuggets unclaimed.\n", playerAttributes.numGoldLeft);
+  // In the case of a PONG, answering our PING, time the round trip; in the case of a PING,
+  // the server timing its own, answer at once
+  else if (strncmp(message, "PONG ", strlen("PONG ")) == 0) {
+    uint64_t sent;
+    if (rtt_parse(message, "PONG ", &sent)) {
+      rtt_sample(&playerAttributes.rtt, sent, hist_now());
     }
+  }
+  else if (strncmp(message, "PING ", strlen("PING ")) == 0) {
+    char pong[message_MaxBytes];
+    snprintf(pong, sizeof(pong), "PONG %s", message + strlen("PING "));
+    message_send(from, pong);
+  }
 
-    printw(displayContent);
-    refresh();
+  // In the case of game message, the server hosts several games and names the one we joined;
+  // nothing to show, since the GRID, GOLD and DISPLAY of that game follow
+  else if (strncmp(message, "GAME ", strlen("GAME ")) == 0) {
   }
 
-  // In the case of error message from server, clear display and print to stderr
+  // In the case of error message from server, tell player their keystroke was inaccurate,
+  // undoing it if it was shown moving them, and print to stderr; the ERROR for a key of
+  // a batch names it, and the server plays batches in turn, so it is a key of the oldest
   else if (strncmp(message, "ERROR", strlen("ERROR")) == 0) {
     fprintf(stderr, "Error message received from server.\n");
-    clear();
-    // Tell player their keystroke was inaccurate
-    if (playerAttributes.isPlayer) {
-      printw("Player %c has %d nuggets (%d nuggets unclaimed). Invalid move\n",
-             playerAttributes.playerID, playerAttributes.purse, playerAttributes.numGoldLeft);
+    int n;
+    if (playerAttributes.numBatches > 0
+        && sscanf(message, "ERROR. Invalid keystroke %d in KEYS", &n) == 1) {
+      int before = predict_pending(playerAttributes.predict);
+      int index = n - 1 - playerAttributes.batchRejected[0];  // those before it are gone
+      if (index >= 0 && index < playerAttributes.batchKeys[0] - playerAttributes.batchRejected[0]) {
+        predict_reject(playerAttributes.predict, index);
+        settleKeys(index, before - predict_pending(playerAttributes.predict), "rejected");
+        playerAttributes.batchRejected[0]++;
+        settleBatches(0);
+        playerAttributes.latest = predict_view(playerAttributes.predict);
+      }
     }
-    printw("%s", playerAttributes.display);
-    refresh();
+    drawFrame("Invalid move");
   }
 
   // In the case of any other message received from server
   else {
     fprintf(stderr, "Server message has bad format.\n");
   }
-  return false;
+  // PINGs, queued keys, and headless keys, fall due however busy the server keeps us
+  pingServer(*(addr_t*)arg);
+  flushKeys(*(addr_t*)arg, false);
+  return headless.on && headlessTick(*(addr_t*)arg);
+}
+
+/**************** receiveFrame **********************/
+/**
+ * Handles a sequenced frame: "KEYFRAME n" and a whole frame, or
+ * "DELTA n base" and the changes from frame base (see support/delta.h).
+ *
+ * Caller provides:
+ *   server address, and the KEYFRAME or DELTA message
+ * We guarantee:
+ *   a frame older than the newest we hold, or a delta whose base we no
+ *   longer hold, is ignored; the server resends, and falls back to whole
+ *   frames if our acknowledgements lag, so lost frames are made up
+ *   otherwise, the frame is kept, shown, and acknowledged with "ACK n"
+ * We return:
+ *   true if the frame was shown
+ */
+static bool receiveFrame(const addr_t from, const char* message)
+{
+  unsigned int seq, base;
+  const char* body = strchr(message, '\n');
+  bool whole = (message[0] == 'K');
+  if (body == NULL || playerAttributes.frames[0] == NULL
+      || (whole ? sscanf(message, "KEYFRAME %u", &seq) != 1
+                : sscanf(message, "DELTA %u %u", &seq, &base) != 2)
+      || seq <= playerAttributes.frameSeq) {
+    return false;
+  }
+  body++;
+  char* frame = playerAttributes.frames[seq % delta_History];
+  if (whole) {
+    if (strlen(body) > playerAttributes.frameLength) {
+      return false;
+    }
+    strcpy(frame, body);
+  }
+  else {
+    if (playerAttributes.frameSeqs[base % delta_History] != base || seq - base >= delta_History) {
+      return false;
+    }
+    const char* baseFrame = playerAttributes.frames[base % delta_History];
+    size_t length = strlen(baseFrame);
+    memmove(frame, baseFrame, length + 1);
+    if (!delta_apply(frame, length, body)) {
+      playerAttributes.frameSeqs[seq % delta_History] = 0;  // garbled; hold nothing there
+      return false;
+    }
+  }
+  playerAttributes.frameSeqs[seq % delta_History] = seq;
+  playerAttributes.frameSeq = seq;
+  char ack[30];
+  snprintf(ack, sizeof(ack), "ACK %u", seq);
+  message_send(from, ack);
+  showDisplay(frame);
+  return true;
+}
+
+/**************** showDisplay **********************/
+/**
+ * Shows a frame under the status line: at once, unless the screen was
+ * drawn less than DrawNanos ago; then it waits, and a newer frame that
+ * comes meanwhile replaces it, so frames that come faster than the
+ * terminal can draw them are skipped rather than queued.
+ *
+ * A player is shown the frame with the moves the server has not yet
+ * shown taken played on top (see support/predict.h).  Headless, nothing
+ * is shown: the keys the frame settles are timed, and the policy's bot
+ * is handed the frame.
+ *
+ * Caller provides:
+ *   the frame, as a DISPLAY message carries it, in memory that stays put
+ *   until it is drawn (incoming, or a held sequenced frame)
+ */
+static void showDisplay(const char* frame)
+{
+  if (playerAttributes.predict != NULL) {
+    int before = predict_pending(playerAttributes.predict);
+    int confirmed = predict_frame(playerAttributes.predict, frame);
+    settleKeys(0, confirmed, "shown");
+    settleKeys(0, before - confirmed - predict_pending(playerAttributes.predict), "undone");
+    settleBatches(before - predict_pending(playerAttributes.predict));
+  }
+  if (headless.on) {
+    if (headless.start == 0) {
+      headless.start = headless.nextKey = hist_now();
+    }
+    if (headless.bots != NULL) {
+      char* display = mem_malloc_assert(strlen("DISPLAY\n") + strlen(frame) + 1,
+                                        "Out of memory for display\n");
+      sprintf(display, "DISPLAY\n%s", frame);
+      bots_deliver(headless.bots, bots_address(headless.bots, 0), display);
+      mem_free(display);
+    }
+    return;
+  }
+  if (playerAttributes.predict != NULL) {
+    frame = predict_view(playerAttributes.predict);
+  }
+  playerAttributes.latest = frame;
+  if (hist_now() - playerAttributes.drawnAt >= DrawNanos) {
+    drawFrame(NULL);
+  }
+}
+
+/**************** drawFrame **********************/
+/**
+ * Draws the status line and the newest frame not yet drawn, if any,
+ * writing only the cells that differ from the frame on the screen, and
+ * updates the terminal once for both.
+ *
+ * Caller provides:
+ *   a note to end the status line with (a player's only), or NULL
+ * We guarantee:
+ *   the whole frame is written if the screen does not hold the last one,
+ *   or the two differ in shape; display then holds the frame drawn
+ */
+static void drawFrame(const char* note)
+{
+  const char* frame = playerAttributes.latest;
+  if (headless.on || playerAttributes.display == NULL || (frame == NULL && note == NULL)) {
+    return;
+  }
+  drawStatus(note);
+  if (frame != NULL) {
+    if (!playerAttributes.onScreen || strlen(frame) != strlen(playerAttributes.display)
+        || !drawChanges(frame)) {
+      move(1, 0);
+      clrtobot();
+      addstr(frame);
+      strcpy(playerAttributes.display, frame);
+      playerAttributes.onScreen = true;
+    }
+    playerAttributes.latest = NULL;
+  }
+  wnoutrefresh(stdscr);
+  doupdate();
+  playerAttributes.drawnAt = hist_now();
+}
+
+/**************** drawStatus **********************/
+/**
+ * Writes the status line: the player's purse and the gold left, or the
+ * spectator's gold left, and the round trip to the server once timed.
+ *
+ * Caller provides:
+ *   a note to end a player's status line with, or NULL
+ */
+static void drawStatus(const char* note)
+{
+  move(0, 0);
+  // Print these messages only if client is a player
+  if (playerAttributes.isPlayer) {
+    printw("Player %c has %d nuggets (%d nuggets unclaimed).",
+           playerAttributes.playerID, playerAttributes.purse, playerAttributes.numGoldLeft);
+    if (playerAttributes.goldCollected != 0) {
+      printw(" GOLD received: %d", playerAttributes.goldCollected);
+    }
+    if (note != NULL) {
+      printw(" %s", note);
+    }
+  }
+  // If client is spectator
+  else {
+    printw("Spectator: %d nuggets unclaimed.", playerAttributes.numGoldLeft);
+  }
+  if (playerAttributes.rtt.samples > 0) {
+    printw(" RTT %.1f ms, jitter %.1f ms", playerAttributes.rtt.smoothed / 1e6,
+           playerAttributes.rtt.jitter / 1e6);
+  }
+  clrtoeol();
+}
+
+/**************** drawChanges **********************/
+/**
+ * Writes each run of cells in which frame differs from the frame on the
+ * screen, and copies it into display.
+ *
+ * Caller provides:
+ *   a frame as long as display
+ * We return:
+ *   true if done; false if the frames' lines break in different places
+ *   (display may then be partly changed, and wants a whole frame)
+ */
+static bool drawChanges(const char* frame)
+{
+  const char* line = frame;
+  char* shown = playerAttributes.display;
+  for (int row = 1; *line != '\0'; row++) {
+    size_t width = strcspn(line, "\n");
+    if (shown[width] != line[width]) {
+      return false;
+    }
+    size_t col = 0;
+    while (col < width) {
+      if (line[col] == shown[col]) {
+        col++;
+        continue;
+      }
+      size_t end = col;
+      while (end < width && line[end] != shown[end]) {
+        if (shown[end] == '\n') {
+          return false;
+        }
+        end++;
+      }
+      mvaddnstr(row, col, line + col, end - col);
+      memcpy(shown + col, line + col, end - col);
+      col = end;
+    }
+    size_t next = width + (line[width] == '\n');
+    line += next;
+    shown += next;
+  }
+  return true;
 }
 
 /**************** checkDisplay **********************/
 /**
- * Ensures client's display size is large enough to fit grid.
+ * Ensures client's display size is large enough to fit grid, and sizes
+ * the frame buffers, and the longest message to accept, from the grid.
  *
  * Caller provides:
  *   Number of rows and columns in grid
@@ -282,6 +710,28 @@ static bool receiveMessage(void* arg, const addr_t from, const char* message)
  */
 static void checkDisplay(int nrow, int ncol)
 {
+  // a frame is a line of ncol characters and a newline for each row; a large one comes
+  // in fragments, which the message module puts back together up to this length
+  if (playerAttributes.display == NULL && nrow > 0 && ncol > 0) {
+    playerAttributes.frameLength = (size_t) nrow * (ncol + 1);
+    playerAttributes.display = mem_malloc_assert(playerAttributes.frameLength + 1,
+                                                 "Out of memory for display\n");
+    playerAttributes.incoming = mem_malloc_assert(playerAttributes.frameLength + 1,
+                                                  "Out of memory for display\n");
+    for (int h = 0; h < delta_History; h++) {
+      playerAttributes.frames[h] = mem_malloc_assert(playerAttributes.frameLength + 1,
+                                                     "Out of memory for frames\n");
+    }
+    message_setLargest(strlen("KEYFRAME 4294967295\n") + playerAttributes.frameLength);
+    if (playerAttributes.isPlayer) {
+      playerAttributes.predict = predict_new(playerAttributes.frameLength);
+      mem_assert(playerAttributes.predict, "Out of memory for prediction\n");
+    }
+  }
+  if (headless.on) {
+    return;  // no terminal
+  }
+
   // Initialize display
   initscr();
   cbreak();
@@ -290,8 +740,6 @@ static void checkDisplay(int nrow, int ncol)
   // Set up row and column variables
   int row;
   int col;
-
-  playerAttributes.display = mem_malloc_assert(65507, "Out of memory for display\n");
   getmaxyx(stdscr, row, col);
 
   // While dimensions are not large enough, prompt user to expand their display window
@@ -302,4 +750,264 @@ static void checkDisplay(int nrow, int ncol)
     }
     getmaxyx(stdscr, row, col);
   }
-}
\ No newline at end of file
+  playerAttributes.onScreen = false;  // draw the next frame whole
+}
+
+/**************** headlessTick **********************/
+/**
+ * Sends a headless client's keys as they fall due, once a frame has come,
+ * and KEY Q once its time is up.
+ *
+ * Caller provides:
+ *   server address
+ * We return:
+ *   true if the server has not answered KEY Q in QuitNanos, so we stop
+ */
+static bool headlessTick(const addr_t server)
+{
+  uint64_t now = hist_now();
+  if (headless.start == 0) {
+    return false;  // no frame yet
+  }
+  if (now - headless.start >= (uint64_t)headless.seconds * 1000000000) {
+    if (!headless.quitting) {
+      flushKeys(server, true);
+      message_send(server, "KEY Q");
+      headless.quitting = true;
+    }
+    return now - headless.start >= (uint64_t)headless.seconds * 1000000000 + QuitNanos;
+  }
+  const uint64_t period = 1e9 / headless.rate;
+  while (headless.nextKey <= now) {
+    if (headless.keys != NULL) {
+      sendKey(server, headless.keys[headless.script]);
+      headless.script = (headless.script + 1) % strlen(headless.keys);
+    }
+    else {
+      bots_act(headless.bots, sendBotMessage, (void*)&server);
+    }
+    headless.nextKey += period;
+  }
+  return false;
+}
+
+/**************** sendKey **********************/
+/**
+ * Plays a key on the prediction, and queues it to go with the next batch
+ * (see flushKeys), noting when it was pressed, so that the frame that
+ * shows it can be timed
+ *
+ * Caller provides:
+ *   server address, and the key
+ * We guarantee:
+ *   a key the prediction does not keep (there is no frame yet, or
+ *   predict_MaxPending are unsettled) is sent at once, alone, as a KEY;
+ *   headless, it is not sent at all while predict_MaxPending are
+ *   unsettled; headless, the key is kept in the ring exactly when the
+ *   prediction keeps it
+ * We return:
+ *   true if the prediction shows the key moving the player
+ */
+static bool sendKey(const addr_t server, const char key)
+{
+  predict_t* predict = playerAttributes.predict;
+  int before = predict_pending(predict);
+  if (headless.on && before == predict_MaxPending) {
+    return false;
+  }
+  uint64_t now = hist_now();  // before sending: the server may answer before the send returns
+  bool moved = predict_key(predict, key, now);
+  if (predict_pending(predict) == before) {
+    char message[] = "KEY x";
+    message[strlen("KEY ")] = key;
+    message_send(server, message);
+    return moved;
+  }
+  if (headless.on) {
+    int slot = (headless.oldest + headless.inFlight) % predict_MaxPending;
+    headless.sentKey[slot] = key;
+    headless.sentAt[slot] = now;
+    headless.inFlight++;
+    headless.sent++;
+  }
+  playerAttributes.queued[playerAttributes.numQueued++] = key;
+  flushKeys(server, false);
+  return moved;
+}
+
+/**************** flushKeys **********************/
+/**
+ * Sends the queued keys as one "KEYS keys" message, once the batches sent
+ * before them have landed: every key of them is settled, or the last was
+ * sent a retransmission timeout ago (the round trip and four times its
+ * jitter, or BatchNanos until a round trip is timed), in case its frame
+ * was lost.  A queued key the prediction has dropped (a frame showed no
+ * player) is dropped from the queue too.
+ *
+ * Caller provides:
+ *   server address, and whether to send the keys now, landed or not
+ */
+static void flushKeys(const addr_t server, const bool now)
+{
+  int pending = predict_pending(playerAttributes.predict);
+  if (playerAttributes.numQueued > pending) {
+    memmove(playerAttributes.queued, playerAttributes.queued + playerAttributes.numQueued - pending,
+            pending);
+    playerAttributes.numQueued = pending;
+  }
+  if (playerAttributes.numQueued == 0) {
+    return;
+  }
+  const rtt_t* rtt = &playerAttributes.rtt;
+  uint64_t timeout = (rtt->samples > 0) ? rtt->smoothed + 4 * rtt->jitter : BatchNanos;
+  if (!now && playerAttributes.numBatches > 0
+      && hist_now() - playerAttributes.batchSentAt < timeout) {
+    return;  // the last batch is still in flight
+  }
+  char message[strlen("KEYS ") + predict_MaxPending + 1];
+  sprintf(message, "KEYS %.*s", playerAttributes.numQueued, playerAttributes.queued);
+  message_send(server, message);
+  predict_sent(playerAttributes.predict, hist_now());
+  playerAttributes.batchKeys[playerAttributes.numBatches] = playerAttributes.numQueued;
+  playerAttributes.batchRejected[playerAttributes.numBatches++] = 0;
+  playerAttributes.batchSentAt = hist_now();
+  playerAttributes.numQueued = 0;
+}
+
+/**************** settleBatches **********************/
+/**
+ * Forgets the oldest batches sent as the prediction settles their keys,
+ * and any the server rejected every key of
+ *
+ * Caller provides:
+ *   how many of the oldest keys sent, not rejected, the prediction dropped
+ *   (confirmed, rolled back or expired, which take whole batches)
+ */
+static void settleBatches(int count)
+{
+  int batches = 0;
+  while (batches < playerAttributes.numBatches) {
+    int left = playerAttributes.batchKeys[batches] - playerAttributes.batchRejected[batches];
+    if (left > count) {
+      break;
+    }
+    count -= left;
+    batches++;
+  }
+  playerAttributes.numBatches -= batches;
+  memmove(playerAttributes.batchKeys, playerAttributes.batchKeys + batches,
+          playerAttributes.numBatches * sizeof(int));
+  memmove(playerAttributes.batchRejected, playerAttributes.batchRejected + batches,
+          playerAttributes.numBatches * sizeof(int));
+}
+
+/**************** sendBotMessage **********************/
+/**
+ * Sends what the policy's bot chooses; its PLAY is dropped, since we
+ * joined under the player's own name
+ *
+ * Caller provides:
+ *   pointer to server address, the bot's address (unused), and its message
+ * We return:
+ *   false
+ */
+static bool sendBotMessage(void* arg, const addr_t from, const char* message)
+{
+  if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
+    sendKey(*(addr_t*)arg, message[strlen("KEY ")]);
+  }
+  return false;
+}
+
+/**************** settleKeys **********************/
+/**
+ * Settles keys sent headless: counts them by outcome, times those a frame
+ * showed, and writes a line for each to the CSV file
+ *
+ * Caller provides:
+ *   the index of the first, oldest first (0 but for a key of a batch
+ *   rejected before the keys ahead of it were shown), how many, and the
+ *   outcome: shown, rejected (ERROR), undone (a frame showed the player
+ *   elsewhere) or lost (no sign of it in a second)
+ */
+static void settleKeys(const int first, const int count, const char* outcome)
+{
+  uint64_t now = hist_now();
+  for (int k = 0; k < count && headless.inFlight > first; k++) {
+    const int at = (headless.oldest + first) % predict_MaxPending;
+    const char key = headless.sentKey[at];
+    const uint64_t sentAt = headless.sentAt[at];
+    for (int j = first; j > 0; j--) {  // close the gap, keeping the keys ahead of it in order
+      const int to = (headless.oldest + j) % predict_MaxPending;
+      const int from = (headless.oldest + j - 1) % predict_MaxPending;
+      headless.sentKey[to] = headless.sentKey[from];
+      headless.sentAt[to] = headless.sentAt[from];
+    }
+    headless.oldest = (headless.oldest + 1) % predict_MaxPending;
+    headless.inFlight--;
+    bool lost = (strcmp(outcome, "lost") == 0);
+    if (strcmp(outcome, "shown") == 0) {
+      hist_record(headless.latency, now - sentAt);
+      headless.shown++;
+    }
+    else if (strcmp(outcome, "rejected") == 0) {
+      headless.rejected++;
+    }
+    else if (lost) {
+      headless.lost++;
+    }
+    else {
+      headless.undone++;
+    }
+    if (headless.csv != NULL) {
+      fprintf(headless.csv, "%c,%.0f,", key, (sentAt - headless.start) / 1e3);
+      if (!lost) {
+        fprintf(headless.csv, "%.1f", (now - sentAt) / 1e3);
+      }
+      fprintf(headless.csv, ",%s\n", outcome);
+    }
+  }
+}
+
+/**************** headlessReport **********************/
+/**
+ * Prints how the headless client's keys fared, and how long those shown
+ * took, and closes the CSV file
+ */
+static void headlessReport(void)
+{
+  settleKeys(0, headless.inFlight, "lost");  // never answered before we quit
+  printf("sent %lu keys: %lu shown, %lu rejected, %lu undone, %lu lost\n",
+         headless.sent, headless.shown, headless.rejected, headless.undone, headless.lost);
+  hist_print(headless.latency, stdout, "keystroke");
+  if (playerAttributes.rtt.samples > 0) {
+    printf("rtt %.1f us, jitter %.1f us, over %lu pings\n", playerAttributes.rtt.smoothed / 1e3,
+           playerAttributes.rtt.jitter / 1e3, playerAttributes.rtt.samples);
+  }
+  hist_delete(headless.latency);
+  bots_delete(headless.bots);
+  if (headless.csv != NULL) {
+    fclose(headless.csv);
+  }
+}
+
+/**************** pingServer **********************/
+/**
+ * Sends "PING t" with the time, at most once each PingNanos, once we are
+ * in a game; its PONG gives a sample of the round trip (see support/rtt.h)
+ *
+ * Caller provides:
+ *   server address
+ */
+static void pingServer(const addr_t server)
+{
+  uint64_t now = hist_now();
+  if (playerAttributes.frameLength == 0 || now - playerAttributes.rtt.pinged < PingNanos) {
+    return;
+  }
+  playerAttributes.rtt.pinged = now;
+  char ping[30];
+  snprintf(ping, sizeof(ping), "PING %llu", (unsigned long long)now);
+  message_send(server, ping);
+}
+
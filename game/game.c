@@ -0,0 +1,1221 @@
+/*
+ * game.c - one game of nuggets: players, spectators, gold and the
+ * messages that drive them
+ *
+ * see game.h for more information.
+ *
+ * Nuggets team, Feb 2022
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for rand_r
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "delta.h"
+#include "game.h"
+#include "grid.h"
+#include "hist.h"
+#include "intcounters.h"
+#include "intmap.h"
+#include "log.h"
+#include "mem.h"
+#include "message.h"
+#include "player.h"
+#include "pool.h"
+
+/**************** global types ****************/
+typedef struct game {
+  intmap_t* allPlayers;  // client address (see message_addrKey) -> player_t*
+  intmap_t* addrID;      // client address -> int* id
+  addr_t* addresses;  // store all player addresses, indexed by the ids in addrID
+  int numGoldLeft;
+  int numPlayers;
+  int numActive;      // players who have joined and not quit
+  grid_t* grid;       // borrowed from the caller; never modified
+  intcounters_t* gold;  // gold at each location of the grid (dense)
+  addr_t* spectators;  // addresses of all connected spectators; those who asked for packed
+                       //   messages last
+  int numSpectators;   // number of connected spectators
+  int numPacking;      // how many of them asked for packed messages
+  int maxSpectators;   // allocated length of spectators; doubled when full
+  unsigned int seed;   // state of this game's random sequence, for rand_r
+  char** frames;      // per-slot DISPLAY message buffers, parallel to addresses, plus one (last slot)
+                      //   shared by all spectators; header pre-written
+  arena_t* scratch;   // temporaries for one update, reset at the start of each update
+  char* overlay;      // gold and player symbols for the update in progress (in scratch)
+  pool_t* pool;       // borrowed from the caller, to render frames in parallel; may be NULL
+  struct viewer* viewers;  // players to be sent the update in progress, in sending order
+  int numViewers;
+  game_timers_t* timers;   // borrowed from the caller; may be NULL
+  struct stream** streams; // per-slot frame history, parallel to addresses; NULL for a player
+                           //   who has not asked for sequenced frames
+  bool* packing;           // per slot, parallel to addresses: did the player send PACK?
+  bool slowSpectators;     // send spectators at most one update each SpectatorNanos?
+  bool holdUpdates;        // hold updates back until game_flush (or HoldNanos)?
+  bool held;               // an update is being held back
+  bool spectatorsBehind;   // an update was not sent to the spectators
+  uint64_t updated;        // when the last update was sent (hist_now)
+  uint64_t spectatorsUpdated;  // and when the spectators were last sent one
+} game_t;
+
+// a player to be sent an update, and the slot of their address and frame
+struct viewer {
+  player_t* player;
+  int slot;
+};
+
+// the frames sent to a player who acknowledges them, so that each update can be sent as
+// the changes since the last frame the player is known to hold
+struct stream {
+  unsigned int seq;               // number of the last frame sent; 0 before the first
+  unsigned int acked;             // newest frame the player has acknowledged; 0 if none
+  bool pending;                   // the update in progress has a message for the player
+  char* sent[delta_History];      // the last frames sent, frame n at n % delta_History
+  char* update;                   // the KEYFRAME or DELTA message of the update in progress
+};
+
+// a message to be sent to every player of a game, for intmap_iterate
+struct gameMessage {
+  game_t* game;
+  const char* message;
+};
+
+/**************** local variables ****************/
+static const int GoldTotal = 250;       // amount of gold in the game
+static const int GoldMinNumPiles = 10;  // minimum number of gold piles
+static const int GoldMaxNumPiles = 30;  // maximum number of gold piles
+static const int UpdateHeaderBytes = 32;  // room for "DELTA seq base\n" or "KEYFRAME seq\n"
+static const int MaxBatchKeys = 64;      // most keys one KEYS message may carry; a Q among
+                                         //   them quits, and the keys after it are dropped
+static const uint64_t SpectatorNanos = 100000000;  // least time between spectators' updates, if slowed
+static const uint64_t HoldNanos = 50000000;        // longest time an update is held back
+
+/**************** local functions ****************/
+static bool playerJoin(game_t* game, char* name, const addr_t client);
+static bool isEmpty(const char* name);
+static void spectatorJoin(game_t* game, const addr_t* address);
+static int findSpectator(game_t* game, const addr_t address);
+static void spectatorQuit(game_t* game, int idx);
+static bool moveKey(game_t* game, player_t* player, const char move);
+static bool playKeys(game_t* game, const addr_t from, const char* keys);
+static void playerQuit(game_t* game, const addr_t from);
+static void endGame(game_t* game);
+static void deletePlayer(void* item);
+static void itemDelete(void* item);
+static void collectViewer(void* arg, const uint64_t addr, void* item);
+static void renderFrame(void* arg, const int index);
+static void acknowledge(game_t* game, const addr_t from, const char* number);
+static void streamUpdate(game_t* game, const int slot);
+static void streamDelete(struct stream* stream);
+static void sendGoldMessage(void* arg, const uint64_t addr, void* item);
+static void goldMessage(game_t* game, player_t* player, const int slot, char* message);
+static void packRequest(game_t* game, const addr_t from);
+static void sendEndMessage(void* arg, const uint64_t addr, void* item);
+static void updateSpectatorDisplay(game_t* game);
+static void changed(game_t* game);
+static void updateAllClients(game_t* game, const bool everyone);
+static void updateSpectators(game_t* game);
+static char* buildOverlay(game_t* game);
+static void overlayGold(void* arg, const int key, const int count);
+static char* clientFrame(game_t* game, int slot);
+static void initializeGoldPiles(game_t* game);
+static void generateRandomLocations(game_t* game, int numGoldPiles, int* arr);
+static void generateGoldDistribution(game_t* game, int numGoldPiles, int* arr);
+
+/**************** game_new ****************/
+/* see game.h for description
+ *
+ * Pseudocode:
+ *   allocate memory to game and check if successful
+ *   set numGoldLeft and the random seed
+ *   create the allPlayers intmap
+ *   create the addrID intmap that stores the ID to the addresses for each client connected
+ *   create the dense intcounters_t for gold that stores (key, count), where key is the location on the grid
+ *     and count is the number of gold at that locaton
+ *   call initializeGoldPiles to create random gold piles in the map
+ *   allocate memory for addresses that stores an array of all the addr_t of players
+ *   allocate the (initially empty) registry of spectator addresses
+ *   set numSpectators and numPlayers to 0
+ *   allocate the (empty) arrays of per-client frame buffers and frame histories, the list of
+ *     viewers, and the scratch arena
+ */
+game_t* game_new(grid_t* grid, const unsigned int seed, pool_t* pool, game_timers_t* timers)
+{
+  if (grid == NULL) {
+    return NULL;
+  }
+  game_t* game = mem_calloc(1, sizeof(game_t));
+  if (game == NULL) {
+    return NULL;
+  }
+  game->grid = grid;
+  game->seed = seed;
+  game->pool = pool;
+  game->timers = timers;
+  game->numGoldLeft = GoldTotal;
+  game->allPlayers = intmap_new(game_MaxPlayers);
+  game->addrID = intmap_new(game_MaxPlayers);
+  game->gold = intcounters_newDense(grid_getNumberRows(grid) * grid_getNumberCols(grid));
+  if (game->allPlayers == NULL || game->addrID == NULL || game->gold == NULL) {
+    game_delete(game);  // free whatever was allocated
+    return NULL;
+  }
+
+  // initialize gold piles by generate random number of gold piles and random number of gold on the grid
+  initializeGoldPiles(game);
+  game->addresses = mem_malloc_assert(game_MaxPlayers * sizeof(addr_t), "Out of memory for addresses variable.\n");
+  game->maxSpectators = 8;  // grows as spectators join
+  game->spectators = mem_malloc_assert(game->maxSpectators * sizeof(addr_t), "Out of memory for spectators.\n");
+  game->numSpectators = 0;  // no spectator initially
+  game->numPlayers = 0;
+  game->numActive = 0;
+
+  // reusable buffers so that steady-state updates do not touch the heap
+  game->frames = mem_calloc_assert(game_MaxPlayers + 1, sizeof(char*), "Out of memory for frames variable.\n");
+  game->viewers = mem_malloc_assert(game_MaxPlayers * sizeof(struct viewer), "Out of memory for viewers.\n");
+  game->streams = mem_calloc_assert(game_MaxPlayers, sizeof(struct stream*), "Out of memory for streams.\n");
+  game->packing = mem_calloc_assert(game_MaxPlayers, sizeof(bool), "Out of memory for packing.\n");
+  int gridSize = grid_getNumberRows(game->grid) * grid_getNumberCols(game->grid);
+  game->scratch = mem_assert(arena_new(gridSize), "Out of memory for scratch arena.\n");
+  return game;
+}
+
+/* ***************** initializeGoldPiles ********************** */
+/*
+ * Generates a random number of gold piles and a random number of gold in each pile for the game
+ *
+ * Pseudocode:
+ *  calculate the maximum number of available spots on the grid
+ *  compare the maxAvailableSpots with GoldMaxNumPiles and take the smaller number
+ *  generate a random number of gold piles between GoldMinNumPiles and the smaller number calculated earlier
+ *  create an array with size number of gold piles storing the locations to put the gold piles
+ *  create an array with size number of gold piles storing the random number of gold in each pile summing up to GoldTotal
+ *  loop through number of gold piles generated, setting the location and the gold count in game->gold
+ *
+ */
+static void initializeGoldPiles(game_t* game)
+{
+  int cols = grid_getNumberCols(game->grid);
+  int rows = grid_getNumberRows(game->grid);
+  // generate number of open spots to put gold
+  int maxAvailableSpots = (rows * cols) - (rows * 2) - (cols * 2);
+  // get the smaller number of piles
+  int max = (GoldMaxNumPiles > maxAvailableSpots) ? maxAvailableSpots : GoldMaxNumPiles;
+  // generate a value between min and max range of gold piles
+  int numGoldPiles = (rand_r(&game->seed) % (max - GoldMinNumPiles + 1)) + GoldMinNumPiles;
+  int goldDistributionArray[numGoldPiles];
+  int randomLocations[numGoldPiles];
+  // generate an array of random valid locations on the grid
+  generateRandomLocations(game, numGoldPiles, randomLocations);
+  // generate an array of random gold amount, summing up to goldTotal
+  generateGoldDistribution(game, numGoldPiles, goldDistributionArray);
+  int idx = 0;
+  while (idx < numGoldPiles) {  // put the randomly generated gold piles down
+    intcounters_set(game->gold, randomLocations[idx], goldDistributionArray[idx]);
+    idx++;
+  }
+}
+
+/* ***************** generateRandomLocations ********************** */
+/*
+ * Generates an array of random locations on the grid to put the gold piles
+ *
+ * Pseudocode:
+ *   loop through the number of gold piles
+ *      generate a random location
+ *      if location is a valid spot on the grid to put the gold
+ *        if the location is not occupied by gold
+ *            store location
+ */
+static void generateRandomLocations(game_t* game, int numGoldPiles, int* arr)
+{
+  int nRows = grid_getNumberRows(game->grid);
+  int nCols = grid_getNumberCols(game->grid);
+  int i = 0;
+  while (i < numGoldPiles) {
+    int location = rand_r(&game->seed) % (nRows * nCols);  // get the index in the map
+    if (grid_isRoom(game->grid, location)) {                 // if it is an available space
+      if (intcounters_get(game->gold, location) != 0) {         // if it is an existing gold pile
+        continue;                                            // do not store as valid location
+      }
+      else {  // if location not occupied by gold
+        arr[i] = location;
+        i++;
+        intcounters_set(game->gold, location, 1);  // mark location for having gold piles
+      }
+    }
+  }
+}
+
+/* ***************** generateGoldDistribution ********************** */
+/*
+ * Generates an array of random number of gold for each gold pile, summing up to GoldTotal
+ *
+ * Pseudocode:
+ *   Calculate goldRemaining, the max value of gold that can be generated such that each
+ *     gold pile has at least 1 gold in it.
+ *   loop through the number of gold piles - 1,
+ *      generate a random gold amount
+ *      store the gold amount in the array
+ *      update number of goldRemaining
+ *   allocate the remaining gold unallocated to the last gold pile
+ */
+static void generateGoldDistribution(game_t* game, int numGoldPiles, int* arr)
+{
+  int goldRemaining = GoldTotal - numGoldPiles;  // track number of gold left to allocate -1 for each pile
+  int i = numGoldPiles - 1;
+  while (i > 0) {
+    int x = 0;
+    if (goldRemaining > 0) {
+      x = (rand_r(&game->seed) % goldRemaining);
+    }
+    int gold = x;
+    arr[i] = gold + 1;
+    goldRemaining -= gold;
+    i--;
+  }
+  arr[0] = goldRemaining + 1;
+}
+
+/**************** game_handleMessage ****************/
+/* see game.h for description
+ *
+ * Pseudocode:
+ *    if client sends PLAY:
+ *        call playerJoin to join the player
+ *        if the new player picked up the last of the gold, end the game
+ *        send GOLD and DISPLAY messages to all clients connected
+ *    else if client sends SPECTATE
+ *        call spectatorJoin, initializing the spectator
+ *    else if message starts with "KEY "
+ *        find the player in game->allPlayers
+ *        if character is Q,
+ *           if it is a player
+ *              call player_quit
+ *           if it is a spectator
+ *              call spectatorQuit, removing the spectator from the registry
+ *           send QUIT message to spectator/player
+ *           send GOLD and DISPLAY messages to all clients
+ *        else if the sender is not a player, send an ERROR
+ *        else
+ *           call player_moveRegular (lowercase) or player_moveCapital (otherwise)
+ *           if it returns true, it is a valid move and player moves and collects gold accordingly
+ *              if game->numGoldLeft is 0, no more gold in game, end the game and send QUIT message to all clients
+ *              send GOLD and DISPLAY messages to all clients
+ *           else, it is an invalid move and server sends message to client informing them that it is invalid
+ *    else if message starts with "KEYS ", call playKeys
+ *    else if message starts with "ACK ", call acknowledge
+ *    else if message is "PACK", call packRequest
+ */
+bool game_handleMessage(game_t* game, const addr_t from, const char* message)
+{
+  if (game == NULL || message == NULL) {
+    return false;
+  }
+  if (strncmp(message, "PLAY ", strlen("PLAY ")) == 0) {
+    const char* realName = message + strlen("PLAY ");  // get the real name after PLAY
+    if (isEmpty(realName)) {  // if no whitespaces in name provided
+      message_send(from, "QUIT Sorry - you must provide player's name.\n");
+    } else {
+      char* name = mem_malloc_assert(strlen(realName) + 1, "Out of memory for name.\n");
+      strcpy(name, realName);
+      bool joined = playerJoin(game, name, from);  // join player
+      mem_free(name);
+      if (joined) {
+        if (game->numGoldLeft == 0) {  // the new player landed on the last pile
+          endGame(game);
+          return true;
+        }
+        changed(game);  // send gold and display messages to all clients
+      }
+    }
+  }
+  else if (strncmp(message, "SPECTATE", strlen("SPECTATE")) == 0) {
+    spectatorJoin(game, &from);
+  }
+  else if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
+    char move = message[strlen("KEY ")];
+    player_t* player = intmap_find(game->allPlayers, message_addrKey(from));
+    if (move == 'Q') {  // if Q, tell client to QUIT and remove player from game
+      if (intmap_find(game->addrID, message_addrKey(from)) != NULL) {
+        // if move is from a current player, quit the player
+        playerQuit(game, from);
+      }
+      else {  // if it is a spectator
+        int idx = findSpectator(game, from);
+        if (idx >= 0) {
+          spectatorQuit(game, idx);
+        }
+        message_send(from, "QUIT Thanks for watching!\n");
+      }
+      // update gold and play displays whenever a keystroke is pressed
+      changed(game);  // send gold and display messages to all clients
+    }
+    else if (player == NULL) {  // spectators, and clients of some other game, cannot move
+      message_send(from, "ERROR. Only players may move.\n");
+    }
+    else {
+      bool moved = moveKey(game, player, move);
+      if (!moved) {
+        // invalid input keystroke
+        log_s("Invalid keystroke: %s", message);
+        message_send(from, "ERROR. Invalid keystroke.\n");
+      }
+      else {
+        // player was successfully moved
+        if (game->numGoldLeft == 0) {  // if no more gold left
+          endGame(game);               // end game, send summary to all players
+          return true;
+        }
+        // update gold and play displays whenever a keystroke is pressed
+        changed(game);  // send gold and display messages to all clients
+      }
+    }
+  }
+  else if (strncmp(message, "KEYS ", strlen("KEYS ")) == 0) {
+    return playKeys(game, from, message + strlen("KEYS "));
+  }
+  else if (strncmp(message, "ACK ", strlen("ACK ")) == 0) {
+    acknowledge(game, from, message + strlen("ACK "));
+  }
+  else if (strcmp(message, "PACK") == 0) {
+    packRequest(game, from);
+  }
+  return false;  // game goes on
+}
+
+/* ***************** moveKey ********************** */
+/*
+ * Moves the player by one key, timing the move
+ * We Return:
+ *    true if the player moved (see player_moveRegular and player_moveCapital)
+ */
+static bool moveKey(game_t* game, player_t* player, const char move)
+{
+  bool moved;
+  uint64_t start = hist_now();
+  if (islower(move)) {
+    moved = player_moveRegular(player, move, game->allPlayers, game->grid, game->gold, &game->numGoldLeft);
+  }
+  else {
+    moved = player_moveCapital(player, move, game->allPlayers, game->grid, game->gold, &game->numGoldLeft);
+  }
+  if (game->timers != NULL) {
+    hist_record(game->timers->move, hist_now() - start);
+  }
+  return moved;
+}
+
+/* ***************** playKeys ********************** */
+/*
+ * Plays the keys of a "KEYS keys" message in order, as that many KEY messages would,
+ * but sends one update after the last rather than one after each; a key that does not
+ * move the player gets "ERROR. Invalid keystroke n in KEYS.", n counting from 1, sent
+ * as it is played, before the update.  A batch of more than MaxBatchKeys is refused whole.
+ * A Q quits the player, as KEY Q would, once the keys before it are played; the keys after
+ * it are dropped.
+ * We Return:
+ *    true if a key picked up the last of the gold, ending the game (keys after it are dropped)
+ */
+static bool playKeys(game_t* game, const addr_t from, const char* keys)
+{
+  player_t* player = intmap_find(game->allPlayers, message_addrKey(from));
+  if (player == NULL) {  // spectators, and clients of some other game, cannot move
+    message_send(from, "ERROR. Only players may move.\n");
+    return false;
+  }
+  if (strlen(keys) > MaxBatchKeys) {
+    message_send(from, "ERROR. Too many keys in KEYS.\n");
+    return false;
+  }
+  bool movedAny = false;
+  for (int k = 0; keys[k] != '\0'; k++) {
+    if (keys[k] == 'Q') {
+      playerQuit(game, from);
+      changed(game);  // the update for the keys before it, and for the player's leaving
+      return false;
+    }
+    if (moveKey(game, player, keys[k])) {
+      movedAny = true;
+      if (game->numGoldLeft == 0) {
+        endGame(game);
+        return true;
+      }
+    }
+    else {
+      char error[50];
+      snprintf(error, sizeof(error), "ERROR. Invalid keystroke %d in KEYS.\n", k + 1);
+      message_send(from, error);
+    }
+  }
+  if (movedAny) {
+    changed(game);  // one update for the whole batch
+  }
+  return false;
+}
+
+/* ***************** playerQuit ********************** */
+/*
+ * Quits the player at the address: takes it off the grid, leaving its purse where it
+ * stood, stops counting it as active, and tells it QUIT; the caller sends the update.
+ * A player that has already quit is only told QUIT again, as its QUIT may have been
+ * lost; its purse was left behind the first time.
+ */
+static void playerQuit(game_t* game, const addr_t from)
+{
+  int* id = intmap_find(game->addrID, message_addrKey(from));
+  if (*id != -1) {
+    player_quit(message_addrKey(from), game->allPlayers, game->gold, &game->numGoldLeft);
+    (game->numActive)--;
+    *id = -1;
+  }
+  message_send(from, "QUIT Thanks for playing!\n");
+}
+
+/* ***************** isEmpty ********************** */
+/*
+ * Checks if a given string has non-spaces characters
+ * We Return:
+ *    true if there's only whitespaces in string provided
+ *    false if there's non-spaces in string
+ */
+static bool isEmpty(const char* name)
+{
+  for (int i=0; i < strlen(name); i++) {
+    if (isspace(name[i]) == 0) { // if not a whitespace
+      return false;
+    }
+  }
+  return true;  // if only whitespaces in name provided
+}
+
+/* ***************** updateSpectatorDisplay ********************** */
+/* Updates the display of every connected spectator, with the frame renderFrame
+ * has already rendered into the shared spectator frame buffer
+ *
+ * Pseudocode:
+ *   if any spectator is connected
+ *      create a gold message, once
+ *      send the same gold and display message to all spectators with message_sendMany,
+ *        packed together with message_sendPacked for those who asked for it
+ */
+static void updateSpectatorDisplay(game_t* game)
+{
+  if (game->numSpectators > 0) {  // if spectators are connected, update their display
+
+    // creating gold message
+    char goldMsg[50];
+    sprintf(goldMsg, "GOLD 0 0 %d\n", game->numGoldLeft);
+
+    // every spectator sees the same frame
+    char* displayMessage = clientFrame(game, game_MaxPlayers);  // last slot is shared by all spectators
+
+    int numPlain = game->numSpectators - game->numPacking;
+    message_sendMany(game->spectators, numPlain, goldMsg);         // send gold messsage
+    message_sendMany(game->spectators, numPlain, displayMessage);  // send display message
+    const char* messages[] = { goldMsg, displayMessage };
+    message_sendPacked(game->spectators + numPlain, game->numPacking, messages, 2);
+  }
+}
+
+/* ***************** changed ********************** */
+/* A message changed the game: sends the update, or, while updates are held back (see
+ * game_throttle), marks it held, unless the last update sent is HoldNanos old
+ */
+static void changed(game_t* game)
+{
+  if (game->holdUpdates && hist_now() - game->updated < HoldNanos) {
+    game->held = true;
+  }
+  else {
+    updateAllClients(game, false);
+  }
+}
+
+/* ***************** updateAllClients ********************** */
+/* Sends GOLD and DISPLAY messages to all players and the spectators; while the
+ * spectators are slowed (see game_throttle), they are left out of an update that
+ * comes within SpectatorNanos of their last one, unless everyone is to get it
+ *
+ * The frames are independent of each other, so they are all rendered first, in
+ * parallel on the pool; then the messages are sent from this thread, always in
+ * the same order.
+ *
+ * Pseudocode:
+ *   call buildOverlay, once for the whole update
+ *   list the players still in the game (the viewers), making sure each has a frame buffer
+ *   render every viewer's frame, and the spectators' frame if they are to get this update,
+ *     with pool_run
+ *   send GOLD message to all players but those who asked for packed messages
+ *   send DISPLAY message to all viewers, in the order listed; a viewer with a frame history
+ *     gets the KEYFRAME or DELTA that renderFrame made instead, if any; a viewer who asked
+ *     for packed messages gets their GOLD and that together, with message_sendPacked
+ *   updateSpectatorDisplay, if they are to get it
+ *   note when the update was sent, and that none is held
+ *   record how long rendering and sending took, if timing
+ *   if compiled with MEMTEST, report the allocation counters
+ *     (they should not move between keystrokes once all clients have joined)
+ */
+static void updateAllClients(game_t* game, const bool everyone)
+{
+  game->overlay = buildOverlay(game);
+  game->numViewers = 0;
+  intmap_iterate(game->allPlayers, game, collectViewer);
+  int numFrames = game->numViewers;
+  uint64_t start = hist_now();
+  bool spectators = game->numSpectators > 0;
+  if (spectators && game->slowSpectators && !everyone
+      && start - game->spectatorsUpdated < SpectatorNanos) {
+    spectators = false;
+    game->spectatorsBehind = true;
+  }
+  if (spectators) {
+    clientFrame(game, game_MaxPlayers);  // last slot is shared by all spectators
+    numFrames++;                          // ... and rendered last
+  }
+  pool_run(game->pool, numFrames, renderFrame, game);
+  uint64_t rendered = hist_now();
+
+  intmap_iterate(game->allPlayers, game, sendGoldMessage);  // send gold messages to all players
+  for (int v = 0; v < game->numViewers; v++) {                 // send display messages to all players
+    int slot = game->viewers[v].slot;
+    struct stream* stream = game->streams[slot];
+    const char* frame = game->frames[slot];
+    if (stream != NULL) {
+      frame = stream->pending ? stream->update : NULL;
+    }
+    if (game->packing[slot]) {
+      char gold[50];
+      goldMessage(game, game->viewers[v].player, slot, gold);
+      const char* messages[] = { gold, frame };
+      message_sendPacked(&game->addresses[slot], 1, messages, (frame == NULL) ? 1 : 2);
+    }
+    else if (frame != NULL) {
+      message_send(game->addresses[slot], frame);
+    }
+  }
+  if (spectators) {
+    updateSpectatorDisplay(game);
+    game->spectatorsUpdated = start;
+    game->spectatorsBehind = false;
+  }
+  game->updated = start;
+  game->held = false;
+  if (game->timers != NULL) {
+    hist_record(game->timers->render, rendered - start);
+    hist_record(game->timers->send, hist_now() - rendered);
+  }
+#ifdef MEMTEST
+  mem_report(stderr, "after update");
+#endif
+}
+
+/* ***************** updateSpectators ********************** */
+/* Sends the spectators alone an update, after one passed them by
+ */
+static void updateSpectators(game_t* game)
+{
+  uint64_t start = hist_now();
+  game->overlay = buildOverlay(game);
+  game->numViewers = 0;
+  clientFrame(game, game_MaxPlayers);
+  renderFrame(game, 0);  // with no viewers, the one task renders the spectators' frame
+  updateSpectatorDisplay(game);
+  game->spectatorsUpdated = start;
+  game->spectatorsBehind = false;
+}
+
+/**************** game_throttle ****************/
+/* see game.h for description
+ *
+ * Pseudocode:
+ *   remember both settings; if no longer holding updates, send the one held, if any
+ */
+void game_throttle(game_t* game, const bool spectators, const bool hold)
+{
+  if (game == NULL) {
+    return;
+  }
+  game->slowSpectators = spectators;
+  game->holdUpdates = hold;
+  if (!hold && game->held) {
+    updateAllClients(game, false);
+  }
+}
+
+/**************** game_flush ****************/
+/* see game.h for description
+ *
+ * Pseudocode:
+ *   if an update is held, send it, to the spectators too if idle
+ *   else if idle and the spectators missed an update, send them one
+ */
+void game_flush(game_t* game, const bool idle)
+{
+  if (game == NULL) {
+    return;
+  }
+  if (game->held) {
+    updateAllClients(game, idle);
+  }
+  else if (idle && game->spectatorsBehind && game->numSpectators > 0) {
+    updateSpectators(game);
+  }
+}
+
+/* ***************** buildOverlay ********************** */
+/* Builds the per-location array of gold and player symbols for one update
+ *
+ * Pseudocode:
+ *   reset the scratch arena, releasing the previous update's temporaries
+ *   allocate one char per grid location from the arena and clear it
+ *   write each player's ID at their location
+ *   write '*' at each location that still has gold (gold is drawn over players)
+ * We return:
+ *   the overlay, valid until the next call
+ */
+static char* buildOverlay(game_t* game)
+{
+  int gridSize = grid_getNumberRows(game->grid) * grid_getNumberCols(game->grid);
+  arena_reset(game->scratch);
+  char* overlay = mem_assert(arena_alloc(game->scratch, gridSize), "Out of memory for overlay.\n");
+  memset(overlay, '\0', gridSize);
+  player_markLocations(game->allPlayers, game->grid, overlay);
+  intcounters_iterate(game->gold, overlay, overlayGold);
+  return overlay;
+}
+
+// mark a gold pile in the overlay; 251 marks a collected pile
+static void overlayGold(void* arg, const int key, const int count)
+{
+  char* overlay = arg;
+  if (count > 0 && count != 251) {
+    overlay[key] = '*';
+  }
+}
+
+/* ***************** clientFrame ********************** */
+/* Gives the DISPLAY message buffer for the client in the given slot of game->addresses
+ *
+ * Pseudocode:
+ *   if the slot has no buffer yet (first update after joining),
+ *      allocate room for the DISPLAY header and a whole frame
+ *      write the header once
+ *   return the buffer; callers render the frame right after the header
+ */
+static char* clientFrame(game_t* game, int slot)
+{
+  if (game->frames[slot] == NULL) {
+    game->frames[slot] = mem_malloc_assert(strlen("DISPLAY\n") + grid_frameLength(game->grid) + 1,
+      "Out of memory for display frame.\n");
+    strcpy(game->frames[slot], "DISPLAY\n");
+  }
+  return game->frames[slot];
+}
+
+/* ***************** endGame ********************** */
+/* Ends the game and send GOLD, DISPLAY, and QUIT messages to all clients
+ *
+ * Pseudocode:
+ *   send GOLD and DISPLAY messages to all clients one final time
+ *   call player_summary and build the QUIT GAME OVER message with the summary
+ *   send it to all players, then to all spectators
+ */
+static void endGame(game_t* game)
+{
+  // Update gold and display one final time for all players
+  updateAllClients(game, true);  // send gold and display messages to all clients
+
+  char* summary = player_summary(game->allPlayers);
+  char* quitMessage = mem_malloc_assert(strlen(summary) + strlen("QUIT GAME OVER:\n") + 1,
+    "Out of memory for quit message.\n");
+  strcpy(quitMessage, "QUIT GAME OVER:\n");
+  strcat(quitMessage, summary);
+
+  // send quit message with summary to all players
+  struct gameMessage end = { game, quitMessage };
+  intmap_iterate(game->allPlayers, &end, sendEndMessage);
+
+  // send quit message with summary to spectators
+  if (game->numSpectators > 0) {
+    message_sendMany(game->spectators, game->numSpectators, quitMessage);
+  }
+  mem_free(quitMessage);
+  mem_free(summary);
+}
+
+/**************** game_log ****************/
+/* see game.h for description */
+void game_log(FILE* fp)
+{
+  log_init(fp);
+}
+
+/**************** game_numPlayers ****************/
+/* see game.h for description */
+int game_numPlayers(game_t* game)
+{
+  return game == NULL ? 0 : game->numPlayers;
+}
+
+/**************** game_numActivePlayers ****************/
+/* see game.h for description */
+int game_numActivePlayers(game_t* game)
+{
+  return game == NULL ? 0 : game->numActive;
+}
+
+/**************** game_numSpectators ****************/
+/* see game.h for description */
+int game_numSpectators(game_t* game)
+{
+  return game == NULL ? 0 : game->numSpectators;
+}
+
+/**************** game_goldLeft ****************/
+/* see game.h for description */
+int game_goldLeft(game_t* game)
+{
+  return game == NULL ? 0 : game->numGoldLeft;
+}
+
+/**************** game_delete ****************/
+/* see game.h for description
+ *
+ * Pseudocode:
+ *   free all memory, deleting allPlayers, addrID, gold, addresses, spectators,
+ *     frames, streams, packing, scratch and game; the grid belongs to the caller
+ */
+void game_delete(game_t* game)
+{
+  if (game == NULL) {
+    return;
+  }
+  intmap_delete(game->allPlayers, deletePlayer);  // delete every player in the map
+  intmap_delete(game->addrID, itemDelete);        // delete all the address ids, freeing the item
+  intcounters_delete(game->gold);
+  if (game->addresses != NULL) {
+    mem_free(game->addresses);
+  }
+  if (game->spectators != NULL) {
+    mem_free(game->spectators);
+  }
+  if (game->frames != NULL) {
+    for (int slot = 0; slot <= game_MaxPlayers; slot++) {
+      if (game->frames[slot] != NULL) {
+        mem_free(game->frames[slot]);
+      }
+    }
+    mem_free(game->frames);
+  }
+  if (game->streams != NULL) {
+    for (int slot = 0; slot < game_MaxPlayers; slot++) {
+      streamDelete(game->streams[slot]);
+    }
+    mem_free(game->streams);
+  }
+  if (game->packing != NULL) {
+    mem_free(game->packing);
+  }
+  if (game->viewers != NULL) {
+    mem_free(game->viewers);
+  }
+  if (game->scratch != NULL) {
+    arena_delete(game->scratch);
+  }
+  mem_free(game);
+}
+
+/* ***************** sendGoldMessage ********************** */
+/* Sends GOLD message to player, telling them the gold they recently collected, the gold in their purse, and the remaining gold in game
+ *
+ * Pseudocode:
+ *   find the player's address id
+ *   if player is still playing, and player is not null, and address id exists in game->addrID,
+ *   and the player has not asked for packed messages (they get GOLD with their DISPLAY),
+ *      create GOLD message with goldMessage
+ *      send GOLD message using message_send
+ */
+static void sendGoldMessage(void* arg, const uint64_t addr, void* item)
+{
+  game_t* game = arg;
+  player_t* player = item;
+  int* id = NULL;
+  id = intmap_find(game->addrID, addr);
+  if (id != NULL && *id != -1 && player != NULL && !game->packing[*id]) {  // if address exists and player still in game
+    char goldM[50];
+    goldMessage(game, player, *id, goldM);
+    addr_t actualAddr = game->addresses[*id];  // get the address of player
+    message_send(actualAddr, goldM);           // send gold message
+  }
+}
+
+/* ***************** goldMessage ********************** */
+/* Writes the GOLD message for the player in the given slot into message (room for 50)
+ *
+ * Pseudocode:
+ *   write the gold they recently collected, their purse and the gold left, and then the
+ *     number of the player's latest frame if they acknowledge frames, so that a GOLD that
+ *     arrives late can be told from a newer one
+ */
+static void goldMessage(game_t* game, player_t* player, const int slot, char* message)
+{
+  struct stream* stream = game->streams[slot];
+  if (stream == NULL) {
+    sprintf(message, "GOLD %d %d %d\n", player_getRecentGold(player), player_getpurse(player), game->numGoldLeft);
+  }
+  else {
+    sprintf(message, "GOLD %d %d %d %u\n", player_getRecentGold(player), player_getpurse(player),
+            game->numGoldLeft, stream->seq);
+  }
+}
+
+/* ***************** packRequest ********************** */
+/* Handles "PACK" from a client that unpacks packed messages (see message_sendPacked):
+ * from now on each update's GOLD and DISPLAY reach it packed together.
+ *
+ * Pseudocode:
+ *   if the client is a player still in the game, mark their slot
+ *   else if it is a spectator not yet packing, swap it to the end of the plain spectators,
+ *      which makes it the first packing one
+ */
+static void packRequest(game_t* game, const addr_t from)
+{
+  int* id = intmap_find(game->addrID, message_addrKey(from));
+  if (id != NULL) {
+    if (*id != -1) {
+      game->packing[*id] = true;
+    }
+    return;
+  }
+  int idx = findSpectator(game, from);
+  int lastPlain = game->numSpectators - game->numPacking - 1;
+  if (idx >= 0 && idx <= lastPlain) {
+    addr_t spectator = game->spectators[idx];
+    game->spectators[idx] = game->spectators[lastPlain];
+    game->spectators[lastPlain] = spectator;
+    (game->numPacking)++;
+  }
+}
+
+/* ***************** collectViewer ********************** */
+/* Adds a player to the list of viewers of the update in progress
+ *
+ * Pseudocode:
+ *   find the player's address id
+ *   if player is still playing, and player is not null, and address id exists in game->addrID,
+ *      append the player and their slot to game->viewers
+ *      make sure the slot has a frame buffer (allocating here, not in the pool's threads)
+ */
+static void collectViewer(void* arg, const uint64_t addr, void* item)
+{
+  game_t* game = arg;
+  player_t* player = item;
+  int* addrID = intmap_find(game->addrID, addr);
+  if (addrID != NULL && *addrID != -1 && player != NULL) {  // if player address exists and player still in game
+    game->viewers[game->numViewers].player = player;
+    game->viewers[game->numViewers].slot = *addrID;
+    game->numViewers++;
+    clientFrame(game, *addrID);
+  }
+}
+
+/* ***************** renderFrame ********************** */
+/* Renders one frame of the update in progress; a task for pool_run
+ *
+ * Pseudocode:
+ *   if index names a viewer,
+ *      call grid_renderView to write what the player can see and has seen, with the
+ *        gold and player symbols from game->overlay, into the player's
+ *        frame buffer right after the DISPLAY header
+ *      if the player has a frame history, call streamUpdate
+ *   else (the one extra task), render the spectators' view into their shared frame
+ * Notes:
+ *   tasks run concurrently; each writes only its own frame (and its player's seen map)
+ */
+static void renderFrame(void* arg, const int index)
+{
+  game_t* game = arg;
+  if (index < game->numViewers) {
+    struct viewer* viewer = &game->viewers[index];
+    grid_renderView(game->grid, player_getCurrCoor(viewer->player), player_getSeen(viewer->player),
+      game->overlay, game->frames[viewer->slot] + strlen("DISPLAY\n"));
+    if (game->streams[viewer->slot] != NULL) {
+      streamUpdate(game, viewer->slot);
+    }
+  }
+  else {
+    grid_renderSpectator(game->grid, game->overlay, game->frames[game_MaxPlayers] + strlen("DISPLAY\n"));
+  }
+}
+
+/* ***************** acknowledge ********************** */
+/* Handles "ACK n" from a player: the player holds frame n, the newest it has.
+ * "ACK 0", before any frame, asks for sequenced frames: from the next update on, the
+ * player is sent KEYFRAME and DELTA messages, rather than DISPLAY (see streamUpdate).
+ *
+ * Pseudocode:
+ *   ignore the message unless it is from a player still in the game, with a number
+ *   if the player has no frame history, and n is 0, allocate one
+ *   else if n is newer than the last frame acknowledged, and was sent, remember it
+ * Notes:
+ *   acknowledgements may be lost or arrive out of order; an older one changes nothing
+ */
+static void acknowledge(game_t* game, const addr_t from, const char* number)
+{
+  int* id = intmap_find(game->addrID, message_addrKey(from));
+  if (id == NULL || *id == -1 || !isdigit((unsigned char)*number)) {
+    return;
+  }
+  unsigned long seq = strtoul(number, NULL, 10);
+  struct stream* stream = game->streams[*id];
+  if (stream == NULL) {
+    if (seq == 0) {
+      int length = grid_frameLength(game->grid);
+      stream = mem_calloc_assert(1, sizeof(struct stream), "Out of memory for stream.\n");
+      for (int h = 0; h < delta_History; h++) {
+        stream->sent[h] = mem_malloc_assert(length + 1, "Out of memory for frame history.\n");
+      }
+      stream->update = mem_malloc_assert(UpdateHeaderBytes + length + 1, "Out of memory for update.\n");
+      game->streams[*id] = stream;
+    }
+  }
+  else if (seq > stream->acked && seq <= stream->seq) {
+    stream->acked = seq;
+  }
+}
+
+/* ***************** streamUpdate ********************** */
+/* Makes the message that brings a player with a frame history up to the frame just
+ * rendered into their frame buffer; a task of renderFrame, so it touches only that slot.
+ *
+ * Pseudocode:
+ *   if the frame is the last one sent, and the player has acknowledged it, send nothing
+ *   number the frame seq + 1, and keep a copy of it in the history
+ *   if the player has acknowledged a frame still in the history, write
+ *      "DELTA seq base\n" and the runs that turn frame base into this one
+ *   if not, or if the runs would be longer than the frame itself, write
+ *      "KEYFRAME seq\n" and the whole frame
+ * Notes:
+ *   a player whose acknowledgements fall delta_History frames behind (lost, or slow)
+ *   is sent whole frames until they catch up, so a player converges after any loss
+ */
+static void streamUpdate(game_t* game, const int slot)
+{
+  struct stream* stream = game->streams[slot];
+  const char* frame = game->frames[slot] + strlen("DISPLAY\n");
+  int length = grid_frameLength(game->grid);
+  stream->pending = false;
+  if (stream->seq > 0 && stream->acked == stream->seq
+      && memcmp(stream->sent[stream->seq % delta_History], frame, length) == 0) {
+    return;  // the player already holds this frame
+  }
+  unsigned int seq = stream->seq + 1;
+  memcpy(stream->sent[seq % delta_History], frame, length + 1);
+  stream->seq = seq;
+  stream->pending = true;
+  if (stream->acked > 0 && seq - stream->acked < delta_History) {
+    int header = sprintf(stream->update, "DELTA %u %u\n", seq, stream->acked);
+    if (delta_encode(stream->sent[stream->acked % delta_History], frame, length,
+                     stream->update + header, length) >= 0) {
+      return;
+    }
+  }
+  int header = sprintf(stream->update, "KEYFRAME %u\n", seq);
+  memcpy(stream->update + header, frame, length + 1);
+}
+
+/* ***************** streamDelete ********************** */
+/* Frees a player's frame history; NULL is ignored */
+static void streamDelete(struct stream* stream)
+{
+  if (stream != NULL) {
+    for (int h = 0; h < delta_History; h++) {
+      mem_free(stream->sent[h]);
+    }
+    mem_free(stream->update);
+    mem_free(stream);
+  }
+}
+
+/* ***************** deletePlayer ********************** */
+/* deletes the player, freeing up memory
+ *
+ * Pseudocode:
+ *   if player is not yet deleted,
+ *      call player_delete
+ */
+static void deletePlayer(void* item)
+{
+  player_t* player = item;
+  if (player != NULL) {
+    player_delete(player);
+  }
+}
+
+/* ***************** sendEndMessage ********************** */
+/* Sends QUIT GAME OVER message to clients
+ *
+ * Pseudocode:
+ *   if the player exists and is still connected to server
+ *      get the player's addr_t
+ *      call message_send to player, sending the player the end of game message
+ */
+static void sendEndMessage(void* arg, const uint64_t addr, void* item)
+{
+  struct gameMessage* end = arg;
+  int* id = intmap_find(end->game->addrID, addr);
+  if (id != NULL && *id != -1 && item != NULL) {  // if player still connected, tell client to quit
+    addr_t actualAddr = end->game->addresses[*id];
+    message_send(actualAddr, end->message);
+  }
+}
+
+/* ***************** playerJoin ********************** */
+/*
+ * Initializes new player to game to the game, sending OK, GRID message to the player
+ *
+ * Pseudocode:
+ *   if numPlayers < game_MaxPlayers:
+ *      create a new player using player_new, drawing from the game's random sequence
+ *      create the OK message
+ *      create the GRID message
+ *      store the new player's addr_t in game->addresses
+ *      store the index of that player's address in game->addresses in game->addrID
+ *      store the new player in game->allPlayers
+ *      send OK and GRID message
+ *      increment game->numPlayers
+ *   else
+ *      send QUIT message to new client trying to connect
+ */
+static bool playerJoin(game_t* game, char* name, const addr_t client)
+{
+  if (game->numPlayers < game_MaxPlayers) {
+    player_t* newPlayer = player_new(name, game->grid, game->allPlayers, &game->numGoldLeft,
+      game->gold, game->numPlayers, &game->seed);
+    int buffer = 20;
+
+    // OK message
+    int okLength = strlen("OK ") + buffer;
+    char okMessage[okLength];
+    snprintf(okMessage, okLength, "OK %s", player_getID(newPlayer));
+
+    // grid message
+    int gridLength = strlen("GRID") + buffer;
+    char gridMessage[gridLength];
+    snprintf(gridMessage, gridLength, "GRID %d %d", grid_getNumberRows(game->grid), grid_getNumberCols(game->grid));
+
+    // create an id for the new player and store it in game->addrID and game->addresses respectively
+    int* newAddrID = mem_malloc_assert(sizeof(int), "Out of memory for new address id variable.\n");
+    *newAddrID = game->numPlayers;
+    game->addresses[game->numPlayers] = client;  // store the address of the player
+
+    intmap_insert(game->addrID, message_addrKey(client), newAddrID);      // store new player's address
+    intmap_insert(game->allPlayers, message_addrKey(client), newPlayer);  // store new player in allPlayers
+
+    message_send(client, okMessage);    // send the player message
+    message_send(client, gridMessage);  // send grid message
+    (game->numPlayers)++;
+    (game->numActive)++;
+    return true;
+  } else {
+    message_send(client, "QUIT Game is full: no more players can join.\n");
+    return false;
+  }
+}
+
+/* ***************** spectatorJoin ********************** */
+/*
+ * Adds a spectator to the game's registry of spectators; any number may watch at once.
+ * Send GRID, GOLD, DISPLAY message to the new spectator
+ *
+ * Pseudocode:
+ *    if the address is not already a spectator
+ *        if the registry is full, double its size
+ *        add the address after the other plain spectators, moving the first packing one to the end
+ *    create GRID message
+ *    create GOLD message
+ *    create DISPLAY message in the shared spectator frame buffer
+ *    send them to the new spectator using message_send
+ */
+static void spectatorJoin(game_t* game, const addr_t* address)
+{
+  if (findSpectator(game, *address) < 0) {  // a repeated SPECTATE just gets the current view again
+    if (game->numSpectators == game->maxSpectators) {
+      game->maxSpectators *= 2;
+      addr_t* spectators = mem_malloc_assert(game->maxSpectators * sizeof(addr_t), "Out of memory for spectators.\n");
+      memcpy(spectators, game->spectators, game->numSpectators * sizeof(addr_t));
+      mem_free(game->spectators);
+      game->spectators = spectators;
+    }
+    int firstPacking = game->numSpectators - game->numPacking;
+    game->spectators[game->numSpectators] = game->spectators[firstPacking];
+    game->spectators[firstPacking] = *address;  // store spectator address
+    (game->numSpectators)++;
+  }
+
+  // grid message
+  char gridMessage[30];
+  sprintf(gridMessage, "GRID %d %d", grid_getNumberRows(game->grid), grid_getNumberCols(game->grid));
+
+  // gold message
+  char goldMessage[50];
+  sprintf(goldMessage, "GOLD 0 0 %d\n", game->numGoldLeft);
+
+  // display message
+  char* displayMessage = clientFrame(game, game_MaxPlayers);  // last slot is shared by all spectators
+  grid_renderSpectator(game->grid, buildOverlay(game), displayMessage + strlen("DISPLAY\n"));
+  message_send(*address, gridMessage);     // send grid message
+  message_send(*address, goldMessage);     // send gold message
+  message_send(*address, displayMessage);  // send display message
+}
+
+/* ***************** findSpectator ********************** */
+/*
+ * Gives the index of the given address in game->spectators, or -1 if it is not a spectator
+ */
+static int findSpectator(game_t* game, const addr_t address)
+{
+  for (int idx = 0; idx < game->numSpectators; idx++) {
+    if (message_eqAddr(game->spectators[idx], address)) {
+      return idx;
+    }
+  }
+  return -1;
+}
+
+/* ***************** spectatorQuit ********************** */
+/*
+ * Removes the spectator at the given index of game->spectators
+ *
+ * Pseudocode:
+ *    move the last spectator of the same kind (plain or packing) into the vacated slot, and
+ *      if that was a plain one, the last packing spectator into its place (order does not
+ *      matter otherwise)
+ *    decrement numSpectators
+ */
+static void spectatorQuit(game_t* game, int idx)
+{
+  int lastPlain = game->numSpectators - game->numPacking - 1;
+  if (idx <= lastPlain) {
+    game->spectators[idx] = game->spectators[lastPlain];
+    game->spectators[lastPlain] = game->spectators[game->numSpectators - 1];
+  }
+  else {
+    game->spectators[idx] = game->spectators[game->numSpectators - 1];
+    (game->numPacking)--;
+  }
+  (game->numSpectators)--;
+}
+
+// delete the item
+static void itemDelete(void* item)
+{
+  if (item != NULL) {
+    mem_free(item);
+  }
+}
@@ -0,0 +1,150 @@
+/*
+ * game.h - header file for the game module
+ *
+ * A game_t is one independent game of nuggets: its players, spectators,
+ * gold, per-client frame buffers and random state.  The server may host
+ * many games at once; each one plays on a grid_t that it borrows and
+ * never modifies, so games on the same map share one grid.
+ *
+ * A game is not thread-safe, but games share no mutable state, so
+ * different games may run concurrently on different threads as long as
+ * each game is only touched by one thread at a time.
+ *
+ * Nuggets team, Feb 2022
+ */
+
+#ifndef __GAME_H
+#define __GAME_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "grid.h"
+#include "hist.h"
+#include "message.h"
+#include "pool.h"
+
+/**************** global types ****************/
+typedef struct game game_t;  // opaque to users of the module
+
+// histograms of how long, in nanoseconds, the stages of handling a message take;
+// any may be NULL, and many games may record into the same ones at once
+typedef struct game_timers {
+  hist_t* move;     // player_moveRegular or player_moveCapital, including the mover's visibility
+  hist_t* render;   // rendering every frame of an update (visibility and encoding, in one pass)
+  hist_t* send;     // sending every GOLD and DISPLAY message of an update
+} game_timers_t;
+
+/**************** global constants ****************/
+static const int game_MaxPlayers = 26;  // maximum number of players in one game
+
+/**************** functions ****************/
+
+/**************** game_new ****************/
+/* Create a new game on the given map, with gold piles already placed.
+ *
+ * Caller provides:
+ *   valid pointer to a grid, which must outlive the game;
+ *   seed for the game's own random sequence (gold piles and player spawns);
+ *   a thread pool on which to render each update's frames in parallel, or NULL
+ *   to render them on the calling thread; the pool, too, must outlive the game,
+ *   and may be shared by many games;
+ *   histograms in which to time each update, or NULL; they must outlive the game.
+ * We return:
+ *   pointer to a new game, with no players or spectators; NULL if error.
+ * We guarantee:
+ *   the same grid and seed, and the same sequence of messages, always
+ *   produce the same game.
+ * Caller is responsible for:
+ *   later calling game_delete.
+ */
+game_t* game_new(grid_t* grid, const unsigned int seed, pool_t* pool, game_timers_t* timers);
+
+/**************** game_handleMessage ****************/
+/* Handle one PLAY, SPECTATE, KEY, KEYS, ACK or PACK message from a client of this game,
+ * sending every reply and update the message causes.
+ *
+ * Caller provides:
+ *   valid pointer to a game that is not over, the sender's address, and the message.
+ * We return:
+ *   true if the message ended the game (the summary has been sent to every client);
+ *   false if the game goes on.
+ * Notes:
+ *   a player who sends "ACK 0" is sent, from then on, numbered KEYFRAME
+ *   (whole) and DELTA (changed) frames instead of DISPLAY, and acknowledges
+ *   each frame it holds with "ACK n"; see support/delta.h.
+ *   a player or spectator who sends "PACK" gets each update's GOLD and
+ *   DISPLAY (or KEYFRAME or DELTA) packed together; see message_sendPacked.
+ *   a player may send "KEYS keys" rather than a KEY for each: the keys are
+ *   played in order, and one update follows the last; a key that does not
+ *   move the player is answered "ERROR. Invalid keystroke n in KEYS.", n
+ *   counting from 1, before the update.
+ *   other messages are ignored; a KEY from an address that is neither a
+ *   player nor a spectator of this game is rejected with an ERROR.
+ */
+bool game_handleMessage(game_t* game, const addr_t from, const char* message);
+
+/**************** game_throttle ****************/
+/* Cut back the updates the game sends, while the server is behind, or stop doing so.
+ *
+ * Caller provides:
+ *   valid pointer to a game;
+ *   spectators: true to send the spectators at most ten updates a second;
+ *   hold: true to hold back each update until game_flush, or until the last
+ *   one sent is 50 ms old, so that a run of moves sends the players one update.
+ * Notes:
+ *   replies (OK, GRID, ERROR, QUIT) and the last update of a game are never
+ *   held back; a new game cuts back nothing.
+ */
+void game_throttle(game_t* game, const bool spectators, const bool hold);
+
+/**************** game_flush ****************/
+/* Send the update held back (see game_throttle), if any.
+ *
+ * Caller provides:
+ *   valid pointer to a game; idle true if there is nothing else to do, so
+ *   the spectators, if an update passed them by, are brought up to date too.
+ */
+void game_flush(game_t* game, const bool idle);
+
+/**************** game_log ****************/
+/* Log what the games see go wrong, such as invalid keystrokes, to a file.
+ *
+ * Caller provides:
+ *   file pointer, passed through to log_init(); NULL (the default) logs nothing.
+ * Notes:
+ *   while log_startAsync is in effect, the entries go through its ring,
+ *   so a game never waits on the file.
+ */
+void game_log(FILE* fp);
+
+/**************** game_numPlayers ****************/
+/* Return the number of players that have joined the game, including
+ * those who have since quit; 0 if game is NULL.
+ */
+int game_numPlayers(game_t* game);
+
+/**************** game_numActivePlayers ****************/
+/* Return the number of players that have joined and not quit; 0 if game is NULL. */
+int game_numActivePlayers(game_t* game);
+
+/**************** game_numSpectators ****************/
+/* Return the number of connected spectators; 0 if game is NULL. */
+int game_numSpectators(game_t* game);
+
+/**************** game_goldLeft ****************/
+/* Return the number of nuggets not yet collected; 0 if game is NULL. */
+int game_goldLeft(game_t* game);
+
+/**************** game_delete ****************/
+/* Delete the game and everything it allocated, except the grid.
+ *
+ * Caller provides:
+ *   pointer to a game, or NULL (ignored).
+ * Notes:
+ *   no message is sent; a game that ends by itself has already told
+ *   its clients (see game_handleMessage).
+ */
+void game_delete(game_t* game);
+
+#endif // __GAME_H
@@ -0,0 +1,268 @@
+/*
+ * gametest.c - test program for the game module
+ *
+ * Plays two games side by side on one shared grid, from the same seed and
+ * the same messages, and checks that they stay identical until both end.
+ * One game renders its updates on a thread pool, the other serially.
+ * The messages the games send are caught in memory: Alice asks the first
+ * game for sequenced frames, and acknowledges them only now and then,
+ * while some are lost; each frame she rebuilds from them must match the
+ * DISPLAY the second game sends her right after.  A batch of keys in one
+ * KEYS message must bring one update, and an ERROR naming each bad key;
+ * a Q among them must quit the player, and drop the keys after it; a player
+ * who quits again, carrying gold, must not leave it behind twice.
+ * While the games hold updates back, a run of moves must bring fewer
+ * updates than moves, and a slowed spectator fewer frames.
+ *
+ * Nuggets team, Feb 2022
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+#include "game.h"
+#include "grid.h"
+#include "hist.h"
+#include "message.h"
+#include "pool.h"
+
+static int errors = 0;
+static addr_t alice;
+static addr_t watcher;
+static int watched;             // DISPLAYs sent to the spectator, by either game
+static addr_t carol;
+static int carolQuits, carolErrors;  // QUITs and ERRORs sent to Carol, by either game
+
+// Alice's frames from the first game, as a client would keep them
+static char* history[delta_History];
+static unsigned int held;       // number of the newest frame she holds; 0 if none
+static bool rebuilt;            // she rebuilt a frame, not yet compared with the second game's
+static int sequenced, lost, compared;
+static int batchErrors, batchErrorSum;  // her ERRORs for keys of a KEYS, and the sum of their numbers
+
+// count and report a failed check
+static void expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+/* ***************** catch ********************** */
+/* Receives every message the games send; only Alice's frames matter.
+ * A KEYFRAME or DELTA (from the first game) is lost one time in four, or else rebuilt
+ * into her history; the next DISPLAY (from the second game) must match what she rebuilt.
+ */
+static void catch(void* arg, const addr_t to, const char* message)
+{
+  if (message_eqAddr(to, watcher) && strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
+    watched++;
+  }
+  if (message_eqAddr(to, carol)) {
+    carolQuits += strncmp(message, "QUIT ", strlen("QUIT ")) == 0;
+    carolErrors += strncmp(message, "ERROR", strlen("ERROR")) == 0;
+  }
+  if (!message_eqAddr(to, alice)) {
+    return;
+  }
+  int n;
+  if (sscanf(message, "ERROR. Invalid keystroke %d in KEYS", &n) == 1) {
+    batchErrors++;
+    batchErrorSum += n;
+    return;
+  }
+  unsigned int seq, base;
+  const char* body = strchr(message, '\n');
+  if (body == NULL) {
+    return;
+  }
+  body++;
+  if (sscanf(message, "KEYFRAME %u", &seq) == 1 || sscanf(message, "DELTA %u %u", &seq, &base) == 2) {
+    sequenced++;
+    if (rand() % 4 == 0) {
+      lost++;
+      return;
+    }
+    expect(seq > held, "frames arrive in order");
+    char* frame = history[seq % delta_History];
+    if (message[0] == 'K') {
+      strcpy(frame, body);
+    }
+    else {
+      expect(history[base % delta_History] != NULL && seq - base < delta_History, "the base is held");
+      int length = strlen(history[base % delta_History]);
+      memmove(frame, history[base % delta_History], length + 1);
+      expect(delta_apply(frame, length, body), "the delta applies");
+    }
+    held = seq;
+    rebuilt = true;
+  }
+  else if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0 && rebuilt) {
+    expect(strcmp(history[held % delta_History], body) == 0, "the rebuilt frame is the whole frame");
+    compared++;
+    rebuilt = false;
+  }
+}
+
+/* **************************************** */
+int main()
+{
+  for (int h = 0; h < delta_History; h++) {
+    history[h] = calloc(65536, 1);
+  }
+  message_setTransport(message_memoryTransport(catch, NULL));
+  if (message_init(NULL) == 0) {
+    fprintf(stderr, "cannot initialize the message module\n");
+    exit(2);
+  }
+  grid_t* grid = grid_read("../maps/visdemo.txt");
+  if (grid == NULL) {
+    fprintf(stderr, "cannot read ../maps/visdemo.txt\n");
+    exit(2);
+  }
+
+  // two games on one grid, from one seed
+  pool_t* pool = pool_new(3);
+  expect(pool != NULL, "pool_new");
+  game_timers_t timers = { hist_new(), hist_new(), hist_new() };  // only the first game is timed
+  game_t* games[2] = { game_new(grid, 42, pool, &timers), game_new(grid, 42, NULL, NULL) };
+  expect(games[0] != NULL && games[1] != NULL, "game_new");
+  expect(game_goldLeft(games[0]) == 250, "a new game has all of its gold");
+
+  addr_t bob;
+  expect(message_setAddr("localhost", "10009", &alice), "address for Alice");
+  expect(message_setAddr("localhost", "10010", &bob), "address for Bob");
+  expect(message_setAddr("localhost", "10011", &watcher), "address for the spectator");
+  expect(message_setAddr("localhost", "10012", &carol), "address for Carol");
+
+  for (int g = 0; g < 2; g++) {
+    game_handleMessage(games[g], alice, "PLAY Alice");
+  }
+  game_handleMessage(games[0], alice, "ACK 0");  // she wants sequenced frames
+  for (int g = 0; g < 2; g++) {                  // each update reaches both games in turn
+    game_handleMessage(games[g], bob, "PLAY Bob");
+  }
+  for (int g = 0; g < 2; g++) {
+    game_handleMessage(games[g], watcher, "SPECTATE");
+    game_handleMessage(games[g], watcher, "KEY l");  // spectators cannot move
+  }
+  expect(game_numPlayers(games[0]) == 2, "two players joined");
+  expect(game_numSpectators(games[0]) == 1, "one spectator joined");
+
+  // a batch of keys that cannot move her brings an ERROR for each, and no update
+  int updates = hist_count(timers.render);
+  game_handleMessage(games[0], alice, "KEYS xzx");
+  expect(batchErrors == 3 && batchErrorSum == 6, "each bad key of a batch is named");
+  expect(hist_count(timers.render) == updates, "a batch that moves no one brings no update");
+  // a batch of moves brings one update for them all, in both games alike
+  for (int g = 0; g < 2; g++) {
+    game_handleMessage(games[g], alice, "KEYS hjklHJKL");
+  }
+  expect(hist_count(timers.render) == updates + 1, "a batch of moves brings one update");
+  int moves = 3 + 8;  // every key of each batch is timed as a move
+
+  // a Q in a batch quits her once the keys before it are played; the keys after it are dropped
+  for (int g = 0; g < 2; g++) {
+    game_handleMessage(games[g], carol, "PLAY Carol");
+  }
+  for (int g = 0; g < 2; g++) {
+    game_handleMessage(games[g], carol, "KEYS hQl");
+  }
+  expect(carolQuits == 2 && carolErrors == 0, "a Q in a batch quits the player");
+  expect(game_numActivePlayers(games[0]) == 2 && game_numActivePlayers(games[1]) == 2,
+         "a player who quits in a batch is no longer active");
+  moves += 1;  // only the key before the Q
+
+  // while updates are held back, a run of moves brings fewer updates, the rest on a flush
+  const char* run[] = { "KEY h", "KEY l", "KEY h" };
+  for (int g = 0; g < 2; g++) {
+    game_throttle(games[g], true, true);
+  }
+  updates = hist_count(timers.render);
+  int frames = watched;
+  for (int m = 0; m < 3; m++, moves++) {
+    for (int g = 0; g < 2; g++) {
+      game_handleMessage(games[g], bob, run[m]);
+    }
+  }
+  expect(watched - frames < 2 * 3, "a slowed spectator misses updates");
+  for (int g = 0; g < 2; g++) {
+    game_flush(games[g], true);
+  }
+  expect(hist_count(timers.render) - updates < 3, "a run of moves held back brings fewer updates");
+  updates = hist_count(timers.render);
+  frames = watched;
+  for (int g = 0; g < 2; g++) {
+    game_flush(games[g], true);
+    game_throttle(games[g], false, false);
+  }
+  expect(hist_count(timers.render) == updates && watched == frames, "a flush leaves nothing held");
+
+  // dash the players about at random until the gold runs out
+  const char* keys[] = { "KEY L", "KEY J", "KEY H", "KEY K", "KEY U", "KEY N", "KEY Y", "KEY B" };
+  srand(1);
+  bool over[2] = { false, false };
+  for (int step = 0; step < 1000000 && !over[0]; step++) {
+    addr_t who = (step % 2 == 0) ? alice : bob;
+    const char* key = keys[rand() % 8];
+    for (int g = 0; g < 2; g++) {
+      over[g] = game_handleMessage(games[g], who, key);
+    }
+    if (held > 0 && rand() % 3 == 0 && !over[0]) {
+      char ack[20];
+      sprintf(ack, "ACK %u", held);
+      game_handleMessage(games[0], alice, ack);
+    }
+    expect(over[0] == over[1], "games from the same seed end together");
+    expect(game_goldLeft(games[0]) == game_goldLeft(games[1]), "games from the same seed stay identical");
+    moves++;
+  }
+  expect(over[0], "the game ends when the gold runs out");
+  expect(game_goldLeft(games[0]) == 0, "no gold is left at the end");
+  printf("both games ended after %d moves\n", moves);
+  printf("Alice was sent %d sequenced frames; %d were lost, %d rebuilt and compared\n",
+         sequenced, lost, compared);
+  expect(compared > 0 && lost > 0, "sequenced frames were lost and rebuilt");
+  expect(hist_count(timers.move) == moves, "every move was timed");
+  expect(hist_count(timers.render) == hist_count(timers.send), "every update was timed");
+  expect(hist_count(timers.render) > 0, "updates were timed");
+
+  game_delete(games[0]);
+  game_delete(games[1]);
+
+  // a player who has quit, and quits again, leaves her gold behind once
+  game_t* game = game_new(grid, 7, NULL, NULL);
+  game_handleMessage(game, carol, "PLAY Carol");
+  for (int step = 0; step < 100000 && game_goldLeft(game) == 250; step++) {
+    game_handleMessage(game, carol, keys[rand() % 8]);
+  }
+  expect(game_goldLeft(game) < 250, "Carol picked up gold");
+  int quits = carolQuits;
+  game_handleMessage(game, carol, "KEYS Q");
+  int goldLeft = game_goldLeft(game);
+  expect(goldLeft == 250, "a player who quits leaves her gold behind");
+  game_handleMessage(game, carol, "KEYS Q");
+  game_handleMessage(game, carol, "KEY Q");
+  expect(game_goldLeft(game) == goldLeft && game_numActivePlayers(game) == 0,
+         "quitting again leaves nothing more behind");
+  expect(carolQuits == quits + 3, "each Q is answered QUIT");
+  game_delete(game);
+
+  grid_delete(grid);  // the grid and pool outlive their games
+  pool_delete(pool);
+  hist_delete(timers.move);
+  hist_delete(timers.render);
+  hist_delete(timers.send);
+  message_done();
+  for (int h = 0; h < delta_History; h++) {
+    free(history[h]);
+  }
+
+  if (errors == 0) {
+    printf("gametest passed\n");
+  }
+  exit(errors == 0 ? 0 : 1);
+}
@@ -12,21 +12,52 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "counters.h"
 #include "file.h"
+#include "intcounters.h"
+#include "intset.h"
 #include "mem.h"
-#include "set.h"
 #include "grid.h"
 
 #define RADIUS 1000
 
 /**************** local types ****************/
+// a run of locations in one row, all visible from some vantage point
+typedef struct span {
+  int first;             // the run's first location
+  int length;            // number of locations in the run
+} span_t;
+
+// a rectangle of rows and columns, edges included
+typedef struct box {
+  int top;
+  int left;
+  int bottom;
+  int right;
+} box_t;
+
 typedef struct grid {
   char** map;
   int nrows;
   int ncols;
+  int* firstSpan;        // NULL unless precomputed; else nrows*ncols+1 indexes into spans:
+  span_t* spans;         // spans firstSpan[loc]..firstSpan[loc+1]-1 are visible from loc
 } grid_t;
 
+// a batch of vantage points for grid_precomputeVisibility, shared with its tasks
+typedef struct batch {
+  grid_t* grid;
+  const int* vantages;   // every open location, in order
+  int first;             // index in vantages of the batch's first vantage point
+  box_t* boxes;          // spots to test from each vantage point in the batch
+  size_t* offsets;       // where each vantage point's flags start in scratch
+  char* scratch;         // one visible flag per spot in each box
+} batch_t;
+
+/**************** local constants ****************/
+static const int BatchVantages = 1024;      // most vantage points in one batch
+static const size_t BatchFlags = 16 << 20;  // most spots tested in one batch
+static const int MaxSpans = 64 << 20;       // give up precomputing beyond this (512MB)
+
 /******************local functions**************/
 /**************mergeHelper************************/
 /* Merge the set this is iterated through into the argument set
@@ -37,7 +68,7 @@ typedef struct grid {
  *  appear in newly-visible locations set, inserts the location
  *  key with dummy item "g" into the newly-visible set.
  */
-static void mergeHelper(void* arg, const char* key, void* item);
+static void mergeHelper(void* arg, const int key, void* item);
 
 /**************isBlocked************************/
 /* Verify whether a point is visible from a vantage point in grid
@@ -55,6 +86,79 @@ static void mergeHelper(void* arg, const char* key, void* item);
  */
 static bool isBlocked(grid_t* grid, int rowObsrvr, int colObsrvr, int rowp, int colp);
 
+/**************isVisibleFrom************************/
+/* Verify whether a point is visible from a vantage point in grid
+ * Does:
+ *  Returns true if the point is not blocked (see isBlocked) and
+ *  lies within RADIUS of the vantage point. The vantage point
+ *  itself is not considered here; callers handle it separately.
+ *  Shared by grid_isVisible and the buffer-based functions below
+ *  so that both views agree exactly.
+ */
+static bool isVisibleFrom(grid_t* grid, int rowObsrvr, int colObsrvr, int rowp, int colp);
+
+/**************mapSymbol************************/
+/* Give the character a seen location shows in a frame
+ * Does:
+ *  If the location is open and the overlay holds a gold or player
+ *  symbol there, return that symbol; otherwise return the character
+ *  from the grid char array.
+ */
+static char mapSymbol(grid_t* grid, int r, int c, const char* overlay);
+
+/**************labelRooms************************/
+/* Number the regions of room spots that touch (diagonally, too)
+ * Does:
+ *  Returns an array with, for each location, the number of its
+ *  region, or -1 if it is not a room spot; fills in *regions with
+ *  the bounding box of each region. A line of sight only crosses
+ *  room spots, so it never leaves the region it starts in.
+ *  Returns NULL if out of memory. Caller frees both arrays.
+ */
+static int* labelRooms(grid_t* grid, box_t** regions);
+
+/**************candidateBox************************/
+/* Give the smallest box that holds every spot visible from a location
+ * Does:
+ *  Joins the boxes of the regions next to the vantage point (its own,
+ *  if it is a room spot) and widens them by one spot, for the wall or
+ *  passage at the far end of a line of sight; then trims to the grid
+ *  and to RADIUS.
+ */
+static box_t candidateBox(grid_t* grid, const int* label, const box_t* regions, int loc);
+
+/**************visibilityTask************************/
+/* Flag every spot in one vantage point's box that is visible from it
+ * Does:
+ *  the pool task of grid_precomputeVisibility: for vantage point
+ *  number index in the batch, writes one flag per spot of its box,
+ *  row by row, into the batch's scratch array.
+ */
+static void visibilityTask(void* arg, const int index);
+
+/**************appendSpans************************/
+/* Append the runs of visible flags in a box to the grid's spans
+ * Does:
+ *  Grows the spans array (doubling) as needed; returns false if it
+ *  would need more than MaxSpans, or memory runs out.
+ */
+static bool appendSpans(grid_t* grid, const box_t* box, const char* flags,
+                        int* numSpans, int* capacity);
+
+/**************forgetVisibility************************/
+/* Free the precomputed visibility, if any, so the grid works it out
+ * frame by frame again
+ */
+static void forgetVisibility(grid_t* grid);
+
+/**************inSpans************************/
+/* Is a location in the next of a vantage point's spans?
+ * Does:
+ *  Skips the spans that end before location, so that asking about
+ *  every location in increasing order walks each span once.
+ */
+static bool inSpans(const span_t** span, const span_t* end, int location);
+
 /******************global functions**************/
 
 /******************grid_read**************/
@@ -79,7 +183,7 @@ grid_t* grid_read(char* filename)
       // assume all rows same length
       numrows++;
       numcols = strlen(word);
-      mem_free(word);
+      free(word);  // file_readLine uses plain malloc
     }
     rewind(file);
 
@@ -92,6 +196,8 @@ grid_t* grid_read(char* filename)
       grid->map = carr;
       grid->ncols = numcols;
       grid->nrows = numrows;
+      grid->firstSpan = NULL;
+      grid->spans = NULL;
       fclose(file);
       return grid;
     }
@@ -134,18 +240,11 @@ bool grid_isOpen(grid_t* grid, int loc)
 {
   char roomSpot = '.';
   char passageSpot = '#';
-  int* coordinates = grid_locationConvert(grid, loc);
-  if (coordinates != NULL) {
-    char** carr = grid->map;
-    if (carr[coordinates[0]][coordinates[1]] != roomSpot &&
-        carr[coordinates[0]][coordinates[1]] != passageSpot) {
-      mem_free(coordinates);
-      return false;
-    }
-    else {
-      mem_free(coordinates);
-      return true;
-    }
+  // convert in place rather than via grid_locationConvert: this is called
+  // on every move and every render, and must not allocate
+  if (grid != NULL && loc >= 0 && loc < (grid->ncols) * (grid->nrows)) {
+    char spot = grid->map[loc / (grid->ncols)][loc % (grid->ncols)];
+    return spot == roomSpot || spot == passageSpot;
   }
   return false;
 }
@@ -155,33 +254,18 @@ bool grid_isOpen(grid_t* grid, int loc)
 bool grid_isRoom(grid_t* grid, int loc)
 {
   char roomSpot = '.';
-  int* coordinates = grid_locationConvert(grid, loc);
-  if (coordinates != NULL) {
-    char** carr = grid->map;
-    if (carr[coordinates[0]][coordinates[1]] != roomSpot) {
-      mem_free(coordinates);
-      return false;
-    }
-    else {
-      mem_free(coordinates);
-      return true;
-    }
+  if (grid != NULL && loc >= 0 && loc < (grid->ncols) * (grid->nrows)) {
+    return grid->map[loc / (grid->ncols)][loc % (grid->ncols)] == roomSpot;
   }
   return false;
 }
 
-set_t* grid_isVisible(grid_t* grid, int loc, set_t* playerLocations, counters_t* gold)
+intset_t* grid_isVisible(grid_t* grid, int loc, intset_t* playerLocations, intcounters_t* gold)
 {
   if (grid_isOpen(grid, loc)) {
     // insert the @ symbol into center of visible set
-    set_t* visible = set_new();
-    char* intToStr = mem_malloc(11);
-
-    if (intToStr != NULL) {
-      sprintf(intToStr, "%d", loc);
-    }
-
-    set_insert(visible, intToStr, "@");
+    intset_t* visible = intset_newDense((grid->ncols) * (grid->nrows));
+    intset_insert(visible, loc, "@");
 
     // now begin testing visible locations
     int location;
@@ -192,40 +276,43 @@ set_t* grid_isVisible(grid_t* grid, int loc, set_t* playerLocations, counters_t*
       for (int c = 0; c < grid->ncols; c++) {
         if (r != coordinates[0] || c != coordinates[1]) {
 
-          if (!isBlocked(grid, coordinates[0], coordinates[1], r, c)) {
-            if((coordinates[0]-r)*(coordinates[0]-r) + (coordinates[1]-c)*(coordinates[1]-c) 
-                <= RADIUS*RADIUS ){
-              //if distance is less than radius
-              //if not blocked, print the location to string key
-              location = r * (grid->ncols) + c;
-              sprintf(intToStr, "%d", location);
-
-              //insert appropriate symbol into set 
-              //(either player symbol, gold symbol, or dummy "g")
-              if (!grid_isOpen(grid, location)) {
-                set_insert(visible, intToStr, "g");
-              }
-              else if (counters_get(gold, location) > 0 && counters_get(gold, location) != 251) {
-                set_insert(visible, intToStr, "*");
-              }
-              else if (set_find(playerLocations, intToStr) != NULL) {
-                set_insert(visible, intToStr, set_find(playerLocations, intToStr));
-              }
-              else {
-                set_insert(visible, intToStr, "g");
-              }
-           }
+          if (isVisibleFrom(grid, coordinates[0], coordinates[1], r, c)) {
+            //if not blocked and distance is less than radius, it is visible
+            location = r * (grid->ncols) + c;
+
+            //insert appropriate symbol into set 
+            //(either player symbol, gold symbol, or dummy "g")
+            if (!grid_isOpen(grid, location)) {
+              intset_insert(visible, location, "g");
+            }
+            else if (intcounters_get(gold, location) > 0 && intcounters_get(gold, location) != 251) {
+              intset_insert(visible, location, "*");
+            }
+            else if (intset_find(playerLocations, location) != NULL) {
+              intset_insert(visible, location, intset_find(playerLocations, location));
+            }
+            else {
+              intset_insert(visible, location, "g");
+            }
           }
         }
       }
     }
-    mem_free(intToStr);
     mem_free(coordinates);
     return visible;
   }
   return NULL;
 }
 
+static bool isVisibleFrom(grid_t* grid, int rowObsrvr, int colObsrvr, int rowp, int colp)
+{
+  if ((rowObsrvr - rowp) * (rowObsrvr - rowp) + (colObsrvr - colp) * (colObsrvr - colp)
+      > RADIUS * RADIUS) {
+    return false;
+  }
+  return !isBlocked(grid, rowObsrvr, colObsrvr, rowp, colp);
+}
+
 static bool isBlocked(grid_t* grid, int rowObsrvr, int colObsrvr, int rowp, int colp)
 {
   char** carr = grid->map;
@@ -302,25 +389,25 @@ static bool isBlocked(grid_t* grid, int rowObsrvr, int colObsrvr, int rowp, int
 
 /******************grid_updateView**************/
 /* see grid.h */
-set_t* grid_updateView(grid_t* grid, int newloc,
-                       set_t* seenBefore, set_t* playerLocations, counters_t* gold)
+intset_t* grid_updateView(grid_t* grid, int newloc,
+                          intset_t* seenBefore, intset_t* playerLocations, intcounters_t* gold)
 {
   if (grid != NULL) {
-    set_t* visible = grid_isVisible(grid, newloc, playerLocations, gold);
+    intset_t* visible = grid_isVisible(grid, newloc, playerLocations, gold);
     if (visible != NULL) {
-      set_iterate(seenBefore, visible, mergeHelper);
-      set_delete(seenBefore,NULL);
+      intset_iterate(seenBefore, visible, mergeHelper);
+      intset_delete(seenBefore,NULL);
       return visible;
     }
   }
   return seenBefore;
 }
 
-static void mergeHelper(void* arg, const char* key, void* item)
+static void mergeHelper(void* arg, const int key, void* item)
 {
-  set_t* newlyVisible = arg;
-  if (set_find(newlyVisible, key) == NULL) {
-    set_insert(newlyVisible, key, "g");
+  intset_t* newlyVisible = arg;
+  if (intset_find(newlyVisible, key) == NULL) {
+    intset_insert(newlyVisible, key, "g");
   }
 }
 
@@ -328,81 +415,436 @@ static void mergeHelper(void* arg, const char* key, void* item)
 /* returns set of all locations in the grid, with gold symbols and player symbol
  *characters in approporatie locxations
  */
-set_t* grid_displaySpectator(grid_t* grid, set_t* playerLocations, counters_t* gold)
+intset_t* grid_displaySpectator(grid_t* grid, intset_t* playerLocations, intcounters_t* gold)
 {
   if (grid != NULL) {
-    set_t* allLocations = set_new();
-    int gridSize = (grid->ncols) * (grid->nrows);
     // get size of grid
-    // convert the int location to string literal, to insert into set
-    char* intToStr = malloc(11);
+    int gridSize = (grid->ncols) * (grid->nrows);
+    intset_t* allLocations = intset_newDense(gridSize);
     char* symbol;
     for (int i = 0; i < gridSize; i++) {
-      sprintf(intToStr, "%d", i);
       if (!grid_isOpen(grid, i)) {
-        set_insert(allLocations, intToStr, "g");
+        intset_insert(allLocations, i, "g");
       }
       else {
-        if (counters_get(gold, i) > 0 && counters_get(gold, i) != 251) {
-          set_insert(allLocations, intToStr, "*");
+        if (intcounters_get(gold, i) > 0 && intcounters_get(gold, i) != 251) {
+          intset_insert(allLocations, i, "*");
         }
         else {
-          symbol = set_find(playerLocations, intToStr);
+          symbol = intset_find(playerLocations, i);
           if (symbol != NULL) {
-            set_insert(allLocations, intToStr, symbol);
+            intset_insert(allLocations, i, symbol);
           }
           else {
-            set_insert(allLocations, intToStr, "g");
+            intset_insert(allLocations, i, "g");
           }
         }
       }
     }
-    free(intToStr);
     return allLocations;
   }
   return NULL;
 }
 
-char* grid_print(grid_t* grid, set_t* locations)
+char* grid_print(grid_t* grid, intset_t* locations)
 {
   if (grid != NULL && locations != NULL) {
     int gridSize = (grid->ncols) * (grid->nrows);
     char** carr = grid->map;
     char* printString = mem_malloc((sizeof(char) * gridSize) + grid->nrows + 1);
-    char* intToStr = mem_malloc(11);
     char* symbol;
-    strcpy(printString, "");
+    char* out = printString;
 
     // run through all grid locations
     for (int i = 0; i < grid->nrows; i++) {
-      strcat(printString, "\n");
+      *out++ = '\n';
       for (int j = 0; j < grid->ncols; j++) {
-        sprintf(intToStr, "%d", i * (grid->ncols) + j);
+        symbol = intset_find(locations, i * (grid->ncols) + j);
 
         // if location is in set
-        if (set_find(locations, intToStr) != NULL) {
-          // if not dummy character (means gold /player), print the symbol
-          symbol = set_find(locations, intToStr);
-          if (strcmp(symbol, "g") != 0) {
-            sprintf(printString + i * ((grid->ncols) + 1) + j + 1, "%s", symbol);
-          }
-          else {
-            // print the grid character corresponding to the location
-            sprintf(printString + i * ((grid->ncols) + 1) + j + 1, "%c", carr[i][j]);
-          }
+        if (symbol != NULL) {
+          // if not dummy character "g" (means gold /player), print the symbol;
+          // otherwise print the grid character corresponding to the location
+          *out++ = (symbol[0] != 'g') ? symbol[0] : carr[i][j];
         }
         // if location not in set, print space (indicates not visible)
         else {
-          strcat(printString, " ");
+          *out++ = ' ';
         }
       }
     }
-    mem_free(intToStr);
+    *out = '\0';
     return printString;
   }
   return NULL;
 }
 
+/******************grid_frameLength**************/
+/* see grid.h */
+int grid_frameLength(grid_t* grid)
+{
+  if (grid != NULL) {
+    return (grid->nrows) * ((grid->ncols) + 1);
+  }
+  return 0;
+}
+
+/******************grid_precomputeVisibility**************/
+/* see grid.h */
+bool grid_precomputeVisibility(grid_t* grid, pool_t* pool,
+                               void (*progress)(void* arg, const int done, const int total),
+                               void* arg)
+{
+  if (grid == NULL) {
+    return false;
+  }
+  if (grid->firstSpan != NULL) {
+    return true;
+  }
+  int size = (grid->nrows) * (grid->ncols);
+  int* vantages = mem_malloc(size * sizeof(int));
+  box_t* regions = NULL;
+  int* label = labelRooms(grid, &regions);
+  batch_t batch = { grid, vantages, 0, mem_malloc(BatchVantages * sizeof(box_t)),
+                    mem_malloc(BatchVantages * sizeof(size_t)), NULL };
+  grid->firstSpan = mem_malloc((size + 1) * sizeof(int));
+  bool ok = vantages != NULL && label != NULL && batch.boxes != NULL
+            && batch.offsets != NULL && grid->firstSpan != NULL;
+
+  // the open spots are the vantage points
+  int total = 0;
+  for (int loc = 0; ok && loc < size; loc++) {
+    if (grid_isOpen(grid, loc)) {
+      vantages[total++] = loc;
+    }
+  }
+
+  int numSpans = 0;
+  int capacity = 0;
+  int nextLoc = 0;         // next location whose first span is not yet known
+  size_t scratchSize = 0;
+  while (ok && batch.first < total) {
+    // take as many vantage points as there is room for
+    int count = 0;
+    size_t flags = 0;
+    while (batch.first + count < total && count < BatchVantages) {
+      box_t box = candidateBox(grid, label, regions, vantages[batch.first + count]);
+      size_t area = (size_t)(box.bottom - box.top + 1) * (box.right - box.left + 1);
+      if (count > 0 && flags + area > BatchFlags) {
+        break;
+      }
+      batch.boxes[count] = box;
+      batch.offsets[count] = flags;
+      flags += area;
+      count++;
+    }
+    if (flags > scratchSize) {
+      if (batch.scratch != NULL) {
+        mem_free(batch.scratch);
+      }
+      scratchSize = flags;
+      if ((batch.scratch = mem_malloc(scratchSize)) == NULL) {
+        ok = false;
+        break;
+      }
+    }
+
+    pool_run(pool, count, visibilityTask, &batch);
+
+    // keep the flags as spans, in location order, so the result never depends on the pool
+    for (int v = 0; ok && v < count; v++) {
+      int loc = vantages[batch.first + v];
+      while (nextLoc <= loc) {
+        grid->firstSpan[nextLoc++] = numSpans;
+      }
+      ok = appendSpans(grid, &batch.boxes[v], batch.scratch + batch.offsets[v],
+                       &numSpans, &capacity);
+    }
+    batch.first += count;
+    if (ok && progress != NULL) {
+      (*progress)(arg, batch.first, total);
+    }
+  }
+  while (ok && nextLoc <= size) {
+    grid->firstSpan[nextLoc++] = numSpans;
+  }
+
+  void* temporaries[] = { vantages, label, regions, batch.boxes, batch.offsets, batch.scratch };
+  for (int i = 0; i < (int)(sizeof(temporaries) / sizeof(temporaries[0])); i++) {
+    if (temporaries[i] != NULL) {
+      mem_free(temporaries[i]);
+    }
+  }
+  if (!ok) {
+    // fall back to working out visibility frame by frame
+    forgetVisibility(grid);
+  }
+  return ok;
+}
+
+static int* labelRooms(grid_t* grid, box_t** regions)
+{
+  int size = (grid->nrows) * (grid->ncols);
+  int* label = mem_malloc(size * sizeof(int));
+  int* queue = mem_malloc(size * sizeof(int));
+  *regions = mem_malloc(size * sizeof(box_t));
+  if (label == NULL || queue == NULL || *regions == NULL) {
+    void* allocated[] = { label, queue, *regions };
+    for (int i = 0; i < 3; i++) {
+      if (allocated[i] != NULL) {
+        mem_free(allocated[i]);
+      }
+    }
+    *regions = NULL;
+    return NULL;
+  }
+  for (int loc = 0; loc < size; loc++) {
+    label[loc] = grid_isRoom(grid, loc) ? size : -1;  // size: not yet labelled
+  }
+
+  // breadth-first search from each room spot not yet labelled
+  int numRegions = 0;
+  for (int start = 0; start < size; start++) {
+    if (label[start] != size) {
+      continue;
+    }
+    box_t* box = &(*regions)[numRegions];
+    *box = (box_t){ start / grid->ncols, start % grid->ncols,
+                    start / grid->ncols, start % grid->ncols };
+    label[start] = numRegions;
+    int head = 0, tail = 0;
+    queue[tail++] = start;
+    while (head < tail) {
+      int r = queue[head] / grid->ncols;
+      int c = queue[head++] % grid->ncols;
+      box->top = r < box->top ? r : box->top;
+      box->bottom = r > box->bottom ? r : box->bottom;
+      box->left = c < box->left ? c : box->left;
+      box->right = c > box->right ? c : box->right;
+      for (int nr = r - 1; nr <= r + 1; nr++) {
+        for (int nc = c - 1; nc <= c + 1; nc++) {
+          if (nr >= 0 && nr < grid->nrows && nc >= 0 && nc < grid->ncols
+              && label[nr * grid->ncols + nc] == size) {
+            label[nr * grid->ncols + nc] = numRegions;
+            queue[tail++] = nr * grid->ncols + nc;
+          }
+        }
+      }
+    }
+    numRegions++;
+  }
+  mem_free(queue);
+  return label;
+}
+
+static box_t candidateBox(grid_t* grid, const int* label, const box_t* regions, int loc)
+{
+  int rowObsrvr = loc / (grid->ncols);
+  int colObsrvr = loc % (grid->ncols);
+  box_t box = { rowObsrvr, colObsrvr, rowObsrvr, colObsrvr };
+  for (int r = rowObsrvr - 1; r <= rowObsrvr + 1; r++) {
+    for (int c = colObsrvr - 1; c <= colObsrvr + 1; c++) {
+      if (r >= 0 && r < grid->nrows && c >= 0 && c < grid->ncols
+          && label[r * grid->ncols + c] >= 0) {
+        const box_t* region = &regions[label[r * grid->ncols + c]];
+        box.top = region->top < box.top ? region->top : box.top;
+        box.bottom = region->bottom > box.bottom ? region->bottom : box.bottom;
+        box.left = region->left < box.left ? region->left : box.left;
+        box.right = region->right > box.right ? region->right : box.right;
+      }
+    }
+  }
+  // one spot further, limited by the grid and the radius
+  int top = rowObsrvr - RADIUS > 0 ? rowObsrvr - RADIUS : 0;
+  int left = colObsrvr - RADIUS > 0 ? colObsrvr - RADIUS : 0;
+  int bottom = rowObsrvr + RADIUS < grid->nrows - 1 ? rowObsrvr + RADIUS : grid->nrows - 1;
+  int right = colObsrvr + RADIUS < grid->ncols - 1 ? colObsrvr + RADIUS : grid->ncols - 1;
+  box.top = box.top - 1 > top ? box.top - 1 : top;
+  box.left = box.left - 1 > left ? box.left - 1 : left;
+  box.bottom = box.bottom + 1 < bottom ? box.bottom + 1 : bottom;
+  box.right = box.right + 1 < right ? box.right + 1 : right;
+  return box;
+}
+
+static void visibilityTask(void* arg, const int index)
+{
+  batch_t* batch = arg;
+  grid_t* grid = batch->grid;
+  int loc = batch->vantages[batch->first + index];
+  int rowObsrvr = loc / (grid->ncols);
+  int colObsrvr = loc % (grid->ncols);
+  const box_t* box = &batch->boxes[index];
+  char* flag = batch->scratch + batch->offsets[index];
+  for (int r = box->top; r <= box->bottom; r++) {
+    for (int c = box->left; c <= box->right; c++) {
+      *flag++ = (r != rowObsrvr || c != colObsrvr)
+                && isVisibleFrom(grid, rowObsrvr, colObsrvr, r, c);
+    }
+  }
+}
+
+static bool appendSpans(grid_t* grid, const box_t* box, const char* flags,
+                        int* numSpans, int* capacity)
+{
+  for (int r = box->top; r <= box->bottom; r++) {
+    for (int c = box->left; c <= box->right; ) {
+      if (!*flags) {
+        flags++;
+        c++;
+        continue;
+      }
+      int first = c;
+      while (c <= box->right && *flags) {
+        flags++;
+        c++;
+      }
+      if (*numSpans == *capacity) {
+        if (*capacity >= MaxSpans) {
+          return false;
+        }
+        int grown = (*capacity == 0) ? 1024 : 2 * *capacity;
+        span_t* spans = mem_malloc(grown * sizeof(span_t));
+        if (spans == NULL) {
+          return false;
+        }
+        if (grid->spans != NULL) {
+          memcpy(spans, grid->spans, *numSpans * sizeof(span_t));
+          mem_free(grid->spans);
+        }
+        grid->spans = spans;
+        *capacity = grown;
+      }
+      grid->spans[(*numSpans)++] = (span_t){ r * (grid->ncols) + first, c - first };
+    }
+  }
+  return true;
+}
+
+static bool inSpans(const span_t** span, const span_t* end, int location)
+{
+  while (*span < end && location >= (*span)->first + (*span)->length) {
+    (*span)++;
+  }
+  return *span < end && location >= (*span)->first;
+}
+
+/******************forgetVisibility**************/
+static void forgetVisibility(grid_t* grid)
+{
+  if (grid->firstSpan != NULL) {
+    mem_free(grid->firstSpan);
+    grid->firstSpan = NULL;
+  }
+  if (grid->spans != NULL) {
+    mem_free(grid->spans);
+    grid->spans = NULL;
+  }
+}
+
+/******************grid_updateSeen**************/
+/* see grid.h */
+bool grid_updateSeen(grid_t* grid, int loc, char* seen)
+{
+  if (seen == NULL || !grid_isOpen(grid, loc)) {
+    return false;
+  }
+  if (grid->firstSpan != NULL) {
+    seen[loc] = 1;
+    for (int s = grid->firstSpan[loc]; s < grid->firstSpan[loc + 1]; s++) {
+      memset(seen + grid->spans[s].first, 1, grid->spans[s].length);
+    }
+    return true;
+  }
+  int rowObsrvr = loc / (grid->ncols);
+  int colObsrvr = loc % (grid->ncols);
+  seen[loc] = 1;
+  for (int r = 0; r < grid->nrows; r++) {
+    for (int c = 0; c < grid->ncols; c++) {
+      if ((r != rowObsrvr || c != colObsrvr) && isVisibleFrom(grid, rowObsrvr, colObsrvr, r, c)) {
+        seen[r * (grid->ncols) + c] = 1;
+      }
+    }
+  }
+  return true;
+}
+
+/******************grid_renderView**************/
+/* see grid.h */
+char* grid_renderView(grid_t* grid, int loc, char* seen, const char* overlay, char* frame)
+{
+  if (grid == NULL || seen == NULL || frame == NULL) {
+    return NULL;
+  }
+  // a vantage point that is not open sees nothing new (as grid_updateView)
+  bool vantage = grid_isOpen(grid, loc);
+  int rowObsrvr = vantage ? loc / (grid->ncols) : -1;
+  int colObsrvr = vantage ? loc % (grid->ncols) : -1;
+  // the precomputed spans visible from there, if any
+  const span_t* span = NULL;
+  const span_t* end = NULL;
+  if (vantage && grid->firstSpan != NULL) {
+    span = grid->spans + grid->firstSpan[loc];
+    end = grid->spans + grid->firstSpan[loc + 1];
+  }
+  char* out = frame;
+
+  for (int r = 0; r < grid->nrows; r++) {
+    *out++ = '\n';
+    for (int c = 0; c < grid->ncols; c++) {
+      int location = r * (grid->ncols) + c;
+      if (r == rowObsrvr && c == colObsrvr) {
+        seen[location] = 1;
+        *out++ = '@';
+      }
+      else if (vantage && (span != NULL ? inSpans(&span, end, location)
+                                        : isVisibleFrom(grid, rowObsrvr, colObsrvr, r, c))) {
+        // currently visible: show gold and players
+        seen[location] = 1;
+        *out++ = mapSymbol(grid, r, c, overlay);
+      }
+      else if (seen[location]) {
+        // seen before but not visible now: map character only
+        *out++ = grid->map[r][c];
+      }
+      else {
+        *out++ = ' ';
+      }
+    }
+  }
+  *out = '\0';
+  return frame;
+}
+
+/******************grid_renderSpectator**************/
+/* see grid.h */
+char* grid_renderSpectator(grid_t* grid, const char* overlay, char* frame)
+{
+  if (grid == NULL || frame == NULL) {
+    return NULL;
+  }
+  char* out = frame;
+  for (int r = 0; r < grid->nrows; r++) {
+    *out++ = '\n';
+    for (int c = 0; c < grid->ncols; c++) {
+      *out++ = mapSymbol(grid, r, c, overlay);
+    }
+  }
+  *out = '\0';
+  return frame;
+}
+
+static char mapSymbol(grid_t* grid, int r, int c, const char* overlay)
+{
+  char spot = grid->map[r][c];
+  if (overlay != NULL && (spot == '.' || spot == '#')) {
+    char symbol = overlay[r * (grid->ncols) + c];
+    if (symbol != '\0') {
+      return symbol;
+    }
+  }
+  return spot;
+}
+
 int grid_getNumberCols(grid_t* grid)
 {
   if (grid != NULL) {
@@ -424,10 +866,11 @@ void grid_delete(grid_t* grid)
   if (grid != NULL) {
     char** map = grid->map;
     for (int i = 0; i < grid_getNumberRows(grid); i++) {
-      mem_free(map[i]);
+      free(map[i]);  // from file_readLine
     }
     
     mem_free(grid->map);
+    forgetVisibility(grid);
     mem_free(grid);
   }
 }
@@ -14,10 +14,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "counters.h"
 #include "file.h"
+#include "intcounters.h"
+#include "intset.h"
 #include "mem.h"
-#include "set.h"
+#include "pool.h"
 
 
 /**************** global types ****************/
@@ -77,7 +78,8 @@ int* grid_locationConvert(grid_t* grid, int loc);
  *  false if points to wall, corner, space
  *  false if location or grid invalid
  * We do:
- *  Call grid_locationConvert on location and grid
+ *  Convert the location to row and column coordinates
+ *  (as grid_locationConvert, but without allocating)
  *  Compare against the character stored at that location
  *  in the grid character array
  */
@@ -93,7 +95,8 @@ bool grid_isOpen(grid_t* grid, int loc);
  *  false if points to anything else
  *  false if location or grid invalid
  * We do:
- *  Call grid_locationConvert on location and grid
+ *  Convert the location to row and column coordinates
+ *  (as grid_locationConvert, but without allocating)
  *  Compare against the character stored at that location
  *  in the grid character array
  */
@@ -106,9 +109,9 @@ bool grid_isRoom(grid_t* grid, int loc);
  * 
  * Caller provides:
  *  pointer to grid_t struct, integer location, 
- *  counters_t* of gold locations, set_t* of player locations
+ *  intcounters_t* of gold locations, intset_t* of player locations
  * We return:
- *  a pointer to set_t of location keys, dummy character items
+ *  a pointer to a dense intset_t of location keys, dummy character items
  *  or gold symbol "*" or other player ID symbols "A", "B", etc..
  *  if gold or other players occupy a location. "@" symbol in the vantage 
  *  point location represents the user.
@@ -122,11 +125,10 @@ bool grid_isRoom(grid_t* grid, int loc);
  *  loop through all other locations in the grid
  *  if line of sight to the location is not blocked by
  *  wall or corner, and location is less than defined radius
- *  away from the observer, print the integer location to a string
- *  literal, and add it to the set.
- *  For the item, insert "*" if counters_find on the gold
+ *  away from the observer, add the location to the set.
+ *  For the item, insert "*" if intcounters_get on the gold
  *  counter returns > 0 for that location, or insert a 
- *  player ID symbol if set_find on the playerlocations set
+ *  player ID symbol if intset_find on the playerlocations set
  *  gives not NULL.
  *  If no players or gold at the location, insert dummy "g" item.
  * 
@@ -134,7 +136,7 @@ bool grid_isRoom(grid_t* grid, int loc);
  *  is followed: i.e. only adjacent points visible in passages,
  *  all direct line of sight points visible in rooms.
  */
-set_t* grid_isVisible(grid_t* grid, int loc, set_t*playerLocations, counters_t* gold);
+intset_t* grid_isVisible(grid_t* grid, int loc, intset_t* playerLocations, intcounters_t* gold);
 
 
 /**************** grid_updateView ****************/
@@ -143,11 +145,11 @@ set_t* grid_isVisible(grid_t* grid, int loc, set_t*playerLocations, counters_t*
  * 
  * Caller provides:
  *  pointer to grid_t struct, integer location, 
- *  counters_t* of gold locations, set_t* of player locations
- *  set_t* of seen before locations
+ *  intcounters_t* of gold locations, intset_t* of player locations
+ *  intset_t* of seen before locations
  * 
  * We return:
- *  a pointer to set_t of location keys, dummy character items
+ *  a pointer to a dense intset_t of location keys, dummy character items
  *  or gold symbol "*" or other player ID symbols "A", "B", etc..
  *  if gold or players occupy a location.
  *  This is representing set of all known and newly seen locations
@@ -159,14 +161,14 @@ set_t* grid_isVisible(grid_t* grid, int loc, set_t*playerLocations, counters_t*
  * 
  * We do:
  *  call grid_visible on the given grid, location, players set and 
- *  gold counters to make a visible set. call set_iterate on the 
+ *  gold counters to make a visible set. call intset_iterate on the 
  *  seenBefore set, and for location keys in there but not in visible,
  *  insert them into visible with dummy item "g", thus erasing
  *  gold and player symbols from no-longer-visible locations.
- *  Then, set_delete the seen before set.
+ *  Then, intset_delete the seen before set.
  */
-set_t* grid_updateView(grid_t* grid, int newloc,
-                       set_t* seenBefore, set_t* playerLocations, counters_t* gold);
+intset_t* grid_updateView(grid_t* grid, int newloc,
+                          intset_t* seenBefore, intset_t* playerLocations, intcounters_t* gold);
 
 /**************** grid_displaySpectator ****************/
 /* Give set of all locations in grid with 
@@ -174,11 +176,11 @@ set_t* grid_updateView(grid_t* grid, int newloc,
  * 
  * Caller provides:
  *  pointer to grid_t struct,
- *  counters_t* of gold locations, set_t* of player locations
+ *  intcounters_t* of gold locations, intset_t* of player locations
  *  
  * 
  * We return:
- *  a pointer to set_t of location keys, dummy character items
+ *  a pointer to a dense intset_t of location keys, dummy character items
  *  or gold symbol "*" or other player ID symbols "A", "B", etc..
  *  if gold or players occupy a location.
  *  This is representing a god's eye view of grid and all gold
@@ -189,23 +191,22 @@ set_t* grid_updateView(grid_t* grid, int newloc,
  *  NULL if grid or location in grid are invalid
  * 
  * We do:
- *  loop through every location in the grid, printing the
- *  integer to string literal and inserting string as key into 
- *  the set of locations.
- *  For the item, insert "*" if counters_find on the gold
+ *  loop through every location in the grid, inserting it as a key
+ *  into the set of locations.
+ *  For the item, insert "*" if intcounters_get on the gold
  *  counter returns > 0 for that location, or insert a 
- *  player ID symbol if set_find on the playerlocations set
+ *  player ID symbol if intset_find on the playerlocations set
  *  gives not NULL.
  *  If no players or gold at the location, insert dummy "g" item.
  */
-set_t* grid_displaySpectator(grid_t* grid, set_t* playerLocations, counters_t* gold);
+intset_t* grid_displaySpectator(grid_t* grid, intset_t* playerLocations, intcounters_t* gold);
 
 
 /**************** grid_print ****************/
 /* Give string representation of set of locations from grid
  * 
  * Caller provides:
- *  pointer to grid_t struct, set_t* of locations in grid
+ *  pointer to grid_t struct, intset_t* of locations in grid
  *  
  * 
  * We return:
@@ -214,18 +215,120 @@ set_t* grid_displaySpectator(grid_t* grid, set_t* playerLocations, counters_t* g
  *  
  *  caller must free this string
  * 
- *  NULL if grid or set_t* are null.
+ *  NULL if grid or intset_t* are null.
  * 
  * We do:
  *  Allocate memory for printstring.
- *  loop through every location in the grid. If set_find for the 
+ *  loop through every location in the grid. If intset_find for the 
  *  inputted set on that location gives NULL, append a space to
- *  the printstring. If set_find gives dummy item "g", append the 
+ *  the printstring. If intset_find gives dummy item "g", append the 
  *  character from grid char array to the string.
- *  If set_find gives gold symbol or player symbol, append that symbol.
+ *  If intset_find gives gold symbol or player symbol, append that symbol.
+ */
+char* grid_print(grid_t* grid, intset_t* locations);
+
+
+/**************** grid_frameLength ****************/
+/* Give the length of a printed frame for the grid
+ * 
+ * Caller provides:
+ *  pointer to grid_t struct
+ *
+ * We return:
+ *  the number of characters grid_print, grid_renderView and
+ *  grid_renderSpectator write for this grid, not counting the
+ *  terminating null: one newline plus ncols characters per row.
+ *  0 if invalid grid pointer
+ */
+int grid_frameLength(grid_t* grid);
+
+/**************** grid_precomputeVisibility ****************/
+/* Work out, once, what is visible from every open spot of the grid
+ * 
+ * Caller provides:
+ *  pointer to grid_t struct,
+ *  a thread pool to share the work with (may be NULL, to work alone),
+ *  a function to call with the number of vantage points done so far
+ *  and the total, after each batch of them (may be NULL), and an
+ *  argument to pass it
+ * 
+ * We return:
+ *  true if the grid now holds its visibility;
+ *  false if grid is NULL, or the visibility would not fit in memory,
+ *  in which case the grid goes on working it out frame by frame
+ * 
+ * We do:
+ *  Each vantage point is independent, so we hand out batches of them
+ *  to the pool. For each one we only test the spots around the room it
+ *  looks into (a line of sight never leaves it), and keep the visible
+ *  spots of each row as runs. grid_updateSeen and grid_renderView then
+ *  walk those runs instead of tracing a line to every spot of the
+ *  grid, and give exactly the same results.
+ *  Call it before the grid is shared; the progress function is
+ *  called on the caller's thread.
+ */
+bool grid_precomputeVisibility(grid_t* grid, pool_t* pool,
+                               void (*progress)(void* arg, const int done, const int total),
+                               void* arg);
+
+/**************** grid_updateSeen ****************/
+/* Mark all locations visible from a vantage point as seen
+ * 
+ * Caller provides:
+ *  pointer to grid_t struct, integer location,
+ *  char* array of nrows*ncols flags, one per grid location
+ * 
+ * We return:
+ *  true if the seen array was updated
+ *  false if grid, location or seen array are invalid
+ * 
+ * We do:
+ *  the same visibility test as grid_isVisible, but instead of
+ *  building a set we set seen[location] to 1 for the vantage point
+ *  and every location visible from it. Allocates no memory.
+ *  Uses the precomputed visibility, if grid_precomputeVisibility
+ *  has been called.
  */
-char* grid_print(grid_t* grid, set_t* locations);
+bool grid_updateSeen(grid_t* grid, int loc, char* seen);
 
+/**************** grid_renderView ****************/
+/* Write a player's view of the grid into a caller-provided frame
+ * 
+ * Caller provides:
+ *  pointer to grid_t struct, integer location of the player,
+ *  char* array of nrows*ncols seen-before flags (see grid_updateSeen),
+ *  const char* overlay of nrows*ncols symbols, one per location:
+ *   '\0' for nothing, '*' for gold, or a player ID symbol; may be NULL,
+ *  char* frame with room for grid_frameLength + 1 characters
+ * 
+ * We return:
+ *  the frame, holding the same string grid_print would give for the
+ *  set grid_updateView returns; NULL if grid, seen or frame are NULL.
+ * 
+ * We do:
+ *  in a single pass over the grid, write '@' at the player's
+ *  location, the overlay symbol (or grid character) at every location
+ *  visible from it, the grid character at every other seen location,
+ *  and a space elsewhere. Newly visible locations are marked in seen.
+ *  Allocates no memory, so callers may reuse one frame per client.
+ *  Uses the precomputed visibility, as grid_updateSeen does.
+ */
+char* grid_renderView(grid_t* grid, int loc, char* seen, const char* overlay, char* frame);
+
+/**************** grid_renderSpectator ****************/
+/* Write the spectator's view of the grid into a caller-provided frame
+ * 
+ * Caller provides:
+ *  pointer to grid_t struct,
+ *  const char* overlay of gold and player symbols (as grid_renderView),
+ *  char* frame with room for grid_frameLength + 1 characters
+ * 
+ * We return:
+ *  the frame, holding the same string grid_print would give for the
+ *  set grid_displaySpectator returns; NULL if grid or frame are NULL.
+ *  Allocates no memory.
+ */
+char* grid_renderSpectator(grid_t* grid, const char* overlay, char* frame);
 
 /**************** grid_getNumberCols ****************/
 /* Give number of columns in the grid
@@ -6,17 +6,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include "grid.h"
+#include "pool.h"
 
+static int checkPrecomputed(const char* mapFile, pool_t* pool);
+static void reportProgress(void* arg, const int done, const int total);
 
 int main(const int argc, char* argv[])
 {
   grid_t* grid = NULL;
   char* printString = NULL;
-  set_t* allLocations = NULL;
-  set_t* visible = NULL;
-  set_t* playerLoc = NULL;
-  counters_t* gold = NULL;
-  set_t* seenbefore = NULL;
+  intset_t* allLocations = NULL;
+  intset_t* visible = NULL;
+  intset_t* playerLoc = NULL;
+  intcounters_t* gold = NULL;
+  intset_t* seenbefore = NULL;
 
 
   //test reading grid from invalid file (does not exist)
@@ -49,7 +52,7 @@ int main(const int argc, char* argv[])
   printf("Printing the view to string...\n");
   printString = grid_print(grid, allLocations);
   printf("Spectator sees the following: \n%s\n",printString);
-  set_delete(allLocations,NULL);
+  intset_delete(allLocations,NULL);
   mem_free(printString);
 
   
@@ -110,15 +113,15 @@ int main(const int argc, char* argv[])
   //Will not display symbols in not-open locations
   //Should not see player "C"
 
-  playerLoc = set_new();
-  set_insert(playerLoc, "1507","A");
-  set_insert(playerLoc, "1538","B");
-  set_insert(playerLoc, "1056","C");
-  set_insert(playerLoc, "1084","D");
+  playerLoc = intset_new();
+  intset_insert(playerLoc, 1507,"A");
+  intset_insert(playerLoc, 1538,"B");
+  intset_insert(playerLoc, 1056,"C");
+  intset_insert(playerLoc, 1084,"D");
 
-  gold = counters_new();
+  gold = intcounters_newDense(grid_getNumberCols(grid)*grid_getNumberRows(grid));
   for(int i =0; i< grid_getNumberCols(grid)*grid_getNumberRows(grid); i+=17){
-    counters_add(gold,i);
+    intcounters_add(gold,i);
   }
 
   //display spectator's view
@@ -129,7 +132,7 @@ int main(const int argc, char* argv[])
   //print the set to a string
   printf("Printing the view to string...\n");
   printf("Specator sees the populated grid: \n%s\n", printString);
-  set_delete(allLocations,NULL);
+  intset_delete(allLocations,NULL);
   mem_free(printString);
 
 
@@ -140,28 +143,28 @@ int main(const int argc, char* argv[])
   printString = grid_print(grid, visible);
   printf("Player A sees the following: \n%s\n",printString);
   mem_free(printString);
-  set_delete(visible,NULL);
+  intset_delete(visible,NULL);
 
   printf("calculating player B's view\n");
   visible = grid_isVisible(grid,1538,playerLoc,gold);
   printString = grid_print(grid, visible);
   printf("Player B sees the following: \n%s\n",printString);
   mem_free(printString);
-  set_delete(visible,NULL);
+  intset_delete(visible,NULL);
 
   printf("calculating player C's view\n");
   visible = grid_isVisible(grid,1056,playerLoc,gold);
   printString = grid_print(grid, visible);
   printf("Player C sees the following: \n%s\n",printString);
   mem_free(printString);
-  set_delete(visible,NULL);
+  intset_delete(visible,NULL);
 
   printf("calculating player D's view\n");
   visible = grid_isVisible(grid,1084,playerLoc,gold);
   printString = grid_print(grid, visible);
   printf("Player D sees the following: \n%s\n",printString);
   mem_free(printString);
-  set_delete(visible,NULL);
+  intset_delete(visible,NULL);
 
 
   //now, iterate player s location through the whole map,
@@ -179,9 +182,70 @@ int main(const int argc, char* argv[])
      printf("New player's cumulative view: \n%s\n",printString);
      mem_free(printString);
    }
-  set_delete(seenbefore,NULL);
-  set_delete(playerLoc,NULL);
-  counters_delete(gold);
+  intset_delete(seenbefore,NULL);
+  intset_delete(playerLoc,NULL);
+  intcounters_delete(gold);
   grid_delete(grid);
-  return 0;
+
+  //precomputed visibility must give exactly the views worked out
+  //frame by frame, from every open spot of every map
+  //(maps named on the command line replace the default list)
+  const char* maps[] = { "../maps/hole.txt", "../maps/main.txt", "../maps/big.txt",
+                         "../maps/challenge.txt", "../maps/edges.txt", "../maps/narrow.txt",
+                         "../maps/visdemo.txt", "../maps/fewspots.txt", "../maps/small.txt",
+                         "../maps/add-drop.txt" };
+  int numMaps = (argc > 1) ? argc - 1 : sizeof(maps) / sizeof(maps[0]);
+  pool_t* pool = pool_new(3);
+  int errors = 0;
+  for (int m = 0; m < numMaps; m++) {
+    errors += checkPrecomputed((argc > 1) ? argv[m + 1] : maps[m], pool);
+  }
+  pool_delete(pool);
+  printf("%s\n", errors == 0 ? "precomputed visibility matches" : "precomputed visibility FAILED");
+  return errors == 0 ? 0 : 1;
+}
+
+//render every open spot's view of the map with and without precomputed
+//visibility; return the number of views that differ
+static int checkPrecomputed(const char* mapFile, pool_t* pool)
+{
+  grid_t* plain = grid_read((char*)mapFile);
+  grid_t* precomputed = grid_read((char*)mapFile);
+  if (plain == NULL || precomputed == NULL
+      || !grid_precomputeVisibility(precomputed, pool, reportProgress, (void*)mapFile)) {
+    fprintf(stderr, "cannot precompute visibility for %s\n", mapFile);
+    return 1;
+  }
+  int size = grid_getNumberRows(plain) * grid_getNumberCols(plain);
+  char* seenPlain = mem_malloc(size);
+  char* seenPrecomputed = mem_malloc(size);
+  char* framePlain = mem_malloc(grid_frameLength(plain) + 1);
+  char* framePrecomputed = mem_malloc(grid_frameLength(plain) + 1);
+  int errors = 0;
+  for (int loc = 0; loc < size; loc++) {
+    memset(seenPlain, 0, size);
+    memset(seenPrecomputed, 0, size);
+    grid_renderView(plain, loc, seenPlain, NULL, framePlain);
+    grid_renderView(precomputed, loc, seenPrecomputed, NULL, framePrecomputed);
+    grid_updateSeen(plain, (loc + 1) % size, seenPlain);
+    grid_updateSeen(precomputed, (loc + 1) % size, seenPrecomputed);
+    if (strcmp(framePlain, framePrecomputed) != 0 || memcmp(seenPlain, seenPrecomputed, size) != 0) {
+      fprintf(stderr, "%s: views from %d differ\n", mapFile, loc);
+      errors++;
+    }
+  }
+  mem_free(seenPlain);
+  mem_free(seenPrecomputed);
+  mem_free(framePlain);
+  mem_free(framePrecomputed);
+  grid_delete(plain);
+  grid_delete(precomputed);
+  return errors;
+}
+
+static void reportProgress(void* arg, const int done, const int total)
+{
+  if (done == total) {
+    printf("%s: visibility from %d spots precomputed\n", (char*)arg, total);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,350 @@
+/*
+ * intcounters.c - CS50-style 'intcounters' module
+ *
+ * see intcounters.h for more information.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime, in the unit test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "intcounters.h"
+#include "intmap.h"
+#include "mem.h"
+
+/**************** file-local global variables ****************/
+static const int SparseCounters = 16;  // counters a sparse set holds before its map grows
+static const int Absent = -1;          // the count of a key not in a dense set
+
+/**************** global types ****************/
+typedef struct intcounters {
+  int* counts;                // dense: the count of each key, Absent if none; else NULL
+  int range;                  // dense: the number of keys; 0 if sparse
+  intmap_t* map;              // sparse: key -> int* count; else NULL
+} intcounters_t;
+
+/**************** local types ****************/
+// a caller's itemfunc and arg, carried through intmap_iterate
+struct intcountersVisit {
+  void* arg;
+  void (*itemfunc)(void* arg, const int key, const int count);
+};
+
+/**************** global functions ****************/
+/* that is, visible outside this file */
+/* see intcounters.h for comments about exported functions */
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static int* intcounters_counter(intcounters_t* ctrs, const int key, const bool create);
+static void intcounters_visit(void* arg, const uint64_t key, void* item);
+static void intcounters_printItem(void* arg, const int key, const int count);
+
+/**************** intcounters_new() ****************/
+/* see intcounters.h for description */
+intcounters_t*
+intcounters_new(void)
+{
+  intcounters_t* ctrs = mem_calloc(1, sizeof(intcounters_t));
+  if (ctrs == NULL) {
+    return NULL;              // error allocating counterset
+  }
+  ctrs->map = intmap_new(SparseCounters);
+  if (ctrs->map == NULL) {
+    mem_free(ctrs);
+    return NULL;
+  }
+  return ctrs;
+}
+
+/**************** intcounters_newDense() ****************/
+/* see intcounters.h for description */
+intcounters_t*
+intcounters_newDense(const int range)
+{
+  if (range <= 0) {
+    return NULL;
+  }
+  intcounters_t* ctrs = mem_calloc(1, sizeof(intcounters_t));
+  if (ctrs == NULL) {
+    return NULL;              // error allocating counterset
+  }
+  ctrs->counts = mem_malloc(range * sizeof(int));
+  if (ctrs->counts == NULL) {
+    mem_free(ctrs);
+    return NULL;
+  }
+  for (int key = 0; key < range; key++) {
+    ctrs->counts[key] = Absent;
+  }
+  ctrs->range = range;
+  return ctrs;
+}
+
+/**************** intcounters_add() ****************/
+/* see intcounters.h for description */
+int
+intcounters_add(intcounters_t* ctrs, const int key)
+{
+  int* count = intcounters_counter(ctrs, key, true);
+  if (count == NULL) {
+    return 0;
+  }
+  return ++(*count);
+}
+
+/**************** intcounters_get() ****************/
+/* see intcounters.h for description */
+int
+intcounters_get(intcounters_t* ctrs, const int key)
+{
+  int* count = intcounters_counter(ctrs, key, false);
+  return count == NULL ? 0 : *count;
+}
+
+/**************** intcounters_set() ****************/
+/* see intcounters.h for description */
+bool
+intcounters_set(intcounters_t* ctrs, const int key, const int count)
+{
+  if (count < 0) {
+    return false;
+  }
+  int* counter = intcounters_counter(ctrs, key, true);
+  if (counter == NULL) {
+    return false;
+  }
+  *counter = count;
+  return true;
+}
+
+/**************** intcounters_print() ****************/
+/* see intcounters.h for description */
+void
+intcounters_print(intcounters_t* ctrs, FILE* fp)
+{
+  if (fp == NULL) {
+    return;
+  }
+  if (ctrs == NULL) {
+    fputs("(null)", fp);
+    return;
+  }
+  fputc('{', fp);
+  intcounters_iterate(ctrs, fp, intcounters_printItem);
+  fputc('}', fp);
+}
+
+/**************** intcounters_iterate() ****************/
+/* see intcounters.h for description */
+void
+intcounters_iterate(intcounters_t* ctrs, void* arg,
+                    void (*itemfunc)(void* arg, const int key, const int count))
+{
+  if (ctrs == NULL || itemfunc == NULL) {
+    return;
+  }
+  if (ctrs->map != NULL) {
+    struct intcountersVisit visit = { arg, itemfunc };
+    intmap_iterate(ctrs->map, &visit, intcounters_visit);
+    return;
+  }
+  for (int key = 0; key < ctrs->range; key++) {
+    if (ctrs->counts[key] != Absent) {
+      (*itemfunc)(arg, key, ctrs->counts[key]);
+    }
+  }
+}
+
+/**************** intcounters_delete() ****************/
+/* see intcounters.h for description */
+void
+intcounters_delete(intcounters_t* ctrs)
+{
+  if (ctrs == NULL) {
+    return;
+  }
+  if (ctrs->map != NULL) {
+    intmap_delete(ctrs->map, mem_free);
+  }
+  else {
+    mem_free(ctrs->counts);
+  }
+  mem_free(ctrs);
+
+#ifdef MEMTEST
+  mem_report(stdout, "End of intcounters_delete");
+#endif
+}
+
+/**************** intcounters_counter ****************/
+/* The counter of key, made (at 0) if create and there is none;
+ * NULL if there is none, or the key is out of range, or out of memory.
+ */
+static int*
+intcounters_counter(intcounters_t* ctrs, const int key, const bool create)
+{
+  if (ctrs == NULL || key < 0) {
+    return NULL;
+  }
+  if (ctrs->map == NULL) {
+    if (key >= ctrs->range || (!create && ctrs->counts[key] == Absent)) {
+      return NULL;
+    }
+    if (ctrs->counts[key] == Absent) {
+      ctrs->counts[key] = 0;
+    }
+    return &ctrs->counts[key];
+  }
+  int* count = intmap_find(ctrs->map, key);
+  if (count == NULL && create) {
+    count = mem_malloc(sizeof(int));
+    if (count == NULL) {
+      return NULL;
+    }
+    *count = 0;
+    if (!intmap_insert(ctrs->map, key, count)) {
+      mem_free(count);
+      return NULL;
+    }
+  }
+  return count;
+}
+
+/**************** intcounters_visit ****************/
+/* Hands one counter of a sparse set's map to the caller's itemfunc */
+static void
+intcounters_visit(void* arg, const uint64_t key, void* item)
+{
+  struct intcountersVisit* visit = arg;
+  (*visit->itemfunc)(visit->arg, (int)key, *(int*)item);
+}
+
+/**************** intcounters_printItem ****************/
+/* Prints one key=counter pair, for intcounters_print */
+static void
+intcounters_printItem(void* arg, const int key, const int count)
+{
+  FILE* fp = arg;
+  fprintf(fp, "%d=%d, ", key, count);
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Count the same keys in a dense and a sparse counterset and a counters
+ * set, checking that all three agree; then time getting the gold at each
+ * location of a grid from each.
+ *
+ *   ./intcounterstest
+ */
+#ifdef UNIT_TEST
+
+#include <time.h>
+#include "counters.h"
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+static void
+sumCounts(void* arg, const int key, const int count)
+{
+  long* sum = arg;
+  *sum += (long)key * count;
+}
+
+static double
+seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main()
+{
+  enum { Range = 2000 };  // about the locations of a large map
+  intcounters_t* dense = intcounters_newDense(Range);
+  intcounters_t* sparse = intcounters_new();
+  counters_t* list = counters_new();
+  expect(dense != NULL && sparse != NULL, "new");
+  expect(intcounters_newDense(0) == NULL, "a dense set needs a range");
+
+  // about 30 piles of gold, some added to and some set
+  for (int pile = 0; pile < 30; pile++) {
+    const int key = (pile * 337) % Range;
+    for (int n = 0; n < pile % 4; n++) {
+      intcounters_add(dense, key);
+      intcounters_add(sparse, key);
+      counters_add(list, key);
+    }
+    if (pile % 5 == 0) {
+      intcounters_set(dense, key, 251);
+      intcounters_set(sparse, key, 251);
+      counters_set(list, key, 251);
+    }
+  }
+  expect(intcounters_set(dense, 1, 0) && intcounters_get(dense, 1) == 0, "a counter may be set to 0");
+  counters_set(list, 1, 0);
+  intcounters_set(sparse, 1, 0);
+  expect(!intcounters_set(dense, Range, 1) && intcounters_add(dense, Range) == 0,
+         "a dense set refuses a key out of range");
+  expect(!intcounters_set(sparse, -1, 1) && !intcounters_set(sparse, 2, -1),
+         "negative keys and counts are refused");
+  for (int key = 0; key < Range; key++) {
+    expect(intcounters_get(dense, key) == counters_get(list, key), "get agrees (dense)");
+    expect(intcounters_get(sparse, key) == counters_get(list, key), "get agrees (sparse)");
+  }
+  long denseSum = 0, sparseSum = 0, listSum = 0;
+  intcounters_iterate(dense, &denseSum, sumCounts);
+  intcounters_iterate(sparse, &sparseSum, sumCounts);
+  counters_iterate(list, &listSum, sumCounts);
+  expect(denseSum == listSum && sparseSum == listSum, "iterate agrees");
+
+  intcounters_t* small = intcounters_newDense(4);
+  intcounters_add(small, 1);
+  intcounters_set(small, 3, 5);
+  printf("small counters: ");
+  intcounters_print(small, stdout);
+  printf("\n");
+  intcounters_delete(small);
+
+  // time getting the gold at every location, as a spectator's frame once did
+  enum { Rounds = 200 };
+  long found = 0;
+  double start = seconds();
+  for (int round = 0; round < Rounds; round++) {
+    for (int key = 0; key < Range; key++) {
+      found += intcounters_get(dense, key);
+    }
+  }
+  const double denseTime = seconds() - start;
+  start = seconds();
+  for (int round = 0; round < Rounds; round++) {
+    for (int key = 0; key < Range; key++) {
+      found -= counters_get(list, key);
+    }
+  }
+  const double listTime = seconds() - start;
+  expect(found == 0, "both get the same counts");
+  printf("get: dense intcounters %.1f ns, counters %.1f ns\n",
+         denseTime / (Rounds * Range) * 1e9, listTime / (Rounds * Range) * 1e9);
+
+  counters_delete(list);
+  intcounters_delete(dense);
+  intcounters_delete(sparse);
+  printf("%s\n", errors == 0 ? "intcounters test passed" : "intcounters test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,138 @@
+/*
+ * intcounters.h - header file for the intcounters module
+ *
+ * An *intcounters* is a set of counters, each distinguished by an integer
+ * key (>= 0), with the same operations as a counters set, but kept so that
+ * a counter is found without walking a list:
+ *   dense - for keys below a known range, such as the locations of a grid:
+ *     one count per key, in an array, so every operation indexes it.
+ *   sparse - for a few keys spread over any range: an intmap (see intmap.h)
+ *     from each key to its count.
+ */
+
+#ifndef __INTCOUNTERS_H
+#define __INTCOUNTERS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct intcounters intcounters_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** intcounters_new ****************/
+/* Create a new (empty) sparse counter structure.
+ *
+ * We return:
+ *   pointer to a new counterset; NULL if error (out of memory).
+ * We guarantee:
+ *   counterset is intialized empty.
+ * Caller is responsible for:
+ *   later calling intcounters_delete();
+ */
+intcounters_t* intcounters_new(void);
+
+/**************** intcounters_newDense ****************/
+/* Create a new (empty) dense counter structure, for keys 0 to range-1.
+ *
+ * Caller provides:
+ *   the range of its keys (must be > 0); the set takes one int per key.
+ * We return:
+ *   pointer to a new counterset; NULL if error (out of memory).
+ * We guarantee:
+ *   counterset is intialized empty.
+ * Caller is responsible for:
+ *   later calling intcounters_delete();
+ */
+intcounters_t* intcounters_newDense(const int range);
+
+/**************** intcounters_add ****************/
+/* Increment the counter indicated by key.
+ *
+ * Caller provides:
+ *   valid pointer to counterset, and key (must be >= 0, and below the
+ *   range of a dense set)
+ * We return:
+ *   the new value of the counter related to the indicated key.
+ *   0 on error (if ctrs is NULL, key is out of range, or out of memory)
+ * We do:
+ *  if the key does not yet exist, create a counter for it and initialize to 1.
+ *  if the key does exist, increment its counter by 1.
+ */
+int intcounters_add(intcounters_t* ctrs, const int key);
+
+/**************** intcounters_get ****************/
+/* Return current value of counter associated with the given key.
+ *
+ * Caller provides:
+ *   valid pointer to counterset, and key
+ * We return:
+ *   current value of counter associated with the given key, if present;
+ *   0 if ctrs is NULL, key is out of range, or key is not found.
+ * Note:
+ *   counterset is unchanged as a result of this call.
+ */
+int intcounters_get(intcounters_t* ctrs, const int key);
+
+/**************** intcounters_set ****************/
+/* Set the current value of counter associated with the given key.
+ *
+ * Caller provides:
+ *   valid pointer to counterset,
+ *   key (must be >= 0, and below the range of a dense set),
+ *   counter value (must be >= 0).
+ * We return:
+ *   false if ctrs is NULL, if key is out of range or count < 0, or if out of memory.
+ *   otherwise returns true.
+ * We do:
+ *   If the key does not yet exist, create a counter for it and initialize to
+ *   the given value.
+ *   If the key does exist, update its counter value to the given value.
+ */
+bool intcounters_set(intcounters_t* ctrs, const int key, const int count);
+
+/**************** intcounters_print ****************/
+/* Print all counters; provide the output file.
+ *
+ * Caller provides:
+ *   valid pointer to counterset,
+ *   FILE open for writing.
+ * We print:
+ *   Nothing if NULL fp.
+ *   "(null)" if NULL ctrs.
+ *   otherwise, comma-separated list of key=counter pairs, all in {brackets}.
+ */
+void intcounters_print(intcounters_t* ctrs, FILE* fp);
+
+/**************** intcounters_iterate ****************/
+/* Iterate over all counters in the set.
+ *
+ * Caller provides:
+ *   valid pointer to counterset,
+ *   arbitrary void* arg,
+ *   valid pointer to itemfunc that can handle one item.
+ * We do:
+ *   nothing, if ctrs==NULL or itemfunc==NULL.
+ *   otherwise, call itemfunc once for each item, with (arg, key, count).
+ * Note:
+ *   the order in which items are handled is undefined (a dense set
+ *   handles them in order of their keys).
+ *   the counterset is unchanged by this operation.
+ */
+void intcounters_iterate(intcounters_t* ctrs, void* arg,
+                         void (*itemfunc)(void* arg,
+                                          const int key, const int count));
+
+/**************** intcounters_delete ****************/
+/* Delete the whole counterset.
+ *
+ * Caller provides:
+ *   a valid pointer to counterset.
+ * We do:
+ *   we ignore NULL ctrs.
+ *   we free all memory we allocate for this counterset.
+ */
+void intcounters_delete(intcounters_t* ctrs);
+
+#endif // __INTCOUNTERS_H
@@ -0,0 +1,433 @@
+/*
+ * intmap.c - CS50-style 'intmap' module
+ *
+ * see intmap.h for more information.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for rand_r and clock_gettime, in the unit test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "intmap.h"
+#include "mem.h"
+
+/**************** file-local global variables ****************/
+static const int MinSlots = 8;
+static const uint64_t Fibonacci = 0x9E3779B97F4A7C15ull;  // 2^64 / golden ratio
+
+/**************** local types ****************/
+typedef struct intmapslot {
+  uint64_t key;               // the pair's key
+  void* item;                 // its item; NULL if the slot is empty
+} intmapslot_t;
+
+/**************** global types ****************/
+typedef struct intmap {
+  intmapslot_t* slots;        // capacity slots, a power of two
+  int capacity;               // number of slots
+  int count;                  // number of them holding an item
+  int shift;                  // 64 - log2(capacity), to take a key's home slot
+} intmap_t;
+
+/**************** global functions ****************/
+/* that is, visible outside this file */
+/* see intmap.h for comments about exported functions */
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static bool intmap_alloc(intmap_t* map, const int capacity);
+static bool intmap_grow(intmap_t* map);
+static void intmap_place(intmap_t* map, uint64_t key, void* item);
+static int intmap_slotOf(intmap_t* map, const uint64_t key);
+
+/**************** home ****************/
+/* The slot a key hashes to: the top bits of its Fibonacci hash, which
+ * spreads keys that differ only in their low (or high) bits.
+ */
+static inline int
+home(const intmap_t* map, const uint64_t key)
+{
+  return (int)((key * Fibonacci) >> map->shift);
+}
+
+/**************** distance ****************/
+/* How far the pair in slot i lies past its home slot. */
+static inline int
+distance(const intmap_t* map, const int i)
+{
+  return (i - home(map, map->slots[i].key)) & (map->capacity - 1);
+}
+
+/**************** intmap_new() ****************/
+/* see intmap.h for description */
+intmap_t*
+intmap_new(const int num_items)
+{
+  if (num_items <= 0) {
+    return NULL;
+  }
+  intmap_t* map = mem_malloc(sizeof(intmap_t));
+  if (map == NULL) {
+    return NULL;              // error allocating map
+  }
+
+  // the smallest power of two that holds num_items at most 7/8 full
+  int capacity = MinSlots;
+  while (capacity < num_items + num_items / 7 + 1) {
+    capacity *= 2;
+  }
+  if (!intmap_alloc(map, capacity)) {
+    mem_free(map);
+    return NULL;
+  }
+  return map;
+}
+
+/**************** intmap_insert() ****************/
+/* see intmap.h for description */
+bool
+intmap_insert(intmap_t* map, const uint64_t key, void* item)
+{
+  if (map == NULL || item == NULL || intmap_slotOf(map, key) >= 0) {
+    return false;
+  }
+  if ((map->count + 1) * 8 > map->capacity * 7 && !intmap_grow(map)) {
+    return false;
+  }
+  intmap_place(map, key, item);
+  map->count++;
+  return true;
+}
+
+/**************** intmap_find() ****************/
+/* see intmap.h for description */
+void*
+intmap_find(intmap_t* map, const uint64_t key)
+{
+  if (map == NULL) {
+    return NULL;
+  }
+  const int i = intmap_slotOf(map, key);
+  return i < 0 ? NULL : map->slots[i].item;
+}
+
+/**************** intmap_remove() ****************/
+/* see intmap.h for description
+ *
+ * Pseudocode:
+ *   find the key's slot, and keep its item to return
+ *   shift each following pair that lies past its home back by one slot,
+ *     up to the first empty slot or pair at home, and empty the last slot moved
+ * (so no tombstones are left, and lookups still stop early)
+ */
+void*
+intmap_remove(intmap_t* map, const uint64_t key)
+{
+  if (map == NULL) {
+    return NULL;
+  }
+  int i = intmap_slotOf(map, key);
+  if (i < 0) {
+    return NULL;
+  }
+  void* item = map->slots[i].item;
+  const int mask = map->capacity - 1;
+  int next = (i + 1) & mask;
+  while (map->slots[next].item != NULL && distance(map, next) > 0) {
+    map->slots[i] = map->slots[next];
+    i = next;
+    next = (next + 1) & mask;
+  }
+  map->slots[i].item = NULL;
+  map->count--;
+  return item;
+}
+
+/**************** intmap_count() ****************/
+/* see intmap.h for description */
+int
+intmap_count(intmap_t* map)
+{
+  return map == NULL ? 0 : map->count;
+}
+
+/**************** intmap_iterate() ****************/
+/* see intmap.h for description */
+void
+intmap_iterate(intmap_t* map, void* arg,
+               void (*itemfunc)(void* arg, const uint64_t key, void* item) )
+{
+  if (map != NULL && itemfunc != NULL) {
+    for (int i = 0; i < map->capacity; i++) {
+      if (map->slots[i].item != NULL) {
+        (*itemfunc)(arg, map->slots[i].key, map->slots[i].item);
+      }
+    }
+  }
+}
+
+/**************** intmap_iterateStrings() ****************/
+/* see intmap.h for description */
+void
+intmap_iterateStrings(intmap_t* map, void* arg,
+                      void (*itemfunc)(void* arg, const char* key, void* item) )
+{
+  char key[21];  // the digits of the largest uint64_t, and the terminator
+  if (map != NULL && itemfunc != NULL) {
+    for (int i = 0; i < map->capacity; i++) {
+      if (map->slots[i].item != NULL) {
+        snprintf(key, sizeof(key), "%" PRIu64, map->slots[i].key);
+        (*itemfunc)(arg, key, map->slots[i].item);
+      }
+    }
+  }
+}
+
+/**************** intmap_delete() ****************/
+/* see intmap.h for description */
+void
+intmap_delete(intmap_t* map, void (*itemdelete)(void* item) )
+{
+  if (map != NULL) {
+    if (itemdelete != NULL) {
+      for (int i = 0; i < map->capacity; i++) {
+        if (map->slots[i].item != NULL) {
+          (*itemdelete)(map->slots[i].item);
+        }
+      }
+    }
+    mem_free(map->slots);
+    mem_free(map);
+  }
+
+#ifdef MEMTEST
+  mem_report(stdout, "End of intmap_delete");
+#endif
+}
+
+/**************** intmap_alloc ****************/
+/* Give the map capacity empty slots (a power of two); false if out of memory */
+static bool
+intmap_alloc(intmap_t* map, const int capacity)
+{
+  intmapslot_t* slots = mem_calloc(capacity, sizeof(intmapslot_t));
+  if (slots == NULL) {
+    return false;
+  }
+  map->slots = slots;
+  map->capacity = capacity;
+  map->count = 0;
+  map->shift = 64;
+  for (int c = capacity; c > 1; c /= 2) {
+    map->shift--;
+  }
+  return true;
+}
+
+/**************** intmap_grow ****************/
+/* Double the slots, and place every pair again; false if out of memory */
+static bool
+intmap_grow(intmap_t* map)
+{
+  intmapslot_t* old = map->slots;
+  const int oldCapacity = map->capacity;
+  const int count = map->count;
+  if (!intmap_alloc(map, oldCapacity * 2)) {
+    return false;
+  }
+  for (int i = 0; i < oldCapacity; i++) {
+    if (old[i].item != NULL) {
+      intmap_place(map, old[i].key, old[i].item);
+    }
+  }
+  map->count = count;
+  mem_free(old);
+  return true;
+}
+
+/**************** intmap_place ****************/
+/* Put a pair, whose key is not in the map, into a map with room for it.
+ *
+ * Pseudocode:
+ *   start at the key's home slot, at distance 0
+ *   step forward until an empty slot, which takes the pair;
+ *     at each pair nearer its home than we are to ours, swap ours for it,
+ *     and carry that one on from its own distance
+ */
+static void
+intmap_place(intmap_t* map, uint64_t key, void* item)
+{
+  const int mask = map->capacity - 1;
+  int i = home(map, key);
+  for (int dist = 0; ; dist++, i = (i + 1) & mask) {
+    intmapslot_t* slot = &map->slots[i];
+    if (slot->item == NULL) {
+      slot->key = key;
+      slot->item = item;
+      return;
+    }
+    const int theirs = distance(map, i);
+    if (theirs < dist) {
+      intmapslot_t carried = *slot;
+      slot->key = key;
+      slot->item = item;
+      key = carried.key;
+      item = carried.item;
+      dist = theirs;
+    }
+  }
+}
+
+/**************** intmap_slotOf ****************/
+/* The slot that holds key; -1 if none.  A pair nearer its home than the
+ * key would be at that slot means the key is not in the map, since an
+ * insert would have taken that pair's place.
+ */
+static int
+intmap_slotOf(intmap_t* map, const uint64_t key)
+{
+  const int mask = map->capacity - 1;
+  int i = home(map, key);
+  for (int dist = 0; ; dist++, i = (i + 1) & mask) {
+    if (map->slots[i].item == NULL || distance(map, i) < dist) {
+      return -1;
+    }
+    if (map->slots[i].key == key) {
+      return i;
+    }
+  }
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Insert, find and remove many keys, checking each against a plain array
+ * of what the map should hold; then time lookups of address-like keys
+ * against a hashtable keyed by the same numbers as strings.
+ *
+ *   ./intmaptest
+ */
+#ifdef UNIT_TEST
+
+#include <string.h>
+#include <time.h>
+#include "hashtable.h"
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+static void
+countItem(void* arg, const uint64_t key, void* item)
+{
+  int* count = arg;
+  if (item == (void*)(uintptr_t)(key + 1)) {
+    (*count)++;
+  }
+}
+
+// as countItem, for an itemfunc written for hashtable_iterate
+static void
+countString(void* arg, const char* key, void* item)
+{
+  int* count = arg;
+  if (item == (void*)(uintptr_t)(strtoull(key, NULL, 10) + 1)) {
+    (*count)++;
+  }
+}
+
+static double
+seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main()
+{
+  enum { Keys = 20000 };
+  static bool present[Keys];
+  uint64_t keys[Keys];
+  unsigned int seed = 50;
+  for (int k = 0; k < Keys; k++) {
+    // address-like keys: family, port and a few hosts, as message_addrKey packs them
+    keys[k] = (2ull << 48) | ((uint64_t)(k % 4000 + 1024) << 32) | (0x0100007f + k / 4000);
+  }
+
+  intmap_t* map = intmap_new(4);  // small, so it grows many times
+  expect(map != NULL, "new");
+  expect(intmap_find(map, keys[0]) == NULL, "an empty map finds nothing");
+  expect(!intmap_insert(map, keys[0], NULL), "a NULL item is refused");
+
+  // a random mix of inserts and removes
+  for (int step = 0; step < 200000; step++) {
+    const int k = rand_r(&seed) % Keys;
+    void* item = (void*)(uintptr_t)(keys[k] + 1);
+    if (rand_r(&seed) % 3 != 0) {
+      expect(intmap_insert(map, keys[k], item) != present[k], "insert succeeds iff the key is new");
+      present[k] = true;
+    }
+    else {
+      expect(intmap_remove(map, keys[k]) == (present[k] ? item : NULL), "remove returns the item");
+      present[k] = false;
+    }
+  }
+  int held = 0;
+  for (int k = 0; k < Keys; k++) {
+    void* item = (void*)(uintptr_t)(keys[k] + 1);
+    expect(intmap_find(map, keys[k]) == (present[k] ? item : NULL), "find agrees with what was inserted");
+    held += present[k];
+  }
+  expect(intmap_count(map) == held, "count");
+  int iterated = 0;
+  intmap_iterate(map, &iterated, countItem);
+  expect(iterated == held, "iterate visits each item once");
+  iterated = 0;
+  intmap_iterateStrings(map, &iterated, countString);
+  expect(iterated == held, "iterateStrings passes each key as a string");
+
+  // time lookups, as the server makes them, against a hashtable
+  hashtable_t* ht = hashtable_new(Keys);
+  char key[32];
+  for (int k = 0; k < Keys; k++) {
+    sprintf(key, "%llu", (unsigned long long)keys[k]);
+    hashtable_insert(ht, key, &keys[k]);
+    if (!present[k]) {
+      intmap_insert(map, keys[k], (void*)(uintptr_t)(keys[k] + 1));
+    }
+  }
+  enum { Lookups = 2000000 };
+  int found = 0;
+  double start = seconds();
+  for (int n = 0; n < Lookups; n++) {
+    found += intmap_find(map, keys[(n * 7919L) % Keys]) != NULL;
+  }
+  const double mapTime = seconds() - start;
+  start = seconds();
+  for (int n = 0; n < Lookups; n++) {
+    sprintf(key, "%llu", (unsigned long long)keys[(n * 7919L) % Keys]);
+    found += hashtable_find(ht, key) != NULL;
+  }
+  const double tableTime = seconds() - start;
+  expect(found == 2 * Lookups, "every key is found in both");
+  printf("lookup: intmap %.0f ns, hashtable %.0f ns (with the key's string)\n",
+         mapTime / Lookups * 1e9, tableTime / Lookups * 1e9);
+
+  hashtable_delete(ht, NULL);
+  intmap_delete(map, NULL);
+  printf("%s\n", errors == 0 ? "intmap test passed" : "intmap test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
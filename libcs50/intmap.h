@@ -0,0 +1,131 @@
+/*
+ * intmap.h - header file for the intmap module
+ *
+ * An *intmap* is a set of (key,item) pairs, like a hashtable, whose keys
+ * are 64-bit integers rather than strings.  A fixed-size binary key that
+ * fits in 64 bits (a network address, say; see message_addrKey) is packed
+ * into one by the caller.
+ *
+ * The pairs are kept inline, in one array of slots, by open addressing
+ * with Robin Hood linear probing: a key is hashed to a home slot, and an
+ * insert that finds it taken steps forward, taking the place of any pair
+ * nearer its own home than the new one is.  So a lookup reads a few
+ * neighbouring slots of one array, without chasing a list or hashing a
+ * string, and a lookup for a missing key stops as soon as it meets a pair
+ * nearer home than the key would be.  The array doubles when it is 7/8 full.
+ */
+
+#ifndef __INTMAP_H
+#define __INTMAP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**************** global types ****************/
+typedef struct intmap intmap_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** intmap_new ****************/
+/* Create a new (empty) intmap.
+ *
+ * Caller provides:
+ *   number of items it expects to hold (must be > 0); it grows past that.
+ * We return:
+ *   pointer to the new intmap; return NULL if error.
+ * We guarantee:
+ *   intmap is initialized empty.
+ * Caller is responsible for:
+ *   later calling intmap_delete.
+ */
+intmap_t* intmap_new(const int num_items);
+
+/**************** intmap_insert ****************/
+/* Insert item, identified by key, into the given intmap.
+ *
+ * Caller provides:
+ *   valid pointer to intmap, any key, valid pointer for item.
+ * We return:
+ *   false if key exists in map, any pointer is NULL, or error;
+ *   true iff new item was inserted.
+ */
+bool intmap_insert(intmap_t* map, const uint64_t key, void* item);
+
+/**************** intmap_find ****************/
+/* Return the item associated with the given key.
+ *
+ * Caller provides:
+ *   valid pointer to intmap, any key.
+ * We return:
+ *   pointer to the item corresponding to the given key, if found;
+ *   NULL if map is NULL or key is not found.
+ * Notes:
+ *   the intmap is unchanged by this operation.
+ */
+void* intmap_find(intmap_t* map, const uint64_t key);
+
+/**************** intmap_remove ****************/
+/* Remove the pair with the given key, and return its item.
+ *
+ * Caller provides:
+ *   valid pointer to intmap, any key.
+ * We return:
+ *   the item that was associated with the key, for the caller to free;
+ *   NULL if map is NULL or key is not found.
+ */
+void* intmap_remove(intmap_t* map, const uint64_t key);
+
+/**************** intmap_count ****************/
+/* Return the number of items in the intmap (0 if map is NULL).
+ */
+int intmap_count(intmap_t* map);
+
+/**************** intmap_iterate ****************/
+/* Iterate over all items in the map; in undefined order.
+ *
+ * Caller provides:
+ *   valid pointer to intmap,
+ *   arbitrary void*arg pointer,
+ *   itemfunc that can handle a single (key, item) pair.
+ * We do:
+ *   nothing, if map==NULL or itemfunc==NULL.
+ *   otherwise, call the itemfunc once for each item, with (arg, key, item).
+ * Notes:
+ *   as for hashtable_iterate, the order is undefined, and the itemfunc
+ *   may change the contents of the item but must not insert or remove.
+ *   Unlike hashtable_iterate's, the itemfunc takes the key as an integer;
+ *   an itemfunc written for a hashtable can use intmap_iterateStrings.
+ */
+void intmap_iterate(intmap_t* map, void* arg,
+                    void (*itemfunc)(void* arg, const uint64_t key, void* item) );
+
+/**************** intmap_iterateStrings ****************/
+/* Iterate over all items in the map, as intmap_iterate does, but with an
+ * itemfunc of the kind hashtable_iterate takes, so a caller moving from a
+ * hashtable to an intmap can keep its itemfuncs.
+ *
+ * We do:
+ *   as intmap_iterate, but pass each key as a string: its decimal digits,
+ *   which strtoull reads back (the string lasts only for that call).
+ * Notes:
+ *   an itemfunc that used the key as an address string must unpack it
+ *   instead (see message_keyAddr), or move to intmap_iterate.
+ */
+void intmap_iterateStrings(intmap_t* map, void* arg,
+                           void (*itemfunc)(void* arg, const char* key, void* item) );
+
+/**************** intmap_delete ****************/
+/* Delete intmap, calling a delete function on each item.
+ *
+ * Caller provides:
+ *   valid intmap pointer,
+ *   valid pointer to function that handles one item (may be NULL).
+ * We do:
+ *   if map==NULL, do nothing.
+ *   otherwise, unless itemfunc==NULL, call the itemfunc on each item.
+ *   free the map itself.
+ */
+void intmap_delete(intmap_t* map, void (*itemdelete)(void* item) );
+
+#endif // __INTMAP_H
@@ -0,0 +1,328 @@
+/*
+ * intset.c - CS50-style 'intset' module
+ *
+ * see intset.h for more information.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime, in the unit test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "intset.h"
+#include "intmap.h"
+#include "mem.h"
+
+/**************** file-local global variables ****************/
+static const int SparseItems = 16;  // items a sparse set holds before its map grows
+
+/**************** global types ****************/
+typedef struct intset {
+  void** items;               // dense: the item of each key, NULL if absent; else NULL
+  int range;                  // dense: the number of keys; 0 if sparse
+  intmap_t* map;              // sparse: key -> item; else NULL
+} intset_t;
+
+/**************** local types ****************/
+// a caller's itemfunc and arg, carried through intmap_iterate
+struct intsetVisit {
+  void* arg;
+  void (*itemfunc)(void* arg, const int key, void* item);
+};
+
+// a caller's itemprint and file, carried through intset_iterate
+struct intsetPrint {
+  FILE* fp;
+  void (*itemprint)(FILE* fp, const int key, void* item);
+};
+
+/**************** global functions ****************/
+/* that is, visible outside this file */
+/* see intset.h for comments about exported functions */
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void intset_visit(void* arg, const uint64_t key, void* item);
+static void intset_printItem(void* arg, const int key, void* item);
+
+/**************** intset_new() ****************/
+/* see intset.h for description */
+intset_t*
+intset_new(void)
+{
+  intset_t* set = mem_calloc(1, sizeof(intset_t));
+  if (set == NULL) {
+    return NULL;              // error allocating set
+  }
+  set->map = intmap_new(SparseItems);
+  if (set->map == NULL) {
+    mem_free(set);
+    return NULL;
+  }
+  return set;
+}
+
+/**************** intset_newDense() ****************/
+/* see intset.h for description */
+intset_t*
+intset_newDense(const int range)
+{
+  if (range <= 0) {
+    return NULL;
+  }
+  intset_t* set = mem_calloc(1, sizeof(intset_t));
+  if (set == NULL) {
+    return NULL;              // error allocating set
+  }
+  set->items = mem_calloc(range, sizeof(void*));
+  if (set->items == NULL) {
+    mem_free(set);
+    return NULL;
+  }
+  set->range = range;
+  return set;
+}
+
+/**************** intset_insert() ****************/
+/* see intset.h for description */
+bool
+intset_insert(intset_t* set, const int key, void* item)
+{
+  if (set == NULL || item == NULL || key < 0) {
+    return false;
+  }
+  if (set->map != NULL) {
+    return intmap_insert(set->map, key, item);
+  }
+  if (key >= set->range || set->items[key] != NULL) {
+    return false;
+  }
+  set->items[key] = item;
+  return true;
+}
+
+/**************** intset_find() ****************/
+/* see intset.h for description */
+void*
+intset_find(intset_t* set, const int key)
+{
+  if (set == NULL || key < 0) {
+    return NULL;
+  }
+  if (set->map != NULL) {
+    return intmap_find(set->map, key);
+  }
+  return key < set->range ? set->items[key] : NULL;
+}
+
+/**************** intset_print() ****************/
+/* see intset.h for description */
+void
+intset_print(intset_t* set, FILE* fp,
+             void (*itemprint)(FILE* fp, const int key, void* item) )
+{
+  if (fp == NULL) {
+    return;
+  }
+  if (set == NULL) {
+    fputs("(null)", fp);
+    return;
+  }
+  struct intsetPrint print = { fp, itemprint };
+  fputc('{', fp);
+  intset_iterate(set, &print, intset_printItem);
+  fputc('}', fp);
+}
+
+/**************** intset_iterate() ****************/
+/* see intset.h for description */
+void
+intset_iterate(intset_t* set, void* arg,
+               void (*itemfunc)(void* arg, const int key, void* item) )
+{
+  if (set == NULL || itemfunc == NULL) {
+    return;
+  }
+  if (set->map != NULL) {
+    struct intsetVisit visit = { arg, itemfunc };
+    intmap_iterate(set->map, &visit, intset_visit);
+    return;
+  }
+  for (int key = 0; key < set->range; key++) {
+    if (set->items[key] != NULL) {
+      (*itemfunc)(arg, key, set->items[key]);
+    }
+  }
+}
+
+/**************** intset_delete() ****************/
+/* see intset.h for description */
+void
+intset_delete(intset_t* set, void (*itemdelete)(void* item) )
+{
+  if (set == NULL) {
+    return;
+  }
+  if (set->map != NULL) {
+    intmap_delete(set->map, itemdelete);
+  }
+  else {
+    if (itemdelete != NULL) {
+      for (int key = 0; key < set->range; key++) {
+        if (set->items[key] != NULL) {
+          (*itemdelete)(set->items[key]);
+        }
+      }
+    }
+    mem_free(set->items);
+  }
+  mem_free(set);
+
+#ifdef MEMTEST
+  mem_report(stdout, "End of intset_delete");
+#endif
+}
+
+/**************** intset_visit ****************/
+/* Hands one pair of a sparse set's map to the caller's itemfunc */
+static void
+intset_visit(void* arg, const uint64_t key, void* item)
+{
+  struct intsetVisit* visit = arg;
+  (*visit->itemfunc)(visit->arg, (int)key, item);
+}
+
+/**************** intset_printItem ****************/
+/* Prints one item, and the comma after it, for intset_print */
+static void
+intset_printItem(void* arg, const int key, void* item)
+{
+  struct intsetPrint* print = arg;
+  if (print->itemprint != NULL) {
+    (*print->itemprint)(print->fp, key, item);
+  }
+  fputc(',', print->fp);
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Fill a dense and a sparse set with the same keys, check that each finds
+ * them, refuses them again and visits each once; then time finding a grid
+ * location in a dense set against a set keyed by the location as a string.
+ *
+ *   ./intsettest
+ */
+#ifdef UNIT_TEST
+
+#include <string.h>
+#include <time.h>
+#include "set.h"
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+static void
+sumKeys(void* arg, const int key, void* item)
+{
+  int* sum = arg;
+  *sum += key;
+}
+
+static void
+printItem(FILE* fp, const int key, void* item)
+{
+  fprintf(fp, "%d:%s", key, (char*)item);
+}
+
+static double
+seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main()
+{
+  enum { Range = 2000 };  // about the locations of a large map
+  intset_t* dense = intset_newDense(Range);
+  intset_t* sparse = intset_new();
+  expect(dense != NULL && sparse != NULL, "new");
+  expect(intset_newDense(0) == NULL, "a dense set needs a range");
+
+  int sum = 0;
+  for (int key = 0; key < Range; key += 7) {
+    expect(intset_insert(dense, key, "g"), "insert a new key (dense)");
+    expect(intset_insert(sparse, key, "g"), "insert a new key (sparse)");
+    sum += key;
+  }
+  expect(!intset_insert(dense, 7, "*") && !intset_insert(sparse, 7, "*"), "a key is inserted once");
+  expect(!intset_insert(dense, Range, "g"), "a dense set refuses a key out of range");
+  expect(!intset_insert(dense, -1, "g") && !intset_insert(sparse, -1, "g"), "negative keys are refused");
+  expect(intset_insert(sparse, 1 << 30, "g"), "a sparse set takes any key");
+  for (int key = 0; key < Range; key++) {
+    bool in = key % 7 == 0;
+    expect((intset_find(dense, key) != NULL) == in, "find (dense)");
+    expect((intset_find(sparse, key) != NULL) == in, "find (sparse)");
+  }
+  expect(intset_find(dense, Range) == NULL && intset_find(dense, -1) == NULL, "find out of range");
+
+  int denseSum = 0, sparseSum = 0;
+  intset_iterate(dense, &denseSum, sumKeys);
+  intset_iterate(sparse, &sparseSum, sumKeys);
+  expect(denseSum == sum && sparseSum == sum + (1 << 30), "iterate visits each item once");
+
+  intset_t* small = intset_newDense(3);
+  intset_insert(small, 0, "A");
+  intset_insert(small, 2, "B");
+  printf("small set: ");
+  intset_print(small, stdout, printItem);
+  printf("\n");
+  intset_delete(small, NULL);
+
+  // time finding a location, as grid_print does for each one
+  set_t* strings = set_new();
+  char key[11];
+  for (int k = 0; k < Range; k += 7) {
+    sprintf(key, "%d", k);
+    set_insert(strings, key, "g");
+  }
+  enum { Rounds = 50 };
+  int found = 0;
+  double start = seconds();
+  for (int round = 0; round < Rounds; round++) {
+    for (int k = 0; k < Range; k++) {
+      found += intset_find(dense, k) != NULL;
+    }
+  }
+  const double denseTime = seconds() - start;
+  start = seconds();
+  for (int round = 0; round < Rounds; round++) {
+    for (int k = 0; k < Range; k++) {
+      sprintf(key, "%d", k);
+      found += set_find(strings, key) != NULL;
+    }
+  }
+  const double stringTime = seconds() - start;
+  expect(found == 2 * Rounds * ((Range + 6) / 7), "both find the same keys");
+  printf("find: dense intset %.1f ns, set %.1f ns (with the key's string)\n",
+         denseTime / (Rounds * Range) * 1e9, stringTime / (Rounds * Range) * 1e9);
+
+  set_delete(strings, NULL);
+  intset_delete(dense, NULL);
+  intset_delete(sparse, NULL);
+  printf("%s\n", errors == 0 ? "intset test passed" : "intset test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
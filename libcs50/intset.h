@@ -0,0 +1,130 @@
+/*
+ * intset.h - header file for the intset module
+ *
+ * An *intset* is a set of (key,item) pairs, like a set, whose keys are
+ * integers (>= 0) rather than strings; so a caller with a number for a key,
+ * such as a location on a grid, need not print it into a string first.
+ * Each key can occur only once, and an item, once inserted, stays.
+ *
+ * A set is one of two kinds, chosen when it is made:
+ *   dense - for keys below a known range, such as the locations of a grid:
+ *     one item pointer per key, in an array, so insert and find index it.
+ *   sparse - for a few keys spread over any range: an intmap (see intmap.h).
+ * Neither allocates memory to insert a key, beyond growing a sparse set's map.
+ */
+
+#ifndef __INTSET_H
+#define __INTSET_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct intset intset_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** intset_new ****************/
+/* Create a new (empty) sparse set.
+ *
+ * We return:
+ *   pointer to a new set, or NULL if error.
+ * We guarantee:
+ *   The set is initialized empty.
+ * Caller is responsible for:
+ *   later calling intset_delete.
+ */
+intset_t* intset_new(void);
+
+/**************** intset_newDense ****************/
+/* Create a new (empty) dense set, for keys 0 to range-1.
+ *
+ * Caller provides:
+ *   the range of its keys (must be > 0); the set takes one pointer per key.
+ * We return:
+ *   pointer to a new set, or NULL if error.
+ * We guarantee:
+ *   The set is initialized empty.
+ * Caller is responsible for:
+ *   later calling intset_delete.
+ */
+intset_t* intset_newDense(const int range);
+
+/**************** intset_insert ****************/
+/* Insert item, identified by an integer key, into the given set.
+ *
+ * Caller provides:
+ *   valid set pointer, key (must be >= 0, and below the range of a dense
+ *   set), and valid pointer to item.
+ * We return:
+ *  false if key exists, key is out of range, any pointer is NULL, or error;
+ *  true iff new item was inserted.
+ */
+bool intset_insert(intset_t* set, const int key, void* item);
+
+/**************** intset_find ****************/
+/* Return the item associated with the given key.
+ *
+ * Caller provides:
+ *   valid set pointer, key.
+ * We return:
+ *   a pointer to the desired item, if found;
+ *   NULL if set is NULL, or key is out of range or not found.
+ * Notes:
+ *   The item is *not* removed from the set.
+ *   Thus, the caller should *not* free the pointer that is returned.
+ */
+void* intset_find(intset_t* set, const int key);
+
+/**************** intset_print ****************/
+/* Print the whole set; provide the output file and func to print each item.
+ *
+ * Caller provides:
+ *   valid set pointer,
+ *   FILE open for writing,
+ *   valid pointer to function that prints one item.
+ * We print:
+ *   nothing if NULL fp. Print (null) if NULL set.
+ *   print a set with no items if NULL itemprint.
+ *  otherwise,
+ *   print a comma-separated list of items surrounded by {brackets}.
+ * Notes:
+ *   The set and its contents are not changed.
+ *   The 'itemprint' function is responsible for printing (key,item).
+ */
+void intset_print(intset_t* set, FILE* fp,
+                  void (*itemprint)(FILE* fp, const int key, void* item) );
+
+/**************** intset_iterate ****************/
+/* Iterate over the set, calling a function on each item.
+ *
+ * Caller provides:
+ *   valid set pointer,
+ *   arbitrary argument (pointer) that is passed-through to itemfunc,
+ *   valid pointer to function that handles one item.
+ * We do:
+ *   nothing, if set==NULL or itemfunc==NULL.
+ *   otherwise, call the itemfunc on each item, with (arg, key, item).
+ * Notes:
+ *   the order in which set items are handled is undefined (a dense set
+ *   handles them in order of their keys).
+ *   the set and its contents are not changed by this function,
+ *   but the itemfunc may change the contents of the item.
+ */
+void intset_iterate(intset_t* set, void* arg,
+                    void (*itemfunc)(void* arg, const int key, void* item) );
+
+/**************** intset_delete ****************/
+/* Delete set, calling a delete function on each item.
+ *
+ * Caller provides:
+ *   valid set pointer,
+ *   valid pointer to function that handles one item (may be NULL).
+ * We do:
+ *   if set==NULL, do nothing.
+ *   otherwise, unless itemfunc==NULL, call the itemfunc on each item.
+ *   free the set itself.
+ */
+void intset_delete(intset_t* set, void (*itemdelete)(void* item) );
+
+#endif // __INTSET_H
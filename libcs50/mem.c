@@ -1,26 +1,113 @@
-/* 
- * memory - mem_malloc and related functions 
- * 
+/*
+ * memory - mem_malloc and related functions
+ *
  * 1. Replacements for malloc(), calloc(), and free(),
  *    that count the number of calls to each,
  *    so you can print reports about the current balance of memory.
- * 
+ *
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Pools of small blocks, one per size class, so that the many tiny,
+ *    short-lived objects of a program (list nodes, coordinate pairs, short
+ *    strings) are reused from a free list rather than got from malloc.
+ *    Each thread keeps its own cache of free blocks, trading them in
+ *    batches with a shared depot, so threads rarely contend.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime, in the unit test
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "mem.h"
 
+/**************** file-local constants ****************/
+static const size_t ClassBytes = 16;   // the smallest class; each next one is twice as big
+static const int Large = -1;           // the class of a block too big for any pool
+static const int Batch = 64;           // blocks traded with the depot at a time
+static const int CacheLimit = 256;     // a thread keeps at most this many of a class
+
+/**************** file-local types ****************/
+// ahead of every block we hand out: its class, so mem_free knows its pool
+typedef struct memheader {
+  _Alignas(max_align_t) int class;     // index into the pools, or Large
+} memheader_t;
+
+// a free block of a pool, linked through the space it hands out
+typedef struct memblock {
+  memheader_t header;
+  struct memblock* next;               // next free block of the same class
+} memblock_t;
+
+// one thread's free blocks and counts; the owner alone writes them
+typedef struct memcache {
+  memblock_t* free[mem_PoolClasses];   // free blocks of each class
+  int count[mem_PoolClasses];          // how many
+  _Atomic long hits[mem_PoolClasses];  // requests served from a free list
+  _Atomic long misses[mem_PoolClasses];// requests that went to malloc
+  _Atomic long nmalloc;                // number of successful malloc calls
+  _Atomic long nfree;                  // number of free calls
+  _Atomic long nfreenull;              // number of free(NULL) calls
+  bool registered;                     // on the list of caches
+  bool exited;                         // retired at thread exit: never listed again
+  struct memcache* next;               // next cache on that list
+} memcache_t;
+
 /**************** file-local global variables ****************/
-// track malloc and free across *all* calls within this program.
-static int nmalloc = 0;         // number of successful malloc calls
-static int nfree = 0;           // number of free calls
-static int nfreenull = 0;       // number of free(NULL) calls
+// track malloc and free across *all* calls within this program:
+// each thread counts in its own cache, and a thread that exits leaves
+// its counts and blocks to these, all under the lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static memcache_t* caches = NULL;                    // every live thread's cache
+static memblock_t* depot[mem_PoolClasses];          // free blocks no thread holds
+static int depotCount[mem_PoolClasses];
+static memcache_t retired;                           // counts of threads that exited
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t exitKey;                        // to retire a cache at thread exit
 
+static _Thread_local memcache_t cache;               // this thread's
+
+/**************** local functions ****************/
+static void* alloc(const size_t size, const bool zero);
+static memcache_t* myCache(void);
+static void makeKey(void);
+static void retire(void* arg);
+static void refill(memcache_t* mine, const int class);
+static void spill(memcache_t* mine, const int class, const int n);
+static void sum(memcache_t* total);
+
+/**************** bump ****************/
+/* Count one in a counter that only this thread writes, without the cost
+ * of an atomic add; others may read it at any time.
+ */
+static inline void
+bump(_Atomic long* counter)
+{
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+/**************** classOf ****************/
+/* The smallest class whose blocks hold size bytes; Large if none does. */
+static inline int
+classOf(const size_t size)
+{
+  int class = 0;
+  while ((ClassBytes << class) < size) {
+    if (++class == mem_PoolClasses) {
+      return Large;
+    }
+  }
+  return class;
+}
 
 /**************** mem_assert ****************/
 /* see mem.h for description */
@@ -51,12 +138,11 @@ mem_assert_const(const void* ptr, const char* message)
 void*
 mem_malloc_assert(const size_t size, const char* message)
 {
-  void* ptr = malloc(size);
+  void* ptr = alloc(size, false);
   if (ptr == NULL) {
     fprintf(stderr, "Out of memory: %s\n", message);
     exit (99);
   }
-  nmalloc++;
   return ptr;
 }
 
@@ -66,11 +152,7 @@ mem_malloc_assert(const size_t size, const char* message)
 void*
 mem_malloc(const size_t size)
 {
-  void* ptr = malloc(size);
-  if (ptr != NULL) {
-    nmalloc++;
-  }
-  return ptr;
+  return alloc(size, false);
 }
 
 /**************** mem_calloc_assert() ****************/
@@ -78,9 +160,7 @@ mem_malloc(const size_t size)
 void*
 mem_calloc_assert(const size_t nmemb, const size_t size, const char* message)
 {
-  void* ptr = mem_assert(calloc(nmemb, size), message);
-  nmalloc++;
-  return ptr;
+  return mem_assert(mem_calloc(nmemb, size), message);
 }
 
 /**************** mem_calloc() ****************/
@@ -88,34 +168,58 @@ mem_calloc_assert(const size_t nmemb, const size_t size, const char* message)
 void*
 mem_calloc(const size_t nmemb, const size_t size)
 {
-  void* ptr = calloc(nmemb, size);
-  if (ptr != NULL) {
-    nmalloc++;
+  if (size != 0 && nmemb > SIZE_MAX / size) {
+    return NULL;
   }
-  return ptr;
+  return alloc(nmemb * size, true);
 }
 
 /**************** mem_free() ****************/
-/* see mem.h for description */
-void 
+/* see mem.h for description
+ *
+ * Pseudocode:
+ *   a large block goes back to free()
+ *   a small one goes on this thread's list for its class;
+ *     if that list is then over the limit, a batch of it goes to the depot
+ *   if this thread has exited, retire its cache again (see myCache)
+ */
+void
 mem_free(void* ptr)
 {
+  memcache_t* mine = myCache();
   if (ptr != NULL) {
-    free(ptr);
-    nfree++;
+    memblock_t* block = (memblock_t*)((memheader_t*)ptr - 1);
+    const int class = block->header.class;
+    if (class == Large) {
+      free(block);
+    }
+    else {
+      block->next = mine->free[class];
+      mine->free[class] = block;
+      if (++mine->count[class] > CacheLimit) {
+        spill(mine, class, Batch);
+      }
+    }
+    bump(&mine->nfree);
   } else {
     // it's an error to call free(NULL)!
-    nfreenull++;
+    bump(&mine->nfreenull);
+  }
+  if (mine->exited) {
+    retire(mine);
   }
 }
 
 /**************** mem_report() ****************/
 /* see mem.h for description */
-void 
+void
 mem_report(FILE* fp, const char* message)
 {
-  fprintf(fp, "%s: %d malloc, %d free, %d free(NULL), %d net\n", 
-          message, nmalloc, nfree, nfreenull, nmalloc - nfree - nfreenull);
+  memcache_t total;
+  sum(&total);
+  fprintf(fp, "%s: %ld malloc, %ld free, %ld free(NULL), %ld net\n",
+          message, total.nmalloc, total.nfree, total.nfreenull,
+          total.nmalloc - total.nfree - total.nfreenull);
 }
 
 /**************** mem_net() ****************/
@@ -123,5 +227,414 @@ mem_report(FILE* fp, const char* message)
 int
 mem_net(void)
 {
-  return nmalloc - nfree - nfreenull;
+  memcache_t total;
+  sum(&total);
+  return (int)(total.nmalloc - total.nfree - total.nfreenull);
+}
+
+/**************** mem_poolStats() ****************/
+/* see mem.h for description */
+void
+mem_poolStats(mem_poolstats_t stats[mem_PoolClasses])
+{
+  memcache_t total;
+  sum(&total);
+  for (int class = 0; class < mem_PoolClasses; class++) {
+    stats[class].bytes = ClassBytes << class;
+    stats[class].hits = total.hits[class];
+    stats[class].misses = total.misses[class];
+  }
+}
+
+/**************** mem_poolReport() ****************/
+/* see mem.h for description */
+void
+mem_poolReport(FILE* fp, const char* message)
+{
+  mem_poolstats_t stats[mem_PoolClasses];
+  mem_poolStats(stats);
+  fprintf(fp, "%s:", message);
+  for (int class = 0; class < mem_PoolClasses; class++) {
+    fprintf(fp, " %zu-byte %ld hit %ld miss%s", stats[class].bytes, stats[class].hits,
+            stats[class].misses, class + 1 < mem_PoolClasses ? "," : "\n");
+  }
+}
+
+/**************** alloc ****************/
+/* Allocate size bytes, zeroed if zero, after a header naming their class;
+ * return the space after the header, or NULL if out of memory.
+ *
+ * Pseudocode:
+ *   a large request goes to malloc (or calloc)
+ *   a small one takes the first block on this thread's list for its class,
+ *     refilling the list from the depot if it is empty;
+ *     if the depot had none either, malloc a block of the class's size
+ *   if this thread has exited, retire its cache again (see myCache)
+ */
+static void*
+alloc(const size_t size, const bool zero)
+{
+  memcache_t* mine = myCache();
+  const int class = classOf(size);
+  memblock_t* block;
+  if (class == Large) {
+    if (size > SIZE_MAX - sizeof(memheader_t)) {
+      return NULL;
+    }
+    block = zero ? calloc(1, sizeof(memheader_t) + size) : malloc(sizeof(memheader_t) + size);
+  }
+  else {
+    if (mine->free[class] == NULL) {
+      refill(mine, class);
+    }
+    block = mine->free[class];
+    if (block != NULL) {
+      mine->free[class] = block->next;
+      mine->count[class]--;
+      bump(&mine->hits[class]);
+    }
+    else {
+      block = malloc(sizeof(memheader_t) + (ClassBytes << class));
+      bump(&mine->misses[class]);
+    }
+    if (block != NULL && zero) {
+      memset(&block->header + 1, 0, size);
+    }
+  }
+  if (block != NULL) {
+    block->header.class = class;
+    bump(&mine->nmalloc);
+  }
+  if (mine->exited) {
+    retire(mine);  // once more, so the exited thread holds nothing
+  }
+  return block == NULL ? NULL : &block->header + 1;
+}
+
+/**************** myCache ****************/
+/* This thread's cache, put on the list of caches on its first use.
+ * A call made after the cache is retired, at thread exit (from another
+ * key's destructor, say), still uses it, but it is not put back on the
+ * list, whose thread-local storage is about to go; the call retires it
+ * again when done, giving its blocks to the depot and its counts to
+ * those of retired threads, so it holds nothing between calls.
+ */
+static memcache_t*
+myCache(void)
+{
+  if (!cache.registered && !cache.exited) {
+    pthread_once(&once, makeKey);
+    pthread_mutex_lock(&lock);
+    cache.next = caches;
+    caches = &cache;
+    cache.registered = true;
+    pthread_mutex_unlock(&lock);
+    pthread_setspecific(exitKey, &cache);
+  }
+  return &cache;
+}
+
+/**************** makeKey ****************/
+/* Make the key whose destructor retires each thread's cache. */
+static void
+makeKey(void)
+{
+  pthread_key_create(&exitKey, retire);
+}
+
+/**************** retire ****************/
+/* At a thread's exit, give its free blocks to the depot, add its counts
+ * to those of retired threads, and take its cache off the list for good.
+ */
+static void
+retire(void* arg)
+{
+  memcache_t* mine = arg;
+  for (int class = 0; class < mem_PoolClasses; class++) {
+    spill(mine, class, mine->count[class]);
+  }
+  pthread_mutex_lock(&lock);
+  for (memcache_t** link = &caches; *link != NULL; link = &(*link)->next) {
+    if (*link == mine) {
+      *link = mine->next;
+      break;
+    }
+  }
+  for (int class = 0; class < mem_PoolClasses; class++) {
+    retired.hits[class] += mine->hits[class];
+    retired.misses[class] += mine->misses[class];
+    mine->hits[class] = mine->misses[class] = 0;
+  }
+  retired.nmalloc += mine->nmalloc;
+  retired.nfree += mine->nfree;
+  retired.nfreenull += mine->nfreenull;
+  mine->nmalloc = mine->nfree = mine->nfreenull = 0;
+  mine->registered = false;
+  mine->exited = true;
+  pthread_mutex_unlock(&lock);
+}
+
+/**************** refill ****************/
+/* Move up to a batch of free blocks of a class from the depot to this
+ * thread's (empty) list.
+ */
+static void
+refill(memcache_t* mine, const int class)
+{
+  pthread_mutex_lock(&lock);
+  memblock_t* first = depot[class];
+  memblock_t* last = first;
+  int n = 0;
+  if (first != NULL) {
+    for (n = 1; n < Batch && last->next != NULL; n++) {
+      last = last->next;
+    }
+    depot[class] = last->next;
+    depotCount[class] -= n;
+    last->next = NULL;
+  }
+  pthread_mutex_unlock(&lock);
+  mine->free[class] = first;
+  mine->count[class] = n;
+}
+
+/**************** spill ****************/
+/* Move the first n free blocks of a class from this thread's list to the
+ * depot.
+ */
+static void
+spill(memcache_t* mine, const int class, const int n)
+{
+  if (n <= 0) {
+    return;
+  }
+  memblock_t* first = mine->free[class];
+  memblock_t* last = first;
+  for (int i = 1; i < n; i++) {
+    last = last->next;
+  }
+  mine->free[class] = last->next;
+  mine->count[class] -= n;
+  pthread_mutex_lock(&lock);
+  last->next = depot[class];
+  depot[class] = first;
+  depotCount[class] += n;
+  pthread_mutex_unlock(&lock);
+}
+
+/**************** sum ****************/
+/* Total the counts of every thread, live or retired, into total. */
+static void
+sum(memcache_t* total)
+{
+  myCache();  // so the caller's own counts are on the list
+  pthread_mutex_lock(&lock);
+  *total = retired;
+  for (memcache_t* c = caches; c != NULL; c = c->next) {
+    for (int class = 0; class < mem_PoolClasses; class++) {
+      total->hits[class] += c->hits[class];
+      total->misses[class] += c->misses[class];
+    }
+    total->nmalloc += c->nmalloc;
+    total->nfree += c->nfree;
+    total->nfreenull += c->nfreenull;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Check that blocks of every size are usable, zeroed by mem_calloc, and
+ * counted; that freed blocks are reused, also by other threads; then time
+ * the allocation pattern of a game tick (a burst of tiny, short-lived
+ * objects) through mem_malloc against plain malloc, in one thread and in
+ * several at once.
+ *
+ *   ./memtest
+ */
+#ifdef UNIT_TEST
+
+#include <time.h>
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+static double
+seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum { Live = 256, Rounds = 20000, Threads = 4 };
+static const size_t Sizes[] = { 2 * sizeof(int), 2, 11, 24, 40, 100 };  // as a game allocates
+static const int NumSizes = sizeof(Sizes) / sizeof(Sizes[0]);
+
+static bool Pooled = true, Plain = false;
+
+// one tick's worth of objects, made and freed, many times over;
+// arg points to whether to use mem_malloc (else plain malloc)
+static void*
+churn(void* arg)
+{
+  const bool pooled = *(bool*)arg;
+  void* live[Live];
+  for (int round = 0; round < Rounds; round++) {
+    for (int i = 0; i < Live; i++) {
+      const size_t size = Sizes[(round + i) % NumSizes];
+      live[i] = pooled ? mem_malloc(size) : malloc(size);
+      *(char*)live[i] = (char)i;
+    }
+    for (int i = 0; i < Live; i++) {
+      if (pooled) {
+        mem_free(live[i]);
+      }
+      else {
+        free(live[i]);
+      }
+    }
+  }
+  return NULL;
 }
+
+// time churn in n threads at once; ns per malloc-free pair, over all threads
+static double
+timeChurn(const int n, const bool pooled)
+{
+  pthread_t threads[Threads];
+  double start = seconds();
+  for (int t = 0; t < n; t++) {
+    pthread_create(&threads[t], NULL, churn, pooled ? &Pooled : &Plain);
+  }
+  for (int t = 0; t < n; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  return (seconds() - start) / ((double)n * Rounds * Live) * 1e9;
+}
+
+// a destructor that uses mem after the thread's cache is retired: on its first
+// round it sets its key again, so it runs once more, after retire has run;
+// then it looks for its thread's cache on the list
+static pthread_key_t lateKey;
+static bool lateListed;
+
+static void
+useLate(void* arg)
+{
+  int* rounds = arg;
+  if ((*rounds)++ == 0) {
+    pthread_setspecific(lateKey, arg);
+    return;
+  }
+  mem_free(mem_malloc(20));
+  mem_free(mem_calloc(1, 2000));
+  *(void**)mem_malloc(40) = NULL;  // left allocated, to be counted
+  pthread_mutex_lock(&lock);
+  for (memcache_t* c = caches; c != NULL; c = c->next) {
+    lateListed = lateListed || c == &cache;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+static void*
+exitLate(void* arg)
+{
+  mem_free(mem_malloc(20));
+  pthread_setspecific(lateKey, arg);
+  return NULL;
+}
+
+// free in this thread the blocks another thread allocated
+static void*
+freeAll(void* arg)
+{
+  void** blocks = arg;
+  for (int i = 0; i < Live; i++) {
+    mem_free(blocks[i]);
+  }
+  return NULL;
+}
+
+int
+main()
+{
+  // every size, up to and past the largest class, is usable and aligned
+  for (size_t size = 0; size <= 1024; size += 3) {
+    unsigned char* ptr = mem_malloc(size);
+    expect(ptr != NULL && (uintptr_t)ptr % _Alignof(max_align_t) == 0, "malloc is aligned");
+    memset(ptr, 0xA5, size);
+    mem_free(ptr);
+    ptr = mem_calloc(1, size);
+    bool zeroed = true;
+    for (size_t i = 0; i < size; i++) {
+      zeroed = zeroed && ptr[i] == 0;
+    }
+    expect(zeroed, "calloc zeroes a reused block");
+    mem_free(ptr);
+  }
+  expect(mem_calloc(SIZE_MAX / 2, 4) == NULL, "calloc refuses an overflowing size");
+  mem_free(NULL);
+  expect(mem_net() == -1, "each malloc and free is counted, and free(NULL) too");
+
+  // a freed block is the next of its class handed out
+  void* first = mem_malloc(20);
+  mem_free(first);
+  expect(mem_malloc(30) == first, "a freed block is reused");
+  mem_free(first);
+
+  // blocks freed by another thread come back through the depot
+  mem_poolstats_t before[mem_PoolClasses], after[mem_PoolClasses];
+  void* blocks[Live];
+  for (int i = 0; i < Live; i++) {
+    blocks[i] = mem_malloc(200);
+  }
+  pthread_t other;
+  pthread_create(&other, NULL, freeAll, blocks);
+  pthread_join(other, NULL);
+  mem_poolStats(before);
+  for (int i = 0; i < Live; i++) {
+    blocks[i] = mem_malloc(200);
+  }
+  mem_poolStats(after);
+  expect(after[4].bytes == 256 && after[4].misses == before[4].misses,
+         "blocks another thread freed are reused");
+  for (int i = 0; i < Live; i++) {
+    mem_free(blocks[i]);
+  }
+  expect(mem_net() == -1, "an exited thread's counts are kept");
+
+  // mem used after a thread's cache is retired does not put it back on the list
+  int rounds = 0;
+  pthread_key_create(&lateKey, useLate);
+  pthread_create(&other, NULL, exitLate, &rounds);
+  pthread_join(other, NULL);
+  expect(rounds == 2 && !lateListed, "an exited thread's cache stays off the list");
+  expect(mem_net() == 0, "and what it does after is counted");
+  pthread_key_delete(lateKey);
+  mem_free(NULL);  // to balance the block it left, for the checks below
+
+  // time it
+  const double plain1 = timeChurn(1, false);
+  const double pooled1 = timeChurn(1, true);
+  const double plainN = timeChurn(Threads, false);
+  const double pooledN = timeChurn(Threads, true);
+  printf("malloc+free: 1 thread: mem %.1f ns, malloc %.1f ns; "
+         "%d threads: mem %.1f ns, malloc %.1f ns\n",
+         pooled1, plain1, Threads, pooledN, plainN);
+  mem_poolReport(stdout, "pools");
+  expect(mem_net() == -1, "the threads freed all they allocated");
+
+  printf("%s\n", errors == 0 ? "mem test passed" : "mem test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
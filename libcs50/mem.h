@@ -14,6 +14,14 @@
  *    that needs to defensively check function parameters that
  *    "should never be NULL".
  *
+ * 4. Blocks of up to 256 bytes come from pools, one per size class, and
+ *    go back to them when freed, so a program that makes and frees many
+ *    small objects rarely calls malloc; each thread keeps its own cache
+ *    of free blocks, so these functions are safe, and fast, in threads.
+ *    Every block starts after a header naming its pool, so a block from
+ *    these functions must be freed by mem_free, never free(), and
+ *    mem_free must be given only blocks from these functions.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
@@ -23,6 +31,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/**************** global types ****************/
+enum { mem_PoolClasses = 5 };  // pools, of 16, 32, 64, 128 and 256-byte blocks
+
+typedef struct mem_poolstats {
+  size_t bytes;             // the size of the pool's blocks
+  long hits;                // requests served by a freed block
+  long misses;              // requests that needed a new block from malloc
+} mem_poolstats_t;
+
 /**************** mem_assert **************************/
 /* If pointer p is NULL, print error message to stderr and die,
  * otherwise, return p unchanged.  Works nicely as a pass-through:
@@ -113,4 +130,20 @@ void mem_report(FILE* fp, const char* message);
  */
 int mem_net(void);
 
+/**************** mem_poolStats() ****************/
+/* Fill in how well each pool has served, summed over every thread.
+ * Caller provides:
+ *   an array of mem_PoolClasses stats, smallest blocks first.
+ * We fill in each one's block size, and its hits and misses so far.
+ */
+void mem_poolStats(mem_poolstats_t stats[mem_PoolClasses]);
+
+/**************** mem_poolReport() ****************/
+/* Print a report of each pool's hits and misses.
+ * We assume:
+ *   caller provides a FILE open for writing, and message suitable for printf.
+ * We print one line: the message, then each pool's block size, hits and misses.
+ */
+void mem_poolReport(FILE* fp, const char* message);
+
 #endif // __MEM_H
@@ -0,0 +1,434 @@
+#define _POSIX_C_SOURCE 200809L  // for rand_r
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "libcs50/mem.h"
+#include "support/hist.h"
+#include "support/message.h"
+
+/**
+ * loadgen - drives a running server with many simulated players over UDP, to measure it
+ *
+ * usage: ./loadgen [-n players] [-r rate] [-d seconds] [-k keys] hostname port
+ *   where players is the number of simulated players, each with a socket of its own, so the
+ *     server sees each at a different address (default 26)
+ *   where rate is how many keystrokes each player sends per second, whether or not the server
+ *     keeps up (default 10; it may be fractional)
+ *   where seconds is how long the players play (default 10)
+ *   where keys is a script of movement keys (from hjklyubn) that each player sends over and
+ *     over, each starting at a different point in it; by default every key is chosen at random
+ *
+ * Each player sends PLAY and, once the server has sent it a frame, keystrokes at the given
+ * rate, staggered so that the players' keystrokes are spread evenly over time.  A keystroke
+ * is answered by an ERROR, or by the first DISPLAY that shows the player moved by exactly
+ * that key's step; a player's keystrokes are handled in order, so each answer goes to its
+ * oldest unanswered one.  The time from sending a keystroke to its answer is its round trip;
+ * a keystroke with no answer after LostNanos is lost.  Afterwards each player quits, and the
+ * round trips and losses are printed to stdout for each player and in total.  Players the
+ * server turns away (a full game) are reported as refused.
+ */
+
+/**************** file-local constants ****************/
+static const char MoveKeys[] = "hlkjyubn";
+static const int RowStep[] = { 0, 0, -1, 1, -1, -1, 1, 1 };  // for each of MoveKeys
+static const int ColStep[] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+static const uint64_t LostNanos = 2000000000;   // a keystroke unanswered this long is lost
+static const uint64_t RejoinNanos = 1000000000; // resend PLAY if unanswered this long
+enum { MaxInFlight = 256 };    // unanswered keystrokes a player remembers; more are lost
+enum { Joining, Playing, Done };   // a player's states
+
+/**************** global types ****************/
+// one simulated player
+typedef struct client {
+  int socket;
+  int state;                   // Joining, Playing or Done
+  bool joined;                 // the server said OK
+  bool refused;                // the server turned it away before it could play
+  uint64_t asked;              // when it last sent PLAY
+  uint64_t nextKey;            // when it sends its next keystroke
+  int script;                  // where it is in the key script
+  unsigned int seed;           // for random keys
+  int at;                      // where it ('@') is in its last frame; -1 if no frame yet
+  int stride;                  // length of a row of its frames, with the newline
+  uint64_t sentAt[MaxInFlight];  // unanswered keystrokes, oldest first, in a ring
+  int step[MaxInFlight];       // how far each one moves the player in a frame
+  int oldest;                  // index of the oldest in the ring
+  int inFlight;                // number in the ring
+  unsigned long sent, answered, rejected, lost, frames;
+  hist_t* rtt;                 // round trips of answered keystrokes, in ns
+} client_t;
+
+/**************** local variables ****************/
+static client_t* clients;
+static int numClients = 26;
+static double rate = 10;
+static int seconds = 10;
+static const char* script;     // NULL for random keys
+static addr_t server;
+static hist_t* total;          // every player's round trips
+static char buffer[65536];     // one datagram (see message_MaxBytes)
+
+/* *********************************************************************** */
+/* Private function prototypes */
+static bool parseArgs(const int argc, char* argv[]);
+static bool openClients();
+static void play(const uint64_t end, const bool sending);
+static void sendText(client_t* client, const char* text);
+static void sendKey(client_t* client, const uint64_t now);
+static void receive(client_t* client, const uint64_t now);
+static void answer(client_t* client, const uint64_t now);
+static void expire(client_t* client, const uint64_t now);
+static void report();
+static void closeClients();
+
+/* ***************** main ********************** */
+int main(const int argc, char* argv[])
+{
+  if (!parseArgs(argc, argv)) {
+    exit(1);
+  }
+  if (!openClients()) {
+    fprintf(stderr, "Failed to open %d sockets.\n", numClients);
+    exit(2);
+  }
+
+  total = mem_assert(hist_new(), "Out of memory for histogram.\n");
+  uint64_t start = hist_now();
+  play(start + (uint64_t)seconds * 1000000000, true);
+  double elapsed = (hist_now() - start) / 1e9;
+  // let the last keystrokes be answered, or be lost, then quit
+  play(hist_now() + LostNanos, false);
+  for (int i = 0; i < numClients; i++) {
+    if (clients[i].state == Playing) {
+      sendText(&clients[i], "KEY Q");
+    }
+  }
+
+  report();
+  unsigned long sent = 0, lost = 0;
+  for (int i = 0; i < numClients; i++) {
+    sent += clients[i].sent;
+    lost += clients[i].lost;
+  }
+  printf("%d players sent %lu keystrokes in %.1f s (%.0f/s); %lu lost (%.2f%%)\n",
+         numClients, sent, elapsed, sent / elapsed, lost, sent > 0 ? 100.0 * lost / sent : 0);
+  hist_print(total, stdout, "rtt");
+  hist_delete(total);
+  closeClients();
+  exit(0);
+}
+
+/* ***************** parseArgs ********************** */
+/*
+ * reads the options, and the server's address
+ *
+ * We return:
+ *    false if the arguments are invalid (after printing why to stderr)
+ */
+static bool parseArgs(const int argc, char* argv[])
+{
+  int arg = 1;
+  while (arg < argc - 2 && argv[arg][0] == '-' && strlen(argv[arg]) == 2) {
+    const char option = argv[arg][1];
+    const char* value = argv[arg + 1];
+    char* end;
+    if (option == 'n') {
+      numClients = strtol(value, &end, 10);
+      if (*value == '\0' || *end != '\0' || numClients < 1) {
+        fprintf(stderr, "Option -n needs a positive integer.\n");
+        return false;
+      }
+    }
+    else if (option == 'r') {
+      rate = strtod(value, &end);
+      if (*value == '\0' || *end != '\0' || !(rate > 0)) {
+        fprintf(stderr, "Option -r needs a positive number.\n");
+        return false;
+      }
+    }
+    else if (option == 'd') {
+      seconds = strtol(value, &end, 10);
+      if (*value == '\0' || *end != '\0' || seconds < 1) {
+        fprintf(stderr, "Option -d needs a positive integer.\n");
+        return false;
+      }
+    }
+    else if (option == 'k') {
+      if (*value == '\0' || strspn(value, MoveKeys) != strlen(value)) {
+        fprintf(stderr, "Option -k needs a script of movement keys (%s).\n", MoveKeys);
+        return false;
+      }
+      script = value;
+    }
+    else {
+      break;
+    }
+    arg += 2;
+  }
+  if (arg != argc - 2) {
+    fprintf(stderr, "usage: ./loadgen [-n players] [-r rate] [-d seconds] [-k keys] "
+            "hostname port\n");
+    return false;
+  }
+  if (!message_setAddr(argv[arg], argv[arg + 1], &server)) {
+    fprintf(stderr, "can't form address from %s %s\n", argv[arg], argv[arg + 1]);
+    return false;
+  }
+  return true;
+}
+
+/* ***************** openClients ********************** */
+/*
+ * Opens a non-blocking UDP socket for each player, on a port of its own, and sends PLAY
+ *
+ * We return:
+ *   false if any socket cannot be opened (after closing those that were)
+ */
+static bool openClients()
+{
+  clients = mem_calloc_assert(numClients, sizeof(client_t), "Out of memory for players.\n");
+  for (int i = 0; i < numClients; i++) {
+    client_t* client = &clients[i];
+    client->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (client->socket < 0 || fcntl(client->socket, F_SETFL, O_NONBLOCK) < 0) {
+      numClients = i + (client->socket >= 0);
+      closeClients();
+      return false;
+    }
+    client->rtt = mem_assert(hist_new(), "Out of memory for histogram.\n");
+    client->seed = i + 1;
+    client->script = (script == NULL) ? 0 : i % strlen(script);
+    client->at = -1;
+    client->state = Joining;
+  }
+  for (int i = 0; i < numClients; i++) {
+    clients[i].asked = hist_now();
+    char play[30];
+    snprintf(play, sizeof(play), "PLAY load%d", i);
+    sendText(&clients[i], play);
+  }
+  return true;
+}
+
+/* ***************** play ********************** */
+/*
+ * Until the end, takes in the players' replies and, if sending, sends each player's
+ *   keystrokes as they fall due
+ *
+ * Pseudocode:
+ *   loop until the end:
+ *     for each player, resend an unanswered PLAY; if playing, send each keystroke that is
+ *       due (if sending), count as lost those unanswered for too long, and note when
+ *       the next is due
+ *     wait for replies on any socket, until the next keystroke is due
+ *     take in every reply waiting on each socket
+ */
+static void play(const uint64_t end, const bool sending)
+{
+  const uint64_t period = 1e9 / rate;
+  struct pollfd* fds = mem_malloc_assert(numClients * sizeof(struct pollfd),
+                                         "Out of memory for poll.\n");
+  uint64_t now;
+  while ((now = hist_now()) < end) {
+    uint64_t wake = end;
+    for (int i = 0; i < numClients; i++) {
+      client_t* client = &clients[i];
+      if (client->state == Joining && !client->joined && now - client->asked > RejoinNanos) {
+        client->asked = now;
+        char play[30];
+        snprintf(play, sizeof(play), "PLAY load%d", i);
+        sendText(client, play);
+      }
+      if (client->state == Playing) {
+        while (sending && client->nextKey <= now) {
+          sendKey(client, client->nextKey);
+          client->nextKey += period;
+        }
+        expire(client, now);
+        if (sending && client->nextKey < wake) {
+          wake = client->nextKey;
+        }
+      }
+      fds[i].fd = client->socket;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    int timeout = (wake > now) ? (wake - now + 999999) / 1000000 : 0;
+    if (poll(fds, numClients, timeout) > 0) {
+      now = hist_now();
+      for (int i = 0; i < numClients; i++) {
+        if (fds[i].revents & POLLIN) {
+          receive(&clients[i], now);
+        }
+      }
+    }
+  }
+  mem_free(fds);
+}
+
+/* ***************** sendText ********************** */
+/* Sends a message to the server from a player's socket; a full socket buffer drops it,
+ * as the network might
+ */
+static void sendText(client_t* client, const char* text)
+{
+  sendto(client->socket, text, strlen(text), 0, (struct sockaddr*)&server, sizeof(server));
+}
+
+/* ***************** sendKey ********************** */
+/*
+ * Sends a player's next keystroke, from the script or at random, and remembers when it was
+ *   sent and how far it should move the player; with too many unanswered, the oldest is lost
+ */
+static void sendKey(client_t* client, const uint64_t now)
+{
+  int key;
+  if (script != NULL) {
+    key = strchr(MoveKeys, script[client->script]) - MoveKeys;
+    client->script = (client->script + 1) % strlen(script);
+  }
+  else {
+    key = rand_r(&client->seed) % strlen(MoveKeys);
+  }
+  if (client->inFlight == MaxInFlight) {
+    client->oldest = (client->oldest + 1) % MaxInFlight;
+    client->inFlight--;
+    client->lost++;
+  }
+  int slot = (client->oldest + client->inFlight++) % MaxInFlight;
+  client->sentAt[slot] = now;
+  client->step[slot] = RowStep[key] * client->stride + ColStep[key];
+  char text[] = "KEY x";
+  text[strlen("KEY ")] = MoveKeys[key];
+  sendText(client, text);
+  client->sent++;
+}
+
+/* ***************** receive ********************** */
+/*
+ * Takes in every reply waiting on a player's socket
+ *
+ * Pseudocode:
+ *   for each datagram from the server,
+ *     OK: the player has joined
+ *     QUIT: the player is done (refused, if it never joined)
+ *     ERROR: answers the oldest unanswered keystroke
+ *     DISPLAY: note where the player is, and how long the frame's rows are; if it moved by
+ *       the oldest keystroke's step, that answers it; the first frame after OK starts it
+ *       playing, with its first keystroke due after its share of the period
+ */
+static void receive(client_t* client, const uint64_t now)
+{
+  ssize_t length;
+  socklen_t size = sizeof(addr_t);
+  addr_t from;
+  while ((length = recvfrom(client->socket, buffer, sizeof(buffer) - 1, 0,
+                            (struct sockaddr*)&from, &size)) >= 0) {
+    buffer[length] = '\0';
+    size = sizeof(addr_t);
+    if (!message_eqAddr(from, server)) {
+      continue;
+    }
+    if (strncmp(buffer, "OK ", strlen("OK ")) == 0) {
+      client->joined = true;
+    }
+    else if (strncmp(buffer, "QUIT", strlen("QUIT")) == 0) {
+      client->refused = !client->joined;
+      client->state = Done;
+    }
+    else if (strncmp(buffer, "ERROR", strlen("ERROR")) == 0 && client->inFlight > 0) {
+      client->rejected++;
+      answer(client, now);
+    }
+    else if (strncmp(buffer, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
+      client->frames++;
+      char* rows = buffer + strlen("DISPLAY\n");
+      rows += (*rows == '\n');
+      char* newline = strchr(rows, '\n');
+      char* me = strchr(rows, '@');
+      client->stride = (newline == NULL) ? 0 : newline - rows + 1;
+      int at = (me == NULL) ? -1 : me - rows;
+      if (client->inFlight > 0 && client->at >= 0 && at >= 0
+          && at - client->at == client->step[client->oldest]) {
+        answer(client, now);
+      }
+      client->at = at;
+      if (client->state == Joining && client->joined) {
+        const uint64_t period = 1e9 / rate;
+        client->state = Playing;
+        client->nextKey = now + period * (client - clients) / numClients;
+      }
+    }
+  }
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    perror("recvfrom");
+  }
+}
+
+/* ***************** answer ********************** */
+/* A player's oldest unanswered keystroke is answered now: record its round trip */
+static void answer(client_t* client, const uint64_t now)
+{
+  hist_record(client->rtt, now - client->sentAt[client->oldest]);
+  hist_record(total, now - client->sentAt[client->oldest]);
+  client->oldest = (client->oldest + 1) % MaxInFlight;
+  client->inFlight--;
+  client->answered++;
+}
+
+/* ***************** expire ********************** */
+/* Counts as lost each of a player's keystrokes unanswered for longer than LostNanos */
+static void expire(client_t* client, const uint64_t now)
+{
+  while (client->inFlight > 0 && now - client->sentAt[client->oldest] > LostNanos) {
+    client->oldest = (client->oldest + 1) % MaxInFlight;
+    client->inFlight--;
+    client->lost++;
+  }
+}
+
+/* ***************** report ********************** */
+/*
+ * Prints a line for each player: keystrokes sent, answered (and of those, rejected), lost,
+ *   round trip percentiles in milliseconds, and frames received
+ */
+static void report()
+{
+  printf("player    sent answered rejected    lost  loss%%   p50 ms   p99 ms   max ms   frames\n");
+  for (int i = 0; i < numClients; i++) {
+    client_t* client = &clients[i];
+    if (client->refused) {
+      printf("%6d refused\n", i);
+      continue;
+    }
+    // unanswered keystrokes still in flight at the end were never answered
+    client->lost += client->inFlight;
+    client->inFlight = 0;
+    printf("%6d %7lu %8lu %8lu %7lu %6.2f %8.2f %8.2f %8.2f %8lu\n", i, client->sent,
+           client->answered, client->rejected, client->lost,
+           client->sent > 0 ? 100.0 * client->lost / client->sent : 0,
+           hist_percentile(client->rtt, 50) / 1e6, hist_percentile(client->rtt, 99) / 1e6,
+           hist_max(client->rtt) / 1e6, client->frames);
+  }
+}
+
+/* ***************** closeClients ********************** */
+/* Closes every player's socket and frees the players */
+static void closeClients()
+{
+  for (int i = 0; i < numClients; i++) {
+    if (clients[i].socket > 0) {
+      close(clients[i].socket);
+    }
+    hist_delete(clients[i].rtt);
+  }
+  mem_free(clients);
+}
@@ -6,21 +6,24 @@
  * Nitya Agarwala, Feb 2022
  */
 
+#define _POSIX_C_SOURCE 200809L  // for rand_r
+
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../grid/grid.h"
-#include "counters.h"
 #include "file.h"
-#include "hashtable.h"
+#include "intcounters.h"
+#include "intmap.h"
+#include "intset.h"
 #include "mem.h"
-#include "set.h"
 
 /**************** file-local global variables ****************/
 /* none */
 static const int MaxNameLength = 50;
+enum { MaxIDs = 26 };  // players are lettered A to Z
 
 /**************** global types ****************/
 typedef struct player {
@@ -29,7 +32,7 @@ typedef struct player {
   int purse;
   int recentGoldCollected;
   int currCoor;
-  set_t* seenBefore;
+  char* seen;  // one flag per grid location: 1 if the player has seen it
 } player_t;
 
 /**************** local types ****************/
@@ -39,22 +42,28 @@ typedef struct playerSwap {
   bool swapped;
 } player_swapstruct;
 
+typedef struct playerMark {
+  char* overlay;
+  int gridSize;
+} player_markstruct;
+
 // function prototypes
-player_t* player_new(char* name, grid_t* grid, hashtable_t* allPlayers,
-  int* numGoldLeft, counters_t* gold, int numPlayers);
-bool player_updateCoordinate(player_t* player, hashtable_t* allPlayers,
-  grid_t* grid, counters_t* gold, int newCoor);
-bool player_moveRegular(player_t* player, char move, hashtable_t* allPlayers,
-  grid_t* grid, counters_t* gold, int* numGoldLeft);
-bool player_moveCapital(player_t* player, char move, hashtable_t* allPlayers,
-  grid_t* grid, counters_t* gold, int* numGoldLeft);
-bool player_collectGold(player_t* player, int* numGoldLeft, counters_t* gold);
-bool player_swapLocations(player_t* currPlayer, hashtable_t* allPlayers, int newCoor);
-bool player_quit(const char* address, hashtable_t* allPlayers, 
-  counters_t* gold,int* numGoldLeft);
+player_t* player_new(char* name, grid_t* grid, intmap_t* allPlayers,
+  int* numGoldLeft, intcounters_t* gold, int numPlayers, unsigned int* seed);
+bool player_updateCoordinate(player_t* player, intmap_t* allPlayers,
+  grid_t* grid, intcounters_t* gold, int newCoor);
+bool player_moveRegular(player_t* player, char move, intmap_t* allPlayers,
+  grid_t* grid, intcounters_t* gold, int* numGoldLeft);
+bool player_moveCapital(player_t* player, char move, intmap_t* allPlayers,
+  grid_t* grid, intcounters_t* gold, int* numGoldLeft);
+bool player_collectGold(player_t* player, int* numGoldLeft, intcounters_t* gold);
+bool player_swapLocations(player_t* currPlayer, intmap_t* allPlayers, int newCoor);
+bool player_quit(const uint64_t address, intmap_t* allPlayers, 
+  intcounters_t* gold,int* numGoldLeft);
 void player_delete(player_t* player);
-char* player_summary(hashtable_t* allPlayers);
-set_t* player_locations(hashtable_t* allPlayers);
+char* player_summary(intmap_t* allPlayers);
+intset_t* player_locations(intmap_t* allPlayers);
+void player_markLocations(intmap_t* allPlayers, grid_t* grid, char* overlay);
 void player_print(player_t* player);
 void itemPrint2(FILE* fp, const char* key, void* item);
 
@@ -63,31 +72,34 @@ int player_getCurrCoor(player_t* player);
 char* player_getID(player_t* player);
 int player_getpurse(player_t* player);
 int player_getRecentGold(player_t* player);
-set_t* player_getSeenBefore(player_t* player);
-void player_setSeenBefore(player_t* player, set_t* set);
+char* player_getSeen(player_t* player);
 
 /**************** local functions ****************/
 /* not visible outside this file */
-static void swap_helper(void* arg, const char* key, void* item);
-static void summary_helper(void* arg, const char* key, void* item);
-static void location_helper(void* arg, const char* key, void* item);
-static void stringfree(void* item);
+static void swap_helper(void* arg, const uint64_t key, void* item);
+static void occupied_helper(void* arg, const uint64_t key, void* item);
+static bool isOccupied(intmap_t* allPlayers, int coor);
+static void order_helper(void* arg, const uint64_t key, void* item);
+static void summary_helper(void* arg, const uint64_t key, void* item);
+static void location_helper(void* arg, const uint64_t key, void* item);
+static void mark_helper(void* arg, const uint64_t key, void* item);
 
 /**************** player_new ****************/
 /* see player.h for description */
-player_t* player_new(char* name, grid_t* grid, hashtable_t* allPlayers, 
-                            int* numGoldLeft, counters_t* gold, int numPlayers)
+player_t* player_new(char* name, grid_t* grid, intmap_t* allPlayers, 
+                            int* numGoldLeft, intcounters_t* gold, int numPlayers, unsigned int* seed)
 {
   mem_assert(name, "name provided was null");
   mem_assert(grid, "grid provided was null");
   mem_assert(gold, "gold provided was null");
+  mem_assert(seed, "seed provided was null");
   player_t* player = mem_malloc(sizeof(player_t));
   if (player == NULL) {
     return NULL;
   }
   int intID = 65 + numPlayers;
   char ID = (char)intID;
-  char* pID = malloc(2);
+  char* pID = mem_malloc(2);
   sprintf(pID, "%c", ID);
   player->pID = pID;
 
@@ -115,50 +127,44 @@ player_t* player_new(char* name, grid_t* grid, hashtable_t* allPlayers,
   strcpy(player->name, name);
 
   // set to random coordinate within grid!!!
-  int coor = rand() % (grid_getNumberRows(grid) * grid_getNumberRows(grid));
-  while (!grid_isOpen(grid, coor)) {
-    coor = rand() % (grid_getNumberRows(grid) * grid_getNumberRows(grid));
+  // (a spot another player stands on will not do: there is no spot of ours to swap them to)
+  int coor = rand_r(seed) % (grid_getNumberRows(grid) * grid_getNumberRows(grid));
+  while (!grid_isOpen(grid, coor) || isOccupied(allPlayers, coor)) {
+    coor = rand_r(seed) % (grid_getNumberRows(grid) * grid_getNumberRows(grid));
   }
   player->purse = 0;
-
-  if (!player_swapLocations(player, allPlayers, coor)) {
-    player->currCoor = coor;
-    player_collectGold(player, numGoldLeft, gold);
-    player->recentGoldCollected = player->purse;
-  }
-
-  player->seenBefore = set_new();
-  if (player->seenBefore == NULL) {
-    // error allocating memory for name;
+  player->currCoor = coor;
+  player_collectGold(player, numGoldLeft, gold);
+  player->recentGoldCollected = player->purse;
+
+  int gridSize = grid_getNumberRows(grid) * grid_getNumberCols(grid);
+  player->seen = mem_calloc(gridSize, sizeof(char));
+  if (player->seen == NULL) {
+    // error allocating memory for seen map;
     // cleanup and return error
+    mem_free(player->name);
     mem_free(player);
     return NULL;
   }
+  grid_updateSeen(grid, player->currCoor, player->seen);
   return player;
 }
 
 /**************** player_updateCoordinate ****************/
 /* see player.h for description */
-bool player_updateCoordinate(player_t* player, hashtable_t* allPlayers, 
-                                  grid_t* grid, counters_t* gold, int newCoor)
+bool player_updateCoordinate(player_t* player, intmap_t* allPlayers, 
+                                  grid_t* grid, intcounters_t* gold, int newCoor)
 {
   player->currCoor = newCoor;
-  set_t* playerLocations = player_locations(allPlayers);
-  set_t* newSeenBefore = grid_updateView(grid, newCoor, player->seenBefore, playerLocations, gold);
-  player->seenBefore = newSeenBefore;
-  set_delete(playerLocations, stringfree);
+  // marks in place; no sets are built on the move path
+  grid_updateSeen(grid, newCoor, player->seen);
   return true;
 }
 
-static void stringfree(void* item)
-{
-  free(item);
-}
-
 /**************** player_moveRegular ****************/
 /* see player.h for description */
-bool player_moveRegular(player_t* player, char move, hashtable_t* allPlayers, 
-                              grid_t* grid, counters_t* gold, int* numGoldLeft)
+bool player_moveRegular(player_t* player, char move, intmap_t* allPlayers, 
+                              grid_t* grid, intcounters_t* gold, int* numGoldLeft)
 {
   int newCoor;
   int cols = grid_getNumberCols(grid);
@@ -235,8 +241,8 @@ bool player_moveRegular(player_t* player, char move, hashtable_t* allPlayers,
 
 /**************** player_moveCapital ****************/
 /* see player.h for description */
-bool player_moveCapital(player_t* player, char move, hashtable_t* allPlayers, 
-                              grid_t* grid, counters_t* gold, int* numGoldLeft)
+bool player_moveCapital(player_t* player, char move, intmap_t* allPlayers, 
+                              grid_t* grid, intcounters_t* gold, int* numGoldLeft)
 {
   int recentGold = 0;  // counts all the gold collected across multiple moves here
   while (true) {
@@ -310,14 +316,14 @@ bool player_moveCapital(player_t* player, char move, hashtable_t* allPlayers,
 
 /**************** player_collectGold ****************/
 /* see player.h for description */
-bool player_collectGold(player_t* player, int* numGoldLeft, counters_t* gold)
+bool player_collectGold(player_t* player, int* numGoldLeft, intcounters_t* gold)
 {
-  int newGold = counters_get(gold, player->currCoor);
+  int newGold = intcounters_get(gold, player->currCoor);
   if (newGold > 0 && newGold != 251) {
     player->purse = player->purse + newGold;
     *numGoldLeft -= newGold;
     player->recentGoldCollected = newGold;
-    counters_set(gold, player->currCoor, 251);
+    intcounters_set(gold, player->currCoor, 251);
     return true;
   }
   player->recentGoldCollected = 0;
@@ -326,11 +332,11 @@ bool player_collectGold(player_t* player, int* numGoldLeft, counters_t* gold)
 
 /**************** player_swapLocations ****************/
 /* see player.h for description */
-bool player_swapLocations(player_t* currPlayer, hashtable_t* allPlayers, int newCoor)
+bool player_swapLocations(player_t* currPlayer, intmap_t* allPlayers, int newCoor)
 {
   struct playerSwap args = {currPlayer, newCoor, false};
   if (allPlayers != NULL) {
-    hashtable_iterate(allPlayers, &args, swap_helper);
+    intmap_iterate(allPlayers, &args, swap_helper);
   }
 
   return args.swapped;
@@ -338,7 +344,7 @@ bool player_swapLocations(player_t* currPlayer, hashtable_t* allPlayers, int new
 
 /**************** swap_helper ****************/
 /* swaps players if one at the same location is found */
-static void swap_helper(void* arg, const char* key, void* item)
+static void swap_helper(void* arg, const uint64_t key, void* item)
 {
   struct playerSwap* args = (struct playerSwap*)arg;
   player_t* currPlayer = args->player;
@@ -351,19 +357,41 @@ static void swap_helper(void* arg, const char* key, void* item)
   }
 }
 
+/**************** isOccupied ****************/
+/* true if some player in allPlayers (which may be NULL) stands at coor */
+static bool isOccupied(intmap_t* allPlayers, int coor)
+{
+  struct playerSwap args = {NULL, coor, false};
+  if (allPlayers != NULL) {
+    intmap_iterate(allPlayers, &args, occupied_helper);
+  }
+  return args.swapped;
+}
+
+/**************** occupied_helper ****************/
+/* notes whether a player stands at the location sought, without moving anyone */
+static void occupied_helper(void* arg, const uint64_t key, void* item)
+{
+  struct playerSwap* args = (struct playerSwap*)arg;
+  player_t* player = item;
+  if (player != NULL && player->currCoor == args->newCoor) {
+    args->swapped = true;
+  }
+}
+
 /**************** player_quit ****************/
 /* see player.h for description */
-bool player_quit(const char* address, hashtable_t* allPlayers, counters_t* gold, int* numGoldLeft)
+bool player_quit(const uint64_t address, intmap_t* allPlayers, intcounters_t* gold, int* numGoldLeft)
 {
-  player_t* player = hashtable_find(allPlayers, address);
+  player_t* player = intmap_find(allPlayers, address);
   if (player == NULL) {
     return false;
   }
-  int goldOnLocation = counters_get(gold, player->currCoor);
+  int goldOnLocation = intcounters_get(gold, player->currCoor);
   if (goldOnLocation ==251){
     goldOnLocation = 0;
   }
-  counters_set(gold, player->currCoor, goldOnLocation + player->purse);
+  intcounters_set(gold, player->currCoor, goldOnLocation + player->purse);
   *numGoldLeft += player->purse;
   player->currCoor = -1;  // removes player from everyone's map
   return true;
@@ -375,23 +403,38 @@ void player_delete(player_t* player)
 {
   mem_free(player->pID);
   mem_free(player->name);
-  set_delete(player->seenBefore, NULL);
+  mem_free(player->seen);
   mem_free(player);
 }
 
 /**************** player_summary ****************/
 /* see player.h for description */
-char* player_summary(hashtable_t* allPlayers)
+char* player_summary(intmap_t* allPlayers)
 {
-  char* summary = malloc(1000000);
+  char* summary = mem_malloc(1000000);
   strcpy(summary, "");
-  hashtable_iterate(allPlayers, &summary, summary_helper);
+  player_t* byID[MaxIDs] = { NULL };  // in ID order, whatever order the map holds them in
+  intmap_iterate(allPlayers, byID, order_helper);
+  for (int i = 0; i < MaxIDs; i++) {
+    summary_helper(&summary, 0, byID[i]);
+  }
   return summary;
 }
 
+/**************** order_helper ****************/
+/* puts each player in its place, by ID */
+static void order_helper(void* arg, const uint64_t key, void* item)
+{
+  player_t** byID = arg;
+  player_t* player = item;
+  if (player != NULL && player->pID[0] >= 'A' && player->pID[0] < 'A' + MaxIDs) {
+    byID[player->pID[0] - 'A'] = player;
+  }
+}
+
 /**************** summary_helper ****************/
 /* helps add the summary of each player */
-static void summary_helper(void* arg, const char* key, void* item)
+static void summary_helper(void* arg, const uint64_t key, void* item)
 {
   player_t* player = item;
   if (player != NULL) {
@@ -412,27 +455,42 @@ static void summary_helper(void* arg, const char* key, void* item)
 
 /**************** player_locations ****************/
 /* see player.h for description */
-set_t* player_locations(hashtable_t* allPlayers)
+intset_t* player_locations(intmap_t* allPlayers)
 {
-  set_t* locationSet = set_new();
-  hashtable_iterate(allPlayers, locationSet, location_helper);
+  intset_t* locationSet = intset_new();
+  intmap_iterate(allPlayers, locationSet, location_helper);
   return locationSet;
 }
 
 /**************** location_Helper ****************/
 /* helps add the location of each player to the locationSet */
-static void location_helper(void* arg, const char* key, void* item)
+static void location_helper(void* arg, const uint64_t key, void* item)
 {
-  set_t* locationSet = arg;
+  intset_t* locationSet = arg;
   player_t* player = item;
   if (player != NULL) {
-    char* coorString = malloc(11);
-    sprintf(coorString, "%d", player->currCoor);
-    char* pIDString = malloc(2);
-    // so you need a way to store things
-    strcpy(pIDString, player->pID);
-    set_insert(locationSet, coorString, pIDString);
-    free(coorString);
+    intset_insert(locationSet, player->currCoor, player->pID);  // the ID is the player's
+  }
+}
+
+/**************** player_markLocations ****************/
+/* see player.h for description */
+void player_markLocations(intmap_t* allPlayers, grid_t* grid, char* overlay)
+{
+  struct playerMark args = {overlay, grid_getNumberRows(grid) * grid_getNumberCols(grid)};
+  if (overlay != NULL) {
+    intmap_iterate(allPlayers, &args, mark_helper);
+  }
+}
+
+/**************** mark_helper ****************/
+/* writes the ID of each player still on the map into the overlay */
+static void mark_helper(void* arg, const uint64_t key, void* item)
+{
+  struct playerMark* args = arg;
+  player_t* player = item;
+  if (player != NULL && player->currCoor >= 0 && player->currCoor < args->gridSize) {
+    args->overlay[player->currCoor] = player->pID[0];
   }
 }
 
@@ -469,19 +527,12 @@ int player_getRecentGold(player_t* player)
   return player->recentGoldCollected;
 }
 
-set_t* player_getSeenBefore(player_t* player)
+char* player_getSeen(player_t* player)
 {
   if (player == NULL) {
     return NULL;
   }
-  return player->seenBefore;
-}
-
-void player_setSeenBefore(player_t* player, set_t* set)
-{
-  if (set != NULL) {
-    player->seenBefore = set;
-  }
+  return player->seen;
 }
 
 void player_print(player_t* player)
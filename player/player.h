@@ -12,11 +12,11 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "../grid/grid.h"
-#include "../libcs50/counters.h"
 #include "../libcs50/file.h"
-#include "../libcs50/hashtable.h"
+#include "../libcs50/intcounters.h"
+#include "../libcs50/intmap.h"
+#include "../libcs50/intset.h"
 #include "../libcs50/mem.h"
-#include "../libcs50/set.h"
 
 /**************** global types ****************/
 typedef struct player player_t;  // opaque to users of the module
@@ -27,6 +27,9 @@ typedef struct player player_t;  // opaque to users of the module
 /**************** player_new ****************/
 /* Create a new initialized player structure.
  *
+ * Caller provides:
+ *   seed, the state of the game's random sequence (see rand_r); it is advanced
+ *   as the player's starting coordinate is drawn.
  * We return:
  *   pointer to a new player_t; NULL if error. 
  * We guarantee:
@@ -34,7 +37,7 @@ typedef struct player player_t;  // opaque to users of the module
  * Caller is responsible for:
  *   later calling player_delete();
  */
-player_t* player_new(char* name, grid_t* grid, hashtable_t* allPlayers, int* numGoldLeft, counters_t* gold, int numPlayers);
+player_t* player_new(char* name, grid_t* grid, intmap_t* allPlayers, int* numGoldLeft, intcounters_t* gold, int numPlayers, unsigned int* seed);
 
 /**************** player_updateCoordinate ****************/
 /* Update the coordinate of a player
@@ -48,9 +51,10 @@ player_t* player_new(char* name, grid_t* grid, hashtable_t* allPlayers, int* num
  * We guarantee:
  *   the player's coordinate will be updated if success
  * We do:
- *   update the player's seenBefore set to add the updated coordinate
+ *   mark everything visible from the new coordinate in the player's
+ *   seen map (see grid_updateSeen)
  */
-bool player_updateCoordinate(player_t* player, hashtable_t* allPlayers, grid_t* grid, counters_t* gold, int newCoor);
+bool player_updateCoordinate(player_t* player, intmap_t* allPlayers, grid_t* grid, intcounters_t* gold, int newCoor);
 
 /**************** player_moveRegular ****************/
 /* Allow player to move once with lowercase key press
@@ -67,7 +71,7 @@ bool player_updateCoordinate(player_t* player, hashtable_t* allPlayers, grid_t*
  *   true if success
  *   false if any error or move was invalid
  */
-bool player_moveRegular(player_t* player, char move, hashtable_t* allPlayers, grid_t* grid, counters_t* gold, int* numGoldLeft);
+bool player_moveRegular(player_t* player, char move, intmap_t* allPlayers, grid_t* grid, intcounters_t* gold, int* numGoldLeft);
 
 /**************** player_moveCapital ****************/
 /* Allow player to move until possible once with uppercase key press
@@ -85,7 +89,7 @@ bool player_moveRegular(player_t* player, char move, hashtable_t* allPlayers, gr
  *   true if success
  *   false if any error or move was invalid
  */
-bool player_moveCapital(player_t* player, char move, hashtable_t* allPlayers, grid_t* grid, counters_t* gold, int* numGoldLeft);
+bool player_moveCapital(player_t* player, char move, intmap_t* allPlayers, grid_t* grid, intcounters_t* gold, int* numGoldLeft);
 
 /**************** player_collectGold ****************/
 /* Collect gold in new location of there is any
@@ -103,14 +107,14 @@ bool player_moveCapital(player_t* player, char move, hashtable_t* allPlayers, gr
  *   true if we colelcted gold
  *   false if no gold was found at player's location
  */
-bool player_collectGold(player_t* player, int* numGoldLeft, counters_t* gold);
+bool player_collectGold(player_t* player, int* numGoldLeft, intcounters_t* gold);
 
 /**************** player_swapLocations ****************/
 /* if there is another player in that locatin, swap the location
  *
  * Caller provides:
  *   valid pointer to current player, 
- *   pointer to hashtable with all player
+ *   pointer to the intmap with all players
  *   int of new location player is trying to move to
  * We do:
  *   if another player exists in that location
@@ -119,13 +123,13 @@ bool player_collectGold(player_t* player, int* numGoldLeft, counters_t* gold);
  *   true if we swapped a player
  *   false if no other player was found in the new coordinate
  */
-bool player_swapLocations(player_t* currPlayer, hashtable_t* allPlayers, int newCoor);
+bool player_swapLocations(player_t* currPlayer, intmap_t* allPlayers, int newCoor);
 
 /**************** player_quit ****************/
-/* Deletes a player when it quits and sets that item in hashtable to null
+/* Takes a player who quits off the grid, leaving their purse where they stood
  *
  * Caller provides:
- *   a valid pointer to a player and hashtable with all players
+ *   the address of a player (see message_addrKey) and the intmap with all players
  * We do:
  *  find player with given address
  *  call player_delete on the player
@@ -134,32 +138,48 @@ bool player_swapLocations(player_t* currPlayer, hashtable_t* allPlayers, int new
  *  true if player was found an deleted
  *  false if player was not found
  */
-bool player_quit(const char* address, hashtable_t* allPlayers, counters_t* gold, int* numGoldLeft);
+bool player_quit(const uint64_t address, intmap_t* allPlayers, intcounters_t* gold, int* numGoldLeft);
 
 
 /**************** player_locations ****************/
 /* Prepapres a set of (int player location, char player IDs)
  *
  * Caller provides:
- *   a valid pointer to hashtable with all players
+ *   a valid pointer to the intmap with all players
  * We do:
- *   iterate over hashtable and add each players location and ID to a set
+ *   iterate over the intmap and add each players location and ID to a set
+ *   (players who quit are skipped)
  * We return:
- *   the set of all player locations and IDs
+ *   the sparse set of all player locations and IDs; the IDs belong to the
+ *   players, so the caller deletes the set with a NULL itemdelete
  */
-set_t* player_locations(hashtable_t* allPlayers);
+intset_t* player_locations(intmap_t* allPlayers);
 
-/**************** player_locations ****************/
+/**************** player_markLocations ****************/
+/* Writes every player's ID symbol into a per-location overlay
+ *
+ * Caller provides:
+ *   a valid pointer to the intmap with all players,
+ *   the grid the players are on,
+ *   a char array with one entry per grid location
+ * We do:
+ *   iterate over the intmap and store each player's ID character at
+ *   the player's location in the overlay; players who quit are skipped.
+ *   Allocates no memory, unlike player_locations.
+ */
+void player_markLocations(intmap_t* allPlayers, grid_t* grid, char* overlay);
+
+/**************** player_summary ****************/
 /* Prepares summary of all players and their gold
  *
  * Caller provides:
- *   a valid pointer to hashtable with all players
+ *   a valid pointer to the intmap with all players
  * We do:
- *   iterate over hashtable and add each player's summary
+ *   iterate over the intmap and add each player's summary
  * We return:
  *   the character pointer to the summary
  */
-char* player_summary(hashtable_t* allPlayers);
+char* player_summary(intmap_t* allPlayers);
 
 /**************** player_delete ****************/
 /* Deletes a player struct and frees all associated memory
@@ -179,6 +199,5 @@ int player_getCurrCoor(player_t* player);
 char* player_getID(player_t* player);
 int player_getpurse(player_t* player);
 int player_getRecentGold(player_t* player);
-set_t* player_getSeenBefore(player_t* player);
-void player_setSeenBefore(player_t* player, set_t* set);
+char* player_getSeen(player_t* player);
 void player_print(player_t* player);
\ No newline at end of file
@@ -12,8 +12,7 @@
 #include "player.h"
 
 // static function prototypes
-void itemPrint(FILE* fp, const char* key, void* item);
-void freeString(void* item);
+void itemPrint(FILE* fp, const int key, void* item);
 void deletePlayer(void* item);
 
 /* **************************************** */
@@ -28,30 +27,31 @@ int main()
   // creating a simple gold counter for testing
   int numPlayers = 0;
   int numGoldLeft = 20;
-  counters_t* gold = counters_new();
-  counters_set(gold, 6, 5);
-  counters_set(gold, 8, 5);
-  counters_set(gold, 13, 5);
-  counters_set(gold, 17, 5);
+  intcounters_t* gold = intcounters_newDense(grid_getNumberRows(grid) * grid_getNumberCols(grid));
+  intcounters_set(gold, 6, 5);
+  intcounters_set(gold, 8, 5);
+  intcounters_set(gold, 13, 5);
+  intcounters_set(gold, 17, 5);
 
-  set_t* allLocations = grid_displaySpectator(grid, NULL, gold);
+  intset_t* allLocations = grid_displaySpectator(grid, NULL, gold);
   char* printString = grid_print(grid, allLocations);
   printf("\n%s", printString);
-  set_delete(allLocations, NULL);
+  intset_delete(allLocations, NULL);
   mem_free(printString);
 
-  // Create a hashtable of players for testing
-  hashtable_t* allPlayers = hashtable_new(10);
+  // Create a map of players for testing
+  intmap_t* allPlayers = intmap_new(10);
 
   // Testing player_new
-  p1 = player_new("Alice", grid, allPlayers, &numGoldLeft, gold, numPlayers);
+  unsigned int seed = 1;  // random sequence for starting coordinates
+  p1 = player_new("Alice", grid, allPlayers, &numGoldLeft, gold, numPlayers, &seed);
   numPlayers++;
-  p2 = player_new("Bob", grid, allPlayers, &numGoldLeft, gold, numPlayers);
+  p2 = player_new("Bob", grid, allPlayers, &numGoldLeft, gold, numPlayers, &seed);
   numPlayers++;
 
-  // Add both players to the hashtable
-  hashtable_insert(allPlayers, "1", p1);
-  hashtable_insert(allPlayers, "2", p2);
+  // Add both players to the map, keyed as if by address
+  intmap_insert(allPlayers, 1, p1);
+  intmap_insert(allPlayers, 2, p2);
 
   // Print player 1
   printf("%s\n", "PLAYER 1:");
@@ -91,14 +91,14 @@ int main()
   player_print(p2);
 
   // Testing player_locations
-  set_t* locations = player_locations(allPlayers);
+  intset_t* locations = player_locations(allPlayers);
   printf("\n%s\n", "LOCATIONS SET:");
-  set_print(locations, stdout, itemPrint);
+  intset_print(locations, stdout, itemPrint);
 
   // Testing player_summary
   char* sum = player_summary(allPlayers);
   printf("\n\nSUMMARY: \n%s\n", sum);
-  free(sum);
+  mem_free(sum);
 
   // printing the grid
   allLocations = grid_displaySpectator(grid, NULL, gold);
@@ -107,16 +107,16 @@ int main()
 
   // Testing player_delete
   mem_free(printString);
-  set_delete(locations, freeString);
-  set_delete(allLocations, NULL);
-  counters_delete(gold);
+  intset_delete(locations, NULL);
+  intset_delete(allLocations, NULL);
+  intcounters_delete(gold);
   grid_delete(grid);
-  hashtable_delete(allPlayers, deletePlayer);
+  intmap_delete(allPlayers, deletePlayer);
   exit(0);
 }
 
 /******** delete_player *********/
-/* deletes each player in a hashtable */
+/* deletes each player in a map */
 void deletePlayer(void* item)
 {
   player_t* player = item;
@@ -125,15 +125,7 @@ void deletePlayer(void* item)
 
 /******** itemPrint *********/
 /* prints each location and player in a set */
-void itemPrint(FILE* fp, const char* key, void* item)
+void itemPrint(FILE* fp, const int key, void* item)
 {
-  fprintf(fp, " location:%s player:%s ", key, (char*)item);
-}
-
-/******** freeString *********/
-/* free character pointer item in a set */
-void freeString(void* item){
-  if (item!=NULL) {
-    free(item);
-  }
+  fprintf(fp, " location:%d player:%s ", key, (char*)item);
 }
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "game/game.h"
+#include "grid/grid.h"
+#include "libcs50/mem.h"
+#include "support/hist.h"
+#include "support/journal.h"
+#include "support/message.h"
+#include "support/pool.h"
+
+/**
+ * replay - plays a session recorded by ./server -j again, as fast as it can, with no network
+ *
+ * usage: ./replay [-p renderers] journal [map.txt ...]
+ *   where journal is a file written by ./server -j
+ *   where renderers is the number of extra threads that help render each update, and
+ *     precompute each map's visibility (default: one less than the number of processors)
+ *   where each map.txt replaces the journaled map with the same contents (the same hash),
+ *     for a journal recorded elsewhere; by default each map is read from its journaled path
+ *
+ * The whole journal is read into memory first, then its messages are handed to the games
+ * in the order they were played, one after another on this thread.  The games' replies go
+ * nowhere: the message module is never initialized, so sending is a no-op.  A game is
+ * deterministic, so each replayed game ends exactly as the recorded one did.
+ *
+ * Prints to stdout how fast the messages were replayed, how long each stage took, and how
+ * every game ended, so that a replay is both a benchmark and a regression test.
+ */
+
+/**************** global types ****************/
+// one table of the recorded server
+typedef struct table {
+  char* mapPath;              // as journaled
+  grid_t* grid;               // shared by every table with the same map
+  uint64_t hash;
+  game_t* game;               // the game in progress; NULL between games
+  int gamesEnded;
+  int messages;               // messages replayed to this table
+} table_t;
+
+// one record, kept in memory until the replay
+typedef struct record {
+  char type;
+  int table;
+  unsigned int seed;
+  int slot;
+  char* text;                 // the message ('K'), in the texts block
+} record_t;
+
+/**************** local variables ****************/
+static table_t* tables;
+static int numTables;
+static record_t* records;
+static int numRecords;
+static char* texts;                      // every message, one after another
+static int numSlots;                     // clients seen in the journal
+
+/* *********************************************************************** */
+/* Private function prototypes */
+static int parseArgs(const int argc, char* argv[], int* renderers);
+static bool loadJournal(const char* path);
+static bool loadMaps(char** maps, const int numMaps, pool_t* pool);
+static void replay(pool_t* pool, game_timers_t* timers);
+static addr_t slotAddress(const int slot);
+static void deleteAll();
+
+/* ***************** main ********************** */
+int main(const int argc, char* argv[])
+{
+  int renderers;
+  int arg = parseArgs(argc, argv, &renderers);
+  if (arg == 0) {
+    exit(1);
+  }
+  if (!loadJournal(argv[arg])) {
+    exit(1);
+  }
+  pool_t* pool = pool_new(renderers);
+  if (pool == NULL) {
+    fprintf(stderr, "Failed to start render threads. Exiting...\n");
+    exit(1);
+  }
+  if (!loadMaps(argv + arg + 1, argc - arg - 1, pool)) {
+    exit(1);
+  }
+  printf("%s: %d games, %d records from %d clients\n", argv[arg], numTables, numRecords, numSlots);
+
+  game_timers_t timers = { hist_new(), hist_new(), NULL };  // nothing is really sent
+  uint64_t start = hist_now();
+  replay(pool, &timers);
+  double seconds = (hist_now() - start) / 1e9;
+
+  int messages = 0;
+  for (int t = 0; t < numTables; t++) {
+    messages += tables[t].messages;
+  }
+  printf("replayed %d messages in %.3f s (%.0f messages/s)\n", messages, seconds,
+         seconds > 0 ? messages / seconds : 0);
+  hist_print(timers.move, stdout, "move");
+  hist_print(timers.render, stdout, "render");
+  for (int t = 0; t < numTables; t++) {
+    table_t* table = &tables[t];
+    printf("game %d on %s: %d messages, %d games ended", t, table->mapPath, table->messages,
+           table->gamesEnded);
+    if (table->game != NULL) {
+      printf("; %d players and %d spectators still in the last, with %d gold left",
+             game_numActivePlayers(table->game), game_numSpectators(table->game),
+             game_goldLeft(table->game));
+    }
+    printf("\n");
+  }
+
+  hist_delete(timers.move);
+  hist_delete(timers.render);
+  deleteAll();
+  pool_delete(pool);
+  exit(0);
+}
+
+/* ***************** parseArgs ********************** */
+/*
+ * reads the -p option, and checks that a journal is named
+ *
+ * We return:
+ *    0 if the arguments are invalid (after printing why to stderr)
+ *    otherwise the index in argv of the journal; renderers is filled in
+ */
+static int parseArgs(const int argc, char* argv[], int* renderers)
+{
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  *renderers = (processors > 1) ? processors - 1 : 0;
+  int arg = 1;
+  if (arg < argc - 1 && strcmp(argv[arg], "-p") == 0) {
+    char* end;
+    long value = strtol(argv[arg + 1], &end, 10);
+    if (*argv[arg + 1] == '\0' || *end != '\0' || value < 0) {
+      fprintf(stderr, "Option -p needs a non-negative integer.\n");
+      return 0;
+    }
+    *renderers = value;
+    arg += 2;
+  }
+  if (arg >= argc) {
+    fprintf(stderr, "usage: ./replay [-p renderers] journal [map.txt ...]\n");
+    return 0;
+  }
+  return arg;
+}
+
+/* ***************** loadJournal ********************** */
+/*
+ * Reads the whole journal into records, texts and tables
+ *
+ * We return:
+ *   false if the journal cannot be read or is damaged (after printing why to stderr)
+ *
+ * Pseudocode:
+ *   read the journal once to count the records, the tables and the message characters
+ *   allocate room for all of them
+ *   read it again, keeping each record; a map record fills in its table
+ */
+static bool loadJournal(const char* path)
+{
+  journal_t* journal = journal_open(path);
+  if (journal == NULL) {
+    fprintf(stderr, "%s is not a readable journal\n", path);
+    return false;
+  }
+  journal_record_t record;
+  size_t textBytes = 0;
+  while (journal_next(journal, &record)) {
+    numRecords++;
+    if (record.table >= numTables) {
+      numTables = record.table + 1;
+    }
+    if (record.type == 'K') {
+      textBytes += strlen(record.text) + 1;
+    }
+  }
+  if (!journal_close(journal)) {
+    fprintf(stderr, "%s is damaged after %d records\n", path, numRecords);
+    return false;
+  }
+
+  tables = mem_calloc_assert(numTables + 1, sizeof(table_t), "Out of memory for tables.\n");
+  records = mem_calloc_assert(numRecords + 1, sizeof(record_t), "Out of memory for records.\n");
+  texts = mem_malloc_assert(textBytes + 1, "Out of memory for messages.\n");
+  journal = journal_open(path);
+  char* text = texts;
+  for (int r = 0; r < numRecords && journal_next(journal, &record); r++) {
+    records[r].type = record.type;
+    records[r].table = record.table;
+    records[r].seed = record.seed;
+    records[r].slot = record.slot;
+    if (record.type == 'K') {
+      records[r].text = strcpy(text, record.text);
+      text += strlen(text) + 1;
+      if (record.slot >= numSlots) {
+        numSlots = record.slot + 1;
+      }
+    }
+    else if (record.type == 'M') {
+      char* mapPath = mem_malloc_assert(strlen(record.text) + 1, "Out of memory for map path.\n");
+      tables[record.table].mapPath = strcpy(mapPath, record.text);
+      tables[record.table].hash = record.hash;
+    }
+  }
+  journal_close(journal);
+  return true;
+}
+
+/* ***************** loadMaps ********************** */
+/*
+ * Reads every table's map, once for each different map, and precomputes its visibility
+ * as the server did.  A map given on the command line with the same hash as a table's
+ * journaled map takes its place; otherwise the journaled path is read, and must still
+ * hold the same map.
+ *
+ * We return:
+ *   false if a map is missing or differs from the one recorded (after printing why)
+ */
+static bool loadMaps(char** maps, const int numMaps, pool_t* pool)
+{
+  for (int t = 0; t < numTables; t++) {
+    table_t* table = &tables[t];
+    if (table->mapPath == NULL) {
+      fprintf(stderr, "The journal has no map for game %d\n", t);
+      return false;
+    }
+    for (int earlier = 0; earlier < t && table->grid == NULL; earlier++) {
+      if (tables[earlier].hash == table->hash) {
+        table->grid = tables[earlier].grid;
+      }
+    }
+    if (table->grid != NULL) {
+      continue;
+    }
+    char* path = table->mapPath;
+    uint64_t hash;
+    for (int m = 0; m < numMaps; m++) {
+      if (journal_hashFile(maps[m], &hash) && hash == table->hash) {
+        path = maps[m];
+      }
+    }
+    if (!journal_hashFile(path, &hash) || hash != table->hash) {
+      fprintf(stderr, "%s is missing, or is not the map recorded; name the right one "
+              "after the journal\n", path);
+      return false;
+    }
+    if ((table->grid = grid_read(path)) == NULL) {
+      return false;
+    }
+    grid_precomputeVisibility(table->grid, pool, NULL, NULL);
+  }
+  return true;
+}
+
+/* ***************** replay ********************** */
+/*
+ * Plays every record, in order
+ *
+ * Pseudocode:
+ *   for each record,
+ *     if it starts a game, replace the table's game with a new one from the recorded seed
+ *     if it is a message, and the table's game goes on, hand it to the game from the
+ *       client's stand-in address; if that ends the game, delete it
+ */
+static void replay(pool_t* pool, game_timers_t* timers)
+{
+  for (int r = 0; r < numRecords; r++) {
+    table_t* table = &tables[records[r].table];
+    if (records[r].type == 'G') {
+      game_delete(table->game);
+      table->game = mem_assert(game_new(table->grid, records[r].seed, pool, timers),
+                               "Out of memory for game.\n");
+    }
+    else if (records[r].type == 'K' && table->game != NULL) {
+      table->messages++;
+      if (game_handleMessage(table->game, slotAddress(records[r].slot), records[r].text)) {
+        game_delete(table->game);
+        table->game = NULL;
+        table->gamesEnded++;
+      }
+    }
+  }
+}
+
+/* ***************** slotAddress ********************** */
+/*
+ * Makes up an address for a journaled client: every slot gets a different one
+ */
+static addr_t slotAddress(const int slot)
+{
+  addr_t address = message_noAddr();
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl((127u << 24) | ((unsigned)slot >> 16));
+  address.sin_port = htons(slot & 0xffff);
+  return address;
+}
+
+/* ***************** deleteAll ********************** */
+/*
+ * Deletes every game, every grid (once, though tables share them) and the records
+ */
+static void deleteAll()
+{
+  for (int t = 0; t < numTables; t++) {
+    game_delete(tables[t].game);
+    bool shared = false;
+    for (int later = t + 1; later < numTables; later++) {
+      shared = shared || tables[later].grid == tables[t].grid;
+    }
+    if (!shared && tables[t].grid != NULL) {
+      grid_delete(tables[t].grid);
+    }
+    if (tables[t].mapPath != NULL) {
+      mem_free(tables[t].mapPath);
+    }
+  }
+  mem_free(tables);
+  mem_free(records);
+  mem_free(texts);
+}
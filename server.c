@@ -1,93 +1,364 @@
+#define _POSIX_C_SOURCE 200809L  // for nanosleep
+
+#include <arpa/inet.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "game/game.h"
 #include "grid/grid.h"
-#include "libcs50/counters.h"
-#include "libcs50/hashtable.h"
+#include "libcs50/intmap.h"
 #include "libcs50/mem.h"
-#include "player/player.h"
+#include "support/bots.h"
+#include "support/bucket.h"
+#include "support/hist.h"
+#include "support/journal.h"
 #include "support/log.h"
 #include "support/message.h"
+#include "support/pool.h"
+#include "support/rtt.h"
 
 /**
- * server - handles all game logic and message sent from all the clients for the gold nuggets game
+ * server - hosts games of gold nuggets, routing the messages sent from all the clients
+ *   to the game each one belongs to
  *
- * usage: ./server map.txt [seed]
- *   where map.txt is the path to a map file for the game
+ * usage: ./server [-g games] [-w workers] [-p renderers] [-v builders] [-s addresses]
+ *                 [-j journal] [-u socket] [-r keys] [-b bots [-a policy] [-d seconds]]
+ *                 map.txt [map.txt ...] [seed]
+ *   where map.txt is the path to a map file for the game; with several maps, each gets its own games
+ *   where games is the number of games hosted on each map (default 1)
+ *   where workers is the number of threads that play the games (default: one per game, up to
+ *     the number of processors)
+ *   where renderers is the number of extra threads that help a game render the frames of an
+ *     update in parallel (default: one less than the number of processors); 0 renders serially
+ *   where builders is the number of extra threads that precompute each map's visibility at
+ *     startup (default: one less than the number of processors); 0 builds it serially
+ *   where addresses is a comma-separated list of IPv4 addresses, besides localhost, that may
+ *     ask for STATS
+ *   where journal is a file in which to record every game's map, seed and messages, so that
+ *     ./replay can play the session again (see support/journal.h)
+ *   where socket is the path of a Unix datagram socket on which to serve clients on this
+ *     host, instead of UDP (see message_unixTransport in support/message.h)
+ *   where keys is how many keys a second each client may send, after a burst of BurstKeys;
+ *     the lobby drops the KEY and KEYS messages beyond that (default 100, or no limit when
+ *     playing bots; 0 for no limit)
+ *   where bots is a number of simulated players to play the games in this process, with no
+ *     network, for seconds seconds (default 10), choosing moves by the given policy, random
+ *     or greedy (default greedy; see support/bots.h); then the server reports how fast the
+ *     games went, and exits
  *   where seed is the random seed number
  *
+ * With a single game, the server exits when that game ends, as it always has.  With more,
+ * a game that ends is replaced by a fresh game on the same map, and the server runs until
+ * its stdin is closed.
+ *
+ * A worker plays its clients' messages in turn, a KEY or a batch of KEYS from each, so a
+ * client with many waiting does not hold up the others (see takeJob).  A worker that falls
+ * behind cuts back its games' updates in steps, and then turns new players away, until it
+ * catches up (see judgeLoad).
+ *
+ * Typing TIMINGS on stdin prints how long each stage of handling a message takes; the server
+ * prints the same when it exits.  Typing STATS prints the server's counters (see formatStats),
+ * and a client on localhost, or at one of the -s addresses, gets the same text by sending the
+ * message STATS.
+ *
+ * Lobby protocol: a client may prefix PLAY or SPECTATE with "GAME n " to pick game n.
+ * Otherwise PLAY joins the first game with room, and SPECTATE watches game 0.  When more
+ * than one game is hosted, the server tells each new player or spectator "GAME n" first.
+ *
  * Assumption: The map.txt file is a valid map file
  * (see https://github.com/cs50winter2022/nuggets-info/blob/main/REQUIREMENTS.md#valid-maps)
  */
 
+/**************** global types ****************/
+// one hosted game and what the lobby needs to know about it; the worker owns game and
+// seed, and the lobby (main thread) reads the counts the worker leaves
+typedef struct table {
+  const char* mapName;
+  grid_t* grid;               // shared, read-only, by every table on the same map
+  game_t* game;               // game in progress; NULL once over, if games are not restarted
+  unsigned int seed;          // seed of the game in progress
+  int worker;                 // index of the worker that plays this table
+  atomic_int joining;         // PLAYs the lobby has queued here that the worker has not played
+  atomic_int joined;          // as of the worker's last job: players that joined the game,
+  atomic_int players;         //   players still in it,
+  atomic_int spectators;      //   connected spectators,
+  atomic_int goldLeft;        //   and nuggets not yet collected (for STATS)
+} table_t;
+
+// a message waiting for a worker
+#define JobMessageBytes 256   // longer messages are truncated; player names are cut at 50 anyway
+typedef struct job {
+  int table;
+  addr_t from;
+  uint64_t received;          // when the lobby received it (hist_now)
+  uint64_t queued;            // when the lobby queued it
+  int next;                   // the next job of the same client, or the next free job; -1 if none
+  char message[JobMessageBytes];
+} job_t;
+
+// the jobs one client has waiting in a worker, oldest first; a client with none has no queue
+typedef struct queue {
+  uint64_t client;            // its address (see message_addrKey)
+  int first, last;            // its oldest and newest jobs, as indices into the worker's jobs
+  int count;                  // number of them
+  int next;                   // the client after it in turn, or the next free queue; -1 if none
+} queue_t;
+
+// how far a worker's games cut back while the worker falls behind (see judgeLoad); each
+// level does what the one before it does, and more
+typedef enum level {
+  Normal,                     // every update goes to every client at once
+  SlowSpectators,             // spectators get at most ten updates a second
+  HoldUpdates,                // a run of moves in one game sends one update (see game_throttle)
+  RefuseJoins,                // the lobby turns new players away
+  NumLevels
+} level_t;
+
+// a thread playing a fixed share of the tables, fed a job from each client in turn, so a
+// client with many jobs waiting does not hold up those behind it
+typedef struct worker {
+  pthread_t thread;
+  int index;
+  atomic_int level;           // the level_t its games are at, as it last judged
+  atomic_ullong lag;          // smoothed time its jobs waited in the queue, in ns
+  uint64_t busy;              // when the load last reached its level (worker only)
+  pthread_mutex_t lock;       // guards everything below
+  pthread_cond_t ready;       // signalled when a job arrives or stopping is set
+  job_t* jobs;                // QueueLength jobs, each waiting in its client's queue, or free
+  queue_t* queues;            // QueueLength queues, each of a client with jobs waiting, or free
+  intmap_t* waiting;          // client address -> queue_t* of its jobs, if it has any waiting
+  int freeJob, freeQueue;     // the first free job and queue; -1 if none
+  int turn, lastTurn;         // the queues whose turns come next and last; -1 if none
+  int count;                  // number of jobs waiting
+  bool stopping;
+} worker_t;
+
+// the round trips to clients, summed for STATS, and the STATS being written (see formatStats)
+typedef struct rttSummary {
+  uint64_t now;
+  int clients;                // measured lately
+  uint64_t smoothed, jitter;  // sums over them
+  uint64_t max;               // the longest smoothed round trip
+  char* buf;                  // STATS, being written
+  size_t size;
+  size_t* used;
+} rttSummary_t;
+
+// the clients the lobby has not heard from lately, being gathered to forget (see forgetIdle)
+typedef struct idle {
+  uint64_t now;
+  uint64_t* keys;             // their addresses (see message_addrKey)
+  int count;
+} idle_t;
+
+/**************** local variables ****************/
+static table_t* tables;                  // every hosted game
+static int numTables;
+static worker_t* workers;                // threads playing the tables
+static int numWorkers;
+static intmap_t* routes;                 // client address -> int* index of its table (lobby only)
+static intmap_t* rtts;                   // client address -> rtt_t* of the round trips of the
+                                         //   PINGs the lobby sent it (lobby only)
+static intmap_t* buckets;                // client address -> bucket_t* of the keys it sent (lobby only)
+static int keyRate = -1;                 // from -r: keys a second per client; 0 for no limit
+static int limitedClients;               // clients that sent keys too fast (lobby only)
+static unsigned long droppedKeys;        // and the keys the lobby dropped for it
+static uint64_t lastForgot;              // when the lobby last forgot idle clients (lobby only)
+static bool restartGames;                // replace ended games, rather than exiting?
+static pool_t* renderPool;               // shared by all games to render their updates
+static atomic_bool serverOver;           // set by a worker when the last game ends
+// how long, in nanoseconds, each stage of handling a message takes (see printTimings)
+static hist_t* parseTimes;               // the lobby: parsing, routing and queueing a message
+static hist_t* queueTimes;               // waiting in a worker's queue
+static hist_t* keystrokeTimes;           // a KEY or KEYS, from reaching the lobby to its update sent
+static game_timers_t gameTimers;         // moving, rendering and sending, in the games
+static uint64_t startTime;               // when the server started (hist_now), for STATS
+#define MaxStatsAddresses 16
+static struct in_addr statsAddresses[MaxStatsAddresses];  // besides localhost, may ask for STATS
+static int numStatsAddresses;
+static const char* journalPath;          // from -j; NULL if not journaling
+static journal_t* journal;               // every game's map, seeds and messages; NULL if none
+static const char* unixPath;             // from -u; NULL to serve over UDP
+static int botCount;                     // from -b; 0 to play real clients over the network
+static bots_policy_t botPolicy = bots_Greedy;  // from -a
+static int botSeconds = 10;              // from -d
+static bots_t* bots;                     // the simulated players, if botCount > 0
+static atomic_int gamesEnded;            // games that ended, for the simulation's report
+static atomic_int levelsRaised;          // times a worker went up a level (see judgeLoad)
+static unsigned long refusedJoins;       // PLAYs turned away while workers were behind (lobby only)
+static const long BotPauseNanos = 20000; // how long the bots wait when none of them can act
+static const int ProgressSteps = 10;     // progress reports while precomputing a map's visibility
+static const int LogEntries = 4096;      // log entries buffered for the logging thread
+static const size_t LogEntryBytes = 2048;  // longer messages are cut in the log
+static const int QueueLength = 1024;     // jobs each worker can hold before dropping messages
+static const int ClientJobs = 128;       // and jobs one client can have waiting there
+static const float PollSeconds = 0.25;   // how often an idle lobby checks serverOver
+static const uint64_t RttStaleNanos = 10000000000;  // STATS leaves out round trips this old
+static const int DefaultKeyRate = 100;   // keys a second per client, unless -r says otherwise
+static const int BurstKeys = 64;         // keys a client may send at once, after a pause
+static const uint64_t ForgetNanos = 10000000000;  // how often the lobby forgets idle clients
+static const int MaxClients = 4096;      // round trips, and buckets, the lobby keeps at once
+// a worker rises to each level once the smoothed wait of its jobs, or the jobs it has
+// queued, reach these; it falls back once both are below half of them
+static const uint64_t LevelLagNanos[NumLevels] = { 0, 10000000, 40000000, 150000000 };
+static const int LevelQueued[NumLevels] = { 0, 64, 256, 768 };
+static const char* LevelNames[NumLevels] = { "normal", "slow-spectators", "hold-updates",
+                                             "refuse-joins" };
+static const long IdleNanos = 10000000;  // how often an idle worker above Normal looks again
+static const uint64_t SettleNanos = 1000000000;  // how long the load stays low before a level falls
+
 /* *********************************************************************** */
 /* Private function prototypes */
-static int parseArgs(const int argc, char* argv[]);
+static int parseArgs(const int argc, char* argv[], int* games, int* workerCount,
+                     int* renderers, int* builders, int* numMaps, unsigned int* seed);
+static bool parseAddresses(char* list);
+static bool isReadable(char* pathName);
+static bool isInteger(const char* arg);
+static bool hostGames(char** maps, const int numMaps, const int games, const unsigned int seed,
+                      pool_t* buildPool);
+static void reportProgress(void* arg, const int done, const int total);
+static void noteTable(table_t* table);
+static bool startWorkers(const int workerCount);
+static void stopWorkers();
+static void deleteTables();
+static void* workerMain(void* arg);
+static void takeJob(worker_t* worker, job_t* job);
+static void takeTurn(worker_t* worker, const int q);
+static int nextTable(worker_t* worker);
+static void playJob(job_t* job, const level_t level);
+static void judgeLoad(worker_t* worker, const uint64_t wait, const int queued);
+static void throttleTables(worker_t* worker, const level_t level);
+static void flushTables(worker_t* worker);
+static bool enqueue(const int table, const addr_t from, const char* message,
+                    const uint64_t received);
+static void playBots();
+static void reportBots(const double seconds);
+static void startTimers();
+static void printTimings(FILE* fp);
+static void deleteTimers();
+static bool mayAskStats(const addr_t from);
+static void formatStats(char* buf, const size_t size);
+static void appendLine(char* buf, const size_t size, size_t* used, const char* format, ...);
+static int assignTable(bool* busy);
+static void route(const addr_t from, const int table);
+static bool quits(const char* message);
+static void forgetClient(const addr_t from);
+static void forgetIdle(const uint64_t now);
+static void rttIdle(void* arg, const uint64_t key, void* item);
+static void bucketIdle(void* arg, const uint64_t key, void* item);
+static void answerPing(const addr_t from, const char* message);
+static bool withinRate(const addr_t from, const char* message, const uint64_t now);
+static void limitLine(void* arg, const uint64_t key, void* item);
+static void rttStats(void* arg, const uint64_t key, void* item);
+static void rttLine(void* arg, const uint64_t key, void* item);
 static bool handleInput(void* arg);
+static bool handleTimeout(void* arg);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
-static bool isReadable(char* pathName);
-static bool playerJoin(char* name, const addr_t client);
-static bool isEmpty(const char* name);
-static void spectatorJoin(const addr_t* address);
-static void buildGrid(grid_t* grid, char** argv);
-static void endGame();
-static void deletePlayer(void* item);
 static void itemDelete(void* item);
-static void sendDisplayMessage(void* arg, const char* addr, void* item);
-static void sendGoldMessage(void* arg, const char* addr, void* item);
-static void sendEndMessage(void* arg, const char* addr, void* item);
-static void updateSpectatorDisplay();
-static void initializeGame(char** argv);
-static void initializeGoldPiles();
-static void generateRandomLocations(int numGoldPiles, int* arr);
-static void generateGoldDistribution(int numGoldPiles, int* arr);
-
-/**************** global types ****************/
-typedef struct game {
-  hashtable_t* allPlayers;
-  hashtable_t* addrID;
-  addr_t* addresses;  // store all player addresses and an additional slot for spectatorAddress (last slot in array)
-  int* numGoldLeft;
-  int numPlayers;
-  grid_t* grid;
-  counters_t* gold;
-  int spectatorAddressID;  // val=0 if no spectator joined, val=MaxPlayers if a spectator joined
-  int port;
-} game_t;
-
-/**************** local variables ****************/
-static game_t* game;                    // game struct storing the state of the game
-static const int MaxPlayers = 26;       // maximum number of players
-static const int GoldTotal = 250;       // amount of gold in the game
-static const int GoldMinNumPiles = 10;  // minimum number of gold piles
-static const int GoldMaxNumPiles = 30;  // maximum number of gold piles
 
 /* ***************** main ********************** */
 int main(const int argc, char* argv[])
 {
   // log_init(stderr);
-  int exitStatus = parseArgs(argc, argv);
-  if (exitStatus == 1) {
+  int games, workerCount, renderers, builders, numMaps;
+  unsigned int seed;
+  int firstMap = parseArgs(argc, argv, &games, &workerCount, &renderers, &builders, &numMaps, &seed);
+  if (firstMap == 0) {
+    exit(1);
+  }
+  startTimers();
+  startTime = hist_now();
+  if ((renderPool = pool_new(renderers)) == NULL) {
+    fprintf(stderr, "Failed to start render threads. Exiting...\n");
+    exit(1);
+  }
+  if (journalPath != NULL && (journal = journal_create(journalPath)) == NULL) {
+    fprintf(stderr, "Cannot write journal %s. Exiting...\n", journalPath);
     exit(1);
   }
-  initializeGame(argv);  // initialize the game with the map
+  pool_t* buildPool = pool_new(builders);  // only needed until the games are set up
+  if (buildPool == NULL) {
+    fprintf(stderr, "Failed to start threads to precompute visibility. Exiting...\n");
+    exit(1);
+  }
+  if (!hostGames(argv + firstMap, numMaps, games, seed, buildPool)) {
+    fprintf(stderr, "Failed to create games. Exiting...\n");
+    exit(1);
+  }
+  pool_delete(buildPool);
 
-  // initialize the message module and play the game
+  // log asynchronously, so that logging every message does not hold up the games
+  if (!log_startAsync(LogEntries, LogEntryBytes)) {
+    fprintf(stderr, "Failed to start the logging thread; logging synchronously.\n");
+  }
+
+  // initialize the message module, over the network or to the simulated players
+  if (botCount > 0) {
+    bots = mem_assert(bots_new(botCount, botPolicy, seed), "Out of memory for bots.\n");
+    // the games' replies go straight to the bots, unlogged
+    message_setTransport(message_memoryTransport(bots_deliver, bots));
+    restartGames = true;                  // the bots play game after game
+  }
+  else if (unixPath != NULL) {
+    message_setTransport(message_unixTransport(unixPath));
+  }
   int port;
-  if ((port = message_init(stderr)) == 0) {
+  if ((port = message_init(bots != NULL ? NULL : stderr)) == 0) {
     fprintf(stderr, "Failed to initialize message module.\n");
     exit(2);  // failure to initialize message module
   }
-  printf("Ready to play, waiting at port %d", port);
-  game->port = port;
+  game_log(bots != NULL ? NULL : stderr);  // the bots bump into walls all the time
+  if (!startWorkers(workerCount)) {
+    fprintf(stderr, "Failed to start worker threads. Exiting...\n");
+    exit(1);
+  }
+  if (numTables > 1) {
+    fprintf(stderr, "Hosting %d games on %d threads\n", numTables, numWorkers);
+  }
 
-  // Loop, waiting for input or for messages; provide callback functions.
-  bool ok = message_loop(&port, 0, NULL, handleInput, handleMessage);
+  bool ok = true;
+  uint64_t start = hist_now();
+  if (bots != NULL) {
+    playBots();
+  }
+  else {
+    if (unixPath != NULL) {
+      printf("Ready to play, waiting at %s", unixPath);
+    }
+    else {
+      printf("Ready to play, waiting at port %d", port);
+    }
+    // Loop, waiting for input or for messages; provide callback functions.
+    ok = message_loop(&port, PollSeconds, handleTimeout, handleInput, handleMessage);
+  }
 
-  // shut down the message module
+  // let the workers finish what is queued, then tear everything down
+  stopWorkers();
+  if (!journal_close(journal)) {
+    fprintf(stderr, "Failed to write all of journal %s\n", journalPath);
+  }
+  if (bots != NULL) {
+    reportBots((hist_now() - start) / 1e9);
+    bots_delete(bots);
+  }
+  else {
+    printTimings(stderr);
+  }
   message_done();
+  unsigned long dropped = log_stopAsync();
+  if (dropped > 0) {
+    fprintf(stderr, "%lu log entries were dropped\n", dropped);
+  }
+  deleteTables();
+  pool_delete(renderPool);
+  deleteTimers();
 
   if (ok) {
     exit(0);  // successfully ran program
@@ -97,568 +368,987 @@ int main(const int argc, char* argv[])
   }
 }
 
-/* ***************** initializeGame ********************** */
+/* ***************** parseArgs ********************** */
 /*
- * Initializes the game, allocating memory for the game struct and initialize the variables in it
+ * checks the arguments given by the caller: the options, that every map is readable, and the
+ *   random seed number if [seed] is provided.  Otherwise, generate a random seed using process id.
+ *
+ * We Return:
+ *    0 if the arguments are invalid (after printing why to stderr)
+ *    otherwise the index in argv of the first map; games, workerCount (0 for the default),
+ *      renderers, builders, numMaps and seed are filled in
  *
  * Pseudocode:
- *   allocate memory to game and check if successful
- *   call buildGrid to create grid_t by loading the map file
- *   set numGoldLeft
- *   create the allPlayers hashtable
- *   create the addrID hashtable that stores the ID to the addresses for each client connected
- *   create the counters_t for gold that stores (key, count), where key is the location on the grid
- *     and count is the number of gold at that locaton
- *   call initializeGoldPiles to create random gold piles in the map
- *   allocate memory for addresses that stores an array of all the addr_t of clients
- *   set spectatorAddressID and numPlayers to 0
- */
-static void initializeGame(char** argv)
-{
-  game = mem_malloc_assert(sizeof(game_t), "Out of memory for game variable.\n");
-  if (game == NULL) {
-    fprintf(stderr, "Failed to create game. Exiting...\n");
-    exit(1);
+ *    read the -g and -w options, each of which needs a positive integer,
+ *      the -p, -v and -r options, which need non-negative ones,
+ *      the -s option, which needs a list of IPv4 addresses, the -j and -u options, which
+ *      need a file name, the -b and -d options, which need positive integers, and the -a option,
+ *      which needs a bot policy
+ *    if more than one argument remains and the last is a number, it is the seed;
+ *        return error if value is not a positive integer
+ *    otherwise use getpid() as the seed
+ *    check that every remaining argument is a readable file, returning error if not
+ */
+static int parseArgs(const int argc, char* argv[], int* games, int* workerCount,
+                     int* renderers, int* builders, int* numMaps, unsigned int* seed)
+{
+  *games = 1;
+  *workerCount = 0;
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  *renderers = (processors > 1) ? processors - 1 : 0;  // the rendering game's own thread helps, too
+  *builders = *renderers;                              // and so does the main thread
+  int arg = 1;
+  while (arg < argc - 1 && (strcmp(argv[arg], "-g") == 0 || strcmp(argv[arg], "-w") == 0
+                            || strcmp(argv[arg], "-p") == 0 || strcmp(argv[arg], "-v") == 0
+                            || strcmp(argv[arg], "-s") == 0 || strcmp(argv[arg], "-j") == 0
+                            || strcmp(argv[arg], "-b") == 0 || strcmp(argv[arg], "-a") == 0
+                            || strcmp(argv[arg], "-d") == 0 || strcmp(argv[arg], "-u") == 0
+                            || strcmp(argv[arg], "-r") == 0)) {
+    if (argv[arg][1] == 's') {
+      if (!parseAddresses(argv[arg + 1])) {
+        fprintf(stderr, "Option -s needs up to %d comma-separated IPv4 addresses.\n",
+                MaxStatsAddresses);
+        return 0;
+      }
+      arg += 2;
+      continue;
+    }
+    if (argv[arg][1] == 'j') {
+      journalPath = argv[arg + 1];
+      arg += 2;
+      continue;
+    }
+    if (argv[arg][1] == 'u') {
+      unixPath = argv[arg + 1];
+      arg += 2;
+      continue;
+    }
+    if (argv[arg][1] == 'a') {
+      if (!bots_parsePolicy(argv[arg + 1], &botPolicy)) {
+        fprintf(stderr, "Option -a needs a policy: random or greedy.\n");
+        return 0;
+      }
+      arg += 2;
+      continue;
+    }
+    int value = atoi(argv[arg + 1]);
+    bool threads = argv[arg][1] == 'p' || argv[arg][1] == 'v' || argv[arg][1] == 'r';
+    if (!isInteger(argv[arg + 1]) || value < (threads ? 0 : 1)) {
+      fprintf(stderr, "Option %s needs a %s integer.\n", argv[arg], threads ? "non-negative" : "positive");
+      return 0;
+    }
+    if (argv[arg][1] == 'g') {
+      *games = value;
+    }
+    else if (argv[arg][1] == 'w') {
+      *workerCount = value;
+    }
+    else if (argv[arg][1] == 'p') {
+      *renderers = value;
+    }
+    else if (argv[arg][1] == 'b') {
+      botCount = value;
+    }
+    else if (argv[arg][1] == 'd') {
+      botSeconds = value;
+    }
+    else if (argv[arg][1] == 'r') {
+      keyRate = value;
+    }
+    else {
+      *builders = value;
+    }
+    arg += 2;
   }
-  buildGrid(game->grid, argv);
-  game->numGoldLeft = mem_malloc_assert(sizeof(int*), "Out of memory for numGoldLeft.\n");
-  *(game->numGoldLeft) = GoldTotal;
-  game->allPlayers = hashtable_new(MaxPlayers);
-  if (game->allPlayers == NULL) {
-    endGame();  // end the game and free all memory
-    fprintf(stderr, "Failed to create allPlayers hashtable. Exiting...\n");
-    exit(1);
+  if (keyRate < 0) {  // the bots measure the server's own speed, so they are not held back
+    keyRate = (botCount > 0) ? 0 : DefaultKeyRate;
   }
-  game->addrID = hashtable_new(MaxPlayers);
-  if (game->addrID == NULL) {
-    endGame();  // end the game and free all memory
-    fprintf(stderr, "Failed to create addresses hashtable. Exiting...\n");
-    exit(1);
+
+  int last = argc - 1;
+  if (last - arg >= 1 && isInteger(argv[last])) {  // if map.txt and seed provided
+    if (atoi(argv[last]) <= 0) {  // if seed provided but 0 or negative value,
+      fprintf(stderr, "Seed provided must be a positive integer.\n");
+      return 0;
+    }
+    *seed = atoi(argv[last]);
+    last--;
   }
-  game->gold = counters_new();
-  if (game->gold == NULL) {
-    endGame();  // end the game and free all memory
-    fprintf(stderr, "Failed to create gold counters. Exiting...\n");
-    exit(1);
+  else {  // if seed not provided, use the process id
+    *seed = getpid();
   }
 
-  // initialize gold piles by generate random number of gold piles and random number of gold on the grid
-  initializeGoldPiles();
-  game->addresses = mem_malloc_assert((MaxPlayers + 1) * sizeof(addr_t), "Out of memory for addresses variable.\n");
-  game->spectatorAddressID = 0;  // no spectator initially. set value MaxPlayers if spectator connected
-  game->numPlayers = 0;
+  if (arg > last) {  // invalid number of arguments provided
+    fprintf(stderr, "Invalid number of arguments provided. "
+      "Please run ./server [-g games] [-w workers] [-p renderers] [-v builders] [-s addresses] "
+      "[-j journal] [-u socket] [-r keys] [-b bots [-a policy] [-d seconds]] map.txt [map.txt ...] "
+      "[seed]\n");
+    return 0;
+  }
+  // check if map files provided are readable
+  for (int map = arg; map <= last; map++) {
+    if (!isReadable(argv[map])) {
+      fprintf(stderr, "Error. %s/1 is not readable\n", argv[map]);
+      return 0;
+    }
+  }
+  *numMaps = last - arg + 1;
+  return arg;  // successfully parsed args
 }
 
-/* ***************** buildGrid ********************** */
+/* ***************** parseAddresses ********************** */
 /*
- * Loads the map.txt given by the caller into a grid_t and stores it
- *
- * Pseudocode:
- *   call grid_read from the grid module on the map filename given to server and store in game->grid
+ * adds each address in a comma-separated list (which we modify) to those that may ask for STATS
+ * return false if one is not an IPv4 address, or there are too many
  */
-static void buildGrid(grid_t* grid, char** argv)
+static bool parseAddresses(char* list)
 {
-  char* filename = argv[1];
-  game->grid = grid_read(filename);  // build the grid
+  for (char* address = strtok(list, ","); address != NULL; address = strtok(NULL, ",")) {
+    if (numStatsAddresses == MaxStatsAddresses
+        || inet_pton(AF_INET, address, &statsAddresses[numStatsAddresses]) != 1) {
+      return false;
+    }
+    numStatsAddresses++;
+  }
+  return numStatsAddresses > 0;
 }
 
-/* ***************** initializeGoldPiles ********************** */
+/* ***************** isReadable ********************** */
 /*
- * Generates a random number of gold piles and a random number of gold in each pile for the game
- *
- * Pseudocode:
- *  calculate the maximum number of available spots on the grid
- *  compare the maxAvailableSpots with GoldMaxNumPiles and take the smaller number
- *  generate a random number of gold piles between GoldMinNumPiles and the smaller number calculated earlier
- *  create an array with size number of gold piles storing the locations to put the gold piles
- *  create an array with size number of gold piles storing the random number of gold in each pile summing up to GoldTotal
- *  loop through number of gold piles generated, setting the location and the gold count in game->gold
- *
+ * check if path is readable
+ * return true if file able to open to read
+ * return false if file cannot open to read
  */
-static void initializeGoldPiles()
+static bool isReadable(char* pathName)
 {
-  int cols = grid_getNumberCols(game->grid);
-  int rows = grid_getNumberRows(game->grid);
-  // generate number of open spots to put gold
-  int maxAvailableSpots = (rows * cols) - (rows * 2) - (cols * 2);
-  // get the smaller number of piles
-  int max = (GoldMaxNumPiles > maxAvailableSpots) ? maxAvailableSpots : GoldMaxNumPiles;
-  // generate a value between min and max range of gold piles
-  int numGoldPiles = (rand() % (max - GoldMinNumPiles + 1)) + GoldMinNumPiles;
-  int goldDistributionArray[numGoldPiles];
-  int randomLocations[numGoldPiles];
-  // generate an array of random valid locations on the grid
-  generateRandomLocations(numGoldPiles, randomLocations);
-  // generate an array of random gold amount, summing up to goldTotal
-  generateGoldDistribution(numGoldPiles, goldDistributionArray);
-  int idx = 0;
-  while (idx < numGoldPiles) {  // put the randomly generated gold piles down
-    counters_set(game->gold, randomLocations[idx], goldDistributionArray[idx]);
-    idx++;
+  FILE* fp;
+  if ((fp = fopen(pathName, "r")) == NULL) {  // if unable to read file, return error.
+    fprintf(stderr, "Unable to read %s\n", pathName);
+    return false;
   }
+  fclose(fp);
+  return true;
+}
+
+// is the argument an integer (so, as the last argument, a seed rather than a map)?
+static bool isInteger(const char* arg)
+{
+  char* end;
+  strtol(arg, &end, 10);
+  return *arg != '\0' && *end == '\0';
 }
 
-/* ***************** generateRandomLocations ********************** */
+/* ***************** hostGames ********************** */
 /*
- * Generates an array of random locations on the grid to put the gold piles
+ * Creates the tables: the given number of games on each map, with every game on a map
+ * sharing the one grid read from it.  Game i starts from seed + i.  Each grid's visibility
+ * is precomputed, on the build pool, before any game starts, so that no player
+ * waits for it; if it does not fit in memory, the games work it out frame by frame.
+ * Each table's map and first seed go in the journal, if there is one.
  *
- * Pseudocode:
- *   loop through the number of gold piles
- *      generate a random location
- *      if location is a valid spot on the grid to put the gold
- *        if the location is not occupied by gold
- *            store location
- */
-static void generateRandomLocations(int numGoldPiles, int* arr)
-{
-  int nRows = grid_getNumberRows(game->grid);
-  int nCols = grid_getNumberCols(game->grid);
-  int i = 0;
-  while (i < numGoldPiles) {
-    int location = rand() % (nRows * nCols);          // get the index in the map
-    if (grid_isRoom(game->grid, location)) {          // if it is an available space
-      if (counters_get(game->gold, location) != 0) {  // if it is an existing gold pile
-        continue;                                     // do not store as valid location
+ * We return:
+ *   false if a map cannot be loaded or a game cannot be created
+ */
+static bool hostGames(char** maps, const int numMaps, const int games, const unsigned int seed,
+                      pool_t* buildPool)
+{
+  numTables = numMaps * games;
+  restartGames = numTables > 1;
+  tables = mem_calloc_assert(numTables, sizeof(table_t), "Out of memory for tables.\n");
+  routes = intmap_new(game_MaxPlayers * numTables);
+  rtts = intmap_new(game_MaxPlayers * numTables);
+  buckets = intmap_new(game_MaxPlayers * numTables);
+  if (routes == NULL || rtts == NULL || buckets == NULL) {
+    return false;
+  }
+  for (int map = 0; map < numMaps; map++) {
+    grid_t* grid = NULL;
+    for (int earlier = 0; earlier < map; earlier++) {  // the same map given twice is read once
+      if (strcmp(maps[earlier], maps[map]) == 0) {
+        grid = tables[earlier * games].grid;
+      }
+    }
+    if (grid == NULL) {
+      if ((grid = grid_read(maps[map])) == NULL) {
+        return false;
       }
-      else {  // if location not occupied by gold
-        arr[i] = location;
-        i++;
-        counters_set(game->gold, location, 1);  // mark location for having gold piles
+      if (!grid_precomputeVisibility(grid, buildPool, reportProgress, maps[map])) {
+        fprintf(stderr, "%s: visibility does not fit in memory; computing it per frame\n", maps[map]);
       }
     }
+    for (int g = 0; g < games; g++) {
+      table_t* table = &tables[map * games + g];
+      table->mapName = maps[map];
+      table->grid = grid;
+      table->seed = seed + map * games + g;
+      table->game = game_new(grid, table->seed, renderPool, &gameTimers);
+      if (table->game == NULL || !journal_map(journal, map * games + g, maps[map])) {
+        return false;
+      }
+      journal_game(journal, map * games + g, table->seed);
+      noteTable(table);
+    }
   }
+  return true;
 }
 
-/* ***************** generateGoldDistribution ********************** */
+/* ***************** reportProgress ********************** */
 /*
- * Generates an array of random number of gold for each gold pile, summing up to GoldTotal
- *
- * Pseudocode:
- *   Calculate goldRemaining, the max value of gold that can be generated such that each
- *     gold pile has at least 1 gold in it.
- *   loop through the number of gold piles - 1,
- *      generate a random gold amount
- *      store the gold amount in the array
- *      update number of goldRemaining
- *   allocate the remaining gold unallocated to the last gold pile
+ * Tells stderr how far the visibility of the map named by arg has got, each time it
+ * passes another tenth of the vantage points
+ */
+static void reportProgress(void* arg, const int done, const int total)
+{
+  static int reported;  // steps reported so far for the current map
+  int step = (int)((long)done * ProgressSteps / total);
+  if (done < total && step <= reported) {
+    return;
+  }
+  reported = (done == total) ? 0 : step;
+  fprintf(stderr, "%s: visibility from %d of %d spots (%d%%)\n",
+          (char*)arg, done, total, (int)((long)done * 100 / total));
+}
+
+/* ***************** noteTable ********************** */
+/*
+ * Copies the counts STATS reports out of the table's game (in the thread that owns the
+ * game), so that the lobby can read them while the worker plays on
+ */
+static void noteTable(table_t* table)
+{
+  atomic_store(&table->joined, game_numPlayers(table->game));
+  atomic_store(&table->players, game_numActivePlayers(table->game));
+  atomic_store(&table->spectators, game_numSpectators(table->game));
+  atomic_store(&table->goldLeft, game_goldLeft(table->game));
+}
+
+/* ***************** deleteTables ********************** */
+/*
+ * Deletes every game, every grid (once, though tables share them), the routes, the
+ * round trips and the clients' buckets
  */
-static void generateGoldDistribution(int numGoldPiles, int* arr)
+static void deleteTables()
 {
-  int goldRemaining = GoldTotal - numGoldPiles;  // track number of gold left to allocate -1 for each pile
-  int i = numGoldPiles - 1;
-  while (i > 0) {
-    int x = 0;
-    if (goldRemaining > 0) {
-      x = (rand() % goldRemaining);
+  for (int t = 0; t < numTables; t++) {
+    game_delete(tables[t].game);
+    bool shared = false;
+    for (int later = t + 1; later < numTables; later++) {
+      shared = shared || tables[later].grid == tables[t].grid;
+    }
+    if (!shared && tables[t].grid != NULL) {
+      grid_delete(tables[t].grid);
     }
-    int gold = x;
-    arr[i] = gold + 1;
-    goldRemaining -= gold;
-    i--;
   }
-  arr[0] = goldRemaining + 1;
+  mem_free(tables);
+  intmap_delete(routes, itemDelete);
+  intmap_delete(rtts, itemDelete);
+  intmap_delete(buckets, itemDelete);
 }
 
-/* ***************** parseArgs ********************** */
+/* ***************** startWorkers ********************** */
 /*
- * checks the arguments given by the caller, ensuring that maps.txt is readable and setting
- *   the random seed number
- * if [seed] is provided. Otherwise, generate a random seed using process id.
+ * Starts the worker threads and deals the tables out among them, round robin.
+ * With workerCount 0, starts one per table, up to the number of processors.
  *
- * We Return:
- *    1 if invalid seed given or map.txt given is not readable
- *    0 if valid map.txt and valid seed (if given)
+ * We return:
+ *   false if a thread could not be started
+ */
+static bool startWorkers(const int workerCount)
+{
+  numWorkers = workerCount;
+  if (numWorkers == 0) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    numWorkers = (processors > 0 && processors < numTables) ? processors : numTables;
+  }
+  if (numWorkers > numTables) {  // extra workers would have nothing to do
+    numWorkers = numTables;
+  }
+  for (int t = 0; t < numTables; t++) {
+    tables[t].worker = t % numWorkers;
+  }
+
+  workers = mem_calloc_assert(numWorkers, sizeof(worker_t), "Out of memory for workers.\n");
+  for (int w = 0; w < numWorkers; w++) {
+    worker_t* worker = &workers[w];
+    worker->index = w;
+    worker->jobs = mem_malloc_assert(QueueLength * sizeof(job_t), "Out of memory for job queue.\n");
+    worker->queues = mem_malloc_assert(QueueLength * sizeof(queue_t),
+                                       "Out of memory for job queue.\n");
+    worker->waiting = mem_assert(intmap_new(QueueLength), "Out of memory for job queue.\n");
+    for (int i = 0; i < QueueLength; i++) {  // every job and queue starts out free
+      worker->jobs[i].next = (i + 1 < QueueLength) ? i + 1 : -1;
+      worker->queues[i].next = (i + 1 < QueueLength) ? i + 1 : -1;
+    }
+    worker->turn = worker->lastTurn = -1;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->ready, NULL);
+    if (pthread_create(&worker->thread, NULL, workerMain, worker) != 0) {
+      numWorkers = w;  // so stopWorkers only joins the ones that started
+      stopWorkers();
+      return false;
+    }
+  }
+  return true;
+}
+
+/* ***************** stopWorkers ********************** */
+/*
+ * Tells every worker to stop once its queue is empty, waits for them, and frees them
+ */
+static void stopWorkers()
+{
+  for (int w = 0; w < numWorkers; w++) {
+    pthread_mutex_lock(&workers[w].lock);
+    workers[w].stopping = true;
+    pthread_cond_signal(&workers[w].ready);
+    pthread_mutex_unlock(&workers[w].lock);
+  }
+  for (int w = 0; w < numWorkers; w++) {
+    pthread_join(workers[w].thread, NULL);
+    pthread_mutex_destroy(&workers[w].lock);
+    pthread_cond_destroy(&workers[w].ready);
+    mem_free(workers[w].jobs);
+    mem_free(workers[w].queues);
+    intmap_delete(workers[w].waiting, NULL);
+  }
+  mem_free(workers);
+  workers = NULL;
+  numWorkers = 0;
+}
+
+/* ***************** workerMain ********************** */
+/*
+ * The body of a worker thread: plays its queued jobs, a client at a time in turn, until stopped
  *
  * Pseudocode:
- *    if 2 or 3 arguments provided, including the command itself,
- *        if 3 arguments,
- *           return error code 1 if value is not a positive integer
- *           srand(value) if it is a positive integer
- *        else (if 2 arguments),
- *           srand(getPid())
- *        check if 2nd argument given is a readable file, returning error code if not readable
- *
- *    else
- *        print to stderr and return error code
- *
+ *   loop:
+ *     wait until there is a job or we are told to stop; above Normal, while waiting,
+ *       bring every client of our games up to date (flushTables) and judge the load as
+ *       nil, each IdleNanos, so the level falls back
+ *     if there is no job, we are stopping: return
+ *     take the oldest job of the client whose turn it is (see takeJob); without holding the
+ *       lock judge the load by how long it waited and how many wait behind it, and play it
+ *     if holding updates, and the next job is for another table (or there is none),
+ *       send the update its game held back, so a run of moves in one game sends one
  */
-static int parseArgs(const int argc, char* argv[])
+static void* workerMain(void* arg)
 {
-  if (argc == 2 || argc == 3) {
-    if (argc == 3) {             // if map.txt and seed provided
-      if (atoi(argv[2]) <= 0) {  // if seed provided but 0 or negative value,
-        fprintf(stderr, "Seed provided must be a positive integer.\n");
-        return 1;
+  worker_t* worker = arg;
+  job_t job;
+  pthread_mutex_lock(&worker->lock);
+  while (true) {
+    while (worker->count == 0 && !worker->stopping) {
+      if (atomic_load(&worker->level) == Normal) {
+        pthread_cond_wait(&worker->ready, &worker->lock);
+        continue;
       }
-      else {  // if seed provided is positive integer
-        srand(atoi(argv[2]));
+      pthread_mutex_unlock(&worker->lock);
+      flushTables(worker);
+      judgeLoad(worker, 0, 0);
+      pthread_mutex_lock(&worker->lock);
+      if (worker->count == 0 && !worker->stopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);  // the clock pthread_cond_timedwait uses
+        until.tv_nsec += IdleNanos;
+        until.tv_sec += until.tv_nsec / 1000000000;
+        until.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&worker->ready, &worker->lock, &until);
       }
     }
-    else {  // if seed not provided, get process id and set random sequence
-      srand(getpid());
+    if (worker->count == 0) {
+      break;  // stopping, and nothing left to do
     }
-
-    // check if map file provided is readable
-    if (!isReadable(argv[1])) {
-      fprintf(stderr, "Error. %s/1 is not readable\n", argv[1]);
-      return 1;
+    takeJob(worker, &job);
+    int queued = worker->count;
+    pthread_mutex_unlock(&worker->lock);
+    judgeLoad(worker, hist_now() - job.queued, queued);
+    playJob(&job, atomic_load(&worker->level));
+    if (strncmp(job.message, "PLAY ", strlen("PLAY ")) == 0) {
+      atomic_fetch_sub(&tables[job.table].joining, 1);  // now in joined, if the game took it
+    }
+    pthread_mutex_lock(&worker->lock);
+    if (atomic_load(&worker->level) >= HoldUpdates
+        && nextTable(worker) != job.table) {
+      pthread_mutex_unlock(&worker->lock);
+      game_flush(tables[job.table].game, false);
+      pthread_mutex_lock(&worker->lock);
     }
   }
-  else {  // invalid number of arguments provided
-    fprintf(stderr, "Invalid number of arguments provided. Please run ./server map.txt [seed]\n");
-    return 1;  // exit with error code 1
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+/* ***************** takeJob ********************** */
+/*
+ * Takes the oldest job of the client whose turn it is out of a worker's queues, into job,
+ * and passes the turn on: a client with more jobs waiting goes to the back of the line, and
+ * one with none gives up its queue.  So each client gets one job, a KEY or a batch of KEYS,
+ * played per turn, however many it has sent.  The caller holds the worker's lock, and has
+ * seen that a job is waiting.
+ */
+static void takeJob(worker_t* worker, job_t* job)
+{
+  int q = worker->turn;
+  queue_t* queue = &worker->queues[q];
+  int slot = queue->first;
+  *job = worker->jobs[slot];
+  worker->jobs[slot].next = worker->freeJob;
+  worker->freeJob = slot;
+  queue->first = job->next;
+  queue->count--;
+  worker->count--;
+
+  worker->turn = queue->next;
+  if (worker->turn < 0) {
+    worker->lastTurn = -1;
+  }
+  if (queue->count > 0) {
+    takeTurn(worker, q);
+  }
+  else {
+    intmap_remove(worker->waiting, queue->client);
+    queue->next = worker->freeQueue;
+    worker->freeQueue = q;
   }
-  return 0;  // successfully parsed args
 }
 
-/* ***************** isReadable ********************** */
+/* ***************** takeTurn ********************** */
 /*
- * check if path is readable
- * return true if file able to open to read
- * return false if file cannot open to read
+ * Puts queue q at the back of the line of clients waiting for a worker (lock held)
  */
-static bool isReadable(char* pathName)
+static void takeTurn(worker_t* worker, const int q)
 {
-  FILE* fp;
-  if ((fp = fopen(pathName, "r")) == NULL) {  // if unable to read file, return error.
-    fprintf(stderr, "Unable to read %s\n", pathName);
-    return false;
+  worker->queues[q].next = -1;
+  if (worker->lastTurn < 0) {
+    worker->turn = q;
   }
-  fclose(fp);
-  return true;
+  else {
+    worker->queues[worker->lastTurn].next = q;
+  }
+  worker->lastTurn = q;
 }
 
-/* ***************** handleMessage ********************** */
+/* ***************** nextTable ********************** */
 /*
- * Handle all messages passed from the client to the server based on protocol
- * in requirements spec.
- *
- * We return:
- *  true if ending game and exiting message loop
- *  false if game still ongoing and should remain in message loop
- *
- * Pseudocode:
- *    if client sends PLAY:
- *        call playerJoin to join the player
- *        send GOLD message to all clients connected
- *        send DISPLAY message to all clients connected
- *        update spectator's display
- *    else if client sends SPECTATE
- *        call spectatorJoin, initializing the spectator
- *    else if message starts with "KEY "
- *        find the player in game->allPlayers
- *        if character is lower character,
- *           call player_moverRegular
- *           if player_moveRegular returns true, it is a valid move and player moves and collects gold accordingly
- *                if game->numGoldLeft is 0, no more gold in game, end the game and send QUIT message to all clients
- *                update all clients' GOLD
- *                update all clients' DISPLAY
- *                updateSpectatorDisplay
- *           else, it is an invalid move and server sends message to client informing them that it is invalid
- *        if character is uppercase,
- *           if character is Q,
- *              if it is a player
- *                  call player_quit
- *              if it is a spectator
- *                  set spectatorAddressID to 0, quitting the spectator and marking that no spectator is connected
- *              send QUIT message to spectator/player
- *              sendGoldMessage to all clients
- *              sendDisplayMessage to all clients
- *              updateSpectatorDisplay
- *
- *           else
- *              call player_moveCapital
- *              if player_moveCapital returns true, it is a valid move and player moves and collects gold accordingly
- *                if game->numGoldLeft is 0, no more gold in game, end the game and send QUIT message to all clients
- *                   update all clients' GOLD
- *                   update all clients' DISPLAY
- *                   updateSpectatorDisplay
- *               else, it is an invalid move and server sends message to client informing them that it is invalid
+ * Returns the table of the job a worker will take next, or -1 if none waits (lock held)
  */
-static bool handleMessage(void* arg, const addr_t from, const char* message)
+static int nextTable(worker_t* worker)
 {
-  if (strncmp(message, "PLAY ", strlen("PLAY ")) == 0) {
-    const char* realName = message + strlen("PLAY ");  // get the real name after PLAY
-    if (isEmpty(realName)) {  // if no whitespaces in name provided
-      message_send(from, "QUIT Sorry - you must provide player's name.\n");
-    } else {
-      char* name = mem_malloc_assert(strlen(realName) + 1, "Out of memory for name.\n");
-      strcpy(name, realName);
-      if (playerJoin(name, from)) {
-        hashtable_iterate(game->allPlayers, NULL, sendGoldMessage);     // send gold messages to all players
-        hashtable_iterate(game->allPlayers, NULL, sendDisplayMessage);  // update all player's displays
-        updateSpectatorDisplay();
-      }                                         // join player
-      mem_free(name);
-    }
+  if (worker->count == 0) {
+    return -1;
   }
-  else if (strncmp(message, "SPECTATE", strlen("SPECTATE")) == 0) {
-    spectatorJoin(&from);
+  return worker->jobs[worker->queues[worker->turn].first].table;
+}
+
+/* ***************** judgeLoad ********************** */
+/*
+ * Judges how far behind a worker is, from one job: how long it waited in the queue (0
+ * when the worker is idle), and how many jobs wait behind it.  The wait is smoothed, an
+ * eighth of the way to each sample, as rtt smooths round trips.  The worker rises to the
+ * highest level whose LevelLagNanos or LevelQueued is reached, and falls back a level at a
+ * time once both have stayed below half of its own for SettleNanos; cutting back brings the
+ * load down at once, and without the wait the level would flap as soon as it did.  When the
+ * level changes we say so on stderr, and cut back its games accordingly (throttleTables).
+ * Only the worker calls this, so only it writes level and lag; the lobby reads them.
+ */
+static void judgeLoad(worker_t* worker, const uint64_t wait, const int queued)
+{
+  uint64_t lag = (7 * atomic_load(&worker->lag) + wait) / 8;
+  atomic_store(&worker->lag, lag);
+  level_t was = atomic_load(&worker->level);
+  level_t level = was;
+  uint64_t now = hist_now();
+  while (level + 1 < NumLevels
+         && (lag >= LevelLagNanos[level + 1] || queued >= LevelQueued[level + 1])) {
+    level++;
   }
-  else if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
-    char move = message[strlen("KEY ")];
-    // if message is a character
-    player_t* player = hashtable_find(game->allPlayers, message_stringAddr(from));
-    // lower character
-    if (islower(move)) {                                                        
-      // if not valid keystroke given                             
-      if (!player_moveRegular(player, move, game->allPlayers, game->grid, game->gold, game->numGoldLeft)) {
-        // invalid input keystroke
-        fprintf(stderr, "Error. Invalid keystroke %s", message);
-        message_send(from, "ERROR. Invalid keystroke.\n");
-      }
-      else {
-        // player was successfully moved
-        if (*game->numGoldLeft == 0) {  // if no more gold left
-          endGame();                    // end game, send summary to all players, delete players
-          return true;                  // stay in message loop
-        }
-        // update gold and play displays whenever a keystroke is pressed
-        hashtable_iterate(game->allPlayers, NULL, sendGoldMessage);     // send gold messages to all players
-        hashtable_iterate(game->allPlayers, NULL, sendDisplayMessage);  // send display messages to all players
-        updateSpectatorDisplay();
-      }
-    }
-    else {                // if capital letter
-      if (move == 'Q') {  // if Q, tell client to QUIT and remove player from game
-        if (hashtable_find(game->addrID, message_stringAddr(from)) != NULL) {
-          // if move is from a current player, quit the player
-          player_quit(message_stringAddr(from), game->allPlayers, game->gold, game->numGoldLeft);
-          int* id = hashtable_find(game->addrID, message_stringAddr(from));
-          *id = -1;
-          message_send(from, "QUIT Thanks for playing!\n");
-        }
-        else {  // if it is a spectator
-          game->spectatorAddressID = 0;
-          message_send(from, "QUIT Thanks for watching!\n");
-        }
-        // update gold and play displays whenever a keystroke is pressed
-        hashtable_iterate(game->allPlayers, NULL, sendGoldMessage);     // send gold messages to all players
-        hashtable_iterate(game->allPlayers, NULL, sendDisplayMessage);  // send display messages to all players
-        updateSpectatorDisplay();
-      }
-      else {
-        if (!player_moveCapital(player, move, game->allPlayers, game->grid, game->gold, game->numGoldLeft)) {
-          // if not valid keystroke given
-          fprintf(stderr, "Error. Invalid keystroke %s", message);  // invalid input keystroke
-          message_send(from, "ERROR. Invalid keystroke.\n");
-        }
-        else {
-          if (*game->numGoldLeft == 0) {  // if no more gold left
-            endGame();                    // end game, send summary to all players, delete players
-            return true;                  // exit message loop
-          }
-          // update gold and play displays whenever a keystroke is pressed
-          hashtable_iterate(game->allPlayers, NULL, sendGoldMessage);     // send gold messages to all players
-          hashtable_iterate(game->allPlayers, NULL, sendDisplayMessage);  // send display messages to all players
-          updateSpectatorDisplay();
-        }
-      }
+  if (level > Normal && (lag >= LevelLagNanos[level] / 2 || queued >= LevelQueued[level] / 2)) {
+    worker->busy = now;
+  }
+  else if (level > Normal && now - worker->busy >= SettleNanos) {
+    level--;
+    worker->busy = now;  // and the next level down must settle, too
+  }
+  if (level == was) {
+    return;
+  }
+  if (level > was) {
+    atomic_fetch_add(&levelsRaised, 1);
+  }
+  atomic_store(&worker->level, level);
+  fprintf(stderr, "Worker %d is at level %s (lag %.1f ms, %d queued)\n", worker->index,
+          LevelNames[level], lag / 1e6, queued);
+  throttleTables(worker, level);
+}
+
+/* ***************** throttleTables ********************** */
+/*
+ * Cuts back the updates of every game the worker plays as far as its level says, or
+ * stops cutting them back (see game_throttle)
+ */
+static void throttleTables(worker_t* worker, const level_t level)
+{
+  for (int t = 0; t < numTables; t++) {
+    if (tables[t].worker == worker->index) {
+      game_throttle(tables[t].game, level >= SlowSpectators, level >= HoldUpdates);
     }
   }
-  return false;  // stay in message loop
 }
 
-/* ***************** isEmpty ********************** */
+/* ***************** flushTables ********************** */
 /*
- * Checks if a given string has non-spaces characters
- * We Return:
- *    true if there's only whitespaces in string provided
- *    false if there's non-spaces in string
+ * Brings every client of every game the worker plays up to date, when it has nothing
+ * else to do (see game_flush)
  */
-static bool isEmpty(const char* name)
+static void flushTables(worker_t* worker)
 {
-  for (int i=0; i < strlen(name); i++) {
-    if (isspace(name[i]) == 0) { // if not a whitespace
-      return false;
+  for (int t = 0; t < numTables; t++) {
+    if (tables[t].worker == worker->index) {
+      game_flush(tables[t].game, true);
     }
   }
-  return true;  // if only whitespaces in name provided
 }
 
-/* ***************** updateSpectatorDisplay ********************** */
-/* Updates the spectator's display if the spectator exists
+/* ***************** playJob ********************** */
+/*
+ * Hands one message to its game (in the worker that owns the table, at the given level)
  *
  * Pseudocode:
- *   if spectator is connected
- *      create a gold message
- *      create a display message
- *      send gold and display message to the spectator
- *   free all unused memory
+ *   if the table's game is already over, drop the message
+ *   add the message to the journal, if there is one
+ *   record how long the message waited in the queue
+ *   pass the message to game_handleMessage; if it was a KEY or KEYS, record how long it took
+ *     from reaching the lobby to the last message of its update
+ *   if that ended the game,
+ *     if restarting games, replace it with a new game on the same map and a new seed,
+ *       record the seed in the journal, and cut back its updates as far as the level says
+ *     else, delete it and tell the lobby the server is done
+ *   update the table's counts, for STATS and for the lobby to place players by
  */
-static void updateSpectatorDisplay()
+static void playJob(job_t* job, const level_t level)
 {
-  if (game->spectatorAddressID != 0) {  // if spectator is connected, update spectator's display
+  table_t* table = &tables[job->table];
+  if (table->game == NULL) {
+    return;
+  }
+  journal_message(journal, job->table, job->from, job->message, job->received);
+  hist_record(queueTimes, hist_now() - job->queued);
+  bool over = game_handleMessage(table->game, job->from, job->message);
+  if (strncmp(job->message, "KEY ", strlen("KEY ")) == 0
+      || strncmp(job->message, "KEYS ", strlen("KEYS ")) == 0) {
+    hist_record(keystrokeTimes, hist_now() - job->received);
+  }
+  if (over) {
+    atomic_fetch_add(&gamesEnded, 1);
+    game_delete(table->game);
+    table->game = NULL;
+    if (restartGames) {
+      table->seed += numTables;  // every table's seeds stay distinct
+      table->game = game_new(table->grid, table->seed, renderPool, &gameTimers);
+      journal_game(journal, job->table, table->seed);
+      game_throttle(table->game, level >= SlowSpectators, level >= HoldUpdates);
+      fprintf(stderr, "Game %d on %s is over; starting a new one\n", job->table, table->mapName);
+    }
+    if (table->game == NULL) {
+      atomic_store(&serverOver, true);
+    }
+  }
+  noteTable(table);
+}
 
-    // creating gold message
-    char goldMsg[50];
-    sprintf(goldMsg, "GOLD 0 0 %d\n", *(game->numGoldLeft));
+/* ***************** enqueue ********************** */
+/*
+ * Queues a message for the worker that plays the given table, behind the client's other
+ * jobs there; a client with none joins the back of the line (see takeJob).  Like the
+ * network, the queue may drop a message: if the worker holds QueueLength jobs, or the
+ * client ClientJobs of them, the message is logged and discarded.
+ *
+ * We return:
+ *   false if the message was dropped
+ */
+static bool enqueue(const int table, const addr_t from, const char* message,
+                    const uint64_t received)
+{
+  worker_t* worker = &workers[tables[table].worker];
+  uint64_t client = message_addrKey(from);
+  pthread_mutex_lock(&worker->lock);
+  queue_t* queue = intmap_find(worker->waiting, client);
+  if (worker->count == QueueLength || (queue != NULL && queue->count == ClientJobs)) {
+    pthread_mutex_unlock(&worker->lock);
+    fprintf(stderr, "Worker for game %d is behind; dropped a message from %s\n",
+      table, message_stringAddr(from));
+    return false;
+  }
+  int slot = worker->freeJob;
+  job_t* job = &worker->jobs[slot];
+  worker->freeJob = job->next;
+  job->table = table;
+  job->from = from;
+  job->received = received;
+  job->queued = hist_now();
+  job->next = -1;
+  snprintf(job->message, JobMessageBytes, "%s", message);
+  if (queue == NULL) {  // there are as many queues as jobs, so one is free
+    int q = worker->freeQueue;
+    queue = &worker->queues[q];
+    worker->freeQueue = queue->next;
+    queue->client = client;
+    queue->first = slot;
+    queue->count = 0;
+    intmap_insert(worker->waiting, client, queue);
+    takeTurn(worker, q);
+  }
+  else {
+    worker->jobs[queue->last].next = slot;
+  }
+  queue->last = slot;
+  queue->count++;
+  worker->count++;
+  pthread_cond_signal(&worker->ready);
+  pthread_mutex_unlock(&worker->lock);
+  return true;
+}
 
-    // creating display message
-    set_t* playerLoc = player_locations(game->allPlayers);
+/* ***************** assignTable ********************** */
+/*
+ * Picks the game for a PLAY that did not name one: the first game with room, passing over
+ * those whose worker is too far behind to take new players (RefuseJoins).  A game has room
+ * for as many more as the players that joined it, as its worker last saw, and the PLAYs
+ * queued for it but not yet played, leave; a PLAY the game refuses so takes up no room
+ * once it is played, and a game that starts over has room again.
+ * We return the table's index, or -1 if there is none; then *busy says whether a game with
+ * room was passed over.
+ */
+static int assignTable(bool* busy)
+{
+  bool skipped = false;
+  for (int t = 0; t < numTables; t++) {
+    if (atomic_load(&tables[t].joined) + atomic_load(&tables[t].joining) < game_MaxPlayers) {
+      if (atomic_load(&workers[tables[t].worker].level) >= RefuseJoins) {
+        skipped = true;
+        continue;
+      }
+      return t;
+    }
+  }
+  *busy = skipped;
+  return -1;
+}
 
-    set_t* spectatorLocations = grid_displaySpectator(game->grid, playerLoc, game->gold);
-    char* display = grid_print(game->grid, spectatorLocations);
-    char* displayMessage = mem_malloc_assert(strlen("DISPLAY\n") + strlen(display) + 1,
-      "Out of memory for display message.\n");
-    strcpy(displayMessage, "DISPLAY\n");
-    strcat(displayMessage, display);
+/* ***************** route ********************** */
+/*
+ * Remembers that messages from this client go to the given table
+ */
+static void route(const addr_t from, const int table)
+{
+  int* routed = intmap_find(routes, message_addrKey(from));
+  if (routed == NULL) {
+    routed = mem_malloc_assert(sizeof(int), "Out of memory for route.\n");
+    intmap_insert(routes, message_addrKey(from), routed);
+  }
+  *routed = table;
+}
 
-    addr_t specAddr = game->addresses[game->spectatorAddressID];  // get spectator address using its index
-    message_send(specAddr, goldMsg);                              // send gold messsage
-    message_send(specAddr, displayMessage);                       // send display message
+/* ***************** answerPing ********************** */
+/*
+ * Answers a client's "PING t" with "PONG t", so the client can time its round trip, and
+ * pings the client back with the lobby's own time, so the lobby can time it too; only
+ * clients that ping are pinged, so others never see a PING.  The lobby times at most
+ * MaxClients at once; when that many are timed, it forgets the idle ones (see forgetIdle),
+ * and if none are, it only answers.
+ */
+static void answerPing(const addr_t from, const char* message)
+{
+  char pong[message_MaxBytes];
+  snprintf(pong, sizeof(pong), "PONG %s", message + strlen("PING "));
+  message_send(from, pong);
 
-    // clear memory space
-    set_delete(playerLoc, itemDelete);
-    set_delete(spectatorLocations, NULL);
-    mem_free(display);
-    mem_free(displayMessage);
+  uint64_t now = hist_now();
+  rtt_t* rtt = intmap_find(rtts, message_addrKey(from));
+  if (rtt == NULL && intmap_count(rtts) >= MaxClients) {
+    forgetIdle(now);
+  }
+  if (rtt == NULL && intmap_count(rtts) >= MaxClients) {
+    return;  // too many clients ping at once to time them all
+  }
+  if (rtt == NULL) {
+    rtt = mem_calloc_assert(1, sizeof(rtt_t), "Out of memory for round trips.\n");
+    intmap_insert(rtts, message_addrKey(from), rtt);
   }
+  rtt->pinged = now;
+  char ping[30];
+  snprintf(ping, sizeof(ping), "PING %llu", (unsigned long long)rtt->pinged);
+  message_send(from, ping);
 }
 
-/* ***************** endGame ********************** */
-/* Ends the game and send GOLD, DISPLAY, and QUIT messages to all clients
- *
- * Pseudocode:
- *   send GOLD messsage to all players
- *   send DISPLAY message to all players
- *   updateSpectatorDisplay
- *   call player_summary and send end message to all players with the summary
- *   if spectator is connected
- *      send quit message to spectator
- *   free all unused memory, deleting allPlayers, addrID, gold, grid, addresses, numGoldLeft and game.
- */
-static void endGame()
-{
-  // Update gold and display one final time for all players
-  hashtable_iterate(game->allPlayers, NULL, sendGoldMessage);     // send gold messages to all players
-  hashtable_iterate(game->allPlayers, NULL, sendDisplayMessage);  // send display messages to all players
-  updateSpectatorDisplay();
-
-  char* summary = player_summary(game->allPlayers);
-
-  // send quit message with summary to all players
-  hashtable_iterate(game->allPlayers, summary, sendEndMessage);
-
-  // send quit message with summary to spectator
-  if (game->spectatorAddressID != 0) {
-    char* quitSpectatorMessage = mem_malloc_assert(strlen(summary) + strlen("QUIT GAME OVER:\n") + 1, 
-      "Out of memory for spectator message.\n");
-    strcpy(quitSpectatorMessage, "QUIT GAME OVER:\n");
-    strcat(quitSpectatorMessage, summary);
-    addr_t specAddr = game->addresses[game->spectatorAddressID];
-    message_send(specAddr, quitSpectatorMessage);
-    mem_free(quitSpectatorMessage);
-  }
-
-  // free all memory
-  mem_free(summary);
-  hashtable_delete(game->allPlayers, deletePlayer);  // delete every player in hashtable
-  hashtable_delete(game->addrID, itemDelete);        // delete all the address ids, freeing the item
-  counters_delete(game->gold);
-  grid_delete(game->grid);
-  mem_free(game->numGoldLeft);
-  mem_free(game->addresses);
-  mem_free(game);
-}
-
-/* ***************** sendGoldMessage ********************** */
-/* Sends GOLD message to player, telling them the gold they recently collected, the gold in their purse, and the remaining gold in game
+/* ***************** withinRate ********************** */
+/*
+ * Charges a client's KEY or KEYS to its bucket (see support/bucket.h), a token a key, so
+ * that no client sends more than keyRate keys a second, after a burst of BurstKeys, and
+ * every update it sets off, to every client in its game; so one client flooding the lobby
+ * with keys cannot fill its worker's queue and crowd out the other clients' messages.
+ * A KEYS is charged for the keys the game plays, those before its first Q; so KEY Q, or a
+ * KEYS that starts with Q, and every other message, is free.  (A KEYS with a Q later in it
+ * that is refused still quits; see handleMessage.)  The first time a client is held back, we say so on stderr (again, if the
+ * lobby has since forgotten its bucket; see forgetIdle).  The lobby keeps at most MaxClients
+ * buckets; when that many are kept, it forgets the idle ones, and if none are, it drops the
+ * keys of clients it has no bucket for, until some are.
  *
- * Pseudocode:
- *   find the player's address id
- *   if player is still playing, and player is not null, and address id exists in game->addrID,
- *      create GOLD message
- *      send GOLD message using message_send
+ * We return:
+ *   false if the message is to be dropped
  */
-static void sendGoldMessage(void* arg, const char* addr, void* item)
+static bool withinRate(const addr_t from, const char* message, const uint64_t now)
 {
-  player_t* player = item;
-  int* id = NULL;
-  id = hashtable_find(game->addrID, addr);
-  if (id != NULL && *id != -1 && player != NULL) {  // if address exists and player still in game
-    char goldM[50];
-    sprintf(goldM, "GOLD %d %d %d\n", player_getRecentGold(player), player_getpurse(player), *(game->numGoldLeft));
-    addr_t actualAddr = game->addresses[*id];  // get the address of player
-    message_send(actualAddr, goldM);           // send gold message
+  int keys;
+  if (keyRate == 0 || strcmp(message, "KEY Q") == 0) {
+    return true;
+  }
+  if (strncmp(message, "KEYS ", strlen("KEYS ")) == 0) {
+    keys = strcspn(message + strlen("KEYS "), "Q");  // the game plays none after a Q
+    if (keys == 0) {
+      return true;
+    }
+  }
+  else if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
+    keys = 1;
+  }
+  else {
+    return true;
+  }
+  bucket_t* bucket = intmap_find(buckets, message_addrKey(from));
+  if (bucket == NULL && intmap_count(buckets) >= MaxClients) {
+    forgetIdle(now);
   }
+  if (bucket == NULL && intmap_count(buckets) >= MaxClients) {
+    droppedKeys += keys;
+    return false;
+  }
+  if (bucket == NULL) {
+    bucket = mem_calloc_assert(1, sizeof(bucket_t), "Out of memory for buckets.\n");
+    intmap_insert(buckets, message_addrKey(from), bucket);
+  }
+  if (bucket_take(bucket, keyRate, BurstKeys, keys, now)) {
+    return true;
+  }
+  droppedKeys += keys;
+  if (bucket->refused == 1) {
+    limitedClients++;
+    fprintf(stderr, "%s sends keys faster than %d a second; dropping some\n",
+            message_stringAddr(from), keyRate);
+  }
+  return false;
 }
 
-/* ***************** sendDisplayMessage ********************** */
-/* Sends DISPLAY message to player with the grid
- *
- * Pseudocode:
- *   find the player's address id
- *   if player is still playing, and player is not null, and address id exists in game->addrID,
- *      get players newSeenBefore using grid_updateView
- *      call grid_print to get the string of the grid that the player can see
- *      create DISPLAY message
- *      send DISPLAY message using message_send
- *      free the messages
- */
-static void sendDisplayMessage(void* arg, const char* addr, void* item)
-{
-  // display message
-  player_t* player = item;
-  int* addrID = hashtable_find(game->addrID, addr);
-  if (addrID != NULL && *addrID != -1 && player != NULL) {  // if player address exists and player still in game
-    addr_t actualAddr = game->addresses[*addrID];           // get player's address
-    set_t* playerLocations = player_locations(game->allPlayers);
-    set_t* newSeenBefore = grid_updateView(game->grid, player_getCurrCoor(player), player_getSeenBefore(player), 
-          playerLocations, game->gold);
-
-    char* display = grid_print(game->grid, newSeenBefore);
-    char* displayMessage = mem_malloc_assert(strlen("DISPLAY\n") + strlen(display) + 1,
-      "Out of memory for display message.\n");
-    strcpy(displayMessage, "DISPLAY\n");
-    strcat(displayMessage, display);           // send all locations that player can see and have seen
-    message_send(actualAddr, displayMessage);  // send display message
-
-    set_delete(playerLocations, itemDelete);
-    player_setSeenBefore(player, newSeenBefore);
-
-    mem_free(display);
-    mem_free(displayMessage);
-  }
-}
-
-/* ***************** deletePlayer ********************** */
-/* deletes the player, freeing up memory
- *
- * Pseudocode:
- *   if player is not yet deleted,
- *      call player_delete
+/* ***************** quits ********************** */
+/*
+ * Says whether a message quits its client's game: KEY Q, or KEYS with a Q in it
+ */
+static bool quits(const char* message)
+{
+  if (strncmp(message, "KEYS ", strlen("KEYS ")) == 0) {
+    return strchr(message + strlen("KEYS "), 'Q') != NULL;
+  }
+  return strcmp(message, "KEY Q") == 0;
+}
+
+/* ***************** forgetClient ********************** */
+/*
+ * Forgets everything the lobby knows of a client that has quit: its table, round trips
+ * and bucket
+ */
+static void forgetClient(const addr_t from)
+{
+  uint64_t key = message_addrKey(from);
+  mem_free(intmap_remove(routes, key));
+  mem_free(intmap_remove(rtts, key));
+  mem_free(intmap_remove(buckets, key));
+}
+
+/* ***************** forgetIdle ********************** */
+/*
+ * Forgets the round trips of the clients that have not pinged for ForgetNanos, which STATS
+ * leaves out by then anyway, and the buckets of those that have sent no keys for as long,
+ * and long enough for their buckets to fill, so that a new one would be the same.  A client
+ * that leaves without quitting so costs the lobby nothing for long.  The lobby calls this
+ * each ForgetNanos, and whenever it keeps MaxClients round trips or buckets.
+ */
+static void forgetIdle(const uint64_t now)
+{
+  intmap_t* maps[2] = { rtts, buckets };
+  void (*isIdle[2])(void* arg, const uint64_t key, void* item) = { rttIdle, bucketIdle };
+  for (int m = 0; m < 2; m++) {
+    int count = intmap_count(maps[m]);
+    if (count == 0) {
+      continue;
+    }
+    idle_t idle = { now, mem_malloc_assert(count * sizeof(uint64_t),
+                                           "Out of memory for idle clients.\n"), 0 };
+    intmap_iterate(maps[m], &idle, isIdle[m]);  // which may not remove them as it goes
+    for (int i = 0; i < idle.count; i++) {
+      mem_free(intmap_remove(maps[m], idle.keys[i]));
+    }
+    mem_free(idle.keys);
+  }
+  lastForgot = now;
+}
+
+/* ***************** rttIdle ********************** */
+/*
+ * Gathers a client whose last PING was ForgetNanos ago, to forget its round trips
  */
-static void deletePlayer(void* item)
+static void rttIdle(void* arg, const uint64_t key, void* item)
 {
-  player_t* player = item;
-  if (player != NULL) {
-    player_delete(player);
+  idle_t* idle = arg;
+  rtt_t* rtt = item;
+  if (idle->now > rtt->pinged && idle->now - rtt->pinged >= ForgetNanos) {
+    idle->keys[idle->count++] = key;
   }
 }
 
-/* ***************** sendEndMessage ********************** */
-/* Sends QUIT GAME OVER message to clients
+/* ***************** bucketIdle ********************** */
+/*
+ * Gathers a client whose bucket has filled, and taken nothing for ForgetNanos, to forget it
+ */
+static void bucketIdle(void* arg, const uint64_t key, void* item)
+{
+  idle_t* idle = arg;
+  bucket_t* bucket = item;
+  if (idle->now > bucket->updated) {
+    uint64_t quiet = idle->now - bucket->updated;
+    if (quiet >= ForgetNanos && keyRate * (quiet / 1e9) >= BurstKeys) {
+      idle->keys[idle->count++] = key;
+    }
+  }
+}
+
+/* ***************** handleMessage ********************** */
+/*
+ * The lobby: sends each message from a client to the right game's worker.
+ *
+ * We return:
+ *  true if the server is done and should exit the message loop
+ *  false otherwise
  *
  * Pseudocode:
- *   create the QUIT GAME OVER message
- *   if the player exists and is still connected to server
- *      get the player's addr_t
- *      call message_send to player, sending the player the end of game message
+ *    if a worker has reported that the last game ended, return true
+ *    every ForgetNanos, forget the clients that have gone quiet (see forgetIdle)
+ *    if it is STATS, reply with the server's counters if the client may see them
+ *    if it is PING, answer it (see answerPing); if it is PONG, answering the lobby's
+ *      last PING to the client, take the round trip as a sample of the client's
+ *    (none of these reach a game)
+ *    if it is a KEY or KEYS beyond the client's rate, drop it (see withinRate), or if it
+ *      quits, pass on only KEY Q
+ *    if the message starts with "GAME n ", the client picked table n; strip the prefix
+ *    if it is PLAY,
+ *        if no table was picked, take the first with room (or tell the client all are full)
+ *        if the table's worker is too far behind (RefuseJoins), tell the client to try later
+ *        count the PLAY as joining that table, until its worker plays it (see assignTable)
+ *    if it is PLAY or SPECTATE (watching game 0 unless one was picked),
+ *        remember the client's table; when hosting several, tell the client its game
+ *    otherwise, send it to the table the client joined (game 0 if none)
+ *    queue the message for the table's worker, and record how long all that took
+ *    if it quits the game, forget the client (see forgetClient)
  */
-static void sendEndMessage(void* arg, const char* addr, void* item)
+static bool handleMessage(void* arg, const addr_t from, const char* message)
+{
+  if (atomic_load(&serverOver)) {
+    return true;
+  }
+  uint64_t received = hist_now();
+  if (received - lastForgot >= ForgetNanos) {
+    forgetIdle(received);
+  }
+
+  if (strcmp(message, "STATS") == 0) {
+    if (mayAskStats(from)) {
+      char stats[message_MaxBytes];
+      formatStats(stats, sizeof(stats));
+      message_send(from, stats);
+    }
+    else {
+      message_send(from, "ERROR. STATS is not allowed from your address.\n");
+    }
+    return false;
+  }
+
+  uint64_t stamp;
+  if (rtt_parse(message, "PING ", &stamp)) {
+    answerPing(from, message);
+    return false;
+  }
+  if (rtt_parse(message, "PONG ", &stamp)) {
+    rtt_t* rtt = intmap_find(rtts, message_addrKey(from));
+    if (rtt != NULL && stamp == rtt->pinged) {
+      rtt_sample(rtt, stamp, received);
+    }
+    return false;
+  }
+  if (!withinRate(from, message, received)) {
+    if (!quits(message)) {
+      return false;
+    }
+    message = "KEY Q";  // its moves are dropped, but the client still quits
+  }
+
+  int table = -1;
+  if (strncmp(message, "GAME ", strlen("GAME ")) == 0) {
+    char* rest;
+    long picked = strtol(message + strlen("GAME "), &rest, 10);
+    if (picked < 0 || picked >= numTables || *rest != ' ') {
+      message_send(from, "ERROR. No such game.\n");
+      return false;
+    }
+    table = picked;
+    message = rest + 1;
+  }
+
+  bool playing = strncmp(message, "PLAY ", strlen("PLAY ")) == 0;
+  if (playing || strncmp(message, "SPECTATE", strlen("SPECTATE")) == 0) {
+    if (playing) {
+      bool busy = false;
+      if (table < 0 && (table = assignTable(&busy)) < 0 && !busy) {
+        message_send(from, "QUIT All games are full: no more players can join.\n");
+        return false;
+      }
+      if (busy || atomic_load(&workers[tables[table].worker].level) >= RefuseJoins) {
+        message_send(from, "QUIT The server is too busy for new players; please try again soon.\n");
+        refusedJoins++;
+        return false;
+      }
+      atomic_fetch_add(&tables[table].joining, 1);
+    }
+    else if (table < 0) {
+      table = 0;
+    }
+    route(from, table);
+    if (numTables > 1) {
+      char gameMessage[30];
+      snprintf(gameMessage, sizeof(gameMessage), "GAME %d", table);
+      message_send(from, gameMessage);
+    }
+  }
+  else if (table < 0) {
+    int* routed = intmap_find(routes, message_addrKey(from));
+    table = (routed == NULL) ? 0 : *routed;
+  }
+  if (!enqueue(table, from, message, received) && playing) {
+    atomic_fetch_sub(&tables[table].joining, 1);
+  }
+  if (quits(message)) {
+    forgetClient(from);
+  }
+  hist_record(parseTimes, hist_now() - received);
+  return false;
+}
+
+// the lobby checks between messages, too, whether the last game has ended, and forgets
+// the clients that have gone quiet
+static bool handleTimeout(void* arg)
 {
-  char* summary = arg;
-  char* message = mem_malloc_assert(strlen(summary) + strlen("QUIT GAME OVER:\n") + 1, 
-    "Out of memory for message in sendEndMessage.\n");
-  strcpy(message, "QUIT GAME OVER:\n");
-  strcat(message, summary);
-  int* id = hashtable_find(game->addrID, addr);
-  if (id != NULL && *id != -1 && item != NULL) {  // if player still connected, tell client to quit
-    addr_t actualAddr = game->addresses[*id];
-    message_send(actualAddr, message);
+  uint64_t now = hist_now();
+  if (now - lastForgot >= ForgetNanos) {
+    forgetIdle(now);
   }
-  mem_free(message);
+  return atomic_load(&serverOver);
 }
 
 // adapted from message.c
@@ -674,137 +1364,278 @@ static bool handleInput(void* arg)
     if (len > 0) {
       line[len - 1] = '\0';  // change newline to null
     }
-    return false;
+    if (strcmp(line, "TIMINGS") == 0) {
+      printTimings(stderr);
+    }
+    else if (strcmp(line, "STATS") == 0) {
+      char stats[message_MaxBytes];
+      formatStats(stats, sizeof(stats));
+      fputs(stats, stdout);
+      fflush(stdout);
+    }
+    return atomic_load(&serverOver);
   }
   else {
     return true;  // EOF
   }
 }
 
-/* ***************** playerJoin ********************** */
+/* ***************** playBots ********************** */
 /*
- * Initializes new player to game to the game, sending OK, GRID message to the player
- *
- * Pseudocode:
- *   if numPlayers < MaxPlayers:
- *      create a new player using player_new
- *      if game->numGoldLeft is 0:
- *          call endGame
- *      create the OK message
- *      create the GRID message
- *      store the new player's addr_t in game->addresses
- *      store the index of that player's address in game->addresses in game->addrID
- *      store the new player in game->allPlayers
- *      update the player's seenBefore
- *      send OK and GRID message
- *      increment game->numPlayers
- *   else
- *      send QUIT message to new client trying to connect
- */
-static bool playerJoin(char* name, const addr_t client)
-{
-  if (game->numPlayers < MaxPlayers) {
-    player_t* newPlayer = player_new(name, game->grid, game->allPlayers, game->numGoldLeft, 
-      game->gold, game->numPlayers);
-
-    // if no more gold left, end the game, sending QUIT messages with summary to all clients
-    if (game->numGoldLeft == 0) {
-      endGame();
-    }
-    int buffer = 20;
-
-    // OK message
-    int okLength = strlen("OK ") + buffer;
-    char okMessage[okLength];
-    snprintf(okMessage, okLength, "OK %s", player_getID(newPlayer));
-
-    // grid message
-    int gridLength = strlen("GRID") + buffer;
-    char gridMessage[gridLength];
-    snprintf(gridMessage, gridLength, "GRID %d %d", grid_getNumberRows(game->grid), grid_getNumberCols(game->grid));
-
-    // create an id for the new player and store it in game->addrID and game->addresses respectively
-    int* newAddrID = mem_malloc_assert(sizeof(int), "Out of memory for new address id variable.\n");
-    *newAddrID = game->numPlayers;
-    game->addresses[game->numPlayers] = client;  // store the address of the player
-
-    hashtable_insert(game->addrID, message_stringAddr(client), newAddrID);      // store new player's address
-    hashtable_insert(game->allPlayers, message_stringAddr(client), newPlayer);  // store new player in allPlayers
-
-    set_t* playerLocations = player_locations(game->allPlayers);
-    set_t* currSeenBfr = player_getSeenBefore(newPlayer);
-    set_delete(currSeenBfr, NULL);
-    player_setSeenBefore(newPlayer, grid_updateView(game->grid, player_getCurrCoor(newPlayer), 
-      NULL, playerLocations, game->gold));
-
-    message_send(client, okMessage);    // send the player message
-    message_send(client, gridMessage);  // send grid message
-    (game->numPlayers)++;
-
-    set_delete(playerLocations, itemDelete);
+ * Lets the simulated players play for botSeconds: each bot's messages go through the
+ * lobby, just as a real client's would, and the games' replies come back to the bots
+ * (see main).  When no bot can act, the lobby pauses briefly, to let the workers run.
+ */
+static void playBots()
+{
+  const uint64_t end = hist_now() + (uint64_t)botSeconds * 1000000000;
+  const struct timespec pause = { 0, BotPauseNanos };
+  while (hist_now() < end) {
+    if (bots_act(bots, handleMessage, NULL) == 0) {
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+/* ***************** reportBots ********************** */
+/*
+ * Prints to stdout how fast the simulated players' games went: moves and frames per
+ * second, games ended, and how long each stage of handling a message took
+ */
+static void reportBots(const double seconds)
+{
+  unsigned long moves = hist_count(gameTimers.move);
+  unsigned long frames = bots_frames(bots);
+  printf("%d %s bots at %d table%s for %.1f s: %lu keys sent, %lu moves (%.0f/s), "
+         "%lu frames (%.0f/s), %d games ended\n",
+         botCount, botPolicy == bots_Greedy ? "greedy" : "random", numTables,
+         numTables == 1 ? "" : "s", seconds, bots_keys(bots), moves, moves / seconds,
+         frames, frames / seconds, atomic_load(&gamesEnded));
+  printTimings(stdout);
+}
+
+/* ***************** startTimers ********************** */
+/*
+ * Creates the histograms that time each stage of handling a message
+ */
+static void startTimers()
+{
+  parseTimes = mem_assert(hist_new(), "Out of memory for timers.\n");
+  queueTimes = mem_assert(hist_new(), "Out of memory for timers.\n");
+  keystrokeTimes = mem_assert(hist_new(), "Out of memory for timers.\n");
+  gameTimers.move = mem_assert(hist_new(), "Out of memory for timers.\n");
+  gameTimers.render = mem_assert(hist_new(), "Out of memory for timers.\n");
+  gameTimers.send = mem_assert(hist_new(), "Out of memory for timers.\n");
+}
+
+/* ***************** printTimings ********************** */
+/*
+ * Prints a line for each stage of handling a message, in the order a KEY goes through
+ * them, with percentiles of how long it takes; the workers may go on recording meanwhile
+ */
+static void printTimings(FILE* fp)
+{
+  fprintf(fp, "Time spent in each stage of handling a message:\n");
+  hist_print(parseTimes, fp, "parse");
+  hist_print(queueTimes, fp, "queue");
+  hist_print(gameTimers.move, fp, "move");
+  hist_print(gameTimers.render, fp, "render");
+  hist_print(gameTimers.send, fp, "send");
+  hist_print(keystrokeTimes, fp, "keystroke");
+}
+
+/* ***************** mayAskStats ********************** */
+/*
+ * Is the client on localhost (127.0.0.0/8), or at one of the addresses given with -s?
+ */
+static bool mayAskStats(const addr_t from)
+{
+  if ((ntohl(from.sin_addr.s_addr) >> 24) == 127) {
     return true;
-  } else {
-    message_send(client, "QUIT Game is full: no more players can join.\n");
-    return false;
   }
+  for (int a = 0; a < numStatsAddresses; a++) {
+    if (statsAddresses[a].s_addr == from.sin_addr.s_addr) {
+      return true;
+    }
+  }
+  return false;
 }
 
-/* ***************** spectatorJoin ********************** */
+/* ***************** formatStats ********************** */
 /*
- * Adds a spectator to the server. If there is already an existing spectator, QUIT the existing spectator
- *   and update spectator address
- * Send GRID, GOLD, DISPLAY message to spectator
+ * Writes the server's counters into buf, one "name values..." line each, for STATS:
  *
- * Pseudocode:
- *    if spectator exists
- *        send QUIT message to the existing spectator
- *    else
- *        initialize spectatorAddressID to MaxPlayers, the special index stored for spectator addresses
- *          in game->addresses
- *    store new spectator address in game->addresses
- *    create GRID message
- *    create GOLD message
- *    create DISPLAY message
- *    send them to spectator using message_send
- *    free all unused memory
- */
-static void spectatorJoin(const addr_t* address)
-{
-  if (game->spectatorAddressID != 0) {  // if spectator exists, send quit message to spectator
-    addr_t specAddr = game->addresses[game->spectatorAddressID];
-    message_send(specAddr, "QUIT You have been replaced by a new spectator.\n");
-  }
-  else {                                    // if no spectator in game and one joins
-    game->spectatorAddressID = MaxPlayers;  // set id to spot reserved for spectator's address in game->addresses
-  }
-  game->addresses[game->spectatorAddressID] = *address;  // store spectator address
-
-  // grid message
-  char gridMessage[30];
-  sprintf(gridMessage, "GRID %d %d", grid_getNumberRows(game->grid), grid_getNumberCols(game->grid));
-
-  // gold message
-  char goldMessage[50];
-  sprintf(goldMessage, "GOLD 0 0 %d\n", *(game->numGoldLeft));
-
-  // display message
-  set_t* playerLoc = player_locations(game->allPlayers);
-  set_t* spectatorLocations = grid_displaySpectator(game->grid, playerLoc, game->gold);
-  char* display = grid_print(game->grid, spectatorLocations);
-  char* displayMessage = mem_malloc_assert(strlen("DISPLAY\n") + strlen(display) + 1,
-        "Out of memory for display message");
-  strcpy(displayMessage, "DISPLAY\n");
-  strcat(displayMessage, display);
-  addr_t specAddr = game->addresses[game->spectatorAddressID];
-  message_send(specAddr, gridMessage);     // send grid message
-  message_send(specAddr, goldMessage);     // send gold message
-  message_send(specAddr, displayMessage);  // send display message
-
-  // free all unused memory
-  mem_free(display);
-  mem_free(displayMessage);
-  set_delete(playerLoc, itemDelete);
-  set_delete(spectatorLocations, NULL);
+ *   STATS
+ *   uptime <seconds>
+ *   games <n> players <n> spectators <n> gold <n>       (over every game)
+ *   kind <word> in <messages> <bytes> out <messages> <bytes>   (one per kind of message)
+ *   bytes in <n> out <n>
+ *   latency-us <stage> count <n> p50 <us> p99 <us> max <us>   (one per stage, as in TIMINGS)
+ *   mem net <allocations not yet freed>
+ *   rtt-us clients <n> mean <us> max <us> jitter <us>   (round trips to clients that ping)
+ *   limit keys-per-s <n> burst <n> limited <clients> dropped <keys>   (see withinRate)
+ *   load raised <n> refused <joins>                     (see judgeLoad)
+ *   load worker <n> level <name> lag-us <us> queued <n> (one per worker)
+ *   game <n> <map> players <n> spectators <n> gold <n>  (one per game)
+ *   client <address> rtt-us <us> jitter-us <us> samples <n>   (one per client that pings)
+ *   limited <address> dropped <messages> of <messages>  (one per client held back)
+ *
+ * Only round trips measured in the last RttStaleNanos count.  Lines that would not fit in
+ * size (a message, at most) are left out, so the per-game and per-client lines, which come
+ * last, are the first to go.  Counts are read while the workers go on playing, so
+ * they need not be consistent with each other.
+ */
+static void formatStats(char* buf, const size_t size)
+{
+  size_t used = 0;
+  buf[0] = '\0';
+  appendLine(buf, size, &used, "STATS");
+  appendLine(buf, size, &used, "uptime %.1f", (hist_now() - startTime) / 1e9);
+
+  int players = 0, spectators = 0, gold = 0;
+  for (int t = 0; t < numTables; t++) {
+    players += atomic_load(&tables[t].players);
+    spectators += atomic_load(&tables[t].spectators);
+    gold += atomic_load(&tables[t].goldLeft);
+  }
+  appendLine(buf, size, &used, "games %d players %d spectators %d gold %d",
+             numTables, players, spectators, gold);
+
+  message_count_t counts[message_MaxKinds];
+  int numKinds = message_counts(counts);
+  unsigned long bytesIn = 0, bytesOut = 0;
+  for (int k = 0; k < numKinds; k++) {
+    appendLine(buf, size, &used, "kind %s in %lu %lu out %lu %lu", counts[k].kind,
+               counts[k].received, counts[k].bytesReceived, counts[k].sent, counts[k].bytesSent);
+    bytesIn += counts[k].bytesReceived;
+    bytesOut += counts[k].bytesSent;
+  }
+  appendLine(buf, size, &used, "bytes in %lu out %lu", bytesIn, bytesOut);
+
+  struct { const char* name; hist_t* hist; } stages[] = {
+    { "parse", parseTimes }, { "queue", queueTimes }, { "move", gameTimers.move },
+    { "render", gameTimers.render }, { "send", gameTimers.send },
+    { "keystroke", keystrokeTimes },
+  };
+  for (int s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+    hist_t* hist = stages[s].hist;
+    appendLine(buf, size, &used, "latency-us %s count %lu p50 %.1f p99 %.1f max %.1f",
+               stages[s].name, hist_count(hist), hist_percentile(hist, 50) / 1e3,
+               hist_percentile(hist, 99) / 1e3, hist_max(hist) / 1e3);
+  }
+  appendLine(buf, size, &used, "mem net %d", mem_net());
+  mem_poolstats_t pools[mem_PoolClasses];
+  mem_poolStats(pools);
+  for (int p = 0; p < mem_PoolClasses; p++) {
+    appendLine(buf, size, &used, "mem pool %zu hits %ld misses %ld", pools[p].bytes,
+               pools[p].hits, pools[p].misses);
+  }
+
+  rttSummary_t summary = { hist_now(), 0, 0, 0, 0, buf, size, &used };
+  intmap_iterate(rtts, &summary, rttStats);
+  appendLine(buf, size, &used, "rtt-us clients %d mean %.1f max %.1f jitter %.1f",
+             summary.clients, summary.clients == 0 ? 0 : summary.smoothed / 1e3 / summary.clients,
+             summary.max / 1e3, summary.clients == 0 ? 0 : summary.jitter / 1e3 / summary.clients);
+  appendLine(buf, size, &used, "limit keys-per-s %d burst %d limited %d dropped %lu",
+             keyRate, BurstKeys, limitedClients, droppedKeys);
+  appendLine(buf, size, &used, "load raised %d refused %lu", atomic_load(&levelsRaised),
+             refusedJoins);
+  for (int w = 0; w < numWorkers; w++) {
+    pthread_mutex_lock(&workers[w].lock);
+    int queued = workers[w].count;
+    pthread_mutex_unlock(&workers[w].lock);
+    appendLine(buf, size, &used, "load worker %d level %s lag-us %.1f queued %d", w,
+               LevelNames[atomic_load(&workers[w].level)], atomic_load(&workers[w].lag) / 1e3,
+               queued);
+  }
+
+  for (int t = 0; t < numTables; t++) {
+    appendLine(buf, size, &used, "game %d %s players %d spectators %d gold %d", t,
+               tables[t].mapName, atomic_load(&tables[t].players),
+               atomic_load(&tables[t].spectators), atomic_load(&tables[t].goldLeft));
+  }
+  intmap_iterate(rtts, &summary, rttLine);
+  intmap_iterate(buckets, &summary, limitLine);
+}
+
+/* ***************** rttStats ********************** */
+/*
+ * Adds a client's round trip, if measured lately, to the summary for STATS
+ */
+static void rttStats(void* arg, const uint64_t key, void* item)
+{
+  rttSummary_t* summary = arg;
+  rtt_t* rtt = item;
+  if (rtt->samples > 0 && summary->now - rtt->updated < RttStaleNanos) {
+    summary->clients++;
+    summary->smoothed += rtt->smoothed;
+    summary->jitter += rtt->jitter;
+    if (rtt->smoothed > summary->max) {
+      summary->max = rtt->smoothed;
+    }
+  }
+}
+
+/* ***************** rttLine ********************** */
+/*
+ * Appends a client's round trip, if measured lately, to STATS
+ */
+static void rttLine(void* arg, const uint64_t key, void* item)
+{
+  rttSummary_t* summary = arg;
+  rtt_t* rtt = item;
+  if (rtt->samples > 0 && summary->now - rtt->updated < RttStaleNanos) {
+    appendLine(summary->buf, summary->size, summary->used,
+               "client %s rtt-us %.1f jitter-us %.1f samples %lu",
+               message_stringAddr(message_keyAddr(key)), rtt->smoothed / 1e3,
+               rtt->jitter / 1e3, rtt->samples);
+  }
+}
+
+/* ***************** limitLine ********************** */
+/*
+ * Appends, for a client whose keys were ever dropped, how many of its messages were, to STATS
+ */
+static void limitLine(void* arg, const uint64_t key, void* item)
+{
+  rttSummary_t* summary = arg;
+  bucket_t* bucket = item;
+  if (bucket->refused > 0) {
+    appendLine(summary->buf, summary->size, summary->used, "limited %s dropped %lu of %lu",
+               message_stringAddr(message_keyAddr(key)), bucket->refused,
+               bucket->refused + bucket->taken);
+  }
+}
+
+/* ***************** appendLine ********************** */
+/*
+ * Appends one formatted line, and its newline, to the used characters of buf, unless it
+ * would not fit in size; then buf is left as it was
+ */
+static void appendLine(char* buf, const size_t size, size_t* used, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buf + *used, size - *used, format, args);
+  va_end(args);
+  if (length < 0 || *used + length + 2 > size) {  // the line, its newline and the terminator
+    buf[*used] = '\0';
+    return;
+  }
+  buf[*used + length] = '\n';
+  buf[*used + length + 1] = '\0';
+  *used += length + 1;
+}
+
+/* ***************** deleteTimers ********************** */
+static void deleteTimers()
+{
+  hist_delete(parseTimes);
+  hist_delete(queueTimes);
+  hist_delete(keystrokeTimes);
+  hist_delete(gameTimers.move);
+  hist_delete(gameTimers.render);
+  hist_delete(gameTimers.send);
 }
 
 // delete the item
@@ -814,4 +1645,4 @@ itemDelete(void* item)
   if (item != NULL) {
     mem_free(item);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,140 @@
+/* 
+ * arena - a resettable scratch allocator for per-tick temporaries
+ *
+ * See arena.h for detailed interface description for each function.
+ * Memory comes from the 'mem' module, so it is counted by mem_report().
+ */
+
+#include <stdlib.h>
+#include "arena.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+// every allocation is rounded up to a multiple of this
+static const size_t Alignment = 16;
+
+/**************** file-local types ****************/
+typedef struct chunk {
+  struct chunk* next;     // next overflow chunk, or NULL
+  size_t size;            // usable bytes following this header
+} chunk_t;
+
+typedef struct arena {
+  char* block;            // main block, reused every round
+  size_t capacity;        // size of main block
+  size_t used;            // bytes of main block handed out this round
+  chunk_t* overflow;      // chunks borrowed this round, most recent first
+  size_t overflowUsed;    // bytes handed out from overflow this round
+} arena_t;
+
+/**************** local functions ****************/
+static size_t roundUp(const size_t size);
+
+/**************** arena_new ****************/
+/* see arena.h for description */
+arena_t*
+arena_new(const size_t capacity)
+{
+  arena_t* arena = mem_malloc(sizeof(arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->capacity = roundUp(capacity);
+  arena->block = NULL;
+  if (arena->capacity > 0) {
+    arena->block = mem_malloc(arena->capacity);
+    if (arena->block == NULL) {
+      mem_free(arena);
+      return NULL;
+    }
+  }
+  arena->used = 0;
+  arena->overflow = NULL;
+  arena->overflowUsed = 0;
+  return arena;
+}
+
+/**************** arena_alloc ****************/
+/* see arena.h for description */
+void*
+arena_alloc(arena_t* arena, const size_t size)
+{
+  if (arena == NULL || size == 0) {
+    return NULL;
+  }
+  const size_t need = roundUp(size);
+
+  // common case: it fits in the main block
+  if (need <= arena->capacity - arena->used) {
+    void* p = arena->block + arena->used;
+    arena->used += need;
+    return p;
+  }
+
+  // otherwise borrow a chunk just for this allocation
+  chunk_t* chunk = mem_malloc(roundUp(sizeof(chunk_t)) + need);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->size = need;
+  chunk->next = arena->overflow;
+  arena->overflow = chunk;
+  arena->overflowUsed += need;
+  return (char*)chunk + roundUp(sizeof(chunk_t));
+}
+
+/**************** arena_reset ****************/
+/* see arena.h for description */
+void
+arena_reset(arena_t* arena)
+{
+  if (arena == NULL) {
+    return;
+  }
+  if (arena->overflow != NULL) {
+    // give back the borrowed chunks ...
+    while (arena->overflow != NULL) {
+      chunk_t* next = arena->overflow->next;
+      mem_free(arena->overflow);
+      arena->overflow = next;
+    }
+    // ... and grow the block so a round like this one fits next time
+    size_t capacity = arena->used + arena->overflowUsed;
+    char* block = mem_malloc(capacity);
+    if (block != NULL) {
+      if (arena->block != NULL) {
+        mem_free(arena->block);
+      }
+      arena->block = block;
+      arena->capacity = capacity;
+    }
+    arena->overflowUsed = 0;
+  }
+  arena->used = 0;
+}
+
+/**************** arena_delete ****************/
+/* see arena.h for description */
+void
+arena_delete(arena_t* arena)
+{
+  if (arena != NULL) {
+    while (arena->overflow != NULL) {
+      chunk_t* next = arena->overflow->next;
+      mem_free(arena->overflow);
+      arena->overflow = next;
+    }
+    if (arena->block != NULL) {
+      mem_free(arena->block);
+    }
+    mem_free(arena);
+  }
+}
+
+/**************** roundUp ****************/
+/* Round size up to the next multiple of Alignment. */
+static size_t
+roundUp(const size_t size)
+{
+  return (size + Alignment - 1) & ~(Alignment - 1);
+}
@@ -0,0 +1,74 @@
+/* 
+ * arena - a resettable scratch allocator for per-tick temporaries
+ *
+ * An arena hands out memory by bumping a pointer through one block.
+ * Nothing is freed individually; instead the caller resets the whole
+ * arena once the temporaries are no longer needed (e.g., after each
+ * server update), and the same block is reused for the next round.
+ *
+ * If a round needs more than the block holds, the arena borrows extra
+ * chunks from the heap and, at the next reset, replaces its block with
+ * one large enough for that round.  Thus after a warm-up round the
+ * arena makes no further heap allocations.
+ *
+ * Typical sequence:
+ *   arena_t* scratch = arena_new(4096);
+ *   ... each round:
+ *   arena_reset(scratch);
+ *   char* temp = arena_alloc(scratch, n);
+ *   ...
+ *   arena_delete(scratch);
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdlib.h>
+
+/****************** types *********************/
+typedef struct arena arena_t;  // opaque to users of the module
+
+/****************** functions *********************/
+
+/******************************************/
+/* arena_new: create a new, empty arena.
+ * Caller provides:
+ *   initial capacity in bytes (may be 0).
+ * Function returns:
+ *   pointer to the new arena; NULL if out of memory.
+ * Caller is responsible for:
+ *   later calling arena_delete.
+ */
+arena_t* arena_new(const size_t capacity);
+
+/******************************************/
+/* arena_alloc: allocate scratch memory from the arena.
+ * Caller provides:
+ *   valid arena pointer, number of bytes (> 0).
+ * Function returns:
+ *   pointer to uninitialized memory, suitably aligned for any type,
+ *   valid until the next arena_reset or arena_delete;
+ *   NULL if arena is NULL, size is 0, or out of memory.
+ * Notes:
+ *   the caller must not free the returned pointer.
+ */
+void* arena_alloc(arena_t* arena, const size_t size);
+
+/******************************************/
+/* arena_reset: release everything allocated from the arena.
+ * Caller provides:
+ *   valid arena pointer (NULL is ignored).
+ * We do:
+ *   make all earlier allocations invalid; if the previous round
+ *   overflowed the block, grow the block so that round would fit.
+ */
+void arena_reset(arena_t* arena);
+
+/******************************************/
+/* arena_delete: free the arena and all its memory.
+ * Caller provides:
+ *   valid arena pointer (NULL is ignored).
+ */
+void arena_delete(arena_t* arena);
+
+#endif // _ARENA_H_
@@ -0,0 +1,561 @@
+/*
+ * bots - simulated players, for driving a server without any network
+ *
+ * See bots.h for detailed interface description for each function.
+ *
+ * Each bot keeps a copy of the latest frame it was sent, under its own
+ * lock, and where in it the bot is; the thread calling bots_act copies
+ * the frame out and decides there, so the delivering threads only ever
+ * copy a frame.  A bot has at most one move in flight: it moves again
+ * once a frame shows it took that step, or the move is rejected.  Merely
+ * showing it somewhere else is not enough, since another player stepping
+ * onto a bot swaps them, and a frame caused by another player's move must
+ * not make it act on a position it is about to leave.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bots.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+static const int MaxBots = 65535;     // one port each
+static const char Keys[] = "hlkjyubn";
+static const int RowStep[] = { 0, 0, -1, 1, -1, -1, 1, 1 };  // for each of Keys
+static const int ColStep[] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+static const uint64_t StaleNanos = 1000000000;  // a move unanswered this long was lost
+enum { Directions = 8 };
+enum { Joining, Playing, Rejoining, Retired };  // bot states
+
+/**************** file-local types ****************/
+typedef struct bot {
+  pthread_mutex_t lock;     // guards frame and frameSize
+  char* frame;              // rows of the latest DISPLAY, each ending in a newline; NULL if none
+  size_t frameSize;         // allocated length of frame
+  atomic_int at;            // where the bot ('@') is in frame; -1 if no frame
+  atomic_int step;          // how far in the frame the bot's last move takes it
+  atomic_bool arrived;      // a frame has shown the bot take that step
+  atomic_bool rejected;     // the server rejected the bot's last move
+  atomic_int state;         // Joining, Playing, Rejoining or Retired
+  // the rest belongs to the acting thread
+  bool asked;               // sent PLAY, in the current Joining state
+  bool moving;              // a move is in flight
+  uint64_t movedAt;         // when it was sent, in nanoseconds
+  uint16_t* visits;         // per spot of the frame, how often a greedy bot has been there
+  int numSpots;             // length of visits
+} bot_t;
+
+typedef struct bots {
+  int count;
+  bots_policy_t policy;
+  unsigned int seed;        // for rand_r, in the acting thread
+  bot_t* bots;
+  atomic_ulong frames;      // DISPLAY messages delivered
+  atomic_ulong keys;        // KEY messages sent
+  char* view;               // the frame being decided on (acting thread only)
+  size_t viewSize;
+  int* from;                // per spot, the first step of a shortest path to it, or -1
+  int* queue;               // spots to visit, in breadth-first order
+  int scratchSpots;         // length of from and queue
+} bots_t;
+
+/**************** local functions ****************/
+static int decide(bots_t* bots, bot_t* bot, const char* view);
+static int nearestGold(bots_t* bots, const char* view, const int rows, const int cols,
+                       const int start);
+static bool isOpen(const char symbol);
+static void resize(char** buffer, size_t* size, const size_t needed);
+static uint64_t now(void);
+
+/**************** bots_new ****************/
+/* see bots.h for description */
+bots_t*
+bots_new(const int count, const bots_policy_t policy, const unsigned int seed)
+{
+  if (count < 1 || count > MaxBots) {
+    return NULL;
+  }
+  bots_t* bots = mem_calloc(1, sizeof(bots_t));
+  if (bots == NULL) {
+    return NULL;
+  }
+  if ((bots->bots = mem_calloc(count, sizeof(bot_t))) == NULL) {
+    mem_free(bots);
+    return NULL;
+  }
+  bots->count = count;
+  bots->policy = policy;
+  bots->seed = seed;
+  for (int i = 0; i < count; i++) {
+    pthread_mutex_init(&bots->bots[i].lock, NULL);
+    atomic_init(&bots->bots[i].at, -1);
+  }
+  return bots;
+}
+
+/**************** bots_parsePolicy ****************/
+/* see bots.h for description */
+bool
+bots_parsePolicy(const char* name, bots_policy_t* policy)
+{
+  if (strcmp(name, "random") == 0) {
+    *policy = bots_Random;
+  }
+  else if (strcmp(name, "greedy") == 0) {
+    *policy = bots_Greedy;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+/**************** bots_address ****************/
+/* see bots.h for description */
+addr_t
+bots_address(bots_t* bots, const int i)
+{
+  addr_t address = message_noAddr();
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(i + 1);
+  return address;
+}
+
+/**************** bots_deliver ****************/
+/* see bots.h for description
+ *
+ * Pseudocode:
+ *   find the bot from the address's port; ignore anyone else's messages
+ *   if DISPLAY, copy the rows after the header into the bot's frame, and note where it is,
+ *     and whether it got there by taking the step of its last move
+ *   if OK, the bot is now playing; if ERROR, its move was rejected
+ *   if QUIT, it rejoins (after GAME OVER) or retires
+ */
+void
+bots_deliver(void* arg, const addr_t to, const char* message)
+{
+  bots_t* bots = arg;
+  const int i = ntohs(to.sin_port) - 1;
+  if (bots == NULL || i < 0 || i >= bots->count || to.sin_addr.s_addr != htonl(INADDR_LOOPBACK)) {
+    return;
+  }
+  bot_t* bot = &bots->bots[i];
+  if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
+    const char* rows = message + strlen("DISPLAY\n");
+    rows += (*rows == '\n');  // the first row may start with its own newline
+    const size_t length = strlen(rows);
+    const char* me = strchr(rows, '@');
+    pthread_mutex_lock(&bot->lock);
+    resize(&bot->frame, &bot->frameSize, length + 2);
+    strcpy(bot->frame, rows);
+    if (length > 0 && rows[length - 1] != '\n') {
+      strcat(bot->frame, "\n");
+    }
+    const int at = (me == NULL) ? -1 : me - rows;
+    const int before = atomic_exchange(&bot->at, at);
+    if (before >= 0 && at >= 0 && at - before == atomic_load(&bot->step)) {
+      atomic_store(&bot->arrived, true);
+    }
+    pthread_mutex_unlock(&bot->lock);
+    atomic_fetch_add_explicit(&bots->frames, 1, memory_order_relaxed);
+  }
+  else if (strncmp(message, "OK ", strlen("OK ")) == 0) {
+    atomic_store(&bot->state, Playing);
+  }
+  else if (strncmp(message, "ERROR", strlen("ERROR")) == 0) {
+    atomic_store(&bot->rejected, true);
+  }
+  else if (strncmp(message, "QUIT", strlen("QUIT")) == 0) {
+    atomic_store(&bot->state, strncmp(message, "QUIT GAME OVER", strlen("QUIT GAME OVER")) == 0
+                                ? Rejoining : Retired);
+  }
+}
+
+/**************** bots_act ****************/
+/* see bots.h for description
+ *
+ * Pseudocode:
+ *   for each bot,
+ *     if it is rejoining after a game ended, it is joining again, with a clean slate
+ *     if it is joining and has not asked, send PLAY
+ *     if it is playing, and has not moved yet, or its last move was rejected, or a frame
+ *       has shown it take that step, or it moved so long ago that the move must
+ *       have been dropped (a worker that falls behind drops messages),
+ *       copy its latest frame, choose a step from it, note how far it goes, and send KEY
+ */
+int
+bots_act(bots_t* bots, bool (*send)(void* arg, const addr_t from, const char* message), void* arg)
+{
+  if (bots == NULL || send == NULL) {
+    return 0;
+  }
+  int sent = 0;
+  for (int i = 0; i < bots->count; i++) {
+    bot_t* bot = &bots->bots[i];
+    int state = Rejoining;
+    if (atomic_compare_exchange_strong(&bot->state, &state, Joining)) {
+      state = Joining;
+      bot->asked = false;
+      bot->moving = false;
+      atomic_store(&bot->at, -1);  // forget the last game's frame
+      if (bot->visits != NULL) {
+        memset(bot->visits, 0, bot->numSpots * sizeof(uint16_t));
+      }
+    }
+    if (state == Joining && !bot->asked) {
+      char play[20];
+      snprintf(play, sizeof(play), "PLAY bot%d", i);
+      (*send)(arg, bots_address(bots, i), play);
+      bot->asked = true;
+      sent++;
+    }
+    else if (state == Playing) {
+      if (atomic_load(&bot->at) < 0) {
+        continue;  // no frame yet
+      }
+      const bool rejected = atomic_exchange(&bot->rejected, false);
+      const bool arrived = atomic_exchange(&bot->arrived, false);
+      if (bot->moving && !rejected && !arrived && now() - bot->movedAt < StaleNanos) {
+        continue;  // the last move is still in flight
+      }
+      pthread_mutex_lock(&bot->lock);
+      resize(&bots->view, &bots->viewSize, strlen(bot->frame) + 1);
+      strcpy(bots->view, bot->frame);
+      pthread_mutex_unlock(&bot->lock);
+      const int step = decide(bots, bot, bots->view);
+      const int stride = strchr(bots->view, '\n') - bots->view + 1;
+      atomic_store(&bot->step, RowStep[step] * stride + ColStep[step]);
+      bot->moving = true;
+      bot->movedAt = now();
+      char key[] = "KEY x";
+      key[strlen("KEY ")] = Keys[step];
+      (*send)(arg, bots_address(bots, i), key);
+      atomic_fetch_add_explicit(&bots->keys, 1, memory_order_relaxed);
+      sent++;
+    }
+  }
+  return sent;
+}
+
+/**************** bots_frames ****************/
+/* see bots.h for description */
+unsigned long
+bots_frames(bots_t* bots)
+{
+  return bots == NULL ? 0 : atomic_load(&bots->frames);
+}
+
+/**************** bots_keys ****************/
+/* see bots.h for description */
+unsigned long
+bots_keys(bots_t* bots)
+{
+  return bots == NULL ? 0 : atomic_load(&bots->keys);
+}
+
+/**************** bots_delete ****************/
+/* see bots.h for description */
+void
+bots_delete(bots_t* bots)
+{
+  if (bots == NULL) {
+    return;
+  }
+  for (int i = 0; i < bots->count; i++) {
+    pthread_mutex_destroy(&bots->bots[i].lock);
+    if (bots->bots[i].frame != NULL) {
+      mem_free(bots->bots[i].frame);
+    }
+    if (bots->bots[i].visits != NULL) {
+      mem_free(bots->bots[i].visits);
+    }
+  }
+  if (bots->view != NULL) {
+    mem_free(bots->view);
+  }
+  if (bots->from != NULL) {
+    mem_free(bots->from);
+    mem_free(bots->queue);
+  }
+  mem_free(bots->bots);
+  mem_free(bots);
+}
+
+/**************** decide ****************/
+/* Choose a bot's next step (an index in Keys) from its view: rows of equal length, each ending in a newline.
+ *
+ * Pseudocode:
+ *   find the bot ('@') in the view, and which of the eight steps from it lead to open spots
+ *   a random bot takes a random open step
+ *   a greedy bot counts a visit to where it is, then heads for the nearest gold it can see,
+ *     if any; otherwise it steps to the open spot it has visited least (the first such,
+ *     from a random start), which soon leads it everywhere
+ */
+static int
+decide(bots_t* bots, bot_t* bot, const char* view)
+{
+  const char* newline = strchr(view, '\n');
+  const int cols = (newline == NULL) ? strlen(view) : newline - view;
+  const int rows = strlen(view) / (cols + 1);
+  const char* me = strchr(view, '@');
+  if (me == NULL || cols == 0) {
+    return rand_r(&bots->seed) % Directions;
+  }
+  const int row = (me - view) / (cols + 1), col = (me - view) % (cols + 1);
+
+  int open[Directions], numOpen = 0;
+  for (int d = 0; d < Directions; d++) {
+    int r = row + RowStep[d], c = col + ColStep[d];
+    if (r >= 0 && r < rows && c >= 0 && c < cols && isOpen(view[r * (cols + 1) + c])) {
+      open[numOpen++] = d;
+    }
+  }
+  if (numOpen == 0) {
+    return rand_r(&bots->seed) % Directions;
+  }
+  const int first = rand_r(&bots->seed) % numOpen;
+  if (bots->policy == bots_Random) {
+    return open[first];
+  }
+
+  if (bot->numSpots != rows * cols) {
+    if (bot->visits != NULL) {
+      mem_free(bot->visits);
+    }
+    bot->numSpots = rows * cols;
+    bot->visits = mem_calloc_assert(bot->numSpots, sizeof(uint16_t), "Out of memory for bot.\n");
+  }
+  if (bot->visits[row * cols + col] < UINT16_MAX) {
+    bot->visits[row * cols + col]++;
+  }
+  int step = nearestGold(bots, view, rows, cols, row * cols + col);
+  if (step >= 0) {
+    return step;
+  }
+  int best = open[first];
+  for (int k = 1; k < numOpen; k++) {
+    int d = open[(first + k) % numOpen];
+    if (bot->visits[(row + RowStep[d]) * cols + col + ColStep[d]]
+        < bot->visits[(row + RowStep[best]) * cols + col + ColStep[best]]) {
+      best = d;
+    }
+  }
+  return best;
+}
+
+/**************** nearestGold ****************/
+/* Search the view breadth first from start (row * cols + col) through open spots;
+ * return the index in Keys of the first step towards the nearest gold, or -1 if none is seen
+ */
+static int
+nearestGold(bots_t* bots, const char* view, const int rows, const int cols, const int start)
+{
+  const int spots = rows * cols;
+  if (spots > bots->scratchSpots) {
+    if (bots->from != NULL) {
+      mem_free(bots->from);
+      mem_free(bots->queue);
+    }
+    bots->from = mem_malloc_assert(spots * sizeof(int), "Out of memory for bot search.\n");
+    bots->queue = mem_malloc_assert(spots * sizeof(int), "Out of memory for bot search.\n");
+    bots->scratchSpots = spots;
+  }
+  for (int s = 0; s < spots; s++) {
+    bots->from[s] = -1;
+  }
+
+  int head = 0, tail = 0;
+  bots->from[start] = Directions;  // marks the start as visited
+  bots->queue[tail++] = start;
+  while (head < tail) {
+    const int spot = bots->queue[head++];
+    const int row = spot / cols, col = spot % cols;
+    for (int d = 0; d < Directions; d++) {
+      int r = row + RowStep[d], c = col + ColStep[d], next = r * cols + c;
+      if (r < 0 || r >= rows || c < 0 || c >= cols || bots->from[next] >= 0
+          || !isOpen(view[r * (cols + 1) + c])) {
+        continue;
+      }
+      bots->from[next] = (spot == start) ? d : bots->from[spot];
+      if (view[r * (cols + 1) + c] == '*') {
+        return bots->from[next];
+      }
+      bots->queue[tail++] = next;
+    }
+  }
+  return -1;
+}
+
+// can a player step onto a spot showing this symbol?  (onto another player, they swap)
+static bool
+isOpen(const char symbol)
+{
+  return symbol == '.' || symbol == '#' || symbol == '*' || isupper(symbol);
+}
+
+// make a buffer at least the needed size, discarding what it held if it must grow
+static void
+resize(char** buffer, size_t* size, const size_t needed)
+{
+  if (*buffer == NULL || *size < needed) {
+    if (*buffer != NULL) {
+      mem_free(*buffer);
+    }
+    *buffer = mem_malloc_assert(needed, "Out of memory for bot frame.\n");
+    *size = needed;
+  }
+}
+
+// a monotonic clock, in nanoseconds
+static uint64_t
+now(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/* ***************************************************************** */
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Hand the bots made-up frames and check the moves they choose, and
+ * that they join, rejoin and retire as the server tells them to.
+ *
+ *   ./botstest
+ */
+#ifdef UNIT_TEST
+
+static int errors = 0;
+static char lastSent[2][30];  // by each bot
+static int numSent = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+static bool
+remember(void* arg, const addr_t from, const char* message)
+{
+  snprintf(lastSent[ntohs(from.sin_port) - 1], sizeof(lastSent[0]), "%s", message);
+  numSent++;
+  return false;
+}
+
+// a frame of a corridor with the bot at the given column (1 to 5)
+static const char*
+corridor(const int col)
+{
+  static char frame[] = "DISPLAY\n\n+-----+\n|.....|\n+-----+";
+  char* row = strchr(frame, '|');
+  memcpy(row, "|.....|", strlen("|.....|"));
+  row[col] = '@';
+  return frame;
+}
+
+// let the bots act; return the number of messages they sent
+static int
+act(bots_t* bots)
+{
+  numSent = 0;
+  bots_act(bots, remember, NULL);
+  return numSent;
+}
+
+int
+main()
+{
+  bots_t* bots = bots_new(2, bots_Greedy, 1);
+  addr_t greedy = bots_address(bots, 0);
+  addr_t other = bots_address(bots, 1);
+
+  expect(act(bots) == 2, "both bots send PLAY");
+  expect(strcmp(lastSent[1], "PLAY bot1") == 0, "PLAY names the bot");
+  expect(act(bots) == 0, "nobody sends twice before the server replies");
+
+  bots_deliver(bots, greedy, "OK A");
+  bots_deliver(bots, other, "OK B");
+  expect(act(bots) == 0, "nobody moves before seeing a frame");
+  // gold down and to the right, behind a wall the bot must go around
+  const char* behindWall = "DISPLAY\n\n"
+    "+-----+\n"
+    "|@.|..|\n"
+    "|..|..|\n"
+    "|....*|\n"
+    "+-----+";
+  bots_deliver(bots, greedy, behindWall);
+  bots_deliver(bots, other, "DISPLAY\n\n+---+\n|@..|\n+---+");
+  expect(bots_frames(bots) == 2, "frames are counted");
+  expect(act(bots) == 2, "each bot with a frame moves");
+  expect(strcmp(lastSent[0], "KEY n") == 0, "greedy bot heads diagonally for the gold");
+  expect(strcmp(lastSent[1], "KEY l") == 0, "a bot takes the only open step");
+
+  bots_deliver(bots, greedy, behindWall);
+  expect(act(bots) == 0, "a bot waits until its move shows in a frame");
+  bots_deliver(bots, greedy, "ERROR. Invalid keystroke.\n");
+  expect(act(bots) == 1, "a bot whose move was rejected moves again");
+
+  bots_deliver(bots, greedy, "DISPLAY\n\n"
+               "+-----+\n"
+               "|..|..|\n"
+               "|.@|..|\n"
+               "|.*...|\n"
+               "+-----+");
+  expect(act(bots) == 1 && strcmp(lastSent[0], "KEY j") == 0, "greedy bot steps onto gold next to it");
+
+  // another player swapping with the bot is not the bot's own move
+  bots_deliver(bots, other, corridor(3));
+  expect(act(bots) == 0, "a bot moved by someone else still waits for its own move");
+  bots_deliver(bots, other, "ERROR. Invalid keystroke.\n");
+  expect(act(bots) == 1, "it moves again once that is rejected");
+
+  // with no gold in sight, a greedy bot goes where it has been least
+  int col = 3;
+  bool been[7] = { false };
+  for (int trial = 0; trial < 10; trial++) {
+    col += (strcmp(lastSent[1], "KEY l") == 0) ? 1 : -1;
+    been[col] = true;
+    bots_deliver(bots, other, corridor(col));
+    expect(act(bots) == 1, "a bot moves after each of its moves shows");
+  }
+  expect(been[1] && been[2] && been[3] && been[4] && been[5], "a greedy bot explores everywhere");
+
+  bots_deliver(bots, greedy, "QUIT GAME OVER:\nA 5 bot0\n");
+  bots_deliver(bots, other, "QUIT All games are full: no more players can join.\n");
+  expect(act(bots) == 1 && strcmp(lastSent[0], "PLAY bot0") == 0, "after GAME OVER only bot0 rejoins");
+  bots_deliver(bots, greedy, "OK C");
+  expect(act(bots) == 0, "a bot that rejoins waits for the new game's frame");
+  expect(bots_keys(bots) == 15, "keys are counted");
+  bots_delete(bots);
+
+  // a random bot only takes open steps
+  bots = bots_new(1, bots_Random, 7);
+  act(bots);
+  bots_deliver(bots, bots_address(bots, 0), "OK A");
+  for (int trial = 0; trial < 20; trial++) {
+    bots_deliver(bots, bots_address(bots, 0), corridor(2 + trial % 2));
+    act(bots);
+    expect(strcmp(lastSent[0], "KEY h") == 0 || strcmp(lastSent[0], "KEY l") == 0,
+           "a random bot takes an open step");
+  }
+  bots_delete(bots);
+
+  printf("%s\n", errors == 0 ? "bots test passed" : "bots test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,112 @@
+/*
+ * bots - simulated players, for driving a server without any network
+ *
+ * A bots_t is a crowd of simulated players that speak the nuggets
+ * protocol: each sends PLAY, then one KEY at a time, sending the next
+ * once a DISPLAY shows the last one taken, or the server rejects it; it
+ * chooses each move from the latest DISPLAY it was sent.
+ * Bot i has its own made-up address (see bots_address); the server's
+ * replies reach the bots through bots_deliver, which is meant to be
+ * what the message module's memory transport delivers to (see
+ * message_memoryTransport), so a whole game can run in one process with
+ * no sockets.
+ *
+ * Policies:
+ *   random - step to a random open spot next to the bot
+ *   greedy - step along a shortest path to the nearest visible gold;
+ *            with none in sight, step to the open spot it has visited least
+ *
+ * Replies may be delivered from any number of threads at once, while
+ * one other thread calls bots_act.
+ *
+ * Typical sequence:
+ *   bots_t* bots = bots_new(26, bots_Greedy, seed);
+ *   message_setTransport(message_memoryTransport(bots_deliver, bots));
+ *   message_init(NULL);
+ *   while (running) {
+ *     bots_act(bots, handleMessage, arg);   // each bot that may, sends one message
+ *   }
+ *   message_done();
+ *   bots_delete(bots);
+ */
+
+#ifndef _BOTS_H_
+#define _BOTS_H_
+
+#include <stdbool.h>
+#include "message.h"
+
+/****************** types *********************/
+typedef struct bots bots_t;  // opaque to users of the module
+
+typedef enum { bots_Random, bots_Greedy } bots_policy_t;
+
+/****************** functions *********************/
+
+/******************************************/
+/* bots_new: create a crowd of bots that have not yet joined a game.
+ * Caller provides:
+ *   number of bots (1 to 65535), their policy, and a seed for their choices.
+ * Function returns:
+ *   pointer to the new bots; NULL if out of memory or count is out of range.
+ * Caller is responsible for:
+ *   later calling bots_delete.
+ */
+bots_t* bots_new(const int count, const bots_policy_t policy, const unsigned int seed);
+
+/******************************************/
+/* bots_parsePolicy: the policy named "random" or "greedy".
+ * Function returns:
+ *   true, having set *policy; false if the name is neither.
+ */
+bool bots_parsePolicy(const char* name, bots_policy_t* policy);
+
+/******************************************/
+/* bots_address: the made-up address from which bot number i speaks.
+ */
+addr_t bots_address(bots_t* bots, const int i);
+
+/******************************************/
+/* bots_deliver: hand a message from the server to the bot at address to.
+ * Caller provides:
+ *   the bots (as a void*, so this can be a transport's deliver function), the bot's address,
+ *   and the message; messages for other addresses are ignored.
+ * We do:
+ *   keep the latest DISPLAY, noting whether it shows the bot's last move taken;
+ *   after ERROR, let the bot move again;
+ *   after QUIT at the end of a game, have the bot join the next game;
+ *   after any other QUIT, retire the bot.
+ */
+void bots_deliver(void* arg, const addr_t to, const char* message);
+
+/******************************************/
+/* bots_act: let every bot that may act send one message.
+ * Caller provides:
+ *   the bots, and a function to send a message as if from a bot's address
+ *   (typically the server's own handler for incoming messages), with its arg.
+ * We do:
+ *   for each bot that has not joined, send PLAY; for each player whose last
+ *   move has shown in a frame or was rejected (or was never answered, for a
+ *   second), choose and send a KEY.
+ * Function returns:
+ *   the number of messages sent.
+ */
+int bots_act(bots_t* bots, bool (*send)(void* arg, const addr_t from, const char* message),
+             void* arg);
+
+/******************************************/
+/* bots_frames: the number of DISPLAY messages delivered to the bots so far.
+ */
+unsigned long bots_frames(bots_t* bots);
+
+/******************************************/
+/* bots_keys: the number of KEY messages the bots have sent so far.
+ */
+unsigned long bots_keys(bots_t* bots);
+
+/******************************************/
+/* bots_delete: free the bots (NULL is ignored); nothing may deliver to them any more.
+ */
+void bots_delete(bots_t* bots);
+
+#endif // _BOTS_H_
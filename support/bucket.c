@@ -0,0 +1,99 @@
+/*
+ * bucket - a token bucket, to hold a client to a rate of input
+ *
+ * See bucket.h for detailed interface description for each function.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bucket.h"
+
+/**************** bucket_take ****************/
+/* see bucket.h for description
+ *
+ * Pseudocode:
+ *   fill the bucket (full, the first time) by rate for each second since it last took,
+ *     up to burst
+ *   if it holds cost tokens, take them and return true; otherwise return false
+ */
+bool
+bucket_take(bucket_t* bucket, const double rate, const double burst, double cost,
+            const uint64_t now)
+{
+  if (bucket == NULL) {
+    return false;
+  }
+  if (bucket->updated == 0) {
+    bucket->tokens = burst;
+  }
+  else if (now > bucket->updated) {
+    bucket->tokens += rate * (now - bucket->updated) / 1e9;
+    if (bucket->tokens > burst) {
+      bucket->tokens = burst;
+    }
+  }
+  if (now > bucket->updated) {
+    bucket->updated = now;
+  }
+  if (cost > burst) {
+    cost = burst;
+  }
+  if (bucket->tokens < cost) {
+    bucket->refused++;
+    return false;
+  }
+  bucket->tokens -= cost;
+  bucket->taken++;
+  return true;
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Send a burst into a fresh bucket, then a flood at ten times its rate, and
+ * check that the burst goes through and the flood is cut to the rate; check
+ * too that a bucket left alone fills up again, and no further.
+ *
+ *   ./buckettest
+ */
+#ifdef UNIT_TEST
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+int
+main()
+{
+  const uint64_t second = 1000000000;
+  bucket_t bucket = { 0 };
+  int passed = 0;
+  for (int i = 0; i < 20; i++) {
+    passed += bucket_take(&bucket, 100, 10, 1, second);
+  }
+  expect(passed == 10 && bucket.refused == 10, "a fresh bucket lets a burst through, and no more");
+
+  passed = 0;
+  for (uint64_t t = 1; t <= 10000; t++) {  // 1000 inputs a second, for ten seconds
+    passed += bucket_take(&bucket, 100, 10, 1, second + t * (second / 1000));
+  }
+  expect(passed >= 995 && passed <= 1005, "a flood is cut to the rate");
+
+  expect(bucket_take(&bucket, 100, 10, 10, 20 * second), "a bucket left alone fills up");
+  expect(!bucket_take(&bucket, 100, 10, 1, 20 * second), "but no further than the burst");
+  expect(bucket_take(&bucket, 100, 10, 50, 21 * second), "a cost above the burst takes the burst");
+  expect(!bucket_take(&bucket, 100, 10, 1, 20 * second), "time going backward adds nothing");
+
+  printf("%s\n", errors == 0 ? "bucket test passed" : "bucket test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,42 @@
+/*
+ * bucket - a token bucket, to hold a client to a rate of input
+ *
+ * The bucket holds up to burst tokens, and fills at rate tokens a second;
+ * each input takes its cost in tokens from it, and one that finds too few
+ * is refused, leaving the bucket as it was.  So a client may send burst
+ * inputs at once, after a pause, but no more than rate a second for long.
+ * A bucket that has taken nothing yet is full.
+ *
+ * Typical sequence:
+ *   bucket_t bucket = { 0 };
+ *   on each input:  if (!bucket_take(&bucket, rate, burst, 1, hist_now())) drop it
+ */
+
+#ifndef _BUCKET_H_
+#define _BUCKET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/****************** types *********************/
+typedef struct bucket {
+  double tokens;           // tokens in the bucket as of updated
+  uint64_t updated;        // when it last took some (see hist_now); 0 if never
+  unsigned long taken;     // inputs it let through
+  unsigned long refused;   // inputs it refused
+} bucket_t;
+
+/****************** functions *********************/
+
+/******************************************/
+/* bucket_take: take cost tokens for an input at now, if the bucket holds them.
+ * Caller provides:
+ *   the rate and burst, the same each time, and the time (see hist_now);
+ *   a cost above burst is taken as burst, so that no input is refused forever.
+ * Function returns:
+ *   true if the input may go ahead; false if it is refused.
+ */
+bool bucket_take(bucket_t* bucket, const double rate, const double burst, double cost,
+                 const uint64_t now);
+
+#endif // _BUCKET_H_
@@ -0,0 +1,166 @@
+/*
+ * delta - the differences between two frames of the same size, as text
+ *
+ * See delta.h for detailed interface description for each function.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "delta.h"
+
+/**************** file-local constants ****************/
+// unchanged characters a run may cover rather than end; about what starting another costs
+static const size_t MergeGap = 6;
+
+/**************** delta_encode ****************/
+/* see delta.h for description
+ *
+ * Pseudocode:
+ *   for each character that differs from base,
+ *     start a run there, and extend it over later differences on the same line
+ *       until MergeGap characters in a row are unchanged
+ *     write the run, giving up if out would pass limit
+ */
+int
+delta_encode(const char* base, const char* frame, const size_t length,
+             char* out, const size_t limit)
+{
+  size_t used = 0;
+  size_t i = 0;
+  while (i < length) {
+    if (base[i] == frame[i]) {
+      i++;
+      continue;
+    }
+    if (frame[i] == '\n') {  // the frames are not the same shape
+      return -1;
+    }
+    size_t start = i;
+    size_t end = i + 1;     // the run is [start, end)
+    for (size_t j = end; j < length && frame[j] != '\n' && j - end < MergeGap; j++) {
+      if (base[j] != frame[j]) {
+        end = j + 1;
+      }
+    }
+    int n = snprintf(out + used, limit + 1 - used, "%zu %.*s\n", start, (int)(end - start),
+                     frame + start);
+    if (n < 0 || used + n > limit) {
+      return -1;
+    }
+    used += n;
+    i = end;
+  }
+  out[used] = '\0';
+  return used;
+}
+
+/**************** delta_apply ****************/
+/* see delta.h for description */
+bool
+delta_apply(char* frame, const size_t length, const char* delta)
+{
+  const char* run = delta;
+  while (*run != '\0') {
+    if (!isdigit((unsigned char)*run)) {
+      return false;
+    }
+    char* rest;
+    unsigned long offset = strtoul(run, &rest, 10);
+    if (*rest != ' ') {
+      return false;
+    }
+    const char* text = rest + 1;
+    const char* eol = strchr(text, '\n');
+    size_t n = (eol == NULL) ? strlen(text) : eol - text;
+    if (offset > length || n > length - offset) {
+      return false;
+    }
+    memcpy(frame + offset, text, n);
+    run = text + n + (eol != NULL);
+  }
+  return true;
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Encode the differences between many pairs of made-up frames, some
+ * nearly the same and some not at all, apply each delta to a copy of
+ * its base, and check the copy then matches the frame; check too that
+ * a delta that will not fit is refused, and that bad deltas are caught.
+ *
+ *   ./deltatest
+ */
+#ifdef UNIT_TEST
+
+static const int Rows = 21;
+static const int Cols = 79;
+static const int Pairs = 2000;
+
+// fill frame with rows of map symbols, each row ended by a newline
+static void
+randomFrame(char* frame, unsigned int* seed)
+{
+  const char symbols[] = " .#-|+*@ABC";
+  for (int r = 0; r < Rows; r++) {
+    for (int c = 0; c < Cols; c++) {
+      frame[r * (Cols + 1) + c] = symbols[rand_r(seed) % (sizeof(symbols) - 1)];
+    }
+    frame[r * (Cols + 1) + Cols] = '\n';
+  }
+  frame[Rows * (Cols + 1)] = '\0';
+}
+
+int
+main(const int argc, char* argv[])
+{
+  const size_t length = Rows * (Cols + 1);
+  char base[length + 1];
+  char frame[length + 1];
+  char copy[length + 1];
+  char out[4 * length + 1];
+  unsigned int seed = 1;
+  int errors = 0;
+  size_t smallest = length, largest = 0;
+
+  for (int pair = 0; pair < Pairs; pair++) {
+    randomFrame(base, &seed);
+    strcpy(frame, base);
+    int changes = (pair % 2 == 0) ? rand_r(&seed) % 10 : rand_r(&seed) % (int)length;
+    for (int k = 0; k < changes; k++) {
+      int at = rand_r(&seed) % length;
+      if (frame[at] != '\n') {
+        frame[at] = (frame[at] == '@') ? '.' : '@';
+      }
+    }
+    int n = delta_encode(base, frame, length, out, sizeof(out) - 1);
+    strcpy(copy, base);
+    if (n < 0 || strlen(out) != n || !delta_apply(copy, length, out) || strcmp(copy, frame) != 0) {
+      printf("pair %d: %d changes not carried by the delta\n", pair, changes);
+      errors++;
+    }
+    if (n >= 0 && changes > 0 && changes < 10) {
+      smallest = (n < smallest) ? n : smallest;
+      largest = (n > largest) ? n : largest;
+    }
+  }
+  printf("deltas of 1 to 9 changes: %zu to %zu bytes, for a %zu-byte frame\n",
+         smallest, largest, length);
+
+  // the same frame needs no runs; a new one will not fit in a frame's length
+  errors += (delta_encode(base, base, length, out, length) != 0 || out[0] != '\0');
+  randomFrame(frame, &seed);
+  errors += (delta_encode(base, frame, length, out, length) != -1);
+  // runs must be well formed, and inside the frame
+  errors += delta_apply(copy, length, "x 12\n");
+  errors += delta_apply(copy, length, "12\n");
+  errors += delta_apply(copy, length, "1679 ab\n");
+  errors += !delta_apply(copy, length, "1678 a");
+
+  printf("%s\n", errors == 0 ? "delta test passed" : "delta test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
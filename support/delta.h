@@ -0,0 +1,60 @@
+/*
+ * delta - the differences between two frames of the same size, as text
+ *
+ * A delta lists, one run per line, the places where a frame differs
+ * from an earlier frame (its base) of the same length:
+ *
+ *   offset text\n
+ *
+ * meaning the characters of the frame from offset on are text.  A run
+ * never crosses a newline of the frame, so the text of a run is the
+ * rest of its line; runs are merged across short stretches that did
+ * not change, where one run costs less than two.  An empty delta means
+ * the frames are the same.
+ *
+ * The server sends a player a delta against the last frame the player
+ * acknowledged, rather than the whole frame (see game.c); both ends
+ * keep the last delta_History frames, by sequence number, so that the
+ * base of a delta is still at hand.
+ *
+ * Typical sequence:
+ *   int len = delta_encode(base, frame, length, out, limit);
+ *   ... on the other end, holding base:
+ *   delta_apply(base, length, out);   // base is now frame
+ */
+
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/****************** constants *********************/
+// frames each end keeps; a base further behind the newest frame is gone
+enum { delta_History = 8 };
+
+/****************** functions *********************/
+
+/******************************************/
+/* delta_encode: write the delta that turns base into frame.
+ * Caller provides:
+ *   two frames of the given length, and room in out for limit characters
+ *   and a terminating null.
+ * Function returns:
+ *   the number of characters written to out; -1 if the delta needs more
+ *   than limit (out then holds a partial delta, to be ignored).
+ */
+int delta_encode(const char* base, const char* frame, const size_t length,
+                 char* out, const size_t limit);
+
+/******************************************/
+/* delta_apply: change frame by every run of delta.
+ * Caller provides:
+ *   a frame of the given length, and a delta written by delta_encode.
+ * Function returns:
+ *   true if every run was applied; false if the delta is malformed or a
+ *   run falls outside the frame (frame may then be partly changed).
+ */
+bool delta_apply(char* frame, const size_t length, const char* delta);
+
+#endif // _DELTA_H_
@@ -0,0 +1,254 @@
+/*
+ * hist - log-linear latency histograms, in the style of HdrHistogram
+ *
+ * See hist.h for detailed interface description for each function.
+ *
+ * Values below 2^SubBits each have their own bucket.  A larger value
+ * whose top bit is bit m falls in one of the 2^(SubBits-1) buckets for
+ * bit m, chosen by the SubBits-1 bits below its top bit.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hist.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+#define SubBits 6                                  // 2^SubBits exact buckets; 2^(SubBits-1) per power above
+static const int Linear = 1 << SubBits;            // values below this are counted exactly
+static const int PerPower = 1 << (SubBits - 1);    // buckets per power of two above that
+static const int NumBuckets = (1 << SubBits) + (64 - SubBits) * (1 << (SubBits - 1));
+
+/**************** file-local types ****************/
+typedef struct hist {
+  atomic_ulong count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+  atomic_ulong* buckets;    // NumBuckets counts
+} hist_t;
+
+/**************** local functions ****************/
+static int bucketOf(const uint64_t value);
+static uint64_t bucketTop(const int bucket);
+
+/**************** hist_new ****************/
+/* see hist.h for description */
+hist_t*
+hist_new(void)
+{
+  hist_t* hist = mem_calloc(1, sizeof(hist_t));
+  if (hist == NULL) {
+    return NULL;
+  }
+  if ((hist->buckets = mem_calloc(NumBuckets, sizeof(atomic_ulong))) == NULL) {
+    mem_free(hist);
+    return NULL;
+  }
+  return hist;
+}
+
+/**************** hist_now ****************/
+/* see hist.h for description */
+uint64_t
+hist_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**************** hist_record ****************/
+/* see hist.h for description */
+void
+hist_record(hist_t* hist, const uint64_t value)
+{
+  if (hist == NULL) {
+    return;
+  }
+  atomic_fetch_add_explicit(&hist->buckets[bucketOf(value)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+  uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  while (value > max
+         && !atomic_compare_exchange_weak_explicit(&hist->max, &max, value,
+                                                   memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+/**************** hist_count ****************/
+/* see hist.h for description */
+unsigned long
+hist_count(hist_t* hist)
+{
+  return hist == NULL ? 0 : atomic_load(&hist->count);
+}
+
+/**************** hist_max ****************/
+/* see hist.h for description */
+uint64_t
+hist_max(hist_t* hist)
+{
+  return hist == NULL ? 0 : atomic_load(&hist->max);
+}
+
+/**************** hist_percentile ****************/
+/* see hist.h for description */
+uint64_t
+hist_percentile(hist_t* hist, const double percent)
+{
+  if (hist == NULL) {
+    return 0;
+  }
+  // count the buckets themselves, since others may be recording as we go
+  unsigned long total = 0;
+  for (int b = 0; b < NumBuckets; b++) {
+    total += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+  }
+  if (total == 0) {
+    return 0;
+  }
+  unsigned long wanted = (unsigned long)(percent / 100 * total + 0.5);
+  wanted = (wanted < 1) ? 1 : (wanted > total ? total : wanted);
+  unsigned long seen = 0;
+  uint64_t max = hist_max(hist);
+  for (int b = 0; b < NumBuckets; b++) {
+    seen += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+    if (seen >= wanted) {
+      uint64_t top = bucketTop(b);
+      return (top < max) ? top : max;
+    }
+  }
+  return max;
+}
+
+/**************** hist_print ****************/
+/* see hist.h for description */
+void
+hist_print(hist_t* hist, FILE* fp, const char* name)
+{
+  if (hist == NULL || fp == NULL || name == NULL) {
+    return;
+  }
+  unsigned long count = hist_count(hist);
+  double mean = (count == 0) ? 0 : (double)atomic_load(&hist->sum) / count;
+  fprintf(fp, "%-10s %8lu  mean %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  p99.9 %9.1f  max %9.1f us\n",
+          name, count, mean / 1000,
+          hist_percentile(hist, 50) / 1000.0, hist_percentile(hist, 90) / 1000.0,
+          hist_percentile(hist, 99) / 1000.0, hist_percentile(hist, 99.9) / 1000.0,
+          hist_max(hist) / 1000.0);
+}
+
+/**************** hist_delete ****************/
+/* see hist.h for description */
+void
+hist_delete(hist_t* hist)
+{
+  if (hist != NULL) {
+    mem_free(hist->buckets);
+    mem_free(hist);
+  }
+}
+
+/**************** bucketOf ****************/
+/* The bucket that counts a value */
+static int
+bucketOf(const uint64_t value)
+{
+  if (value < Linear) {
+    return (int)value;
+  }
+  int top = 63 - __builtin_clzll(value);        // >= SubBits
+  int shift = top - SubBits + 1;                // >= 1
+  int sub = (int)(value >> shift) - PerPower;   // the bits below the top one
+  return Linear + (shift - 1) * PerPower + sub;
+}
+
+/**************** bucketTop ****************/
+/* The largest value a bucket counts */
+static uint64_t
+bucketTop(const int bucket)
+{
+  if (bucket < Linear) {
+    return bucket;
+  }
+  int shift = (bucket - Linear) / PerPower + 1;
+  uint64_t sub = (bucket - Linear) % PerPower + PerPower;
+  return ((sub + 1) << shift) - 1;
+}
+
+/* ***************************************************************** */
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Record known values, from several threads at once, and check the
+ * count, the maximum, and that every percentile is within the promised
+ * error of the exact answer.
+ *
+ *   ./histtest
+ */
+#ifdef UNIT_TEST
+#include <pthread.h>
+#include <stdbool.h>
+
+static const int Threads = 4;
+static const uint64_t PerThread = 250000;
+
+// thread t records the values t+1, t+1+Threads, ... : together, 1..Threads*PerThread
+static void*
+recorder(void* arg)
+{
+  hist_t* hist = ((void**)arg)[0];
+  int t = *(int*)((void**)arg)[1];
+  for (uint64_t v = t + 1; v <= Threads * PerThread; v += Threads) {
+    hist_record(hist, v);
+  }
+  return NULL;
+}
+
+int
+main(const int argc, char* argv[])
+{
+  hist_t* hist = hist_new();
+  pthread_t threads[Threads];
+  int index[Threads];
+  void* args[Threads][2];
+  for (int t = 0; t < Threads; t++) {
+    index[t] = t;
+    args[t][0] = hist;
+    args[t][1] = &index[t];
+    pthread_create(&threads[t], NULL, recorder, args[t]);
+  }
+  for (int t = 0; t < Threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  int errors = 0;
+  const uint64_t n = Threads * PerThread;
+  errors += (hist_count(hist) != n);
+  errors += (hist_max(hist) != n);
+  const double percents[] = { 1, 10, 50, 90, 99, 99.9, 100 };
+  for (int i = 0; i < sizeof(percents) / sizeof(percents[0]); i++) {
+    double exact = percents[i] / 100 * n;
+    double estimate = hist_percentile(hist, percents[i]);
+    bool close = estimate >= exact - 1 && estimate <= exact * (1 + 1.0 / PerPower) + 1;
+    printf("p%-5g exact %9.0f estimate %9.0f%s\n", percents[i], exact, estimate, close ? "" : "  WRONG");
+    errors += !close;
+  }
+  // small values are exact
+  hist_t* small = hist_new();
+  for (uint64_t v = 0; v < Linear; v++) {
+    hist_record(small, v);
+  }
+  errors += (hist_percentile(small, 50) != Linear / 2 - 1);
+  hist_print(hist, stdout, "test");
+  hist_delete(hist);
+  hist_delete(small);
+  printf("%s\n", errors == 0 ? "hist test passed" : "hist test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
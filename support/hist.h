@@ -0,0 +1,94 @@
+/* 
+ * hist - log-linear latency histograms, in the style of HdrHistogram
+ *
+ * A histogram counts values (typically nanoseconds, from hist_now) in
+ * buckets that are exact below 64 and, above that, 32 to each power of
+ * two, so any value is known to within about 3% while the whole range
+ * of a 64-bit value fits in under 2000 buckets.  Recording is a few
+ * relaxed atomic increments, with no locks and no allocation, so many
+ * threads may record into one histogram at once; percentiles read
+ * while others record are approximate.
+ *
+ * Typical sequence:
+ *   hist_t* render = hist_new();
+ *   ... on the hot path:
+ *   uint64_t start = hist_now();
+ *   ...
+ *   hist_record(render, hist_now() - start);
+ *   ... on demand:
+ *   hist_print(render, stderr, "render");
+ *   hist_delete(render);
+ */
+
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/****************** types *********************/
+typedef struct hist hist_t;  // opaque to users of the module
+
+/****************** functions *********************/
+
+/******************************************/
+/* hist_new: create a new, empty histogram.
+ * Function returns:
+ *   pointer to the new histogram; NULL if out of memory.
+ * Caller is responsible for:
+ *   later calling hist_delete.
+ */
+hist_t* hist_new(void);
+
+/******************************************/
+/* hist_now: the time, in nanoseconds, on a clock that never jumps
+ * (CLOCK_MONOTONIC); only differences between two readings mean anything.
+ */
+uint64_t hist_now(void);
+
+/******************************************/
+/* hist_record: count one value.
+ * Caller provides:
+ *   histogram (NULL is ignored), and the value.
+ * Notes:
+ *   safe to call from any number of threads at once.
+ */
+void hist_record(hist_t* hist, const uint64_t value);
+
+/******************************************/
+/* hist_count: the number of values recorded (0 if hist is NULL).
+ */
+unsigned long hist_count(hist_t* hist);
+
+/******************************************/
+/* hist_max: the largest value recorded (0 if none, or hist is NULL).
+ */
+uint64_t hist_max(hist_t* hist);
+
+/******************************************/
+/* hist_percentile: estimate a percentile of the recorded values.
+ * Caller provides:
+ *   histogram, and the percentile, 0 to 100 (e.g., 99.9).
+ * Function returns:
+ *   the top of the bucket holding that percentile, but no more than
+ *   the largest value recorded; 0 if none, or hist is NULL.
+ */
+uint64_t hist_percentile(hist_t* hist, const double percent);
+
+/******************************************/
+/* hist_print: write one line summarizing a histogram of nanoseconds:
+ *   name, count, mean, and the 50th, 90th, 99th and 99.9th percentiles
+ *   and maximum, in microseconds.
+ * Caller provides:
+ *   histogram, open file, and a name for the line.
+ */
+void hist_print(hist_t* hist, FILE* fp, const char* name);
+
+/******************************************/
+/* hist_delete: free the histogram.
+ * Caller provides:
+ *   histogram (NULL is ignored), which no thread may still be recording into.
+ */
+void hist_delete(hist_t* hist);
+
+#endif // _HIST_H_
@@ -0,0 +1,448 @@
+/*
+ * journal - a compact binary record of everything that drove a server's games
+ *
+ * See journal.h for detailed interface description for each function.
+ *
+ * Fields are written a byte at a time, least significant first, so a
+ * journal reads back the same on any machine.  Records go through the
+ * stdio buffer, under the journal's lock, so journaling a message costs
+ * a hash-table lookup and a small copy, not a system call.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for truncate, in the unit test
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "journal.h"
+#include "intmap.h"
+#include "hist.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+static const char Magic[4] = { 'N', 'U', 'G', 'J' };
+static const uint32_t Version = 1;
+static const int MaxText = 65535;   // longest text a record can hold
+static const int ExpectedClients = 200; // client addresses the map holds before it grows
+
+/**************** file-local types ****************/
+typedef struct journal {
+  FILE* fp;
+  bool writing;             // created by journal_create, rather than journal_open
+  bool ok;                  // no write error, or no damaged record read, so far
+  pthread_mutex_t lock;     // guards everything below, when writing
+  uint64_t start;           // when the journal was created (hist_now)
+  intmap_t* slots;          // address (see message_addrKey) -> int* slot, when writing
+  int numSlots;
+  char* text;               // MaxText + 1 characters, for the text of the record read last
+} journal_t;
+
+/**************** local functions ****************/
+static journal_t* journalNew(FILE* fp, const bool writing);
+static void putField(journal_t* journal, uint64_t value, const int bytes);
+static bool getField(journal_t* journal, uint64_t* value, const int bytes);
+static bool getText(journal_t* journal);
+static void putText(journal_t* journal, const char* text);
+static void slotDelete(void* item);
+
+/**************** journal_create ****************/
+/* see journal.h for description */
+journal_t*
+journal_create(const char* path)
+{
+  FILE* fp = fopen(path, "wb");
+  if (fp == NULL) {
+    return NULL;
+  }
+  journal_t* journal = journalNew(fp, true);
+  if (journal == NULL) {
+    return NULL;
+  }
+  fwrite(Magic, 1, sizeof(Magic), fp);
+  putField(journal, Version, 4);
+  return journal;
+}
+
+/**************** journal_map ****************/
+/* see journal.h for description */
+bool
+journal_map(journal_t* journal, const int table, const char* mapPath)
+{
+  uint64_t hash;
+  if (journal == NULL) {
+    return true;
+  }
+  if (!journal_hashFile(mapPath, &hash)) {
+    return false;
+  }
+  pthread_mutex_lock(&journal->lock);
+  putField(journal, 'M', 1);
+  putField(journal, table, 2);
+  putField(journal, hash, 8);
+  putText(journal, mapPath);
+  pthread_mutex_unlock(&journal->lock);
+  return true;
+}
+
+/**************** journal_game ****************/
+/* see journal.h for description */
+void
+journal_game(journal_t* journal, const int table, const unsigned int seed)
+{
+  if (journal == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&journal->lock);
+  putField(journal, 'G', 1);
+  putField(journal, table, 2);
+  putField(journal, seed, 4);
+  pthread_mutex_unlock(&journal->lock);
+}
+
+/**************** journal_message ****************/
+/* see journal.h for description
+ *
+ * Pseudocode:
+ *   under the lock,
+ *     find the sender's slot, giving it the next one if it is new
+ *     write the record: type, table, time since the journal began, slot, text
+ */
+void
+journal_message(journal_t* journal, const int table, const addr_t from,
+                const char* message, const uint64_t arrived)
+{
+  if (journal == NULL || message == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&journal->lock);
+  const uint64_t address = message_addrKey(from);
+  int* slot = intmap_find(journal->slots, address);
+  if (slot == NULL) {
+    slot = mem_malloc_assert(sizeof(int), "Out of memory for journal slot.\n");
+    *slot = journal->numSlots++;
+    intmap_insert(journal->slots, address, slot);
+  }
+  putField(journal, 'K', 1);
+  putField(journal, table, 2);
+  putField(journal, arrived > journal->start ? arrived - journal->start : 0, 8);
+  putField(journal, *slot, 4);
+  putText(journal, message);
+  pthread_mutex_unlock(&journal->lock);
+}
+
+/**************** journal_open ****************/
+/* see journal.h for description */
+journal_t*
+journal_open(const char* path)
+{
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return NULL;
+  }
+  char magic[sizeof(Magic)];
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, Magic, sizeof(Magic)) != 0) {
+    fclose(fp);
+    return NULL;
+  }
+  journal_t* journal = journalNew(fp, false);
+  uint64_t version;
+  if (journal != NULL && (!getField(journal, &version, 4) || version != Version)) {
+    journal_close(journal);
+    return NULL;
+  }
+  return journal;
+}
+
+/**************** journal_next ****************/
+/* see journal.h for description
+ *
+ * Pseudocode:
+ *   read the type; at the end of the file, there are no more records
+ *   read the fields of that type of record; if any is missing, or the
+ *     type is unknown, the journal is damaged
+ */
+bool
+journal_next(journal_t* journal, journal_record_t* record)
+{
+  if (journal == NULL || journal->writing || !journal->ok || record == NULL) {
+    return false;
+  }
+  int type = getc(journal->fp);
+  if (type == EOF) {
+    return false;
+  }
+  memset(record, 0, sizeof(journal_record_t));
+  record->type = type;
+  uint64_t table, hash, seed, time, slot;
+  bool ok = getField(journal, &table, 2);
+  record->table = table;
+  if (type == 'M') {
+    ok = ok && getField(journal, &hash, 8) && getText(journal);
+    record->hash = hash;
+    record->text = journal->text;
+  }
+  else if (type == 'G') {
+    ok = ok && getField(journal, &seed, 4);
+    record->seed = seed;
+  }
+  else if (type == 'K') {
+    ok = ok && getField(journal, &time, 8) && getField(journal, &slot, 4) && getText(journal);
+    record->time = time;
+    record->slot = slot;
+    record->text = journal->text;
+  }
+  else {
+    ok = false;
+  }
+  journal->ok = ok;
+  return ok;
+}
+
+/**************** journal_hashFile ****************/
+/* see journal.h for description */
+bool
+journal_hashFile(const char* path, uint64_t* hash)
+{
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL || hash == NULL) {
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    return false;
+  }
+  *hash = 0xcbf29ce484222325ULL;  // FNV-1a offset basis
+  int c;
+  while ((c = getc(fp)) != EOF) {
+    *hash = (*hash ^ (unsigned char)c) * 0x100000001b3ULL;
+  }
+  fclose(fp);
+  return true;
+}
+
+/**************** journal_close ****************/
+/* see journal.h for description */
+bool
+journal_close(journal_t* journal)
+{
+  if (journal == NULL) {
+    return true;
+  }
+  bool ok = journal->ok;
+  if (journal->writing) {
+    ok = ok && !ferror(journal->fp);
+    intmap_delete(journal->slots, slotDelete);
+  }
+  if (fclose(journal->fp) != 0) {
+    ok = false;
+  }
+  pthread_mutex_destroy(&journal->lock);
+  if (journal->text != NULL) {
+    mem_free(journal->text);
+  }
+  mem_free(journal);
+  return ok;
+}
+
+/**************** journalNew ****************/
+/* Make a journal on an open file; close the file and return NULL if out of memory */
+static journal_t*
+journalNew(FILE* fp, const bool writing)
+{
+  journal_t* journal = mem_calloc(1, sizeof(journal_t));
+  if (journal != NULL) {
+    if (writing) {
+      journal->slots = intmap_new(ExpectedClients);
+    }
+    else {
+      journal->text = mem_malloc(MaxText + 1);
+    }
+  }
+  if (journal == NULL || (writing ? journal->slots == NULL : journal->text == NULL)) {
+    if (journal != NULL) {
+      mem_free(journal);
+    }
+    fclose(fp);
+    return NULL;
+  }
+  journal->fp = fp;
+  journal->writing = writing;
+  journal->ok = true;
+  journal->start = hist_now();
+  pthread_mutex_init(&journal->lock, NULL);
+  return journal;
+}
+
+// write the low bytes of a value, least significant first
+static void
+putField(journal_t* journal, uint64_t value, const int bytes)
+{
+  for (int b = 0; b < bytes; b++) {
+    putc(value & 0xff, journal->fp);
+    value >>= 8;
+  }
+}
+
+// read a value written by putField; false if the file ends first
+static bool
+getField(journal_t* journal, uint64_t* value, const int bytes)
+{
+  *value = 0;
+  for (int b = 0; b < bytes; b++) {
+    int c = getc(journal->fp);
+    if (c == EOF) {
+      return false;
+    }
+    *value |= (uint64_t)c << (8 * b);
+  }
+  return true;
+}
+
+// write a text's length and its characters, cut to MaxText
+static void
+putText(journal_t* journal, const char* text)
+{
+  size_t length = strlen(text);
+  if (length > MaxText) {
+    length = MaxText;
+  }
+  putField(journal, length, 2);
+  fwrite(text, 1, length, journal->fp);
+}
+
+// read a text written by putText into journal->text; false if the file ends first
+static bool
+getText(journal_t* journal)
+{
+  uint64_t length;
+  if (!getField(journal, &length, 2) || fread(journal->text, 1, length, journal->fp) != length) {
+    return false;
+  }
+  journal->text[length] = '\0';
+  return true;
+}
+
+static void
+slotDelete(void* item)
+{
+  if (item != NULL) {
+    mem_free(item);
+  }
+}
+
+/* ***************************************************************** */
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Write a journal from several threads at once, read it back, and check
+ * that every record survives intact and in order, that each client keeps one slot,
+ * and that a journal cut short is reported as damaged.
+ *
+ *   ./journaltest [path]
+ */
+#ifdef UNIT_TEST
+#include <stdlib.h>
+#include <unistd.h>
+
+#define Threads 4
+static const int PerThread = 5000;
+static const char* Map = "journal.c";  // any readable file will do as a map
+
+static journal_t* shared;
+
+static void*
+writer(void* arg)
+{
+  const int table = (int)(long)arg;
+  addr_t from = message_noAddr();
+  char message[40];
+  for (int i = 0; i < PerThread; i++) {
+    from.sin_port = htons(1000 + table * 10 + i % 3);  // three clients per table
+    snprintf(message, sizeof(message), "KEY %c %d", "hjkl"[i % 4], i);
+    journal_message(shared, table, from, message, hist_now());
+  }
+  return NULL;
+}
+
+int
+main(const int argc, char* argv[])
+{
+  const char* path = (argc > 1) ? argv[1] : "journaltest.nj";
+  int errors = 0;
+
+  shared = journal_create(path);
+  if (shared == NULL || !journal_map(shared, 0, Map)) {
+    fprintf(stderr, "cannot write %s\n", path);
+    exit(2);
+  }
+  for (int t = 0; t < Threads; t++) {
+    journal_game(shared, t, 42 + t);
+  }
+  pthread_t threads[Threads];
+  for (int t = 0; t < Threads; t++) {
+    pthread_create(&threads[t], NULL, writer, (void*)(long)t);
+  }
+  for (int t = 0; t < Threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  errors += !journal_close(shared);
+
+  // read it back: every table's messages arrive in order, with consistent slots
+  journal_t* journal = journal_open(path);
+  journal_record_t record;
+  int next[Threads] = { 0 };
+  int slotOf[Threads][3];
+  memset(slotOf, -1, sizeof(slotOf));
+  int records = 0, maps = 0, games = 0;
+  uint64_t hash, lastTime[Threads] = { 0 };
+  journal_hashFile(Map, &hash);
+  while (journal_next(journal, &record)) {
+    records++;
+    if (record.type == 'M') {
+      maps++;
+      errors += (record.hash != hash || strcmp(record.text, Map) != 0);
+    }
+    else if (record.type == 'G') {
+      games++;
+      errors += (record.seed != 42 + record.table);
+    }
+    else {
+      char expected[40];
+      const int t = record.table, i = next[t]++;
+      snprintf(expected, sizeof(expected), "KEY %c %d", "hjkl"[i % 4], i);
+      errors += (strcmp(record.text, expected) != 0);
+      if (slotOf[t][i % 3] < 0) {
+        slotOf[t][i % 3] = record.slot;
+      }
+      errors += (slotOf[t][i % 3] != record.slot);
+      errors += (record.time < lastTime[t]);  // each table's messages arrive in order
+      lastTime[t] = record.time;
+    }
+  }
+  errors += !journal_close(journal);
+  errors += (maps != 1 || games != Threads || records != 1 + Threads + Threads * PerThread);
+  printf("read back %d records\n", records);
+
+  // cut the journal in the middle of its last record
+  FILE* fp = fopen(path, "r+b");
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  if (truncate(path, size - 3) != 0) {
+    errors++;
+  }
+  journal = journal_open(path);
+  records = 0;
+  while (journal_next(journal, &record)) {
+    records++;
+  }
+  errors += journal_close(journal);  // should report the damage
+  errors += (records != Threads * PerThread + Threads);
+  printf("a damaged journal reads back %d records, and is reported\n", records);
+
+  remove(path);
+  printf("%s\n", errors == 0 ? "journal test passed" : "journal test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,129 @@
+/*
+ * journal - a compact binary record of everything that drove a server's games
+ *
+ * A journal holds, for each hosted game (a "table"), the map it is played
+ * on, identified by a hash of the map file, and the seed of each game
+ * started there; then every message a game accepted, in the order the
+ * game handled it, with the time it arrived and the client's slot.  A
+ * slot is a small number standing for one client address, in the order
+ * the journal first saw them.  Since a game is deterministic, given its
+ * map, its seed and its messages, feeding a journal back through the
+ * game module replays the session exactly, with no network at all.
+ *
+ * Writing is thread-safe: each record is written under a lock, so the
+ * threads playing different tables may share one journal.
+ *
+ * File format: the magic "NUGJ" and a 32-bit version, then records, each
+ * a one-byte type followed by little-endian fields:
+ *   'M' table(16) hash(64) length(16) path          the table's map
+ *   'G' table(16) seed(32)                          a new game on the table
+ *   'K' table(16) time(64) slot(32) length(16) text a message it accepted
+ * where time is in nanoseconds since the journal was created.
+ *
+ * Typical sequence, in a server:
+ *   journal_t* journal = journal_create("session.nj");
+ *   journal_map(journal, 0, "maps/main.txt");
+ *   journal_game(journal, 0, seed);
+ *   ... as each message is handled:
+ *   journal_message(journal, 0, from, message, receivedAt);
+ *   journal_close(journal);
+ * and in a replay:
+ *   journal_t* journal = journal_open("session.nj");
+ *   journal_record_t record;
+ *   while (journal_next(journal, &record)) { ... }
+ *   journal_close(journal);
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "message.h"
+
+/****************** types *********************/
+typedef struct journal journal_t;  // opaque to users of the module
+
+// one record read back from a journal; which fields mean something depends on type
+typedef struct journal_record {
+  char type;              // 'M', 'G' or 'K' (see above)
+  int table;
+  uint64_t hash;          // 'M': hash of the map file
+  const char* text;       // 'M': path of the map file; 'K': the message
+                          //   (both valid until the next journal_next)
+  unsigned int seed;      // 'G'
+  uint64_t time;          // 'K': nanoseconds since the journal was created
+  int slot;               // 'K': the client
+} journal_record_t;
+
+/****************** functions *********************/
+
+/******************************************/
+/* journal_create: start writing a new journal, replacing any file at path.
+ * Function returns:
+ *   pointer to the new journal; NULL if the file cannot be written, or out of memory.
+ * Caller is responsible for:
+ *   later calling journal_close, which finishes writing the file.
+ */
+journal_t* journal_create(const char* path);
+
+/******************************************/
+/* journal_map: record which map a table is played on.
+ * Caller provides:
+ *   journal (NULL is ignored), table number, and path of its map file.
+ * Function returns:
+ *   false if the map file cannot be read to hash it (nothing is recorded).
+ */
+bool journal_map(journal_t* journal, const int table, const char* mapPath);
+
+/******************************************/
+/* journal_game: record that a new game started on a table, with the given seed.
+ *   A NULL journal is ignored.
+ */
+void journal_game(journal_t* journal, const int table, const unsigned int seed);
+
+/******************************************/
+/* journal_message: record a message that a table's game is about to handle.
+ * Caller provides:
+ *   journal (NULL is ignored), table number, the sender's address, the message,
+ *   and when it arrived (hist_now).
+ * Notes:
+ *   messages longer than 65535 characters are cut; a write error is
+ *   remembered and reported by journal_close.
+ */
+void journal_message(journal_t* journal, const int table, const addr_t from,
+                     const char* message, const uint64_t arrived);
+
+/******************************************/
+/* journal_open: open a journal to read it back.
+ * Function returns:
+ *   pointer to the journal; NULL if the file cannot be read, or is not a journal.
+ * Caller is responsible for:
+ *   later calling journal_close.
+ */
+journal_t* journal_open(const char* path);
+
+/******************************************/
+/* journal_next: read the next record of a journal opened with journal_open.
+ * Function returns:
+ *   true, having filled in record; false at the end of the journal, or if
+ *   the rest of it is damaged (see journal_close).
+ */
+bool journal_next(journal_t* journal, journal_record_t* record);
+
+/******************************************/
+/* journal_hashFile: hash the contents of a file (64-bit FNV-1a), as journal_map does.
+ * Function returns:
+ *   true, having set *hash; false if the file cannot be read.
+ */
+bool journal_hashFile(const char* path, uint64_t* hash);
+
+/******************************************/
+/* journal_close: finish writing or reading, and free the journal.
+ * Function returns:
+ *   false if anything could not be written, or what was read ended in
+ *   the middle of a record; true otherwise (and for a NULL journal).
+ */
+bool journal_close(journal_t* journal);
+
+#endif // _JOURNAL_H_
@@ -1,14 +1,69 @@
 /* 
  * log module - a simple way to log messages to a file
  * 
+ * In asynchronous mode the log_x functions only copy their arguments
+ * into a ring buffer.  Each entry carries a sequence number saying
+ * whose turn it is: a logging thread claims a position with one
+ * compare-and-swap on the tail, fills the entry, then publishes it by
+ * bumping its sequence; the background writer takes entries from the
+ * head in order and hands each back by bumping its sequence again.
+ * Logging threads take the lock only to wake a sleeping writer, and
+ * count themselves in flight while they might touch the ring, so that
+ * log_stopAsync waits for them before the last drain and the free.
+ * 
  * David Kotz, May 2019
  */
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
 #include "log.h"
+#include "mem.h"
+
+/**************** file-local types ****************/
+typedef struct entry {
+  _Atomic size_t sequence;  // position it may be filled for; that plus one once filled
+  FILE* fp;
+  char kind;                // 's', 'd', 'c', 'v', 'e' or 'p': the log_x that made it
+  const char* format;
+  int num;                  // the int of log_d, char of log_c, or errno of log_e
+  size_t length;            // full length of the string argument
+  char* text;               // the string argument, perhaps cut
+} entry_t;
+
+/**************** file-local global variables ****************/
+static int level = 2;                 // log_LevelPayloads
+static size_t maxPayload = 0;         // characters of each payload to log; 0 for all
+
+static atomic_bool async;             // copy entries into the ring?
+static atomic_int inFlight;           // logging threads that may be using the ring
+static entry_t* ring;
+static int numEntries;
+static size_t entryBytes;             // longest text an entry holds
+static _Atomic size_t tail;           // next position to fill
+static size_t head;                   // next position to write (writer only)
+static atomic_ulong dropped;          // entries dropped because the ring was full
+static unsigned long droppedNoted;    // drops already noted in the log (writer only)
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;  // guards the writer's sleep
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;    // signalled when an entry or stop arrives
+static atomic_bool sleeping;          // writer is (about to be) waiting on wake
+static atomic_bool stopping;
+
+/**************** local functions ****************/
+static void logEntry(FILE* fp, const char kind, const char* format, const int num,
+                     const char* text);
+static void enqueue(FILE* fp, const char kind, const char* format, const int num,
+                    const char* text);
+static void writeEntry(FILE* fp, const char kind, const char* format, const int num,
+                       const char* text, const size_t shown, const size_t length);
+static void* writerMain(void* arg);
+static bool entryReady(void);
 
 /**************** flog_init ****************/
 /* Initialize the logging module.
@@ -26,10 +81,8 @@ void flog_init(FILE* fp)
 void
 flog_s(FILE* fp, const char* format, const char* str)
 {
-  if (fp != NULL && format != NULL && str != NULL) {
-    fprintf(fp, format, str);
-    fputc('\n', fp);
-    fflush(fp);
+  if (fp != NULL && format != NULL && str != NULL && level >= log_LevelEvents) {
+    logEntry(fp, 's', format, 0, str);
   }
 }
 
@@ -41,10 +94,8 @@ flog_s(FILE* fp, const char* format, const char* str)
 void
 flog_d(FILE* fp, const char* format, const int num)
 {
-  if (fp != NULL && format != NULL) {
-    fprintf(fp, format, num);
-    fputc('\n', fp);
-    fflush(fp);
+  if (fp != NULL && format != NULL && level >= log_LevelEvents) {
+    logEntry(fp, 'd', format, num, NULL);
   }
 }
 
@@ -56,10 +107,8 @@ flog_d(FILE* fp, const char* format, const int num)
 void
 flog_c(FILE* fp, const char* format, const char ch)
 {
-  if (fp != NULL && format != NULL) {
-    fprintf(fp, format, ch);
-    fputc('\n', fp);
-    fflush(fp);
+  if (fp != NULL && format != NULL && level >= log_LevelEvents) {
+    logEntry(fp, 'c', format, ch, NULL);
   }
 }
 
@@ -70,10 +119,8 @@ flog_c(FILE* fp, const char* format, const char ch)
 void
 flog_v(FILE* fp, const char* str)
 {
-  if (fp != NULL && str != NULL) {
-    fputs(str, fp);
-    fputc('\n', fp);
-    fflush(fp);
+  if (fp != NULL && str != NULL && level >= log_LevelEvents) {
+    logEntry(fp, 'v', NULL, 0, str);
   }
 }
 
@@ -87,8 +134,20 @@ void
 flog_e(FILE* fp, const char* str)
 {
   if (fp != NULL && str != NULL) {
-    fprintf(fp, "%s: %s\n", str, strerror(errno));
-    fflush(fp);
+    logEntry(fp, 'e', NULL, errno, str);
+  }
+}
+
+/**************** flog_p ****************/
+/* 
+ * log a payload to the logfile, if logging is enabled at that level,
+ * cut to maxPayload characters.
+ */
+void
+flog_p(FILE* fp, const char* payload)
+{
+  if (fp != NULL && payload != NULL && level >= log_LevelPayloads) {
+    logEntry(fp, 'p', NULL, 0, payload);
   }
 }
 
@@ -101,3 +160,361 @@ flog_done(FILE* fp)
 {
   flog_v(fp, "END OF LOG");
 }
+
+/**************** log_setLimits ****************/
+/* see log.h for description */
+void
+log_setLimits(const int newLevel, const size_t newMaxPayload)
+{
+  level = newLevel;
+  maxPayload = newMaxPayload;
+}
+
+/**************** log_startAsync ****************/
+/* see log.h for description */
+bool
+log_startAsync(const int entries, const size_t bytes)
+{
+  if (atomic_load(&async) || entries <= 0 || bytes == 0) {
+    return false;
+  }
+  ring = mem_calloc(entries, sizeof(entry_t));
+  char* texts = mem_malloc(entries * (bytes + 1));
+  if (ring == NULL || texts == NULL) {
+    mem_free(ring);
+    mem_free(texts);
+    return false;
+  }
+  for (int i = 0; i < entries; i++) {
+    atomic_init(&ring[i].sequence, i);
+    ring[i].text = texts + i * (bytes + 1);
+  }
+  numEntries = entries;
+  entryBytes = bytes;
+  atomic_store(&tail, 0);
+  head = 0;
+  atomic_store(&dropped, 0);
+  droppedNoted = 0;
+  atomic_store(&stopping, false);
+  if (pthread_create(&writer, NULL, writerMain, NULL) != 0) {
+    mem_free(texts);
+    mem_free(ring);
+    return false;
+  }
+  atomic_store(&async, true);
+  return true;
+}
+
+/**************** log_stopAsync ****************/
+/* see log.h for description */
+unsigned long
+log_stopAsync(void)
+{
+  if (!atomic_load(&async)) {
+    return 0;
+  }
+  atomic_store(&async, false);
+  while (atomic_load(&inFlight) > 0) {  // a thread that saw async may still be filling an entry
+    sched_yield();
+  }
+  pthread_mutex_lock(&lock);
+  atomic_store(&stopping, true);
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer, NULL);
+
+  mem_free(ring[0].text);  // the start of the one block of texts
+  mem_free(ring);
+  ring = NULL;
+  return atomic_load(&dropped);
+}
+
+/**************** log_dropped ****************/
+/* see log.h for description */
+unsigned long
+log_dropped(void)
+{
+  return atomic_load(&dropped);
+}
+
+/**************** logEntry ****************/
+/* Write an entry now, or leave it for the writer if logging asynchronously.
+ * We count ourselves in flight before looking at async, so that once
+ * log_stopAsync has cleared it and seen none in flight, no thread is left
+ * using the ring.
+ */
+static void
+logEntry(FILE* fp, const char kind, const char* format, const int num, const char* text)
+{
+  atomic_fetch_add(&inFlight, 1);
+  if (atomic_load(&async)) {
+    enqueue(fp, kind, format, num, text);
+    atomic_fetch_sub(&inFlight, 1);
+    return;
+  }
+  atomic_fetch_sub(&inFlight, 1);
+  size_t length = (text == NULL) ? 0 : strlen(text);
+  size_t shown = length;
+  if (kind == 'p' && maxPayload > 0 && shown > maxPayload) {
+    shown = maxPayload;
+  }
+  writeEntry(fp, kind, format, num, text, shown, length);
+  fflush(fp);
+}
+
+/**************** enqueue ****************/
+/* Copy an entry into the next free position of the ring; drop it if there is none */
+static void
+enqueue(FILE* fp, const char kind, const char* format, const int num, const char* text)
+{
+  size_t position = atomic_load_explicit(&tail, memory_order_relaxed);
+  entry_t* entry;
+  while (true) {
+    entry = &ring[position % numEntries];
+    size_t sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+    if (sequence == position) {
+      if (atomic_compare_exchange_weak_explicit(&tail, &position, position + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    }
+    else if (sequence < position) {  // the writer has not yet freed this entry: full
+      atomic_fetch_add(&dropped, 1);
+      return;
+    }
+    else {                           // another thread took this position first
+      position = atomic_load_explicit(&tail, memory_order_relaxed);
+    }
+  }
+
+  entry->fp = fp;
+  entry->kind = kind;
+  entry->format = format;
+  entry->num = num;
+  entry->length = 0;
+  if (text != NULL) {
+    entry->length = strlen(text);
+    size_t shown = entry->length < entryBytes ? entry->length : entryBytes;
+    if (kind == 'p' && maxPayload > 0 && shown > maxPayload) {
+      shown = maxPayload;
+    }
+    memcpy(entry->text, text, shown);
+    entry->text[shown] = '\0';
+  }
+  atomic_store(&entry->sequence, position + 1);  // publish it
+
+  if (atomic_load(&sleeping)) {
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+/**************** writeEntry ****************/
+/* Format one entry into its log; shown is how much of text to write */
+static void
+writeEntry(FILE* fp, const char kind, const char* format, const int num,
+           const char* text, const size_t shown, const size_t length)
+{
+  switch (kind) {
+  case 's': fprintf(fp, format, text); break;
+  case 'd': fprintf(fp, format, num); break;
+  case 'c': fprintf(fp, format, (char)num); break;
+  case 'v': fputs(text, fp); break;
+  case 'e': fprintf(fp, "%s: %s", text, strerror(num)); break;
+  case 'p': fwrite(text, 1, shown, fp); break;
+  }
+  if (shown < length) {
+    fprintf(fp, " [cut to %zu of %zu characters]", shown, length);
+  }
+  fputc('\n', fp);
+}
+
+/**************** writerMain ****************/
+/* The background thread: write entries in order; sleep when caught up */
+static void*
+writerMain(void* arg)
+{
+  FILE* lastFP = NULL;  // log most recently written to
+  while (true) {
+    if (entryReady()) {
+      entry_t* entry = &ring[head % numEntries];
+      if (lastFP != NULL && entry->fp != lastFP) {
+        fflush(lastFP);
+      }
+      lastFP = entry->fp;
+      size_t shown = (entry->kind == 's' || entry->kind == 'v' || entry->kind == 'e'
+                      || entry->kind == 'p') ? strlen(entry->text) : 0;
+      writeEntry(entry->fp, entry->kind, entry->format, entry->num, entry->text,
+                 shown, entry->length);
+      atomic_store(&entry->sequence, head + numEntries);  // hand it back
+      head++;
+      continue;
+    }
+
+    // caught up: note any drops, flush, and sleep until there is more
+    unsigned long drops = atomic_load(&dropped);
+    if (lastFP != NULL) {
+      if (drops > droppedNoted) {
+        fprintf(lastFP, "log: %lu entries dropped\n", drops - droppedNoted);
+        droppedNoted = drops;
+      }
+      fflush(lastFP);
+    }
+    pthread_mutex_lock(&lock);
+    atomic_store(&sleeping, true);
+    while (!entryReady() && !atomic_load(&stopping)) {
+      pthread_cond_wait(&wake, &lock);
+    }
+    atomic_store(&sleeping, false);
+    bool done = !entryReady() && atomic_load(&stopping);
+    pthread_mutex_unlock(&lock);
+    if (done) {
+      return NULL;
+    }
+  }
+}
+
+/**************** entryReady ****************/
+/* Has the entry at the head been filled? (writer only) */
+static bool
+entryReady(void)
+{
+  return atomic_load(&ring[head % numEntries].sequence) == head + 1;
+}
+
+/* ***************************************************************** */
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Log from several threads at once, asynchronously, into a file with
+ * a ring too small to hold it all, and check that every entry was
+ * either written whole or counted as dropped; again, stopping while the
+ * threads still log, so that their later entries are written at once
+ * (whole, though perhaps interleaved with each other's);
+ * then check payload limits.
+ *
+ *   ./logtest [entries]
+ */
+#ifdef UNIT_TEST
+
+static const int Threads = 4;
+static const int PerThread = 20000;
+
+static void*
+logger(void* arg)
+{
+  FILE* fp = arg;
+  for (int i = 0; i < PerThread; i++) {
+    flog_d(fp, "entry %d", i);
+  }
+  return NULL;
+}
+
+// as logger, counting the entries it has logged so far in racers
+static atomic_int racers;
+
+static void*
+racer(void* arg)
+{
+  FILE* fp = arg;
+  for (int i = 0; i < PerThread; i++) {
+    flog_d(fp, "entry %d", i);
+    atomic_fetch_add(&racers, 1);
+  }
+  return NULL;
+}
+
+// count the lines of fp that start with prefix, from the beginning
+static int
+countLines(FILE* fp, const char* prefix)
+{
+  char line[200];
+  int count = 0;
+  rewind(fp);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    count += (strncmp(line, prefix, strlen(prefix)) == 0);
+  }
+  return count;
+}
+
+// count the times word appears in fp, from the beginning, even where synchronous
+// entries from several threads were interleaved; no prefix of word may recur in it
+static int
+countWords(FILE* fp, const char* word)
+{
+  int count = 0;
+  size_t matched = 0;
+  int c;
+  rewind(fp);
+  while ((c = getc(fp)) != EOF) {
+    matched = (c == word[matched]) ? matched + 1 : (c == word[0]);
+    if (word[matched] == '\0') {
+      count++;
+      matched = 0;
+    }
+  }
+  return count;
+}
+
+int
+main(const int argc, char* argv[])
+{
+  int entries = (argc > 1) ? atoi(argv[1]) : 1024;
+  FILE* fp = tmpfile();
+  if (fp == NULL || !log_startAsync(entries, 64)) {
+    fprintf(stderr, "cannot start asynchronous logging\n");
+    exit(1);
+  }
+  pthread_t threads[Threads];
+  for (int t = 0; t < Threads; t++) {
+    pthread_create(&threads[t], NULL, logger, fp);
+  }
+  for (int t = 0; t < Threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  unsigned long drops = log_stopAsync();
+  int written = countLines(fp, "entry ");
+  printf("%d entries written, %lu dropped, of %d\n", written, drops, Threads * PerThread);
+  int errors = (written + drops != Threads * PerThread);
+
+  // stop while they log: each entry is still written or counted, and nothing is lost
+  FILE* racing = tmpfile();
+  if (racing == NULL || !log_startAsync(entries, 64)) {
+    fprintf(stderr, "cannot start asynchronous logging\n");
+    exit(1);
+  }
+  for (int t = 0; t < Threads; t++) {
+    pthread_create(&threads[t], NULL, racer, racing);
+  }
+  while (atomic_load(&racers) < PerThread) {  // a quarter of the way through
+    sched_yield();
+  }
+  drops = log_stopAsync();
+  for (int t = 0; t < Threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  written = countWords(racing, "entry ");
+  printf("stopped while logging: %d entries written, %lu dropped, of %d\n", written, drops,
+         Threads * PerThread);
+  errors += (written + drops != Threads * PerThread);
+
+  // payloads: cut by the limit, and skipped below their level
+  FILE* payloads = tmpfile();
+  log_setLimits(log_LevelPayloads, 5);
+  flog_p(payloads, "0123456789");
+  log_setLimits(log_LevelEvents, 0);
+  flog_p(payloads, "not logged");
+  flog_v(payloads, "logged");
+  log_setLimits(log_LevelPayloads, 0);
+  errors += (countLines(payloads, "01234 [cut to 5 of 10 characters]") != 1);
+  errors += (countLines(payloads, "not logged") != 0);
+  errors += (countLines(payloads, "logged") != 1);
+
+  fclose(fp);
+  fclose(racing);
+  fclose(payloads);
+  printf("%s\n", errors == 0 ? "log test passed" : "log test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
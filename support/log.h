@@ -22,6 +22,7 @@
 #ifndef _LOG_H_
 #define _LOG_H_
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -83,6 +84,13 @@ static inline void log_e(const char* str) { flog_e(logFP, str); }
  * This function is best used immediately after a system call.
  */
 
+void flog_p(FILE* fp, const char* payload);
+static inline void log_p(const char* payload) { flog_p(logFP, payload); }
+/* log_p: print a payload, such as the body of a message, to the log.
+ * Unlike the others, payloads can be long; log_setLimits controls
+ * whether they are logged at all, and how much of each.
+ */
+
 void flog_done(FILE* fp);
 static inline void log_done(void) { flog_done(logFP); logFP = NULL; }
 /* log_done: call this when finished logging, or when you want to pause
@@ -90,4 +98,47 @@ static inline void log_done(void) { flog_done(logFP); logFP = NULL; }
  * It is the caller's responsibility to close the file, if desired.
  */
 
+/*********** program-wide settings ****************/
+/* Unlike logFP, these settings are kept in log.c and apply to every
+ * file of the program that logs.
+ */
+
+/* logging levels; each one logs everything the ones before it do */
+static const int log_LevelErrors = 0;    // log_e only
+static const int log_LevelEvents = 1;    // also log_s, log_d, log_c, log_v
+static const int log_LevelPayloads = 2;  // also log_p; the default
+
+void log_setLimits(const int level, const size_t maxPayload);
+/* log_setLimits: log only calls at or below the given level, and at
+ * most maxPayload characters of each payload (0 for no limit, the
+ * default).  A cut payload ends with a note of its full length.
+ */
+
+bool log_startAsync(const int entries, const size_t entryBytes);
+/* log_startAsync: from now on, the log_x functions copy what they are
+ * given into a ring buffer of the given number of entries and return
+ * at once; a background thread formats and writes them.  The string
+ * argument of each call is cut to entryBytes characters.  If the buffer
+ * is full the entry is dropped and counted; whenever it catches up,
+ * the background thread notes in the log how many were dropped.
+ * Format strings must stay valid until written, as literals do.
+ * Returns false if the buffer or thread cannot be made, or logging is
+ * already asynchronous; logging then stays as it was.
+ * Call this before other threads may log.
+ */
+
+unsigned long log_stopAsync(void);
+/* log_stopAsync: write out every entry still buffered, stop the
+ * background thread, and go back to logging synchronously.  Other
+ * threads may still be logging: it waits for any in the middle of an
+ * entry, and they log synchronously from then on.  Call it before
+ * closing any file that is being logged to.
+ * Returns the number of entries dropped while logging asynchronously.
+ */
+
+unsigned long log_dropped(void);
+/* log_dropped: the number of entries dropped so far because the ring
+ * buffer was full.  May be called from any thread.
+ */
+
 #endif // _LOG_H_
@@ -1,31 +1,47 @@
 /* 
  * message - a UDP-based messaging module
- *
+ * 
  * Provides a message-passing abstraction among Internet hosts.  Messages
  * are sent via UDP and are thus limited to UDP packet size, may be lost,
  * and may be reordered, but require no connection setup or teardown.
  * 
+ * The datagrams themselves are carried by a transport: a table of
+ * functions that open, send, receive and close.  UDP is the default;
+ * an in-memory transport, for clients in the same process, and a Unix
+ * datagram socket, for clients on the same host, may be set instead.
+ * Everything else - checking arguments, counting, logging, the loop -
+ * is the same whichever transport carries the datagrams.
+ * 
  * See message.h for detailed interface description for each function.
  * Depends on the 'log' module and thus must be linked with log.o.
  * 
  * Compile with -DUNIT_TEST for a standalone unit test; see below.
- *
+ * 
  * David Kotz - May 2019
  */
 
+#define _GNU_SOURCE     // for sendmmsg(), used by message_sendMany on Linux
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
 #include <strings.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <math.h>
+#include <ctype.h>
+#include <time.h>
 #include "message.h"
 #include "log.h"
+#include "mem.h"
 
 /**************** file-local constants ****************/
 /* See message.h for other constants (shared with users of this module).
@@ -35,6 +51,15 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+static const int SendBatch = 64; // datagrams handed to the kernel per sendmmsg()
+
+static const int NoPort = 1;     // reported by transports that have no port numbers
+enum { MaxPartials = 8 };                     // messages being put together at once
+static const long FragmentNanos = 2000000000; // how long to wait for the rest of a message
+static const int IPHeaderBytes = 20;          // in every packet of a datagram
+static const int UDPHeaderBytes = 8;          // in the first packet
+static const int MaxUnixPeers = 65535;  // one made-up port each
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
  * This module provides init() and done() functions that allow it
@@ -48,11 +73,108 @@ static const int MaxPort = 65535;
  */
 static int ourSocket = 0;     // socket on which to receive messages
 
+/* Traffic counts for message_counts, one slot per kind of message.
+ * A thread that meets a new kind claims a free slot with a
+ * compare-and-swap and names it; two threads may name two slots for
+ * the same kind at once, which message_counts adds back together.
+ * The last slot counts every kind that found no free slot.
+ */
+typedef struct kindSlot {
+  atomic_int state;                // Free, Naming or Named
+  char kind[message_KindBytes];
+  atomic_ulong received;
+  atomic_ulong bytesReceived;
+  atomic_ulong sent;
+  atomic_ulong bytesSent;
+} kindSlot_t;
+enum { Free, Naming, Named };
+static kindSlot_t kindSlots[message_MaxKinds];
+
+/* The in-memory transport: sent messages go to a function; messages
+ * injected by message_inject wait in a queue, and a pipe wakes the
+ * loop, holding one byte while the queue is not empty.
+ */
+typedef struct injected {
+  addr_t from;
+  char* message;
+  struct injected* next;
+} injected_t;
+static struct {
+  void (*deliver)(void* arg, const addr_t to, const char* message);
+  void* arg;
+  pthread_mutex_t lock;        // guards the queue
+  injected_t* head;
+  injected_t* tail;
+  int pipe[2];                 // read end, write end
+} memory = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, { -1, -1 } };
+
+/* The Unix datagram transport: each peer's socket path is given a number,
+ * in the order first heard from, which stands as its port in addr_t.
+ */
+static struct {
+  pthread_mutex_t lock;        // guards the peers
+  struct sockaddr_un* peers;   // peer n is peers[n - 1]
+  int numPeers;
+  int size;                    // room in peers
+} unixPeers = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+/* Messages arriving in fragments: each is put together in a partial_t
+ * until all its fragments are in, or it is dropped as too old.
+ */
+typedef struct partial {
+  addr_t from;
+  unsigned int id;              // the sender's number for the message
+  int count;                    // fragments in the message; 0 if the slot is free
+  int received;                 // fragments in so far
+  char* have;                   // which fragments are in: count flags
+  char* text;                   // room for count fragments and a null
+  size_t length;                // of the message; known once the last fragment is in
+  struct timespec started;      // when the first fragment came
+} partial_t;
+static partial_t partials[MaxPartials];
+static size_t largest = 65507;   // message_MaxBytes: accept no fragmented message
+static atomic_uint nextMessageId;
+
+/**************** local functions ****************/
+static int transmit(const addr_t* to, const int count, const char* datagram,
+                    const size_t length);
+static int sendFragments(const addr_t* to, const int count, const char* message,
+                         const size_t length);
+static int ipPackets(const size_t length);
+static void flushPacked(const addr_t* to, const int count, char* packed, size_t* used,
+                        const char** lone, int* parts);
+static bool unpack(void* arg, const addr_t from, char* packed, const size_t length,
+                   bool (*handleMessage)(void* arg, const addr_t from, const char* message));
+static partial_t* reassemble(const addr_t from, const char* fragment, const size_t length);
+static void forget(partial_t* partial);
+static long elapsed(const struct timespec since);
+static int udpOpen(void* arg);
+static bool udpSend(void* arg, const addr_t to, const char* message, const size_t length);
+static int udpSendMany(void* arg, const addr_t* to, const int count,
+                       const char* message, const size_t length);
+static int socketFd(void* arg);
+static int udpReceive(void* arg, addr_t* from, char* buf, const size_t size);
+static void socketClose(void* arg);
+static int memoryOpen(void* arg);
+static bool memorySend(void* arg, const addr_t to, const char* message, const size_t length);
+static int memoryFd(void* arg);
+static int memoryReceive(void* arg, addr_t* from, char* buf, const size_t size);
+static void memoryClose(void* arg);
+static int unixOpen(void* arg);
+static bool unixSend(void* arg, const addr_t to, const char* message, const size_t length);
+static int unixReceive(void* arg, addr_t* from, char* buf, const size_t size);
+static void unixClose(void* arg);
+
+// the transport in use, and whether message_init has opened it
+static message_transport_t transport = {
+  "udp", 65507 /* message_MaxBytes */, udpOpen, udpSend, udpSendMany, socketFd, udpReceive, socketClose, NULL
+};
+static bool opened = false;
+
 /***********************************************************************/
 /**************** message_init ****************/
 /* 
- * Set up a socket on which to receive messages; return the port number.
- * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
+ * Open the transport; return the port number.
  * Log error and return zero if any error.
  * See message.h for detailed description.
  */
@@ -62,11 +184,52 @@ message_init(FILE* logFP)
   log_init(logFP);
 
   // Have we already been initialized?
-  if (ourSocket != 0) {
+  if (opened) {
     log_v("message_init: called again, when already initialized");
     return 0;
   }
 
+  int port = (*transport.open)(transport.arg);
+  if (port == 0) {
+    return 0;
+  }
+  opened = true;
+  log_d("message_init: ready at port '%d'", port);
+  log_s("message_init: over %s", transport.name);
+
+  return port;
+}
+
+/**************** message_setTransport ****************/
+/* see message.h for description */
+bool
+message_setTransport(const message_transport_t newTransport)
+{
+  if (opened) {
+    log_v("message_setTransport: called after message_init");
+    return false;
+  }
+  if (newTransport.open == NULL || newTransport.send == NULL || newTransport.fd == NULL
+      || newTransport.receive == NULL || newTransport.close == NULL) {
+    log_v("message_setTransport: called with a missing function");
+    return false;
+  }
+  if (newTransport.maxBytes != 0 && newTransport.maxBytes < message_MaxBytes) {
+    log_v("message_setTransport: called with datagrams too short for a fragment");
+    return false;
+  }
+  transport = newTransport;
+  return true;
+}
+
+/**************** udpOpen ****************/
+/* 
+ * Set up a socket on which to receive messages; return the port number.
+ * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
+ */
+static int
+udpOpen(void* arg)
+{
   // Create socket on which to listen (file descriptor)
   ourSocket = socket(AF_INET, SOCK_DGRAM, 0);
   if (ourSocket < 0) {
@@ -96,10 +259,7 @@ message_init(FILE* logFP)
     return 0;
   }
   // extract our port number
-  int port = ntohs(self.sin_port);
-  log_d("message_init: ready at port '%d'", port);
-
-  return port;
+  return ntohs(self.sin_port);
 }
 
 /**************** message_noAddr ****************/
@@ -159,7 +319,7 @@ message_setAddr(const char* hostname, const char* portString, addr_t* addr)
     log_v("message_setAddr: called with NULL argument");
     return false;
   }
-  
+
   // Look up the hostname
   struct hostent *hostp = gethostbyname(hostname);
   if (hostp == NULL) {
@@ -184,7 +344,7 @@ message_setAddr(const char* hostname, const char* portString, addr_t* addr)
   addr->sin_family = AF_INET;
   bcopy(hostp->h_addr_list[0], &addr->sin_addr, hostp->h_length);
   addr->sin_port = htons(port);
-  
+
   return true;
 }
 
@@ -192,6 +352,8 @@ message_setAddr(const char* hostname, const char* portString, addr_t* addr)
 /* Produce a string representation of the address.
  * Returns pointer to static storage that should not be retained
  * (because every call to this function returns the same pointer).
+ * The storage is per-thread, so threads may call this concurrently;
+ * for the same reason we format the IP ourselves, not with inet_ntoa.
  * See message.h for detailed description.
  */
 const char*
@@ -199,16 +361,112 @@ message_stringAddr(const addr_t addr)
 {
   // Maximum string length to hold an IP address and port, plus null.
   // e.g., 255.255.255.255:65507
-  static char addrString[22]; // constant appears in snprintf below
+  static _Thread_local char addrString[22]; // constant appears in snprintf below
 
-  snprintf(addrString, 22, "%s:%05d",
-	   inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+  const unsigned long ip = ntohl(addr.sin_addr.s_addr);
+  snprintf(addrString, 22, "%lu.%lu.%lu.%lu:%05d",
+	   (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff,
+	   ntohs(addr.sin_port));
 
   return addrString;
 }
 
+/**************** message_addrKey ****************/
+/* Pack the fields message_eqAddr compares: the family in the top 16 bits,
+ * then the port, then the IP address, each as it lies in the address.
+ * See message.h for detailed description.
+ */
+uint64_t
+message_addrKey(const addr_t addr)
+{
+  return ((uint64_t)addr.sin_family << 48)
+    | ((uint64_t)addr.sin_port << 32)
+    | addr.sin_addr.s_addr;
+}
+
+/**************** message_keyAddr ****************/
+/* Unpack an address packed by message_addrKey.
+ * See message.h for detailed description.
+ */
+addr_t
+message_keyAddr(const uint64_t key)
+{
+  addr_t addr = message_noAddr();
+  addr.sin_family = (sa_family_t)(key >> 48);
+  addr.sin_port = (in_port_t)(key >> 32);
+  addr.sin_addr.s_addr = (in_addr_t)key;
+  return addr;
+}
+
+/**************** countKind ****************/
+/* Find, or claim, the slot that counts messages of the same kind as
+ * this one: the same first word (cut to fit), or "other" if none.
+ */
+static kindSlot_t*
+countKind(const char* message)
+{
+  char kind[message_KindBytes];
+  int length = 0;
+  while (length < message_KindBytes - 1 && message[length] != '\0'
+         && message[length] != ' ' && message[length] != '\n') {
+    kind[length] = message[length];
+    length++;
+  }
+  kind[length] = '\0';
+  if (length == 0) {
+    strcpy(kind, "other");
+  }
+
+  kindSlot_t* last = &kindSlots[message_MaxKinds - 1];
+  for (kindSlot_t* slot = kindSlots; slot < last; slot++) {
+    int state = atomic_load(&slot->state);
+    if (state == Named && strcmp(slot->kind, kind) == 0) {
+      return slot;
+    }
+    if (state == Free && atomic_compare_exchange_strong(&slot->state, &state, Naming)) {
+      strcpy(slot->kind, kind);
+      atomic_store(&slot->state, Named);
+      return slot;
+    }
+  }
+  int state = Free;
+  if (atomic_compare_exchange_strong(&last->state, &state, Naming)) {
+    strcpy(last->kind, "other");
+    atomic_store(&last->state, Named);
+  }
+  return last;
+}
+
+/**************** message_counts ****************/
+/* see message.h for description */
+int
+message_counts(message_count_t* counts)
+{
+  int numKinds = 0;
+  for (int i = 0; i < message_MaxKinds; i++) {
+    kindSlot_t* slot = &kindSlots[i];
+    if (atomic_load(&slot->state) != Named) {
+      continue;
+    }
+    int k = 0;
+    while (k < numKinds && strcmp(counts[k].kind, slot->kind) != 0) {
+      k++;
+    }
+    if (k == numKinds) {
+      memset(&counts[k], 0, sizeof(message_count_t));
+      strcpy(counts[k].kind, slot->kind);
+      numKinds++;
+    }
+    counts[k].received += atomic_load(&slot->received);
+    counts[k].bytesReceived += atomic_load(&slot->bytesReceived);
+    counts[k].sent += atomic_load(&slot->sent);
+    counts[k].bytesSent += atomic_load(&slot->bytesSent);
+  }
+  return numKinds;
+}
+
 /**************** numLines ****************/
-/*
+/* 
  * Return number of lines needed to print the string:
  * 0 if string is NULL or empty;
  * Otherwise return number of newline characters,
@@ -245,7 +503,7 @@ numLines(const char* string)
 void
 message_send(const addr_t to, const char* message)
 {
-  if (ourSocket == 0) {
+  if (!opened) {
     log_v("message_send: called before message_init");
     return; // error in usage of this function.
   }
@@ -253,19 +511,729 @@ message_send(const addr_t to, const char* message)
     log_v("message_send: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
-             (struct sockaddr *) &to, sizeof(to)) < 0) {
+  const size_t length = strlen(message);
+  int nsent;
+  if (transport.maxBytes != 0 && length > transport.maxBytes) {
+    nsent = sendFragments(&to, 1, message, length);
+  } else {
+    nsent = transmit(&to, 1, message, length);
+  }
+  if (nsent == 0) {
     log_e("message_send: error sending to datagram socket");
   } else {
     log_s("message_send: TO %s", message_stringAddr(to));
     log_d("message_send: %d lines:", numLines(message));
-    log_s("%s", message);
+    log_p(message);
+  }
+}
+
+/**************** message_sendMany ****************/
+/* 
+ * Send one string message to each of several correspondents,
+ * all at once if the transport can, else one by one.
+ * See message.h for detailed description.
+ */
+void
+message_sendMany(const addr_t* to, const int count, const char* message)
+{
+  if (!opened) {
+    log_v("message_sendMany: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (to == NULL || message == NULL) {
+    log_v("message_sendMany: called with null argument");
+    return; // error in usage of this function.
+  }
+  if (count <= 0) {
+    return; // nobody to send to
+  }
+
+  const size_t length = strlen(message);
+  int nsent;              // number of addresses the transport accepted the message for
+  if (transport.maxBytes != 0 && length > transport.maxBytes) {
+    nsent = sendFragments(to, count, message, length);
+  } else {
+    nsent = transmit(to, count, message, length);
+  }
+  log_d("message_sendMany: TO %d addresses", nsent);
+  log_d("message_sendMany: %d lines:", numLines(message));
+  log_p(message);
+}
+
+/**************** transmit ****************/
+/* 
+ * Send one datagram to each of count addresses, all at once if the
+ * transport can, and count it by kind.
+ * Return the number of datagrams the transport accepted.
+ */
+static int
+transmit(const addr_t* to, const int count, const char* datagram, const size_t length)
+{
+  int nsent = 0;
+  if (count > 1 && transport.sendMany != NULL) {
+    nsent = (*transport.sendMany)(transport.arg, to, count, datagram, length);
+  }
+  else {
+    for (int i = 0; i < count; i++) {
+      if ((*transport.send)(transport.arg, to[i], datagram, length)) {
+        nsent++;
+      } else if (count > 1) {
+        log_e("message_sendMany: error sending to datagram socket");
+      }
+    }
+  }
+  kindSlot_t* slot = countKind(datagram);
+  atomic_fetch_add_explicit(&slot->sent, nsent, memory_order_relaxed);
+  atomic_fetch_add_explicit(&slot->bytesSent, (unsigned long) nsent * length, memory_order_relaxed);
+  return nsent;
+}
+
+/**************** sendFragments ****************/
+/* 
+ * Send a message too long for one datagram as a numbered series of
+ * fragments, "FRAGMENT id index count\n" and the next
+ * message_FragmentBytes of the message, each to every address.
+ * Return the number of addresses that were sent every fragment.
+ */
+static int
+sendFragments(const addr_t* to, const int count, const char* message, const size_t length)
+{
+  const int fragments = (length + message_FragmentBytes - 1) / message_FragmentBytes;
+  const unsigned int id = atomic_fetch_add(&nextMessageId, 1);
+  char* datagram = mem_malloc(message_MaxBytes + 1);
+  if (datagram == NULL) {
+    log_e("message_send: out of memory for a fragment");
+    return 0;
+  }
+  int nsent = count;
+  for (int index = 0; index < fragments; index++) {
+    size_t offset = (size_t) index * message_FragmentBytes;
+    size_t n = (length - offset < message_FragmentBytes) ? length - offset : message_FragmentBytes;
+    int header = sprintf(datagram, "FRAGMENT %u %d %d\n", id, index, fragments);
+    memcpy(datagram + header, message + offset, n);
+    datagram[header + n] = '\0';
+    int accepted = transmit(to, count, datagram, header + n);
+    nsent = (accepted < nsent) ? accepted : nsent;
+  }
+  mem_free(datagram);
+  log_d("message_send: in %d fragments", fragments);
+  return nsent;
+}
+
+/**************** message_sendPacked ****************/
+/* 
+ * Pack the messages into datagrams, greedily in order, and send each to
+ * every address; see message.h for detailed description.
+ *
+ * Pseudocode:
+ *   for each message,
+ *     if it is too long to pack, send what is packed so far, then send it alone
+ *     else if adding it to what is packed so far would take more IP packets than
+ *       sending the two apart, send what is packed so far first
+ *     append its length and the message to what is packed
+ *   send what is packed; a datagram holding one message is sent as that message
+ */
+void
+message_sendPacked(const addr_t* to, const int count, const char** messages, const int numMessages)
+{
+  if (!opened) {
+    log_v("message_sendPacked: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (to == NULL || messages == NULL) {
+    log_v("message_sendPacked: called with null argument");
+    return; // error in usage of this function.
+  }
+  if (count <= 0) {
+    return; // nobody to send to
+  }
+
+  static _Thread_local char packed[65508];  // message_MaxBytes, and a null
+  size_t used = 0;              // bytes of packed in use
+  const char* lone = NULL;      // the first message packed, in case it is the only one
+  int parts = 0;                // messages packed
+  for (int m = 0; m < numMessages; m++) {
+    if (messages[m] == NULL) {
+      log_v("message_sendPacked: called with null message");
+      continue;
+    }
+    const size_t length = strlen(messages[m]);
+    char prefix[24];
+    const int prefixLength = sprintf(prefix, "%zu\n", length);
+    const size_t partLength = prefixLength + length;
+    if (strlen("PACKED\n") + partLength > message_MaxBytes) {
+      flushPacked(to, count, packed, &used, &lone, &parts);
+      message_sendMany(to, count, messages[m]);
+      continue;
+    }
+    if (parts > 0
+        && (used + partLength > message_MaxBytes
+            || (transport.maxBytes != 0
+                && ipPackets(used + partLength) >= ipPackets(used) + ipPackets(length)))) {
+      flushPacked(to, count, packed, &used, &lone, &parts);
+    }
+    if (parts == 0) {
+      used = sprintf(packed, "PACKED\n");
+      lone = messages[m];
+    }
+    memcpy(packed + used, prefix, prefixLength);
+    memcpy(packed + used + prefixLength, messages[m], length);
+    used += partLength;
+    parts++;
+  }
+  flushPacked(to, count, packed, &used, &lone, &parts);
+}
+
+/**************** flushPacked ****************/
+/* 
+ * Send the datagram packed so far, if any, to every address, and start
+ * afresh; a datagram of one message is sent as that message alone.
+ */
+static void
+flushPacked(const addr_t* to, const int count, char* packed, size_t* used,
+            const char** lone, int* parts)
+{
+  if (*parts == 1) {
+    message_sendMany(to, count, *lone);
+  }
+  else if (*parts > 1) {
+    packed[*used] = '\0';
+    int nsent = transmit(to, count, packed, *used);
+    log_d("message_sendPacked: TO %d addresses", nsent);
+    log_d("message_sendPacked: %d messages in one datagram:", *parts);
+    log_p(packed);
+  }
+  *used = 0;
+  *lone = NULL;
+  *parts = 0;
+}
+
+/**************** ipPackets ****************/
+/* 
+ * Return the number of IP packets a UDP datagram of the given payload
+ * takes on a path with message_PathMTU.
+ */
+static int
+ipPackets(const size_t length)
+{
+  const size_t perPacket = message_PathMTU - IPHeaderBytes;
+  return (UDPHeaderBytes + length + perPacket - 1) / perPacket;
+}
+
+/**************** unpack ****************/
+/* 
+ * Hand each message of a packed datagram to handleMessage, in order,
+ * ending each with a null in place while it is handled.
+ * Return true if a handler says to stop looping.
+ */
+static bool
+unpack(void* arg, const addr_t from, char* packed, const size_t length,
+       bool (*handleMessage)(void* arg, const addr_t from, const char* message))
+{
+  char* end = packed + length;
+  char* part = packed + strlen("PACKED\n");
+  while (part < end) {
+    char* text;
+    unsigned long partLength = strtoul(part, &text, 10);
+    if (!isdigit((unsigned char) *part) || *text != '\n' || partLength > end - (text + 1)) {
+      log_v("message_loop: dropped the rest of a badly packed datagram");
+      return false;
+    }
+    text++;
+    char saved = text[partLength];
+    text[partLength] = '\0';
+    bool done = (*handleMessage)(arg, from, text);
+    text[partLength] = saved;
+    if (done) {
+      return true;
+    }
+    part = text + partLength;
   }
+  return false;
+}
+
+/**************** message_setLargest ****************/
+/* see message.h for description */
+void
+message_setLargest(const size_t bytes)
+{
+  largest = bytes;
+}
+
+/**************** reassemble ****************/
+/* 
+ * Put a fragment into the message it belongs to; return that message,
+ * once every fragment is in (the caller then forgets it), else NULL.
+ * Fragments that are malformed, or of a message longer than largest,
+ * are dropped; a message that is not complete after FragmentNanos is
+ * dropped to make room, as is the oldest if every slot is in use.
+ */
+static partial_t*
+reassemble(const addr_t from, const char* fragment, const size_t length)
+{
+  unsigned int id;
+  int index, count, header = 0;
+  if (sscanf(fragment, "FRAGMENT %u %d %d%n", &id, &index, &count, &header) != 3
+      || fragment[header] != '\n' || count < 2 || index < 0 || index >= count
+      || (size_t) (count - 1) * message_FragmentBytes >= largest) {
+    log_v("message_loop: dropped a bad or overlong fragment");
+    return NULL;
+  }
+  header++;
+  size_t n = length - header;
+  if (n > message_FragmentBytes || (index < count - 1 && n != message_FragmentBytes)) {
+    log_v("message_loop: dropped a fragment of the wrong length");
+    return NULL;
+  }
+
+  // find the message, or a slot for it: a free one, else the oldest
+  partial_t* partial = NULL;
+  partial_t* spare = NULL;
+  for (int p = 0; p < MaxPartials && partial == NULL; p++) {
+    partial_t* slot = &partials[p];
+    if (slot->count != 0 && elapsed(slot->started) > FragmentNanos) {
+      log_v("message_loop: gave up on a message missing fragments");
+      forget(slot);
+    }
+    if (slot->count != 0 && slot->id == id && message_eqAddr(slot->from, from)) {
+      partial = slot;
+    } else if (spare == NULL || (spare->count != 0 && (slot->count == 0
+               || elapsed(slot->started) > elapsed(spare->started)))) {
+      spare = slot;
+    }
+  }
+  if (partial == NULL) {
+    if (spare->count != 0) {
+      log_v("message_loop: dropped a message missing fragments, to make room");
+      forget(spare);
+    }
+    partial = spare;
+    partial->have = mem_calloc(count, 1);
+    partial->text = mem_malloc((size_t) count * message_FragmentBytes + 1);
+    if (partial->have == NULL || partial->text == NULL) {
+      log_e("message_loop: out of memory for a fragmented message");
+      forget(partial);
+      return NULL;
+    }
+    partial->from = from;
+    partial->id = id;
+    partial->count = count;
+    partial->received = 0;
+    clock_gettime(CLOCK_MONOTONIC, &partial->started);
+  }
+  if (count != partial->count || partial->have[index]) {
+    return NULL;   // a duplicate, or at odds with the others
+  }
+  partial->have[index] = 1;
+  partial->received++;
+  memcpy(partial->text + (size_t) index * message_FragmentBytes, fragment + header, n);
+  if (index == count - 1) {
+    partial->length = (size_t) index * message_FragmentBytes + n;
+  }
+  if (partial->received < count) {
+    return NULL;
+  }
+  partial->text[partial->length] = '\0';
+  return partial;
+}
+
+/**************** forget ****************/
+/* Free a partial message's slot. */
+static void
+forget(partial_t* partial)
+{
+  if (partial->have != NULL) {
+    mem_free(partial->have);
+  }
+  if (partial->text != NULL) {
+    mem_free(partial->text);
+  }
+  partial->have = NULL;
+  partial->text = NULL;
+  partial->count = 0;
+}
+
+/**************** elapsed ****************/
+/* Nanoseconds since the given time, on the monotonic clock. */
+static long
+elapsed(const struct timespec since)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since.tv_sec) * 1000000000L + (now.tv_nsec - since.tv_nsec);
+}
+
+/**************** udpSend ****************/
+static bool
+udpSend(void* arg, const addr_t to, const char* message, const size_t length)
+{
+  return sendto(ourSocket, message, length, 0, (struct sockaddr *) &to, sizeof(to)) >= 0;
+}
+
+/**************** udpSendMany ****************/
+/* 
+ * On Linux the datagrams are handed to the kernel in batches with
+ * sendmmsg(), so the message is neither copied nor re-measured per
+ * recipient and the syscall count drops by up to SendBatch times.
+ * Return the number of datagrams the kernel accepted.
+ */
+static int
+udpSendMany(void* arg, const addr_t* to, const int count, const char* message,
+            const size_t length)
+{
+  int nsent = 0;          // number of datagrams accepted by the kernel
+#ifdef __linux__
+  struct iovec iov = { (void*) message, length };  // shared by every datagram
+  struct mmsghdr batch[SendBatch];
+  for (int base = 0; base < count; base += SendBatch) {
+    const int n = (count - base < SendBatch) ? count - base : SendBatch;
+    memset(batch, 0, n * sizeof(struct mmsghdr));
+    for (int i = 0; i < n; i++) {
+      batch[i].msg_hdr.msg_name = (void*) &to[base + i];
+      batch[i].msg_hdr.msg_namelen = sizeof(addr_t);
+      batch[i].msg_hdr.msg_iov = &iov;
+      batch[i].msg_hdr.msg_iovlen = 1;
+    }
+    // sendmmsg may stop early; an error refers to the first unsent datagram
+    int done = 0;
+    while (done < n) {
+      int r = sendmmsg(ourSocket, batch + done, n - done, 0);
+      if (r < 0) {
+        log_e("message_sendMany: error sending to datagram socket");
+        done++;           // skip the datagram that failed
+      } else {
+        done += r;
+        nsent += r;
+      }
+    }
+  }
+#else
+  for (int i = 0; i < count; i++) {
+    if (sendto(ourSocket, message, length, 0,
+               (struct sockaddr *) &to[i], sizeof(to[i])) < 0) {
+      log_e("message_sendMany: error sending to datagram socket");
+    } else {
+      nsent++;
+    }
+  }
+#endif
+  return nsent;
+}
+
+/**************** socketFd ****************/
+/* the socket, for select(); shared by the UDP and Unix transports */
+static int
+socketFd(void* arg)
+{
+  return ourSocket;
+}
+
+/**************** udpReceive ****************/
+static int
+udpReceive(void* arg, addr_t* from, char* buf, const size_t size)
+{
+  socklen_t senderlen = sizeof(addr_t);  // must pass address to length
+  return recvfrom(ourSocket, buf, size, 0, (struct sockaddr *) from, &senderlen);
+}
+
+/**************** socketClose ****************/
+static void
+socketClose(void* arg)
+{
+  if (ourSocket != 0) {
+    close(ourSocket);
+    ourSocket = 0;
+  }
+}
+
+/**************** message_udpTransport ****************/
+/* see message.h for description */
+message_transport_t
+message_udpTransport(void)
+{
+  message_transport_t udpTransport = {
+    "udp", message_MaxBytes, udpOpen, udpSend, udpSendMany, socketFd, udpReceive, socketClose, NULL
+  };
+  return udpTransport;
+}
+
+/**************** message_memoryTransport ****************/
+/* see message.h for description */
+message_transport_t
+message_memoryTransport(void (*deliver)(void* arg, const addr_t to, const char* message),
+                        void* arg)
+{
+  memory.deliver = deliver;
+  memory.arg = arg;
+  message_transport_t memoryTransport = {
+    "memory", 0, memoryOpen, memorySend, NULL, memoryFd, memoryReceive, memoryClose, &memory
+  };
+  return memoryTransport;
+}
+
+/**************** memoryOpen ****************/
+static int
+memoryOpen(void* arg)
+{
+  if (pipe(memory.pipe) != 0) {
+    log_e("message_init: error opening pipe");
+    memory.pipe[0] = memory.pipe[1] = -1;
+    return 0;
+  }
+  return NoPort;
+}
+
+/**************** memorySend ****************/
+static bool
+memorySend(void* arg, const addr_t to, const char* message, const size_t length)
+{
+  if (memory.deliver != NULL) {
+    (*memory.deliver)(memory.arg, to, message);
+  }
+  return true;
+}
+
+/**************** message_inject ****************/
+/* see message.h for description
+ * 
+ * Pseudocode:
+ *   copy the message, and append it to the queue
+ *   if the queue was empty, write a byte to the pipe, to wake the loop
+ */
+bool
+message_inject(const addr_t from, const char* message)
+{
+  if (!opened || transport.open != memoryOpen || message == NULL) {
+    log_v("message_inject: called without the memory transport open");
+    return false;
+  }
+  injected_t* datagram = mem_malloc(sizeof(injected_t));
+  char* copy = mem_malloc(strlen(message) + 1);
+  if (datagram == NULL || copy == NULL) {
+    if (datagram != NULL) {
+      mem_free(datagram);
+    }
+    if (copy != NULL) {
+      mem_free(copy);
+    }
+    return false;
+  }
+  datagram->from = from;
+  datagram->message = strcpy(copy, message);
+  datagram->next = NULL;
+  pthread_mutex_lock(&memory.lock);
+  bool wake = memory.head == NULL;
+  if (wake) {
+    memory.head = datagram;
+  } else {
+    memory.tail->next = datagram;
+  }
+  memory.tail = datagram;
+  if (wake && write(memory.pipe[1], "", 1) != 1) {
+    log_e("message_inject: error writing to pipe");
+  }
+  pthread_mutex_unlock(&memory.lock);
+  return true;
+}
+
+/**************** memoryFd ****************/
+static int
+memoryFd(void* arg)
+{
+  return memory.pipe[0];
+}
+
+/**************** memoryReceive ****************/
+/* take the oldest injected message; once the queue is empty, empty the pipe */
+static int
+memoryReceive(void* arg, addr_t* from, char* buf, const size_t size)
+{
+  pthread_mutex_lock(&memory.lock);
+  injected_t* datagram = memory.head;
+  if (datagram == NULL) {
+    pthread_mutex_unlock(&memory.lock);
+    errno = EAGAIN;
+    return -1;
+  }
+  memory.head = datagram->next;
+  if (memory.head == NULL) {
+    char byte;
+    if (read(memory.pipe[0], &byte, 1) != 1) {
+      log_e("message_loop: error reading from pipe");
+    }
+  }
+  pthread_mutex_unlock(&memory.lock);
+
+  size_t length = strlen(datagram->message);
+  if (length > size) {
+    length = size;  // cut, as a datagram too long for the buffer would be
+  }
+  memcpy(buf, datagram->message, length);
+  *from = datagram->from;
+  mem_free(datagram->message);
+  mem_free(datagram);
+  return length;
+}
+
+/**************** memoryClose ****************/
+/* drop any messages still queued, and close the pipe */
+static void
+memoryClose(void* arg)
+{
+  pthread_mutex_lock(&memory.lock);
+  while (memory.head != NULL) {
+    injected_t* next = memory.head->next;
+    mem_free(memory.head->message);
+    mem_free(memory.head);
+    memory.head = next;
+  }
+  pthread_mutex_unlock(&memory.lock);
+  for (int end = 0; end < 2; end++) {
+    if (memory.pipe[end] >= 0) {
+      close(memory.pipe[end]);
+      memory.pipe[end] = -1;
+    }
+  }
+}
+
+/**************** message_unixTransport ****************/
+/* see message.h for description */
+message_transport_t
+message_unixTransport(const char* path)
+{
+  message_transport_t unixTransport = {
+    "unix", message_MaxBytes, unixOpen, unixSend, NULL, socketFd, unixReceive, unixClose, (void*) path
+  };
+  return unixTransport;
+}
+
+/**************** unixOpen ****************/
+/* 
+ * Bind a Unix datagram socket at the path (the arg), replacing any old one there;
+ * return a made-up port number, since there is none
+ */
+static int
+unixOpen(void* arg)
+{
+  const char* path = arg;
+  struct sockaddr_un self;
+  if (path == NULL || strlen(path) >= sizeof(self.sun_path)) {
+    log_v("message_init: missing or over-long Unix socket path");
+    return 0;
+  }
+  ourSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (ourSocket < 0) {
+    log_e("message_init: error opening Unix datagram socket");
+    ourSocket = 0;
+    return 0;
+  }
+  memset(&self, 0, sizeof(self));
+  self.sun_family = AF_UNIX;
+  strcpy(self.sun_path, path);
+  unlink(path);
+  if (bind(ourSocket, (struct sockaddr *) &self, sizeof(self))) {
+    log_e("message_init: binding Unix socket name");
+    close(ourSocket);
+    ourSocket = 0;
+    return 0;
+  }
+  return NoPort;
+}
+
+/**************** unixSend ****************/
+/* send to the path of the peer whose number is the address's port */
+static bool
+unixSend(void* arg, const addr_t to, const char* message, const size_t length)
+{
+  const int peer = ntohs(to.sin_port);
+  pthread_mutex_lock(&unixPeers.lock);
+  if (peer < 1 || peer > unixPeers.numPeers) {
+    pthread_mutex_unlock(&unixPeers.lock);
+    return false;
+  }
+  struct sockaddr_un path = unixPeers.peers[peer - 1];
+  pthread_mutex_unlock(&unixPeers.lock);
+  return sendto(ourSocket, message, length, 0, (struct sockaddr *) &path, sizeof(path)) >= 0;
+}
+
+/**************** unixReceive ****************/
+/* 
+ * Receive one datagram, and make up the sender's address: 127.0.0.1, with the sender's
+ * number as its port, numbering each new path as it is first heard from.  A sender
+ * whose socket has no path cannot be answered, so its datagram is dropped.
+ */
+static int
+unixReceive(void* arg, addr_t* from, char* buf, const size_t size)
+{
+  struct sockaddr_un sender;
+  socklen_t senderlen = sizeof(sender);
+  memset(&sender, 0, sizeof(sender));
+  int nbytes = recvfrom(ourSocket, buf, size, 0, (struct sockaddr *) &sender, &senderlen);
+  if (nbytes < 0) {
+    return nbytes;
+  }
+  if (senderlen <= sizeof(sa_family_t) || sender.sun_path[0] == '\0') {
+    log_v("message_loop: dropped a datagram from an unnamed Unix socket");
+    *from = message_noAddr();
+    return nbytes;
+  }
+
+  pthread_mutex_lock(&unixPeers.lock);
+  int peer = 0;
+  while (peer < unixPeers.numPeers
+         && strcmp(unixPeers.peers[peer].sun_path, sender.sun_path) != 0) {
+    peer++;
+  }
+  if (peer == unixPeers.numPeers && peer < MaxUnixPeers) {
+    if (unixPeers.numPeers == unixPeers.size) {
+      int size = (unixPeers.size == 0) ? 16 : 2 * unixPeers.size;
+      struct sockaddr_un* peers = mem_malloc(size * sizeof(struct sockaddr_un));
+      if (peers != NULL) {
+        if (unixPeers.peers != NULL) {
+          memcpy(peers, unixPeers.peers, unixPeers.numPeers * sizeof(struct sockaddr_un));
+          mem_free(unixPeers.peers);
+        }
+        unixPeers.peers = peers;
+        unixPeers.size = size;
+      }
+    }
+    if (unixPeers.numPeers < unixPeers.size) {
+      unixPeers.peers[unixPeers.numPeers++] = sender;
+    }
+  }
+  const bool known = peer < unixPeers.numPeers;
+  pthread_mutex_unlock(&unixPeers.lock);
+
+  *from = message_noAddr();
+  if (known) {
+    from->sin_family = AF_INET;
+    from->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    from->sin_port = htons(peer + 1);
+  } else {
+    log_v("message_loop: too many Unix peers; dropped a datagram");
+  }
+  return nbytes;
+}
+
+/**************** unixClose ****************/
+/* close the socket, remove its path, and forget the peers */
+static void
+unixClose(void* arg)
+{
+  socketClose(arg);
+  unlink((const char*) arg);
+  pthread_mutex_lock(&unixPeers.lock);
+  if (unixPeers.peers != NULL) {
+    mem_free(unixPeers.peers);
+  }
+  unixPeers.peers = NULL;
+  unixPeers.numPeers = unixPeers.size = 0;
+  pthread_mutex_unlock(&unixPeers.lock);
 }
 
 /**************** message_loop ****************/
 /* 
- * Loop forever, calling handler functions for stdin or socket,
+ * Loop forever, calling handler functions for stdin or the transport,
  * as input is available from either.
  * Returns false on error or true if any of the handlers return true.
  * See message.h for detailed description.
@@ -278,7 +1246,7 @@ message_loop(void* arg, const float timeout,
                                    const addr_t from, const char* buf))
 {
   // check if we're ready for messaging
-  if (ourSocket == 0) {
+  if (!opened) {
     log_v("message_loop called before message_init");
     return false; // error in usage of this function.
   }
@@ -303,24 +1271,25 @@ message_loop(void* arg, const float timeout,
   struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
   if (timeout > 0.0) {
     timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
+    timeoutval.tv_usec = (timeout - (int)timeout) * 1000000;
   }
+  const int transportFd = (*transport.fd)(transport.arg);  // readable when a datagram waits
 
   // loop until error or some handler indicates time to quit looping
   while (true) {
     // for use with select()
     fd_set rfds;        // set of file descriptors we want to read
-    
-    // Watch stdin (fd 0) and the socket to see when either has input.
+
+    // Watch stdin (fd 0) and the transport to see when either has input.
     int nfds = 0;             // number of file descriptors to monitor
     FD_ZERO(&rfds);           // default to none
     if (handleInput != NULL) {
       FD_SET(0, &rfds);       // monitor stdin
       nfds = 1;
     }
-    if (handleMessage != NULL && ourSocket != 0) {
-      FD_SET(ourSocket, &rfds); // monitor the socket
-      nfds = ourSocket+1;       // highest-numbered fd in rfds
+    if (handleMessage != NULL && transportFd > 0) {
+      FD_SET(transportFd, &rfds); // monitor the transport
+      nfds = transportFd+1;       // highest-numbered fd in rfds
     }
     if (timeout > 0.0) {      // is timeout desired?
       timer = timeoutval;     // set the timer to the timeout value
@@ -332,7 +1301,7 @@ message_loop(void* arg, const float timeout,
     // Wait for input on either source
     int select_response = select(nfds, &rfds, NULL, NULL, timerp);
     // note: 'rfds' updated
-    
+
     if (select_response < 0) {
       if (errno == EINTR) {
 	// select() was interrupted by a signal - most likely SIGWINCH;
@@ -359,15 +1328,12 @@ message_loop(void* arg, const float timeout,
           break; // handler says to exit loop 
         }
       }
-      if (FD_ISSET(ourSocket, &rfds)) {
-        // socket has input ready
+      if (transportFd > 0 && FD_ISSET(transportFd, &rfds)) {
+        // the transport has input ready
         log_v("message_loop: message ready on socket");
         struct sockaddr_in sender;     // sender of this message
-        struct sockaddr *senderp = (struct sockaddr *) &sender;
-        socklen_t senderlen = sizeof(sender);  // must pass address to length
         char buf[message_MaxBytes]; // buffer for reading data from socket
-        int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 
-                              0, senderp, &senderlen);
+        int nbytes = (*transport.receive)(transport.arg, &sender, buf, message_MaxBytes-1);
         if (nbytes < 0) {
           // error, ignore it
           log_e("message_loop: receiving from socket");
@@ -379,12 +1345,34 @@ message_loop(void* arg, const float timeout,
             log_d("message_loop: non-Internet family %d\n", sender.sin_family);
           } else {
 	    // record it
+            kindSlot_t* slot = countKind(buf);
+            atomic_fetch_add_explicit(&slot->received, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&slot->bytesReceived, nbytes, memory_order_relaxed);
 	    log_s("message_loop: FROM %s", message_stringAddr(sender));
 	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
+	    log_p(buf);
+
+            // put it together with the rest of its message, if it is a fragment
+            char* message = buf;
+            partial_t* partial = NULL;
+            if (strncmp(buf, "FRAGMENT ", strlen("FRAGMENT ")) == 0) {
+              partial = reassemble(sender, buf, nbytes);
+              message = (partial == NULL) ? NULL : partial->text;
+            }
 
-            // handle it
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
+            // handle it, or each message packed in it
+            bool done = false;
+            if (message == NULL || handleMessage == NULL) {
+              done = false;
+            } else if (strncmp(message, "PACKED\n", strlen("PACKED\n")) == 0) {
+              done = unpack(arg, sender, message, strlen(message), handleMessage);
+            } else {
+              done = (*handleMessage)(arg, sender, message);
+            }
+            if (partial != NULL) {
+              forget(partial);
+            }
+            if (done) {
               break; // handler says to exit loop 
             }
           }
@@ -403,14 +1391,18 @@ message_loop(void* arg, const float timeout,
 void
 message_done(void)
 {
-  if (ourSocket != 0) {
-    close(ourSocket);
-    ourSocket = 0;
+  if (opened) {
+    (*transport.close)(transport.arg);
+    opened = false;
+  }
+  for (int p = 0; p < MaxPartials; p++) {
+    forget(&partials[p]);
   }
   log_v("message_done: message module closing down.");
 }
 
 
+
 /* ****************************************************************** */
 /* ************************* UNIT_TEST ****************************** */
 /* 
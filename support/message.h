@@ -2,8 +2,13 @@
  * message - a UDP-based messaging module
  *
  * Provides a message-passing abstraction among Internet hosts.  Messages
- * are sent via UDP and are thus limited to UDP packet size, may be lost,
- * and may be reordered, but require no connection setup or teardown.
+ * are sent via UDP and thus may be lost, and may be reordered, but
+ * require no connection setup or teardown.  A message longer than one
+ * datagram is sent in fragments, which message_loop puts back together
+ * (see message_setLargest); if any fragment is lost, the message is.
+ * Another transport may carry them instead (see message_setTransport):
+ * memory, for correspondents in the same process, or a Unix datagram
+ * socket, for correspondents on the same host.
  * 
  * Typical server sequence looks like this:
  *   message_init(stderr);
@@ -28,6 +33,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <arpa/inet.h>  // These two includes are not needed for this file, 
 #include <sys/select.h> // but is needed for users of this file.
 
@@ -45,11 +51,52 @@
  */
 typedef struct sockaddr_in addr_t;
 
+// How many messages of one kind (named by the message's first word) have
+// been sent and received, and how many bytes they held; see message_counts
+#define message_KindBytes 16
+#define message_MaxKinds 24    // kinds counted separately; the rest are counted as "other"
+typedef struct message_count {
+  char kind[message_KindBytes];   // first word, or "other"
+  unsigned long received;
+  unsigned long bytesReceived;
+  unsigned long sent;             // datagrams; a message sent to n addresses counts n times
+  unsigned long bytesSent;
+} message_count_t;
+
+// A transport carries the module's datagrams (see message_setTransport).
+// Each function is passed the transport's arg; all must be thread-safe
+// for sending, since several threads may send at once.
+typedef struct message_transport {
+  const char* name;             // for the log
+  size_t maxBytes;              // longest datagram it carries (at least message_MaxBytes); 0 if any
+  // ready to send and receive; returns the port number (> 0), or 0 on error
+  int  (*open)(void* arg);
+  // send one datagram; returns false on error
+  bool (*send)(void* arg, const addr_t to, const char* message, const size_t length);
+  // send one datagram to each address; returns how many were sent (NULL: send each)
+  int  (*sendMany)(void* arg, const addr_t* to, const int count,
+                   const char* message, const size_t length);
+  // a descriptor that select() finds readable when a datagram is waiting
+  int  (*fd)(void* arg);
+  // take one waiting datagram (at most size bytes); returns its length, or -1 on error
+  int  (*receive)(void* arg, addr_t* from, char* buf, const size_t size);
+  void (*close)(void* arg);
+  void* arg;
+} message_transport_t;
+
 /****************** constants *********************/
 // Maximum payload size for UDP messages, according to
 // https://en.wikipedia.org/wiki/User_Datagram_Protocol
 static const int message_MaxBytes = 65507;
 
+// Largest IP packet assumed to cross the network unfragmented (Ethernet);
+// see message_sendPacked
+static const int message_PathMTU = 1500;
+
+// Payload of each fragment of a longer message; its header,
+// "FRAGMENT id index count\n", fits in the rest of a datagram
+static const int message_FragmentBytes = 65472;
+
 /****************** global functions *********************/
 
 /******************************************/
@@ -115,11 +162,28 @@ bool message_setAddr(const char* hostname, const char* portStr, addr_t* addr);
  * Returns:
  *   a string representation of the address,
  *   which is a pointer to static storage that cannot be retained!
+ *   (Each thread has its own storage, so threads do not clobber each other.)
  * Logs:
  *   nothing.
  */
 const char* message_stringAddr(const addr_t addr);
 
+/******************************************/
+/* message_addrKey: pack an address into one integer, for an intmap.
+ * Caller provides: an address.
+ * Function returns:
+ *   a number that two addresses share iff message_eqAddr holds of them,
+ *   from which message_keyAddr makes the address again.
+ * Logs: nothing.
+ */
+uint64_t message_addrKey(const addr_t addr);
+
+/******************************************/
+/* message_keyAddr: the address that message_addrKey packed into key.
+ * Logs: nothing.
+ */
+addr_t message_keyAddr(const uint64_t key);
+
 /******************************************/
 /* message_send: send a message.
  * Caller provides:
@@ -133,6 +197,64 @@ const char* message_stringAddr(const addr_t addr);
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_sendMany: send the same message to many addresses.
+ * Caller provides:
+ *   an array of valid addresses to which to send the message,
+ *   the number of addresses in that array,
+ *   a string containing the message.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Notes:
+ *   Equivalent to calling message_send() once per address, but the
+ *   datagrams are submitted to the kernel in batches where the platform
+ *   allows it (sendmmsg on Linux), which is much cheaper for large fan-out.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message,
+ *   the number of recipients and the message, once.
+ */
+void message_sendMany(const addr_t* to, const int count, const char* message);
+
+/******************************************/
+/* message_sendPacked: send several messages, in order, to each of many
+ *   addresses, packed into as few datagrams, and packets, as the path
+ *   allows.
+ * Caller provides:
+ *   an array of valid addresses, and its length (1 for a single address);
+ *   an array of strings, the messages, and its length.
+ * Function returns: none
+ * Assumptions: message_init() has already been called; every recipient
+ *   reads messages with message_loop, which unpacks them (or otherwise
+ *   understands the packing below).
+ * Notes:
+ *   Messages that go together are sent as one datagram, "PACKED\n" and
+ *   then, for each message, its length in decimal, a newline, and the
+ *   message.  Consecutive messages go together only if that takes fewer
+ *   IP packets, on a path with message_PathMTU, than sending them apart,
+ *   so a small update stays within one packet and a large one gains no
+ *   IP fragment.  A message that goes alone is sent as message_send
+ *   would.  message_loop hands each message of a packed datagram to
+ *   handleMessage in turn.
+ * Logs:
+ *   errors in arguments, and each message as message_sendMany does.
+ */
+void message_sendPacked(const addr_t* to, const int count,
+                        const char** messages, const int numMessages);
+
+/******************************************/
+/* message_setLargest: how long a message message_loop will put together
+ *   from fragments.
+ * Caller provides:
+ *   the length, in bytes, of the longest message it expects; typically
+ *   sized from what the correspondent announced (such as a GRID).
+ * Notes:
+ *   The default, message_MaxBytes, accepts no fragmented message; a
+ *   message whose fragments add up to more is dropped.  Fragments of a
+ *   message that is not complete within two seconds are dropped, too.
+ */
+void message_setLargest(const size_t bytes);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -148,7 +270,8 @@ void message_send(const addr_t to, const char* message);
  *   handleTimeout: called when time passes without input or message.
  *   handleInput: should read once from stdin and process it.
  *   handleMessage: provided the address from which the message arrived,
- *     and a string containing the contents of the message. The handler should
+ *     and a string containing the contents of the message (put together, if
+ *     it came in fragments; one at a time, if several came packed together). The handler should
  *     realize the string's memory will be reused upon return from the handler.
  *   All are provided 'arg', passed-through untouched.
  *   Handlers should return true to terminate looping, false to keep looping.
@@ -166,6 +289,85 @@ bool message_loop(void* arg, const float timeout,
                                         const addr_t from, 
                                         const char* message));
 
+/******************************************/
+/* message_setTransport: carry datagrams by another transport than UDP.
+ * Caller provides:
+ *   a transport (see message_transport_t), typically from
+ *   message_memoryTransport or message_unixTransport.
+ * Function returns:
+ *   true; false if the module is already initialized, or a required
+ *   function is missing.
+ * Notes:
+ *   Call before message_init, which opens the transport;
+ *   message_done closes it.
+ * Logs: errors in usage.
+ */
+bool message_setTransport(const message_transport_t transport);
+
+/******************************************/
+/* message_udpTransport: the default transport, UDP over the Internet.
+ */
+message_transport_t message_udpTransport(void);
+
+/******************************************/
+/* message_memoryTransport: a transport for correspondents in this process.
+ * Caller provides:
+ *   a function to receive every message sent, with the address it was
+ *   sent to, and an arg passed to it.
+ * Function returns:
+ *   the transport, for message_setTransport.
+ * Notes:
+ *   message_init returns port 1.  Sending calls deliver once per
+ *   address, on the sending thread, so deliver must be thread-safe if
+ *   several threads send; it must not keep the message, whose memory
+ *   may be reused.  Correspondents send with message_inject, and
+ *   message_loop hands each injected message to handleMessage.
+ */
+message_transport_t message_memoryTransport(void (*deliver)(void* arg, const addr_t to,
+                                                            const char* message),
+                                            void* arg);
+
+/******************************************/
+/* message_inject: queue a message from a correspondent in this process,
+ *   for message_loop to handle as if it had arrived from the address.
+ * Function returns:
+ *   true; false unless the memory transport is open, or out of memory.
+ * Notes:
+ *   Any thread may inject.
+ */
+bool message_inject(const addr_t from, const char* message);
+
+/******************************************/
+/* message_unixTransport: a transport over a Unix datagram socket, for
+ *   correspondents on the same host.
+ * Caller provides:
+ *   the path at which to bind the socket (replacing any socket there);
+ *   the string must last until message_done.
+ * Function returns:
+ *   the transport, for message_setTransport.
+ * Notes:
+ *   message_init returns port 1; message_done removes the path.
+ *   Correspondents send from sockets bound to paths of their own; each
+ *   path is numbered as first heard from, and appears to the handlers as
+ *   address 127.0.0.1 with that number as its port, which message_send
+ *   maps back to the path.
+ */
+message_transport_t message_unixTransport(const char* path);
+
+/******************************************/
+/* message_counts: how much traffic of each kind the program has sent
+ *   and received so far, where a message's kind is its first word.
+ * Caller provides:
+ *   array of at least message_MaxKinds counts to fill in.
+ * Function returns:
+ *   the number of kinds filled in, in the order first seen.
+ * Notes:
+ *   The counts are kept without locks, so they may be read while
+ *   other threads send; they are not reset by message_init.
+ * Logs: nothing.
+ */
+int message_counts(message_count_t* counts);
+
 /******************************************/
 /* message_done: shut down the module.
  * Caller provides: nothing.
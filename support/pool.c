@@ -0,0 +1,341 @@
+/*
+ * pool - a small work-stealing thread pool for fork-join batches
+ *
+ * See pool.h for detailed interface description for each function.
+ *
+ * Each participant's share of a batch is a range [first, last) of task
+ * numbers packed into one 64-bit atomic word, so the owner taking from
+ * the front and thieves taking from the back are each a single
+ * compare-and-swap, and a task can never be taken twice.  Threads sleep
+ * on a condition variable between batches.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "pool.h"
+#include "mem.h"
+
+/**************** file-local types ****************/
+typedef struct share {
+  _Atomic uint64_t range;   // first task in the high 32 bits, one past the last in the low 32
+  char pad[56];             // keep each share on its own cache line
+} share_t;
+
+typedef struct worker {
+  pthread_t thread;
+  struct pool* pool;
+  int index;                // index of this worker's share
+} worker_t;
+
+typedef struct pool {
+  int threads;              // number of workers
+  worker_t* workers;
+  share_t* shares;          // threads + 1 shares; the caller's is last
+  atomic_flag busy;         // set while some caller is running a batch
+  pthread_mutex_t lock;     // guards everything below
+  pthread_cond_t start;     // signalled when a batch is posted, or stopping is set
+  pthread_cond_t done;      // signalled when the last worker finishes a batch
+  unsigned long batches;    // number of batches posted so far
+  int active;               // workers still working on the current batch
+  bool stopping;
+  void (*task)(void* arg, const int index);
+  void* arg;
+} pool_t;
+
+/**************** local functions ****************/
+static void* workerMain(void* arg);
+static void participate(pool_t* pool, const int self);
+static int takeFirst(share_t* share);
+static int takeLast(share_t* share);
+static uint64_t packRange(const uint64_t first, const uint64_t last);
+
+/**************** pool_new ****************/
+/* see pool.h for description */
+pool_t*
+pool_new(const int threads)
+{
+  if (threads < 0) {
+    return NULL;
+  }
+  pool_t* pool = mem_calloc(1, sizeof(pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->workers = mem_calloc(threads + 1, sizeof(worker_t));
+  pool->shares = mem_calloc(threads + 1, sizeof(share_t));
+  if (pool->workers == NULL || pool->shares == NULL) {
+    pool_delete(pool);
+    return NULL;
+  }
+  atomic_flag_clear(&pool->busy);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (int w = 0; w < threads; w++) {
+    pool->workers[w].pool = pool;
+    pool->workers[w].index = w;
+    if (pthread_create(&pool->workers[w].thread, NULL, workerMain, &pool->workers[w]) != 0) {
+      pool_delete(pool);  // stops the threads started so far
+      return NULL;
+    }
+    pool->threads++;
+  }
+  return pool;
+}
+
+/**************** pool_threads ****************/
+/* see pool.h for description */
+int
+pool_threads(pool_t* pool)
+{
+  return pool == NULL ? 0 : pool->threads;
+}
+
+/**************** pool_run ****************/
+/* see pool.h for description */
+void
+pool_run(pool_t* pool, const int ntasks, void (*task)(void* arg, const int index), void* arg)
+{
+  if (ntasks <= 0 || task == NULL) {
+    return;
+  }
+  // run the batch here if there is nobody to share it with
+  if (ntasks == 1 || pool == NULL || pool->threads == 0 || atomic_flag_test_and_set(&pool->busy)) {
+    for (int i = 0; i < ntasks; i++) {
+      (*task)(arg, i);
+    }
+    return;
+  }
+
+  // deal out equal shares, then wake the workers
+  const int participants = pool->threads + 1;
+  for (int p = 0; p < participants; p++) {
+    uint64_t first = (uint64_t)ntasks * p / participants;
+    uint64_t last = (uint64_t)ntasks * (p + 1) / participants;
+    atomic_store_explicit(&pool->shares[p].range, packRange(first, last), memory_order_relaxed);
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->arg = arg;
+  pool->active = pool->threads;
+  pool->batches++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  participate(pool, pool->threads);
+
+  // wait for the workers to finish their last tasks
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  atomic_flag_clear(&pool->busy);
+}
+
+/**************** pool_delete ****************/
+/* see pool.h for description */
+void
+pool_delete(pool_t* pool)
+{
+  if (pool == NULL) {
+    return;
+  }
+  if (pool->workers != NULL && pool->shares != NULL) {  // the lock and conditions exist
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int w = 0; w < pool->threads; w++) {
+      pthread_join(pool->workers[w].thread, NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+  }
+  if (pool->workers != NULL) {
+    mem_free(pool->workers);
+  }
+  if (pool->shares != NULL) {
+    mem_free(pool->shares);
+  }
+  mem_free(pool);
+}
+
+/**************** workerMain ****************/
+/* The body of each pool thread: sleep until a batch is posted, work on it, repeat */
+static void*
+workerMain(void* arg)
+{
+  worker_t* worker = arg;
+  pool_t* pool = worker->pool;
+  unsigned long seen = 0;  // batches this worker has worked on
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (pool->batches == seen && !pool->stopping) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stopping) {
+      break;
+    }
+    seen = pool->batches;
+    pthread_mutex_unlock(&pool->lock);
+
+    participate(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**************** participate ****************/
+/* Run tasks from our own share, then steal from the others until every share is empty */
+static void
+participate(pool_t* pool, const int self)
+{
+  int index;
+  while ((index = takeFirst(&pool->shares[self])) >= 0) {
+    (*pool->task)(pool->arg, index);
+  }
+
+  const int participants = pool->threads + 1;
+  bool stole = true;
+  while (stole) {
+    stole = false;
+    for (int k = 1; k < participants && !stole; k++) {
+      if ((index = takeLast(&pool->shares[(self + k) % participants])) >= 0) {
+        (*pool->task)(pool->arg, index);
+        stole = true;
+      }
+    }
+  }
+}
+
+/**************** takeFirst ****************/
+/* Take the first task of a share (as its owner); return -1 if it is empty */
+static int
+takeFirst(share_t* share)
+{
+  uint64_t range = atomic_load(&share->range);
+  while (true) {
+    uint64_t first = range >> 32, last = range & 0xffffffff;
+    if (first >= last) {
+      return -1;
+    }
+    if (atomic_compare_exchange_weak(&share->range, &range, packRange(first + 1, last))) {
+      return (int)first;
+    }
+  }
+}
+
+/**************** takeLast ****************/
+/* Take the last task of a share (as a thief); return -1 if it is empty */
+static int
+takeLast(share_t* share)
+{
+  uint64_t range = atomic_load(&share->range);
+  while (true) {
+    uint64_t first = range >> 32, last = range & 0xffffffff;
+    if (first >= last) {
+      return -1;
+    }
+    if (atomic_compare_exchange_weak(&share->range, &range, packRange(first, last - 1))) {
+      return (int)(last - 1);
+    }
+  }
+}
+
+static uint64_t
+packRange(const uint64_t first, const uint64_t last)
+{
+  return (first << 32) | last;
+}
+
+/* ***************************************************************** */
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Run many batches of uneven tasks and check that every task of every
+ * batch runs exactly once, including when two callers share a pool.
+ *
+ *   ./pooltest [threads]
+ */
+#ifdef UNIT_TEST
+#include <stdio.h>
+
+typedef struct batch {
+  int ntasks;
+  _Atomic int* runs;        // number of times each task ran
+} batch_t;
+
+static void
+countTask(void* arg, const int index)
+{
+  batch_t* batch = arg;
+  volatile int spin = 0;
+  for (int i = 0; i < (index % 97) * 50; i++) {  // uneven work, so stealing happens
+    spin++;
+  }
+  atomic_fetch_add(&batch->runs[index], 1);
+}
+
+// run many batches on the pool; return the number of tasks that did not run exactly once
+static int
+runBatches(pool_t* pool, const int nbatches)
+{
+  int errors = 0;
+  for (int b = 0; b < nbatches; b++) {
+    batch_t batch = { (b * 7919) % 3001, NULL };
+    batch.runs = calloc(batch.ntasks + 1, sizeof(_Atomic int));
+    pool_run(pool, batch.ntasks, countTask, &batch);
+    for (int i = 0; i < batch.ntasks; i++) {
+      errors += (batch.runs[i] != 1);
+    }
+    free(batch.runs);
+  }
+  return errors;
+}
+
+static void*
+caller(void* arg)
+{
+  static _Atomic int errors;
+  atomic_fetch_add(&errors, runBatches(arg, 200));
+  return &errors;
+}
+
+int
+main(const int argc, char* argv[])
+{
+  int threads = (argc > 1) ? atoi(argv[1]) : 3;
+  pool_t* pool = pool_new(threads);
+  if (pool == NULL) {
+    fprintf(stderr, "pool_new(%d) failed\n", threads);
+    exit(1);
+  }
+  printf("pool of %d threads\n", pool_threads(pool));
+
+  int errors = runBatches(pool, 500);
+  printf("one caller: %d errors\n", errors);
+
+  pthread_t other;
+  pthread_create(&other, NULL, caller, pool);
+  void* result = caller(pool);
+  pthread_join(other, NULL);
+  printf("two callers: %d errors\n", *(_Atomic int*)result);
+  errors += *(_Atomic int*)result;
+
+  errors += runBatches(NULL, 20);
+  pool_delete(pool);
+  printf("%s\n", errors == 0 ? "pool test passed" : "pool test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,71 @@
+/*
+ * pool - a small work-stealing thread pool for fork-join batches
+ *
+ * The caller hands the pool a batch of n independent tasks, numbered
+ * 0..n-1, and one function to run each of them; pool_run returns once
+ * every task has run.  The calling thread works on the batch too, so a
+ * pool of k threads runs a batch on up to k+1 cores.
+ *
+ * Each participant starts with an equal, contiguous share of the task
+ * numbers and takes tasks from the front of its share; a participant
+ * that runs out steals from the back of another's share, so uneven
+ * tasks still balance out.  Scheduling takes no locks.
+ *
+ * A pool runs one batch at a time.  If pool_run is called while the
+ * pool is busy with another caller's batch, the caller simply runs its
+ * whole batch itself.  A NULL pool, or one with no threads, does the same.
+ *
+ * Typical sequence:
+ *   pool_t* pool = pool_new(3);
+ *   ... whenever there is a batch:
+ *   pool_run(pool, n, renderOne, state);   // calls renderOne(state, i) for i in 0..n-1
+ *   ...
+ *   pool_delete(pool);
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/****************** types *********************/
+typedef struct pool pool_t;  // opaque to users of the module
+
+/****************** functions *********************/
+
+/******************************************/
+/* pool_new: start a pool of threads.
+ * Caller provides:
+ *   number of threads (>= 0) in addition to the caller's own.
+ * Function returns:
+ *   pointer to the new pool; NULL if out of memory or a thread cannot start.
+ * Caller is responsible for:
+ *   later calling pool_delete.
+ */
+pool_t* pool_new(const int threads);
+
+/******************************************/
+/* pool_threads: the number of threads in the pool (0 if pool is NULL).
+ */
+int pool_threads(pool_t* pool);
+
+/******************************************/
+/* pool_run: run a batch of tasks, in parallel, and wait for all of them.
+ * Caller provides:
+ *   pool (may be NULL), number of tasks (>= 0),
+ *   function to run each task, and an argument passed to every task.
+ * We do:
+ *   call task(arg, i) exactly once for each i in 0..ntasks-1, in no
+ *   particular order and on any thread; return when all have returned.
+ * Notes:
+ *   tasks must be independent of each other; pool_run may not be called
+ *   from inside a task.
+ */
+void pool_run(pool_t* pool, const int ntasks, void (*task)(void* arg, const int index), void* arg);
+
+/******************************************/
+/* pool_delete: stop the pool's threads and free the pool.
+ * Caller provides:
+ *   pool (NULL is ignored), which must not be running a batch.
+ */
+void pool_delete(pool_t* pool);
+
+#endif // _POOL_H_
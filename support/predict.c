@@ -0,0 +1,467 @@
+/*
+ * predict - a player's own moves, shown before the server confirms them
+ *
+ * See predict.h for detailed interface description for each function.
+ *
+ * Each move not yet confirmed keeps where it started and where it was
+ * predicted to leave the player, both as offsets into the frame; the
+ * view is rebuilt from the truth, by playing them all again, whenever
+ * the truth or the moves change.  Frames are rows of equal width, each
+ * ended by a newline, so a step off the side of the map meets a newline
+ * (never open) and needs no column arithmetic.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "predict.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+static const uint64_t ExpireNanos = 1000000000;  // a move not shown taken this long never will be
+static const char Keys[] = "hlkjyubn";
+static const int RowStep[] = { 0, 0, -1, 1, -1, -1, 1, 1 };  // for each of Keys
+static const int ColStep[] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+
+/**************** file-local types ****************/
+typedef struct move {
+  char key;       // as sent with KEY
+  long from;      // where the player stood before it
+  long to;        // where it leaves them (from, if it does not move them)
+  uint64_t sent;  // when it was sent, or made if not yet sent (see hist_now)
+  bool last;      // is it the last of the moves sent together?  a frame can only show those
+} move_t;
+
+struct predict {
+  size_t length;      // of the longest frame
+  char* truth;        // the last frame from the server
+  long truthLength;   // its length
+  char* view;         // the truth, with the pending moves played on top
+  char* under;        // what lies under each spot, as far as any frame showed; '\0' if unknown
+  long home;          // where the truth shows the player; -1 if nowhere (or no truth yet)
+  long width;         // of a row of the truth, with its newline
+  move_t pending[predict_MaxPending];  // moves not yet confirmed, oldest first
+  int numPending;
+  int numSent;        // how many of them, the oldest, have been sent
+};
+
+/**************** local functions ****************/
+static bool isOpen(const char symbol);
+static long play(predict_t* predict, const long from, const char key);
+static long step(predict_t* predict, const long from, const int direction);
+static void replay(predict_t* predict);
+static void drop(predict_t* predict, const int count);
+
+/**************** predict_new ****************/
+/* see predict.h for description */
+predict_t*
+predict_new(const size_t frameLength)
+{
+  predict_t* predict = mem_calloc(1, sizeof(predict_t));
+  if (predict == NULL) {
+    return NULL;
+  }
+  predict->length = frameLength;
+  predict->truth = mem_malloc(frameLength + 1);
+  predict->view = mem_malloc(frameLength + 1);
+  predict->under = mem_calloc(frameLength + 1, sizeof(char));
+  if (predict->truth == NULL || predict->view == NULL || predict->under == NULL) {
+    predict_delete(predict);
+    return NULL;
+  }
+  predict->truth[0] = '\0';
+  predict->home = -1;
+  return predict;
+}
+
+/**************** predict_frame ****************/
+/* see predict.h for description
+ *
+ * Pseudocode:
+ *   keep the frame as the truth, and note what it shows under each spot
+ *     no player stands on (a spot with gold is a room spot)
+ *   find the player in it, and the width of its rows
+ *   if they stand where the last move of some batch sent would leave them, drop it and
+ *     those before it, unless it is where the first started and no move up to it took
+ *     them elsewhere
+ *   else, unless they stand where the first started, roll back: drop every sent move
+ *   replay the rest on the new truth
+ */
+int
+predict_frame(predict_t* predict, const char* frame)
+{
+  size_t length = strlen(frame);
+  if (predict == NULL || length > predict->length) {
+    return 0;
+  }
+  memcpy(predict->truth, frame, length + 1);
+  predict->truthLength = length;
+  for (size_t i = 0; i < length; i++) {
+    char symbol = frame[i];
+    if (symbol == '*') {
+      predict->under[i] = '.';
+    }
+    else if (symbol != '@' && !isupper(symbol)) {
+      predict->under[i] = symbol;
+    }
+  }
+
+  const char* at = strchr(frame, '@');
+  predict->home = (at == NULL) ? -1 : at - frame;
+  if (at != NULL) {
+    const char* start = at;
+    while (start > frame && start[-1] != '\n') {
+      start--;
+    }
+    predict->width = strcspn(start, "\n") + 1;
+  }
+
+  int confirmed = 0;
+  if (predict->numSent > 0 && predict->home >= 0) {
+    bool stayed = (predict->home == predict->pending[0].from);
+    bool away = false;  // has a move up to m taken the player elsewhere?
+    int m = 0;
+    for (; m < predict->numSent; m++) {
+      away = away || predict->pending[m].to != predict->pending[m].from;
+      if (predict->pending[m].last && predict->pending[m].to == predict->home
+          && (!stayed || away)) {
+        break;
+      }
+    }
+    if (m < predict->numSent) {
+      confirmed = m + 1;
+      drop(predict, confirmed);
+    }
+    else if (!stayed) {
+      // the player is where no move would leave them: a move went otherwise than predicted
+      drop(predict, predict->numSent);
+    }
+  }
+  replay(predict);
+  return confirmed;
+}
+
+/**************** predict_key ****************/
+/* see predict.h for description */
+bool
+predict_key(predict_t* predict, const char key, const uint64_t now)
+{
+  if (predict == NULL || predict->home < 0 || predict->numPending == predict_MaxPending) {
+    return false;
+  }
+  move_t* move = &predict->pending[predict->numPending++];
+  move->key = key;
+  move->from = (predict->numPending > 1) ? move[-1].to : predict->home;
+  move->to = play(predict, move->from, key);
+  move->sent = now;
+  move->last = false;
+  return move->to != move->from;
+}
+
+/**************** predict_sent ****************/
+/* see predict.h for description */
+void
+predict_sent(predict_t* predict, const uint64_t now)
+{
+  if (predict != NULL && predict->numPending > predict->numSent) {
+    for (int m = predict->numSent; m < predict->numPending; m++) {
+      predict->pending[m].sent = now;
+    }
+    predict->pending[predict->numPending - 1].last = true;
+    predict->numSent = predict->numPending;
+  }
+}
+
+/**************** predict_reject ****************/
+/* see predict.h for description */
+void
+predict_reject(predict_t* predict, const int index)
+{
+  if (predict != NULL && index >= 0 && index < predict->numPending) {
+    if (index < predict->numSent) {
+      predict->numSent--;
+    }
+    if (predict->pending[index].last && index > 0 && !predict->pending[index - 1].last) {
+      predict->pending[index - 1].last = true;  // the batch now ends a move sooner
+    }
+    predict->numPending--;
+    memmove(predict->pending + index, predict->pending + index + 1,
+            (predict->numPending - index) * sizeof(move_t));
+    replay(predict);
+  }
+}
+
+/**************** predict_expire ****************/
+/* see predict.h for description */
+bool
+predict_expire(predict_t* predict, const uint64_t now)
+{
+  if (predict == NULL) {
+    return false;
+  }
+  int stale = 0;
+  while (stale < predict->numSent && now - predict->pending[stale].sent >= ExpireNanos) {
+    stale++;
+  }
+  if (stale == 0) {
+    return false;
+  }
+  drop(predict, stale);
+  replay(predict);
+  return true;
+}
+
+/**************** predict_view ****************/
+/* see predict.h for description */
+const char*
+predict_view(predict_t* predict)
+{
+  if (predict == NULL || predict->truth[0] == '\0') {
+    return NULL;
+  }
+  return predict->view;
+}
+
+/**************** predict_pending ****************/
+/* see predict.h for description */
+int
+predict_pending(predict_t* predict)
+{
+  return (predict == NULL) ? 0 : predict->numPending;
+}
+
+/**************** predict_delete ****************/
+/* see predict.h for description */
+void
+predict_delete(predict_t* predict)
+{
+  if (predict != NULL) {
+    mem_free(predict->truth);
+    mem_free(predict->view);
+    mem_free(predict->under);
+    mem_free(predict);
+  }
+}
+
+/**************** isOpen ****************/
+// can a player step onto a spot showing this symbol?  (onto another player, they swap)
+static bool
+isOpen(const char symbol)
+{
+  return symbol == '.' || symbol == '#' || symbol == '*' || isupper(symbol);
+}
+
+/**************** play ****************/
+/* Play one key on the view, from the given spot: a small letter takes
+ * one step, a capital letter steps until it cannot, and any other key
+ * does nothing.
+ * Returns where the player ends up.
+ */
+static long
+play(predict_t* predict, const long from, const char key)
+{
+  if (key == '\0' || strchr(Keys, tolower(key)) == NULL) {
+    return from;
+  }
+  int direction = strchr(Keys, tolower(key)) - Keys;
+  long at = from;
+  for (long next; (next = step(predict, at, direction)) >= 0; at = next) {
+    if (islower(key)) {
+      return next;
+    }
+  }
+  return at;
+}
+
+/**************** step ****************/
+/* Take one step in the view, swapping with any player in the way, and
+ * put back what lies under the spot left (a room spot, if no frame showed it).
+ * Returns the new spot; -1 if the step is not open.
+ */
+static long
+step(predict_t* predict, const long from, const int direction)
+{
+  long to = from + RowStep[direction] * predict->width + ColStep[direction];
+  if (to < 0 || to >= predict->truthLength || !isOpen(predict->view[to])) {
+    return -1;
+  }
+  char* view = predict->view;
+  if (isupper(view[to])) {
+    view[from] = view[to];
+  }
+  else {
+    view[from] = (predict->under[from] != '\0') ? predict->under[from] : '.';
+  }
+  view[to] = '@';
+  return to;
+}
+
+/**************** replay ****************/
+/* Rebuild the view: the truth, with each pending move played again from
+ * where the last one left the player, noting where each now goes; a truth
+ * that does not show the player drops them all.
+ */
+static void
+replay(predict_t* predict)
+{
+  memcpy(predict->view, predict->truth, predict->truthLength + 1);
+  if (predict->home < 0) {
+    predict->numPending = predict->numSent = 0;
+  }
+  long at = predict->home;
+  for (int m = 0; m < predict->numPending; m++) {
+    move_t* move = &predict->pending[m];
+    move->from = at;
+    move->to = play(predict, at, move->key);
+    at = move->to;
+  }
+}
+
+/**************** drop ****************/
+/* Forget the oldest count pending moves. */
+static void
+drop(predict_t* predict, const int count)
+{
+  predict->numPending -= count;
+  predict->numSent = (predict->numSent > count) ? predict->numSent - count : 0;
+  memmove(predict->pending, predict->pending + count, predict->numPending * sizeof(move_t));
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Play moves on a small room, with the frames a server would send for
+ * them coming late, early or not at all, and check the view each time:
+ * moves show at once, are kept until confirmed, and are rolled back when
+ * a frame or an ERROR shows them not taken.
+ *
+ *   ./predicttest
+ */
+#ifdef UNIT_TEST
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+// a frame of one room with the player at the given row and column, and B at row 3, column 3
+static const char*
+room(const int row, const int col)
+{
+  static char frame[64];
+  strcpy(frame,
+         "+-----+\n"
+         "|.*...|\n"
+         "|.....#\n"
+         "|..B..|\n"
+         "+-----+\n");
+  frame[row * 8 + col] = '@';
+  return frame;
+}
+
+// where the view shows the player, as row * 8 + column
+static long
+where(predict_t* predict)
+{
+  return strchr(predict_view(predict), '@') - predict_view(predict);
+}
+
+int
+main()
+{
+  predict_t* predict = predict_new(strlen(room(1, 1)));
+  expect(predict_view(predict) == NULL, "no view before a frame");
+  expect(!predict_key(predict, 'l', 0), "no move is predicted before a frame");
+
+  predict_frame(predict, room(1, 1));
+  expect(strcmp(predict_view(predict), room(1, 1)) == 0, "with no moves the view is the frame");
+
+  // a step shows at once, and picks up the gold; the frame for it confirms it
+  expect(predict_key(predict, 'l', 0), "a step onto gold moves the player");
+  expect(strcmp(predict_view(predict), room(1, 2)) == 0, "the step shows at once");
+  predict_sent(predict, 0);
+  expect(!predict_key(predict, 'k', 0), "a step into a wall does not");
+  expect(!predict_key(predict, 'x', 0), "nor does a key that is not a move");
+  predict_sent(predict, 0);
+  expect(predict_frame(predict, room(1, 1)) == 0 && predict_pending(predict) == 3,
+         "a frame that shows no step taken confirms none");
+  expect(strcmp(predict_view(predict), room(1, 2)) == 0, "the step is still shown");
+  expect(predict_frame(predict, room(1, 2)) == 1 && predict_pending(predict) == 2,
+         "the frame with the step confirms it");
+  predict_reject(predict, 0);
+  predict_reject(predict, 0);
+  expect(predict_pending(predict) == 0, "the rejected keys are dropped");
+
+  // a key of a batch rejected before the frame for the keys before it
+  predict_key(predict, 'x', 0);
+  expect(predict_key(predict, 'j', 0), "a batch with a bad key, then a step");
+  predict_sent(predict, 0);
+  predict_reject(predict, 0);
+  expect(predict_pending(predict) == 1 && where(predict) == 2 * 8 + 2, "the bad key is dropped");
+  predict_key(predict, 'x', 0);
+  predict_sent(predict, 0);
+  predict_reject(predict, 1);
+  predict_reject(predict, 5);
+  expect(predict_frame(predict, room(2, 2)) == 1 && predict_pending(predict) == 0,
+         "a later key of a batch is dropped, and the move before it kept");
+  predict_frame(predict, room(1, 2));
+
+  // a batch that brings the player back where they started is confirmed by the frame for it
+  predict_key(predict, 'j', 0);
+  predict_key(predict, 'k', 0);
+  predict_sent(predict, 0);
+  expect(predict_frame(predict, room(1, 2)) == 2 && predict_pending(predict) == 0,
+         "a frame shows a batch taken that returns the player");
+  predict_key(predict, 'j', 0);
+  expect(predict_frame(predict, room(2, 2)) == 0 && predict_pending(predict) == 1,
+         "a frame confirms no key not yet sent");
+  predict_reject(predict, 0);
+  predict_frame(predict, room(1, 2));
+
+  // a run stops at the wall; what lay under the player comes back
+  expect(predict_key(predict, 'J', 0), "a run moves the player");
+  expect(where(predict) == 3 * 8 + 2, "a run goes to the wall");
+  expect(predict_view(predict)[1 * 8 + 2] == '.', "the spot the gold was on is a room spot");
+  expect(predict_key(predict, 'l', 0), "a step onto another player swaps them");
+  expect(where(predict) == 3 * 8 + 3 && predict_view(predict)[3 * 8 + 2] == 'B',
+         "the other player takes our spot");
+  predict_sent(predict, 0);
+
+  // a frame showing the player anywhere else rolls every move sent back
+  predict_key(predict, 'h', 0);
+  expect(predict_frame(predict, room(2, 5)) == 0 && predict_pending(predict) == 1,
+         "a surprise drops every move sent");
+  expect(where(predict) == 2 * 8 + 4, "and plays the rest on the frame");
+  predict_reject(predict, 0);
+  expect(strcmp(predict_view(predict), room(2, 5)) == 0, "and with none, shows the frame");
+
+  // a step into the passage remembers the room spot under the player
+  expect(predict_key(predict, 'l', 0), "a step into the passage");
+  predict_sent(predict, 100);
+  expect(predict_view(predict)[2 * 8 + 5] == '.', "the room spot is put back");
+  expect(!predict_expire(predict, 100 + ExpireNanos - 1), "a move is kept for a second");
+  expect(predict_expire(predict, 100 + ExpireNanos), "then dropped");
+  expect(strcmp(predict_view(predict), room(2, 5)) == 0, "and the view is the frame again");
+  predict_key(predict, 'l', 0);
+  expect(!predict_expire(predict, 10 * ExpireNanos) && predict_pending(predict) == 1,
+         "a move not yet sent is kept however long it waits");
+  predict_reject(predict, 0);
+
+  // a frame too long is ignored
+  predict_frame(predict, "+-----+\n|.....|\n|.....|\n|.....|\n+-----+\n|@....|\n");
+  expect(strcmp(predict_view(predict), room(2, 5)) == 0, "an overlong frame is ignored");
+  predict_delete(predict);
+
+  printf("%s\n", errors == 0 ? "predict test passed" : "predict test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
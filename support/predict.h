@@ -0,0 +1,130 @@
+/*
+ * predict - a player's own moves, shown before the server confirms them
+ *
+ * A predict_t holds the last frame the server sent a player (the truth)
+ * and the moves the player has made since, which the server has not yet
+ * shown taken; the oldest of them have been sent to the server, and the
+ * rest wait to be (see predict_sent).  Its view is the truth with those
+ * moves played on top, by the server's rules as far as the frame shows
+ * them: a step goes to an open spot ('.', '#', gold '*', or another
+ * player, who swaps places), and a capital letter keeps stepping while
+ * it can.  What lies under a spot that a player covers is remembered
+ * from earlier frames.
+ *
+ * Each new truth is reconciled with the moves sent: those it shows taken
+ * (the player stands where the last of a batch sent together would have
+ * left them, or back where they started after it took them elsewhere)
+ * are dropped, and the rest are played again on the new frame.  A truth
+ * that shows the player anywhere else means a move went otherwise than
+ * predicted, and every move sent is dropped, rolling the view back to the
+ * truth with only the moves not yet sent on top; so is a move the server
+ * rejects, and one it has not shown taken within a second of sending it
+ * (its KEY was lost, or it did not move the player after all).  The
+ * server plays a batch of keys (see KEYS) before it sends one frame, so
+ * only the ends of batches are compared with a frame, and one that shows
+ * the player back where they started is the frame for them.
+ *
+ * Typical sequence:
+ *   predict_t* predict = predict_new(frameLength);
+ *   on each frame:      predict_frame(predict, frame);  show predict_view(predict)
+ *   on each key:        if (predict_key(predict, key, hist_now())) show predict_view(predict)
+ *   on sending them:    predict_sent(predict, hist_now())
+ *   on ERROR:           predict_reject(predict, 0); show predict_view(predict)
+ *   now and then:       if (predict_expire(predict, hist_now())) show predict_view(predict)
+ *   predict_delete(predict);
+ */
+
+#ifndef _PREDICT_H_
+#define _PREDICT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/****************** types *********************/
+typedef struct predict predict_t;  // opaque to users of the module
+
+/****************** constants *********************/
+// keys kept at once; a key sent while this many are unconfirmed is not
+enum { predict_MaxPending = 32 };
+
+/****************** functions *********************/
+
+/******************************************/
+/* predict_new: create a prediction for frames of the given length.
+ * Function returns:
+ *   pointer to the new prediction, holding no frame yet; NULL if out of memory.
+ * Caller is responsible for:
+ *   later calling predict_delete.
+ */
+predict_t* predict_new(const size_t frameLength);
+
+/******************************************/
+/* predict_frame: take a frame from the server as the truth, and reconcile
+ *   the moves not yet confirmed with it.
+ * Caller provides:
+ *   a frame, as a DISPLAY carries it, no longer than frameLength (a longer
+ *   one is ignored).
+ * Function returns:
+ *   the number of the oldest keys it confirmed (showed taken); any others
+ *   it dropped were rolled back (see predict_pending).
+ */
+int predict_frame(predict_t* predict, const char* frame);
+
+/******************************************/
+/* predict_key: play a key the player pressed on top of the view.
+ * Caller provides:
+ *   the key, as it will be sent with KEY or KEYS, and the time (see hist_now).
+ * Function returns:
+ *   true if the view changed (the key is a move, and it moved the player).
+ * Notes:
+ *   every key after the first frame is kept (unless predict_MaxPending
+ *   are), moving the player or not,
+ *   since the server answers each key that does not move them with an
+ *   ERROR (see predict_reject); keys before any frame are ignored.
+ */
+bool predict_key(predict_t* predict, const char key, const uint64_t now);
+
+/******************************************/
+/* predict_sent: every move not yet confirmed has now been sent to the
+ *   server, those not sent before as one batch, so the frames may confirm them.
+ * Caller provides:
+ *   the time (see hist_now); each move expires a second after it.
+ */
+void predict_sent(predict_t* predict, const uint64_t now);
+
+/******************************************/
+/* predict_reject: the server rejected a move not yet confirmed.
+ * Caller provides:
+ *   its index among them, oldest first: 0 for the answer to a lone KEY,
+ *   which the server answers in order; a later one for a key of a batch
+ *   (see KEYS), whose ERRORs come before the frame that shows the keys
+ *   before them.
+ *   An index with no move is ignored.
+ */
+void predict_reject(predict_t* predict, const int index);
+
+/******************************************/
+/* predict_expire: drop the moves sent, and not confirmed, a second before now.
+ * Function returns:
+ *   true if any was dropped (the view may have changed).
+ */
+bool predict_expire(predict_t* predict, const uint64_t now);
+
+/******************************************/
+/* predict_view: the truth with the moves not yet confirmed played on top;
+ *   NULL before the first frame.  The string changes with every call above.
+ */
+const char* predict_view(predict_t* predict);
+
+/******************************************/
+/* predict_pending: the number of moves not yet confirmed.
+ */
+int predict_pending(predict_t* predict);
+
+/******************************************/
+/* predict_delete: free the prediction (NULL is ignored).
+ */
+void predict_delete(predict_t* predict);
+
+#endif // _PREDICT_H_
@@ -0,0 +1,115 @@
+/*
+ * rtt - a smoothed estimate of a network round trip, and of its jitter
+ *
+ * See rtt.h for detailed interface description for each function.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtt.h"
+
+/**************** rtt_sample ****************/
+/* see rtt.h for description
+ *
+ * Pseudocode:
+ *   the first sample is the estimate, with half of it as jitter
+ *   after that, jitter = 3/4 jitter + 1/4 |smoothed - sample|,
+ *     then smoothed = 7/8 smoothed + 1/8 sample
+ */
+void
+rtt_sample(rtt_t* rtt, const uint64_t sent, const uint64_t now)
+{
+  if (rtt == NULL || sent > now) {
+    return;
+  }
+  const uint64_t sample = now - sent;
+  if (rtt->samples == 0) {
+    rtt->smoothed = sample;
+    rtt->jitter = sample / 2;
+  }
+  else {
+    uint64_t deviation = (sample > rtt->smoothed) ? sample - rtt->smoothed : rtt->smoothed - sample;
+    rtt->jitter = (3 * rtt->jitter + deviation) / 4;
+    rtt->smoothed = (7 * rtt->smoothed + sample) / 8;
+  }
+  rtt->samples++;
+  rtt->updated = now;
+}
+
+/**************** rtt_parse ****************/
+/* see rtt.h for description */
+bool
+rtt_parse(const char* message, const char* word, uint64_t* stamp)
+{
+  size_t length = strlen(word);
+  if (strncmp(message, word, length) != 0 || !isdigit((unsigned char)message[length])) {
+    return false;
+  }
+  char* end;
+  unsigned long long value = strtoull(message + length, &end, 10);
+  if (*end != '\0') {
+    return false;
+  }
+  *stamp = value;
+  return true;
+}
+
+/* ************************** UNIT_TEST **************************** */
+/*
+ * Feed the estimate steady and then jumpy round trips, and check that it
+ * settles on the steady one with little jitter, and follows the jump;
+ * check too that PING and PONG messages are read, and bad ones refused.
+ *
+ *   ./rtttest
+ */
+#ifdef UNIT_TEST
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+int
+main()
+{
+  rtt_t rtt = { 0 };
+  rtt_sample(&rtt, 1000, 3000);
+  expect(rtt.samples == 1 && rtt.smoothed == 2000 && rtt.jitter == 1000,
+         "the first sample is the estimate");
+  for (uint64_t t = 0; t < 100; t++) {
+    rtt_sample(&rtt, t * 10000, t * 10000 + 2000);
+  }
+  expect(rtt.smoothed == 2000 && rtt.jitter < 10, "steady round trips settle, with no jitter");
+  for (uint64_t t = 0; t < 100; t++) {
+    rtt_sample(&rtt, t * 10000, t * 10000 + 4000 + (t % 2) * 2000);
+  }
+  expect(rtt.smoothed > 4500 && rtt.smoothed < 5500, "the estimate follows a jump");
+  expect(rtt.jitter > 500 && rtt.jitter < 1500, "and the jitter shows the spread");
+  rtt_t before = rtt;
+  rtt_sample(&rtt, 5000, 4000);
+  expect(rtt.samples == before.samples, "a PONG from the future is ignored");
+
+  uint64_t stamp = 0;
+  expect(rtt_parse("PING 12345678901234", "PING ", &stamp) && stamp == 12345678901234ULL,
+         "a PING is read");
+  expect(rtt_parse("PONG 7", "PONG ", &stamp) && stamp == 7, "a PONG is read");
+  expect(!rtt_parse("PONG 7", "PING ", &stamp), "a PONG is not a PING");
+  expect(!rtt_parse("PING ", "PING ", &stamp), "a PING needs a time");
+  expect(!rtt_parse("PING -3", "PING ", &stamp), "a time is not negative");
+  expect(!rtt_parse("PING 3 4", "PING ", &stamp), "a PING has nothing after the time");
+
+  printf("%s\n", errors == 0 ? "rtt test passed" : "rtt test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}
+
+#endif // UNIT_TEST
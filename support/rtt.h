@@ -0,0 +1,53 @@
+/*
+ * rtt - a smoothed estimate of a network round trip, and of its jitter
+ *
+ * Either end of a connection may send "PING t", where t is the time on
+ * its own clock (see hist_now), and the other answers at once with
+ * "PONG t"; the time from sending the PING to getting its PONG is one
+ * round trip, taken as a sample.  The estimate follows each sample as
+ * TCP's does (RFC 6298): the smoothed round trip moves an eighth of the
+ * way to the sample, and the jitter (the mean deviation) a quarter of
+ * the way to how far the sample is from it.
+ *
+ * Typical sequence:
+ *   rtt_t rtt = { 0 };
+ *   send "PING t" with t = hist_now() ... and on its PONG:
+ *   uint64_t sent;
+ *   if (rtt_parse(message, "PONG ", &sent)) rtt_sample(&rtt, sent, hist_now());
+ */
+
+#ifndef _RTT_H_
+#define _RTT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/****************** types *********************/
+typedef struct rtt {
+  uint64_t smoothed;       // smoothed round trip, in ns
+  uint64_t jitter;         // mean deviation of the samples from it, in ns
+  unsigned long samples;   // how many it has taken; 0 means no estimate yet
+  uint64_t updated;        // when it last took one
+  uint64_t pinged;         // when the last PING was sent, so its PONG can be told from others
+} rtt_t;
+
+/****************** functions *********************/
+
+/******************************************/
+/* rtt_sample: take the round trip of a PING sent at sent, answered at now.
+ * Caller provides:
+ *   times from the same clock (see hist_now); a PONG that claims to
+ *   answer a PING from the future is ignored.
+ */
+void rtt_sample(rtt_t* rtt, const uint64_t sent, const uint64_t now);
+
+/******************************************/
+/* rtt_parse: read the time from a PING or PONG message.
+ * Caller provides:
+ *   the message, and its first word with the space after it ("PING " or "PONG ").
+ * Function returns:
+ *   true, having set *stamp, if the message is that word and a time, and nothing more.
+ */
+bool rtt_parse(const char* message, const char* word, uint64_t* stamp);
+
+#endif // _RTT_H_
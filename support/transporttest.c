@@ -0,0 +1,201 @@
+/*
+ * transporttest.c - test the message module's memory and Unix transports
+ *
+ * Drives message_loop through the memory transport: messages injected
+ * before the loop starts, from inside its handler, and from another
+ * thread while it waits, must each reach handleMessage once, in order,
+ * from the address they were injected as, and each reply must reach the
+ * deliver function addressed back to its sender.  Then drives it through
+ * a Unix datagram socket, with two correspondents bound to paths of their
+ * own: each must appear as its own address, and get its reply.
+ *
+ *   ./transporttest
+ *
+ * Nuggets team, Feb 2022
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for nanosleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "message.h"
+
+static int errors = 0;
+
+static void
+expect(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    errors++;
+  }
+}
+
+/**************** the memory transport ****************/
+enum { Messages = 4 };
+static const char* Sent[Messages] = { "ONE", "TWO", "THREE", "FOUR" };
+static addr_t senders[2];        // the addresses messages are injected as
+static int handled;              // messages handleMessage has seen
+static int delivered;            // replies deliver has seen
+static bool timedOut;
+
+// the address message m is injected as: they take turns
+static addr_t
+senderOf(const int m)
+{
+  return senders[m % 2];
+}
+
+// catches every reply the loop sends: ECHO of each message, to its sender
+static void
+deliver(void* arg, const addr_t to, const char* message)
+{
+  char expected[20];
+  if (delivered < Messages) {
+    snprintf(expected, sizeof(expected), "ECHO %s", Sent[delivered]);
+    expect(strcmp(message, expected) == 0, "replies arrive in order");
+    expect(message_eqAddr(to, senderOf(delivered)), "a reply goes to the sender");
+  }
+  delivered++;
+}
+
+// injects the last message once the loop has had time to wait for it
+static void*
+injectLater(void* arg)
+{
+  struct timespec pause = { 0, 50000000 };  // 50 ms
+  nanosleep(&pause, NULL);
+  expect(message_inject(senderOf(Messages - 1), Sent[Messages - 1]), "inject from another thread");
+  return NULL;
+}
+
+// echoes each message; the third injects the next, and the last ends the loop
+static bool
+echo(void* arg, const addr_t from, const char* message)
+{
+  if (handled < Messages) {
+    expect(strcmp(message, Sent[handled]) == 0, "messages are handled in order");
+    expect(message_eqAddr(from, senderOf(handled)), "a message comes from where it was injected");
+  }
+  char reply[20];
+  snprintf(reply, sizeof(reply), "ECHO %s", message);
+  message_send(from, reply);
+  handled++;
+  if (handled == 2) {
+    expect(message_inject(senderOf(2), Sent[2]), "inject from the handler");
+  }
+  return handled == Messages;
+}
+
+static bool
+giveUp(void* arg)
+{
+  timedOut = true;
+  return true;
+}
+
+static void
+testMemory(void)
+{
+  expect(message_setAddr("127.0.0.1", "5001", &senders[0])
+         && message_setAddr("127.0.0.1", "5002", &senders[1]), "message_setAddr");
+  expect(!message_inject(senders[0], "EARLY"), "inject needs the memory transport open");
+  expect(message_setTransport(message_memoryTransport(deliver, NULL)), "set the memory transport");
+  expect(message_init(NULL) == 1, "the memory transport opens");
+
+  expect(message_inject(senderOf(0), Sent[0]) && message_inject(senderOf(1), Sent[1]),
+         "inject before the loop");
+  pthread_t later;
+  pthread_create(&later, NULL, injectLater, NULL);
+  expect(message_loop(NULL, 2, giveUp, NULL, echo), "the loop ends when a handler says so");
+  pthread_join(later, NULL);
+  expect(!timedOut, "no injected message is missed");
+  expect(handled == Messages && delivered == Messages, "each message is handled and answered once");
+
+  message_done();
+  expect(!message_inject(senders[0], "LATE"), "inject needs the memory transport open");
+}
+
+/**************** the Unix transport ****************/
+// a correspondent's socket, bound to a path of its own
+static int
+correspondent(const char* path)
+{
+  int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+  struct sockaddr_un self = { .sun_family = AF_UNIX };
+  strcpy(self.sun_path, path);
+  unlink(path);
+  if (sock < 0 || bind(sock, (struct sockaddr*) &self, sizeof(self)) != 0) {
+    return -1;
+  }
+  struct timeval wait = { 2, 0 };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+  return sock;
+}
+
+// answers each correspondent with the port it appears to send from; ends after two
+static bool
+answer(void* arg, const addr_t from, const char* message)
+{
+  int* count = arg;
+  expect(from.sin_addr.s_addr == htonl(INADDR_LOOPBACK), "a Unix peer appears as localhost");
+  char reply[30];
+  snprintf(reply, sizeof(reply), "HI %s %d", message, ntohs(from.sin_port));
+  message_send(from, reply);
+  return ++(*count) == 2;
+}
+
+static void
+testUnix(void)
+{
+  char path[48], paths[2][64];
+  snprintf(path, sizeof(path), "/tmp/transporttest-%d", (int) getpid());
+  for (int c = 0; c < 2; c++) {
+    snprintf(paths[c], sizeof(paths[c]), "%s-%d", path, c);
+  }
+  expect(message_setTransport(message_unixTransport(path)), "set the Unix transport");
+  expect(message_init(NULL) == 1, "the Unix transport opens");
+
+  struct sockaddr_un server = { .sun_family = AF_UNIX };
+  strcpy(server.sun_path, path);
+  int socks[2];
+  for (int c = 0; c < 2; c++) {
+    socks[c] = correspondent(paths[c]);
+    expect(socks[c] >= 0, "bind a correspondent");
+    const char* hello = c == 0 ? "A" : "B";
+    expect(sendto(socks[c], hello, strlen(hello), 0, (struct sockaddr*) &server,
+                  sizeof(server)) == strlen(hello), "a correspondent sends");
+  }
+  int count = 0;
+  expect(message_loop(&count, 2, giveUp, NULL, answer), "the loop ends when a handler says so");
+  expect(!timedOut && count == 2, "both datagrams are handled");
+
+  const char* expected[2] = { "HI A 1", "HI B 2" };  // peers are numbered as first heard from
+  for (int c = 0; c < 2; c++) {
+    char buf[30] = "";
+    ssize_t n = socks[c] >= 0 ? recv(socks[c], buf, sizeof(buf) - 1, 0) : -1;
+    expect(n > 0 && strcmp(buf, expected[c]) == 0, "each correspondent gets its own reply");
+    close(socks[c]);
+    unlink(paths[c]);
+  }
+
+  message_done();
+  expect(access(path, F_OK) != 0, "message_done removes the socket's path");
+}
+
+int
+main()
+{
+  testMemory();
+  testUnix();
+  printf("%s\n", errors == 0 ? "transport test passed" : "transport test FAILED");
+  exit(errors == 0 ? 0 : 1);
+}